@@ -1,17 +1,52 @@
+#define _FILE_OFFSET_BITS 64
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <ctype.h>
 #include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include <winioctl.h>
+#include <tlhelp32.h>
 #include <direct.h>
 #include <io.h>
+#include <process.h>
+typedef HANDLE worker_thread_t;
+typedef CRITICAL_SECTION worker_mutex_t;
 #endif
 #ifndef _WIN32
 #include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sched.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/statvfs.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+#include <pthread.h>
+typedef pthread_t worker_thread_t;
+typedef pthread_mutex_t worker_mutex_t;
 #endif
+#include "encode.h"
 
 static const char *DEFAULT_DEE_ROOT = "D:\\Dolby_Encoding_Engine";
 
@@ -26,6 +61,14 @@ static void format_win32_error(DWORD error_code, char *buffer, size_t buffer_siz
 static void replace_extension(const char *src, char *dest, size_t dest_size, const char *ext);
 static int file_exists(const char *path);
 static void remove_file_if_exists(const char *path);
+static void sync_file_to_disk(FILE *f);
+static long long file_mtime_of(const char *path);
+static void queue_preempt_tick(void);
+static void job_note(const char *fmt, ...);
+static void job_warn(const char *fmt, ...);
+static const char *xml_template_acquire(const char *path, size_t *length);
+static void xml_template_release(const char *text);
+static char *xml_template_render(const char *text, const char *spec, size_t *length, char *error, size_t error_size);
 
 static int case_equal(const char *a, const char *b) {
     if (!a || !b) return 0;
@@ -197,7 +240,7 @@ static void remove_file_if_exists(const char *path) {
     if (!path || !*path) return;
     if (!file_exists(path)) return;
     if (remove(path) != 0) {
-        fprintf(stderr, "警告: 无法删除临时文件 %s (errno=%d)\n", path, errno);
+        job_warn("警告: 无法删除临时文件 %s (errno=%d)\n", path, errno);
     }
 }
 
@@ -368,10 +411,17 @@ typedef struct {
     int valid; /* 1 表示有效记录，0 表示无记录 */
 } LastParams;
 
+/* 先写同目录下的临时文件再整体替换，GUI 同时改写输出路径或进程中途退出都不会留下半个文件 */
 static void save_last_params(const char *path, const LastParams *p) {
-    FILE *f = fopen(path, "w");
+    char temp_path[600];
+#ifdef _WIN32
+    snprintf(temp_path, sizeof(temp_path), "%s.%d.tmp", path, _getpid());
+#else
+    snprintf(temp_path, sizeof(temp_path), "%s.%d.tmp", path, (int)getpid());
+#endif
+    FILE *f = fopen(temp_path, "w");
     if (!f) {
-        fprintf(stderr, "无法打开状态文件进行写入: %s (errno=%d)\n", path, errno);
+        job_warn("无法打开状态文件进行写入: %s (errno=%d)\n", temp_path, errno);
         return;
     }
     fprintf(f, "choice=%d\n", p->choice);
@@ -383,12 +433,23 @@ static void save_last_params(const char *path, const LastParams *p) {
     fprintf(f, "output_file=%s\n", p->output_file);
     fprintf(f, "input_file=%s\n", p->input_file);
     fprintf(f, "valid=1\n");
+    sync_file_to_disk(f);
     fclose(f);
-    printf("DEBUG: Saving params: choice=%d, start='%s', end='%s', prepend='%s', append='%s', template='%s', output='%s', input='%s', valid=%d\n",
+#ifdef _WIN32
+    if (!MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+#else
+    if (rename(temp_path, path) != 0) {
+#endif
+        job_warn("无法替换状态文件: %s (errno=%d)\n", path, errno);
+        remove(temp_path);
+        return;
+    }
+    job_note("DEBUG: Saving params: choice=%d, start='%s', end='%s', prepend='%s', append='%s', template='%s', output='%s', input='%s', valid=%d\n",
            p->choice, p->start, p->end, p->prepend_silence, p->append_silence, p->template_xml, p->output_file, p->input_file, p->valid);
-    printf("已保存上一次操作参数到: %s\n", path);
+    job_note("已保存上一次操作参数到: %s\n", path);
 }
 
+#ifndef DEE_LIBRARY
 static void load_last_params(const char *path, LastParams *out) {
     FILE *f = fopen(path, "r");
     char buf[1024];
@@ -421,31 +482,62 @@ static void load_last_params(const char *path, LastParams *out) {
     }
     fclose(f);
     if (out->valid) {
-        printf("已加载上一次操作参数（%s）。\n", path);
+        job_note("已加载上一次操作参数（%s）。\n", path);
     } else {
-        printf("状态文件存在但解析后无有效记录（%s）。\n", path);
+        job_note("状态文件存在但解析后无有效记录（%s）。\n", path);
     }
 }
+#endif
 // --------- 持久化相关结束 ---------
 
-// 生成临时 XML 文件
-void generate_xml(const char *template_xml, const char *temp_xml,
-                  const char *input_file, const char *output_file,
-                  const char *start, const char *end, const char *prepend_silence, const char *append_silence)
+/* 从内存中的模板取一行，与 fgets 相同：保留换行，超长的行分段返回 */
+static int template_next_line(const char **cursor, const char *end, char *line, size_t line_size) {
+    const char *p = *cursor;
+    size_t n = 0;
+    if (p >= end) return 0;
+    while (p < end && n + 1 < line_size) {
+        char c = *p++;
+        line[n++] = c;
+        if (c == '\n') break;
+    }
+    line[n] = '\0';
+    *cursor = p;
+    return 1;
+}
+
+// 生成临时 XML 文件（模板取自 XML 模板缓存，overrides 为 “路径=值” 列表，见任务 XML 覆盖一节）；成功返回 0
+int generate_xml(const char *template_xml, const char *temp_xml,
+                 const char *input_file, const char *output_file,
+                 const char *start, const char *end, const char *prepend_silence, const char *append_silence,
+                 const char *data_rate, const char *overrides)
 {
-    FILE *in = fopen(template_xml, "r");
+    size_t template_len = 0;
+    const char *template_text = xml_template_acquire(template_xml, &template_len);
+    char *rendered = NULL;
+    if (template_text && overrides && overrides[0]) {
+        char error[256];
+        rendered = xml_template_render(template_text, overrides, &template_len, error, sizeof(error));
+        if (!rendered) {
+            job_warn("XML 覆盖无效: %s\n", error);
+            xml_template_release(template_text);
+            return 1;
+        }
+    }
     FILE *out = fopen(temp_xml, "w");
-    if (!in || !out) {
-        printf("无法打开模板或临时文件！\n");
-        if (in) fclose(in);
+    if (!template_text || !out) {
+        job_note("无法打开模板或临时文件！\n");
+        if (template_text) xml_template_release(template_text);
         if (out) fclose(out);
-        return;
+        free(rendered);
+        return 1;
     }
 
     char line[1024];
     int in_encode_section = 0;
+    const char *source = rendered ? rendered : template_text;
+    const char *cursor = source;
 
-    while (fgets(line, sizeof(line), in)) {
+    while (template_next_line(&cursor, source + template_len, line, sizeof(line))) {
         // 进入/离开 <encode_to_atmos_ddp> 区块
         if (strstr(line, "<encode_to_atmos_ddp") || strstr(line, "<encode_to_dthd")) {
             in_encode_section = 1;
@@ -529,6 +621,17 @@ void generate_xml(const char *template_xml, const char *temp_xml,
             }
         }
 
+        // 替换码率（kbps），只有 DDP 模板含 <data_rate>，TrueHD 为无损不受影响
+        if (in_encode_section && strstr(line, "<data_rate>")) {
+            if (data_rate != NULL && strlen(data_rate) > 0) {
+                const char *p = line;
+                while (*p == ' ' || *p == '\t') p++;
+                int indent_len = (int)(p - line);
+                fprintf(out, "%.*s<data_rate>%s</data_rate>\n", indent_len, line, data_rate);
+                continue;
+            }
+        }
+
         // 替换输出文件路径和文件名
         if (strstr(line, "<path>PATH</path>")) {
             const char *p = line;
@@ -574,669 +677,11507 @@ void generate_xml(const char *template_xml, const char *temp_xml,
         fputs(line, out);
     }
 
-    fclose(in);
+    xml_template_release(template_text);
+    free(rendered);
     fclose(out);
+    return 0;
 }
 
-int main(int argc, char *argv[])
-{
-    system("chcp 65001 > nul"); // 设置控制台UTF-8
+// --------- 通用工具：线程、64 位文件偏移、缓冲读取 ---------
+typedef void (*worker_fn)(void *arg);
 
-    int choice;
-    char start[64], end[64], prepend_silence[64], append_silence[64]; 
-    char output_file_buf[512]; // 用于存储 output_file，因为其需要被修改
-    char input_file_buf[512]; // 用于存储 input_file
-    char cmd[4096]; 
-    char base_path[512];
-    char temp_xml_path[1024];
-    char dee_exe_path[1024];
-    char temp_dir_path[1024];
-    char template_ec3_path[1024];
-    char template_m4a_path[1024];
-    char template_mlp_path[1024];
-    char intermediate_mlp_path[512];
-    char intermediate_ddp_path[512];
-    char intermediate_ddp_alt_ec3[512];
-    char intermediate_ddp_alt_ddp[512];
-    char final_output_path[512];
-    char inter_mll_path[512];
-    char inter_log_path[512];
-    const char *dee_output_target = NULL;
-    int interactive_mode = 1;
-    const char *template_xml = NULL;
-    const char *state_file = "last_params.txt";
-    LastParams last_params;
+typedef struct {
+    worker_fn fn;
+    void *arg;
+} WorkerTrampoline;
 
-    const char *env_base = getenv("DEE_ROOT");
-    if (env_base && env_base[0]) {
-        copy_string(base_path, sizeof(base_path), env_base);
-    } else {
-        copy_string(base_path, sizeof(base_path), DEFAULT_DEE_ROOT);
+#ifdef _WIN32
+static unsigned __stdcall worker_trampoline(void *param) {
+    WorkerTrampoline t = *(WorkerTrampoline *)param;
+    free(param);
+    t.fn(t.arg);
+    return 0;
+}
+#else
+static void *worker_trampoline(void *param) {
+    WorkerTrampoline t = *(WorkerTrampoline *)param;
+    free(param);
+    t.fn(t.arg);
+    return NULL;
+}
+#endif
+
+static int worker_start(worker_thread_t *thread, worker_fn fn, void *arg) {
+    WorkerTrampoline *t = (WorkerTrampoline *)malloc(sizeof(WorkerTrampoline));
+    if (!t) return 0;
+    t->fn = fn;
+    t->arg = arg;
+#ifdef _WIN32
+    uintptr_t handle = _beginthreadex(NULL, 0, worker_trampoline, t, 0, NULL);
+    if (handle == 0) {
+        free(t);
+        return 0;
     }
-    normalize_slashes(base_path);
+    *thread = (HANDLE)handle;
+#else
+    if (pthread_create(thread, NULL, worker_trampoline, t) != 0) {
+        free(t);
+        return 0;
+    }
+#endif
+    return 1;
+}
 
-    build_path(temp_xml_path, sizeof(temp_xml_path), base_path, "temp_job.xml");
-    build_path(dee_exe_path, sizeof(dee_exe_path), base_path, "dee.exe");
-    build_path(temp_dir_path, sizeof(temp_dir_path), base_path, "DolbyTemp");
-    build_path(template_ec3_path, sizeof(template_ec3_path), base_path, "xml_templates\\encode_to_atmos_ddp\\atmos_mezz_encode_to_atmos_ddp_ec3.xml");
-    build_path(template_m4a_path, sizeof(template_m4a_path), base_path, "xml_templates\\encode_to_atmos_ddp\\atmos_mezz_encode_to_atmos_ddp_mp4.xml");
-    build_path(template_mlp_path, sizeof(template_mlp_path), base_path, "xml_templates\\encode_to_dthd\\atmos_mezz_encode_to_dthd_mlp.xml");
+static void worker_join(worker_thread_t thread) {
+#ifdef _WIN32
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
 
-    printf("使用 Dolby Encoding Engine 路径: %s\n", base_path);
+static void worker_mutex_init(worker_mutex_t *m) {
+#ifdef _WIN32
+    InitializeCriticalSection(m);
+#else
+    pthread_mutex_init(m, NULL);
+#endif
+}
 
-    ensure_parent_directory(temp_xml_path);
-    ensure_directory_exists(temp_dir_path);
-    load_last_params(state_file, &last_params);
+static void worker_mutex_lock(worker_mutex_t *m) {
+#ifdef _WIN32
+    EnterCriticalSection(m);
+#else
+    pthread_mutex_lock(m);
+#endif
+}
 
-    // 初始化所有参数为空字符串，以便于后续逻辑判断
-    start[0] = end[0] = prepend_silence[0] = append_silence[0] = output_file_buf[0] = input_file_buf[0] = '\0';
-    intermediate_mlp_path[0] = intermediate_ddp_path[0] = intermediate_ddp_alt_ec3[0] = intermediate_ddp_alt_ddp[0] = final_output_path[0] = '\0';
-    inter_mll_path[0] = inter_log_path[0] = '\0';
-    choice = 0;
-    dee_output_target = NULL;
+static void worker_mutex_unlock(worker_mutex_t *m) {
+#ifdef _WIN32
+    LeaveCriticalSection(m);
+#else
+    pthread_mutex_unlock(m);
+#endif
+}
 
-    if (argc > 1) {
-        interactive_mode = 0;
-        // 从命令行参数解析
-        choice = atoi(argv[1]);
-        if (argc > 2 && strlen(argv[2]) > 0) copy_string(start, sizeof(start), argv[2]);
-        if (argc > 3 && strlen(argv[3]) > 0) copy_string(end, sizeof(end), argv[3]);
-        if (argc > 4 && strlen(argv[4]) > 0) copy_string(prepend_silence, sizeof(prepend_silence), argv[4]);
-        if (argc > 5 && strlen(argv[5]) > 0) copy_string(append_silence, sizeof(append_silence), argv[5]);
-        if (argc > 6 && strlen(argv[6]) > 0) copy_string(output_file_buf, sizeof(output_file_buf), argv[6]);
-        if (argc > 7 && strlen(argv[7]) > 0) copy_string(input_file_buf, sizeof(input_file_buf), argv[7]);
+static int cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
 
-        // 检查 output_file_buf 和 input_file_buf 是否为空，如果为空则使用默认值
-        if (output_file_buf[0] == '\0') {
-             if (choice == 1) {
-                 copy_string(output_file_buf, sizeof(output_file_buf), "D:\\atmos.ec3");
-             } else if (choice == 2) {
-                 copy_string(output_file_buf, sizeof(output_file_buf), "D:\\atmos.m4a");
-             } else if (choice == 3) {
-                 copy_string(output_file_buf, sizeof(output_file_buf), "D:\\atmos.mlp");
-             } else if (choice == 4) {
-                 copy_string(output_file_buf, sizeof(output_file_buf), "D:\\atmos_bluray.m4a");
-             } else if (choice == 5) {
-                 copy_string(output_file_buf, sizeof(output_file_buf), "D:\\atmos_bluray_atmos.m4a");
-             }
-        }
-        if (input_file_buf[0] == '\0') {
-            copy_string(input_file_buf, sizeof(input_file_buf), "D:\\ADM.wav");
-        }
-
-        if (choice == 1) {
-            ensure_extension(output_file_buf, sizeof(output_file_buf), ".ec3");
-        } else if (choice == 2) {
-            ensure_extension(output_file_buf, sizeof(output_file_buf), ".m4a");
-        } else if (choice == 3) {
-            ensure_extension(output_file_buf, sizeof(output_file_buf), ".mlp");
-        } else if (choice == 4 || choice == 5) {
-            ensure_extension(output_file_buf, sizeof(output_file_buf), ".m4a");
-        }
-
-        copy_string(final_output_path, sizeof(final_output_path), output_file_buf);
-        if (choice == 4 || choice == 5) {
-            replace_extension(final_output_path, intermediate_mlp_path, sizeof(intermediate_mlp_path), ".mlp");
-            replace_extension(final_output_path, intermediate_ddp_alt_ec3, sizeof(intermediate_ddp_alt_ec3), ".ec3");
-            replace_extension(intermediate_mlp_path, inter_mll_path, sizeof(inter_mll_path), ".mlp.mll");
-            replace_extension(intermediate_mlp_path, inter_log_path, sizeof(inter_log_path), ".mlp.log");
-            if (choice == 4) {
-                replace_extension(final_output_path, intermediate_ddp_path, sizeof(intermediate_ddp_path), ".eb3");
-                replace_extension(final_output_path, intermediate_ddp_alt_ddp, sizeof(intermediate_ddp_alt_ddp), ".ddp");
-            } else {
-                intermediate_ddp_path[0] = '\0';
-                intermediate_ddp_alt_ddp[0] = '\0';
-            }
-            dee_output_target = intermediate_mlp_path;
-        } else {
-            intermediate_mlp_path[0] = '\0';
-            intermediate_ddp_path[0] = '\0';
-            intermediate_ddp_alt_ec3[0] = '\0';
-            intermediate_ddp_alt_ddp[0] = '\0';
-            inter_mll_path[0] = '\0';
-            inter_log_path[0] = '\0';
-            dee_output_target = output_file_buf;
-        }
+static long long file_size_of(const char *path) {
+    if (!path || !*path) return -1;
+#ifdef _WIN32
+    struct _stati64 st;
+    if (_stati64(path, &st) != 0) return -1;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0) return -1;
+#endif
+    return (long long)st.st_size;
+}
 
-        printf("DEBUG: Parsed CLI args -> choice=%d, start='%s', end='%s', prepend='%s', append='%s', output='%s', input='%s'\n",
-               choice, start, end, prepend_silence, append_silence, output_file_buf, input_file_buf);
+static int path_is_directory(const char *path) {
+    if (!path || !*path) return 0;
+#ifdef _WIN32
+    struct _stati64 st;
+    if (_stati64(path, &st) != 0) return 0;
+    return (st.st_mode & _S_IFDIR) != 0;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0) return 0;
+    return S_ISDIR(st.st_mode);
+#endif
+}
 
-        // 根据 choice 设置 template_xml
-        if (choice == 1) {
-            template_xml = template_ec3_path;
-        } else if (choice == 2) {
-            template_xml = template_m4a_path;
-        } else if (choice == 3) {
-            template_xml = template_mlp_path;
-        } else if (choice == 4 || choice == 5) {
-            template_xml = template_mlp_path;
-        } else {
-            fprintf(stderr, "错误: 无效的编码选项（%d）。\n", choice);
-            if (interactive_mode) system("pause");
-            return 1;
-        }
+/* 路径中的文件名部分（最后一个分隔符之后） */
+static const char *path_file_name(const char *path) {
+    const char *sep = strrchr(path, '\\');
+    const char *sep_alt = strrchr(path, '/');
+    if (sep_alt && (!sep || sep_alt > sep)) sep = sep_alt;
+    return sep ? sep + 1 : path;
+}
 
-        // 跳过交互式菜单，直接进入编码流程
-        goto encode_process;
+static void sync_file_to_disk(FILE *f) {
+    fflush(f);
+#ifdef _WIN32
+    _commit(_fileno(f));
+#else
+    fsync(fileno(f));
+#endif
+}
 
-    } else {
-        // 没有命令行参数，显示交互式菜单
-    while (1)
-    {
-        printf("\n=============================\n");
-        printf("  Dolby Encoding Engine 工具\n");
-        printf("=============================\n");
-        printf("1. ADM BWF 编码为 atmos.ec3\n");
-        printf("2. ADM BWF 编码为 atmos.m4a\n");
-        printf("3. ADM BWF 编码为 atmos.mlp\n");
-        printf("4. ADM BWF 编码为 7.1ch Dolby Digital Plus (Blu-ray)\n");
-        printf("5. ADM BWF 编码为 Dolby Atmos M4A 7.1 (Blu-ray)\n");
-        printf("6. 重复上一次操作\n");
-        printf("0. 退出程序\n");
-        printf("请输入选项: ");
+static int file_seek64(FILE *f, long long offset) {
+#ifdef _WIN32
+    return _fseeki64(f, offset, SEEK_SET);
+#else
+    return fseeko(f, (off_t)offset, SEEK_SET);
+#endif
+}
 
-        if (scanf("%d", &choice) != 1) {
-            printf("输入无效，请输入数字！\n");
-            while (getchar() != '\n'); 
-            continue;
-        }
-        while (getchar() != '\n'); // 清空缓冲
+typedef struct {
+    FILE *fp;
+    unsigned char *buf;
+    size_t cap;
+    size_t len;
+    size_t pos;
+    long long base;  /* buf[0] 对应的文件偏移 */
+    long long limit; /* 读取上限（不含） */
+} ByteReader;
 
-        if (choice == 0) {
-            printf("退出程序。\n");
-            break;
-        }
+static int reader_open(ByteReader *r, const char *path, size_t cap, long long limit) {
+    memset(r, 0, sizeof(*r));
+    r->fp = fopen(path, "rb");
+    if (!r->fp) return 0;
+    r->buf = (unsigned char *)malloc(cap);
+    if (!r->buf) {
+        fclose(r->fp);
+        r->fp = NULL;
+        return 0;
+    }
+    r->cap = cap;
+    r->limit = limit;
+    return 1;
+}
 
-        /* 如果选择 4：直接使用上次保存的参数并跳过交互 */
-        if (choice == 6) {
-            if (!last_params.valid) {
-                printf("没有可用的上一次操作记录，无法重复。\n");
-                continue;
-            }
-            /* 从上次记录拷贝参数 */
-            copy_string(start, sizeof(start), last_params.start);
-            copy_string(end, sizeof(end), last_params.end);
-            copy_string(prepend_silence, sizeof(prepend_silence), last_params.prepend_silence);
-            copy_string(append_silence, sizeof(append_silence), last_params.append_silence);
-            /* 使用上次保存的类型（如果有）作为本次的具体格式 */
-            choice = last_params.choice ? last_params.choice : 1;
-            if (last_params.output_file[0]) {
-                copy_string(output_file_buf, sizeof(output_file_buf), last_params.output_file);
-            } else if (choice == 1) {
-                copy_string(output_file_buf, sizeof(output_file_buf), "D:\\atmos.ec3");
-            } else if (choice == 2) {
-                copy_string(output_file_buf, sizeof(output_file_buf), "D:\\atmos.m4a");
-            } else if (choice == 3) {
-                copy_string(output_file_buf, sizeof(output_file_buf), "D:\\atmos.mlp");
-            } else if (choice == 4) {
-                copy_string(output_file_buf, sizeof(output_file_buf), "D:\\atmos_bluray.m4a");
-            } else if (choice == 5) {
-                copy_string(output_file_buf, sizeof(output_file_buf), "D:\\atmos_bluray_atmos.m4a");
-            } else {
-                copy_string(output_file_buf, sizeof(output_file_buf), "D:\\atmos.ec3");
-            }
-            if (last_params.input_file[0]) {
-                copy_string(input_file_buf, sizeof(input_file_buf), last_params.input_file);
-            } else {
-                copy_string(input_file_buf, sizeof(input_file_buf), "D:\\ADM.wav");
-            }
-            if (last_params.template_xml[0]) {
-                template_xml = last_params.template_xml;
-            } else if (choice == 1) {
-                template_xml = template_ec3_path;
-            } else if (choice == 2) {
-                template_xml = template_m4a_path;
-            } else if (choice == 3) {
-                template_xml = template_mlp_path;
-            } else if (choice == 4 || choice == 5) {
-                template_xml = template_mlp_path;
-            }
-            if (choice == 1) {
-                ensure_extension(output_file_buf, sizeof(output_file_buf), ".ec3");
-            } else if (choice == 2) {
-                ensure_extension(output_file_buf, sizeof(output_file_buf), ".m4a");
-            } else if (choice == 3) {
-                ensure_extension(output_file_buf, sizeof(output_file_buf), ".mlp");
-            } else if (choice == 4 || choice == 5) {
-                ensure_extension(output_file_buf, sizeof(output_file_buf), ".m4a");
-            }
-            printf("使用上一次参数：choice=%d, start='%s', end='%s', prepend='%s', append='%s', out='%s'\n", choice, start, end, prepend_silence, append_silence, output_file_buf);
-        } else {
-            /* 普通选项 1、2、3 或 4：交互式输入（回车表示空，保留模板默认） */
-            printf("请输入起始时间 (HH:MM:SS:FF / HH:MM:SS.xx，直接回车默认): ");
-            if (fgets(start, sizeof(start), stdin)) trim_newline(start);
+static void reader_close(ByteReader *r) {
+    if (r->fp) fclose(r->fp);
+    free(r->buf);
+    memset(r, 0, sizeof(*r));
+}
 
-            printf("请输入结束时间 (HH:MM:SS:FF / HH:MM:SS.xx，直接回车默认): ");
-            if (fgets(end, sizeof(end), stdin)) trim_newline(end);
+static int reader_seek(ByteReader *r, long long offset) {
+    if (offset >= r->base && offset <= r->base + (long long)r->len) {
+        r->pos = (size_t)(offset - r->base);
+        return 1;
+    }
+    if (file_seek64(r->fp, offset) != 0) return 0;
+    r->base = offset;
+    r->len = r->pos = 0;
+    return 1;
+}
 
-            printf("请输入开头空白时长 (秒，如10.0，直接回车默认0.0): ");
-            if (fgets(prepend_silence, sizeof(prepend_silence), stdin)) trim_newline(prepend_silence);
 
-            printf("请输入结尾空白时长 (秒，如5.0，直接回车默认0.0): ");
-            if (fgets(append_silence, sizeof(append_silence), stdin)) trim_newline(append_silence);
+/* 确保当前位置起至少有 n 字节可用；不足（到达文件尾或 limit）时返回可用字节数 */
+static size_t reader_fill(ByteReader *r, size_t n) {
+    size_t avail = r->len - r->pos;
+    if (avail >= n) return avail;
+    if (r->pos > 0) {
+        memmove(r->buf, r->buf + r->pos, avail);
+        r->base += (long long)r->pos;
+        r->len = avail;
+        r->pos = 0;
+    }
+    long long remaining = r->limit - (r->base + (long long)r->len);
+    while (r->len < r->cap && remaining > 0) {
+        size_t want = r->cap - r->len;
+        if ((long long)want > remaining) want = (size_t)remaining;
+        size_t got = fread(r->buf + r->len, 1, want, r->fp);
+        if (got == 0) break;
+        r->len += got;
+        remaining -= (long long)got;
+        if (r->len - r->pos >= n && r->len == r->cap) break;
+    }
+    return r->len - r->pos;
+}
 
-                // 交互模式下设置 output_file_buf 和 input_file_buf 默认值
-                if (choice == 1) {
-                    copy_string(output_file_buf, sizeof(output_file_buf), "D:\\atmos.ec3");
-                } else if (choice == 2) {
-                    copy_string(output_file_buf, sizeof(output_file_buf), "D:\\atmos.m4a");
-                } else if (choice == 3) {
-                    copy_string(output_file_buf, sizeof(output_file_buf), "D:\\atmos.mlp");
-                } else if (choice == 4) {
-                    copy_string(output_file_buf, sizeof(output_file_buf), "D:\\atmos_bluray.m4a");
-                } else if (choice == 5) {
-                    copy_string(output_file_buf, sizeof(output_file_buf), "D:\\atmos_bluray_atmos.m4a");
-                }
-                copy_string(input_file_buf, sizeof(input_file_buf), "D:\\ADM.wav");
-        }
+typedef struct {
+    const unsigned char *data;
+    size_t size_bits;
+    size_t pos;
+    int overrun;
+} BitReader;
 
-        if (choice == 1) {
-            template_xml = template_ec3_path;
-        } else if (choice == 2) {
-            template_xml = template_m4a_path;
-        } else if (choice == 3) {
-            template_xml = template_mlp_path;
-        } else if (choice == 4 || choice == 5) {
-            template_xml = template_mlp_path;
-        } else {
-            printf("无效选项，请重新输入。\n");
+static unsigned bits_read(BitReader *br, int n) {
+    unsigned value = 0;
+    for (int i = 0; i < n; ++i) {
+        if (br->pos >= br->size_bits) {
+            br->overrun = 1;
+            value <<= 1;
             continue;
         }
+        unsigned bit = (br->data[br->pos >> 3] >> (7 - (br->pos & 7))) & 1u;
+        value = (value << 1) | bit;
+        br->pos++;
+    }
+    return value;
+}
 
-        if (choice == 1) {
-            ensure_extension(output_file_buf, sizeof(output_file_buf), ".ec3");
-        } else if (choice == 2) {
-            ensure_extension(output_file_buf, sizeof(output_file_buf), ".m4a");
-        } else if (choice == 3) {
-            ensure_extension(output_file_buf, sizeof(output_file_buf), ".mlp");
-        } else if (choice == 4 || choice == 5) {
-            ensure_extension(output_file_buf, sizeof(output_file_buf), ".m4a");
-        }
-
-        copy_string(final_output_path, sizeof(final_output_path), output_file_buf);
-        if (choice == 4 || choice == 5) {
-            replace_extension(final_output_path, intermediate_mlp_path, sizeof(intermediate_mlp_path), ".mlp");
-            replace_extension(final_output_path, intermediate_ddp_alt_ec3, sizeof(intermediate_ddp_alt_ec3), ".ec3");
-            replace_extension(intermediate_mlp_path, inter_mll_path, sizeof(inter_mll_path), ".mll");
-            replace_extension(intermediate_mlp_path, inter_log_path, sizeof(inter_log_path), ".mlp.log");
-            if (choice == 4) {
-                replace_extension(final_output_path, intermediate_ddp_path, sizeof(intermediate_ddp_path), ".eb3");
-                replace_extension(final_output_path, intermediate_ddp_alt_ddp, sizeof(intermediate_ddp_alt_ddp), ".ddp");
-            } else {
-                intermediate_ddp_path[0] = '\0';
-                intermediate_ddp_alt_ddp[0] = '\0';
-            }
-            dee_output_target = intermediate_mlp_path;
-        } else {
-            intermediate_mlp_path[0] = '\0';
-            intermediate_ddp_path[0] = '\0';
-            intermediate_ddp_alt_ec3[0] = '\0';
-            intermediate_ddp_alt_ddp[0] = '\0';
-            inter_mll_path[0] = '\0';
-            inter_log_path[0] = '\0';
-            dee_output_target = output_file_buf;
-        }
+static void bits_skip(BitReader *br, size_t n) {
+    br->pos += n;
+    if (br->pos > br->size_bits) br->overrun = 1;
+}
 
-            goto encode_process; // 完成交互后跳转到编码流程
+static unsigned read_be16(const unsigned char *p) { return ((unsigned)p[0] << 8) | p[1]; }
+static unsigned long read_be32(const unsigned char *p) {
+    return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) | ((unsigned long)p[2] << 8) | p[3];
+}
+static unsigned long long read_be64(const unsigned char *p) {
+    return ((unsigned long long)read_be32(p) << 32) | read_be32(p + 4);
+}
+
+/* 非反射 CRC-16，AC-3/E-AC-3 使用多项式 0x8005，TrueHD major sync 使用 0x002D */
+static unsigned short crc16_table_8005[256];
+static unsigned short crc16_table_002d[256];
+static int crc16_tables_ready = 0;
+
+static void crc16_build_table(unsigned short *table, unsigned short poly) {
+    for (int i = 0; i < 256; ++i) {
+        unsigned short crc = (unsigned short)(i << 8);
+        for (int b = 0; b < 8; ++b) {
+            crc = (crc & 0x8000) ? (unsigned short)((crc << 1) ^ poly) : (unsigned short)(crc << 1);
         }
+        table[i] = crc;
     }
+}
 
-encode_process:
-    if (!template_xml || template_xml[0] == '\0') {
-        fprintf(stderr, "错误: 未找到编码模板路径，请检查 DEE_ROOT 设置是否正确。\n");
-        if (interactive_mode) system("pause");
-        return 1;
-    }
+static void crc16_init_tables(void) {
+    if (crc16_tables_ready) return;
+    crc16_build_table(crc16_table_8005, 0x8005);
+    crc16_build_table(crc16_table_002d, 0x002D);
+    crc16_tables_ready = 1;
+}
 
-    if (dee_exe_path[0] == '\0') {
-        fprintf(stderr, "错误: 未设置 dee.exe 路径，请检查 DEE_ROOT 设置是否正确。\n");
-        if (interactive_mode) system("pause");
-        return 1;
+static unsigned short crc16_compute(const unsigned short *table, const unsigned char *data, size_t len) {
+    unsigned short crc = 0;
+    for (size_t i = 0; i < len; ++i) {
+        crc = (unsigned short)((crc << 8) ^ table[((crc >> 8) ^ data[i]) & 0xFF]);
     }
+    return crc;
+}
+// --------- 通用工具结束 ---------
 
-        /* 生成临时 XML */
-    if (!dee_output_target || !*dee_output_target) {
-        dee_output_target = output_file_buf;
-    }
+// --------- 输出码流 QC 校验（E-AC-3 / TrueHD / MP4） ---------
+enum {
+    QC_FORMAT_UNKNOWN = 0,
+    QC_FORMAT_EAC3,
+    QC_FORMAT_TRUEHD,
+    QC_FORMAT_MP4
+};
 
-    generate_xml(template_xml, temp_xml_path, input_file_buf, dee_output_target, start, end, prepend_silence, append_silence);
+#define QC_MAX_ERRORS 16
+#define QC_MAX_THREADS 16
+#define QC_MIN_CHUNK_BYTES (16LL * 1024 * 1024)
 
-        /* 执行 dee */
-        int cmd_len = 0;
-#ifdef _WIN32
-        char quoted_dee_exe[1024];
-        char quoted_temp_xml[2048];
-        char quoted_input_file[2048];
-        char quoted_output_file[2048];
-        char quoted_temp_dir[2048];
+typedef struct {
+    int container;   /* QC_FORMAT_EAC3 / QC_FORMAT_TRUEHD / QC_FORMAT_MP4 */
+    int require_joc; /* 1: 必须含 JOC (Atmos)，0: 不要求 */
+    int min_channels;
+} QcExpect;
 
-        quote_argument(quoted_dee_exe, sizeof(quoted_dee_exe), dee_exe_path);
-        quote_argument(quoted_temp_xml, sizeof(quoted_temp_xml), temp_xml_path);
-        quote_argument(quoted_input_file, sizeof(quoted_input_file), input_file_buf);
-        quote_argument(quoted_output_file, sizeof(quoted_output_file), dee_output_target);
-        quote_argument(quoted_temp_dir, sizeof(quoted_temp_dir), temp_dir_path);
+typedef struct {
+    int bsid;
+    int strmtyp;
+    int substreamid;
+    int frame_size;
+    int sample_rate;
+    int blocks;
+    int acmod;
+    int lfeon;
+    int chanmap; /* -1 表示未携带 */
+    int joc;
+    int joc_complexity;
+} Eac3FrameInfo;
 
-        cmd_len = snprintf(cmd, sizeof(cmd),
-            "%s -x %s -a %s -o %s --temp %s",
-            quoted_dee_exe, quoted_temp_xml, quoted_input_file, quoted_output_file, quoted_temp_dir);
-#else
-        cmd_len = snprintf(cmd, sizeof(cmd),
-            "\"%s\" -x \"%s\" -a \"%s\" -o \"%s\" --temp \"%s\"",
-            dee_exe_path, temp_xml_path, input_file_buf, dee_output_target, temp_dir_path);
-#endif
-        if (cmd_len < 0 || cmd_len >= (int)sizeof(cmd)) {
-            fprintf(stderr, "错误: 构建命令行失败或过长，请检查路径设置。\n");
-            if (interactive_mode) system("pause");
-            return 1;
-        }
+typedef struct {
+    /* E-AC-3 */
+    long long frames;
+    long long access_units;   /* substreamid 0 的独立帧数量 */
+    long long dependent_frames;
+    long long joc_frames;
+    long long crc_errors;
+    int has_config;
+    Eac3FrameInfo config;     /* 首帧配置 */
+    int au_bytes;             /* 首个访问单元（独立帧 + 依赖帧）字节数 */
+    int dep_chanmap;
+    long long config_changes;
+    /* TrueHD */
+    long long units;
+    long long major_syncs;
+    long long parity_errors;
+    long long major_sync_crc_errors;
+    long long max_major_sync_gap;
+    int truehd_rate;
+    int truehd_substreams;
+    int truehd_stream_type;
+    /* 通用 */
+    long long payload_bytes;
+    long long sync_losses;
+    long long corrupt_bytes;
+    int truncated;
+} QcStats;
 
-    // ========== DEBUG: 打印生成的 temp_job.xml 内容 ==========
-    printf("\n========== START temp_job.xml CONTENT ===========\n");
-    FILE *debug_f = fopen(temp_xml_path, "r");
-    if (debug_f) {
-        char debug_line[1024];
-        while (fgets(debug_line, sizeof(debug_line), debug_f)) {
-            printf("%s", debug_line);
-        }
-        fclose(debug_f);
-    } else {
-        printf("无法打开 temp_job.xml 进行调试读取！\n");
-    }
-    printf("========== END temp_job.xml CONTENT ===========\n\n");
-    // ========================================================
+typedef struct {
+    char path[1024];
+    int format;
+    long long file_size;
+    QcStats stats;
+    /* MP4 */
+    char major_brand[5];
+    char codec[5];
+    int mp4_has_moov;
+    int mp4_mdat_count;
+    int mp4_fragments;
+    long long mp4_sample_count;
+    unsigned long mp4_timescale;
+    unsigned long long mp4_duration;
+    int dec3_joc;
+    int dec3_data_rate;
+    int dec3_found;
+    int threads_used;
+    double elapsed_seconds;
+    int error_count;
+    char errors[QC_MAX_ERRORS][256];
+} QcReport;
 
-        /* 先保存本次参数以便下次重复（放在执行前，避免执行过程中意外退出导致丢失） */
-        LastParams cur = {0};
-        cur.choice = choice;
-        copy_string(cur.start, sizeof(cur.start), start);
-        copy_string(cur.end, sizeof(cur.end), end);
-        copy_string(cur.prepend_silence, sizeof(cur.prepend_silence), prepend_silence);
-        copy_string(cur.append_silence, sizeof(cur.append_silence), append_silence);
-        copy_string(cur.template_xml, sizeof(cur.template_xml), template_xml ? template_xml : "");
-        copy_string(cur.output_file, sizeof(cur.output_file), output_file_buf);
-        copy_string(cur.input_file, sizeof(cur.input_file), input_file_buf);
-        cur.valid = 1;
-        save_last_params(state_file, &cur);
-        /* 更新内存中的 last_params */
-        last_params = cur;
-
-        printf("执行命令: %s\n", cmd);
-        fflush(stdout);
+static void qc_fail(QcReport *report, const char *fmt, ...) {
+    if (report->error_count >= QC_MAX_ERRORS) {
+        report->error_count++;
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(report->errors[report->error_count], sizeof(report->errors[0]), fmt, ap);
+    va_end(ap);
+    report->error_count++;
+}
 
-    int exit_code = 0;
-#ifdef _WIN32
-    char command_line[4096];
-    copy_string(command_line, sizeof(command_line), cmd);
+static const int ac3_frame_words[38][3] = {
+    {64, 69, 96}, {64, 70, 96}, {80, 87, 120}, {80, 88, 120}, {96, 104, 144}, {96, 105, 144},
+    {112, 121, 168}, {112, 122, 168}, {128, 139, 192}, {128, 140, 192}, {160, 174, 240}, {160, 175, 240},
+    {192, 208, 288}, {192, 209, 288}, {224, 243, 336}, {224, 244, 336}, {256, 278, 384}, {256, 279, 384},
+    {320, 348, 480}, {320, 349, 480}, {384, 417, 576}, {384, 418, 576}, {448, 487, 672}, {448, 488, 672},
+    {512, 557, 768}, {512, 558, 768}, {640, 696, 960}, {640, 697, 960}, {768, 835, 1152}, {768, 836, 1152},
+    {896, 975, 1344}, {896, 976, 1344}, {1024, 1114, 1536}, {1024, 1115, 1536}, {1152, 1253, 1728},
+    {1152, 1254, 1728}, {1280, 1393, 1920}, {1280, 1394, 1920}
+};
 
-    STARTUPINFOA si;
-    PROCESS_INFORMATION pi;
-    ZeroMemory(&si, sizeof(si));
-    si.cb = sizeof(si);
-    ZeroMemory(&pi, sizeof(pi));
+/* 解析 AC-3 / E-AC-3 同步帧头（ATSC A/52 Annex E），返回帧字节数，非法时返回 0 */
+static int parse_eac3_header(const unsigned char *p, size_t avail, Eac3FrameInfo *info) {
+    static const int eac3_rates[3] = {48000, 44100, 32000};
+    static const int eac3_reduced_rates[3] = {24000, 22050, 16000};
+    static const int block_counts[4] = {1, 2, 3, 6};
+    if (avail < 8 || p[0] != 0x0B || p[1] != 0x77) return 0;
+    memset(info, 0, sizeof(*info));
+    info->chanmap = -1;
+    int bsid = p[5] >> 3;
+    info->bsid = bsid;
 
-    BOOL success = CreateProcessA(
-        dee_exe_path,
-        command_line,
-        NULL,
-        NULL,
-        FALSE,
-        0,
-        NULL,
-        NULL,
-        &si,
-        &pi);
+    if (bsid <= 8) {
+        int fscod = p[4] >> 6;
+        int frmsizecod = p[4] & 0x3F;
+        if (fscod == 3 || frmsizecod > 37) return 0;
+        BitReader br = {p + 5, (avail - 5) * 8, 5, 0};
+        bits_read(&br, 3); /* bsmod */
+        info->acmod = (int)bits_read(&br, 3);
+        if ((info->acmod & 1) && info->acmod != 1) bits_read(&br, 2);
+        if (info->acmod & 4) bits_read(&br, 2);
+        if (info->acmod == 2) bits_read(&br, 2);
+        info->lfeon = (int)bits_read(&br, 1);
+        info->frame_size = ac3_frame_words[frmsizecod][fscod] * 2;
+        info->sample_rate = eac3_rates[fscod];
+        info->blocks = 6;
+        return info->frame_size;
+    }
+    if (bsid < 11 || bsid > 16) return 0;
 
-    if (!success) {
-        DWORD err = GetLastError();
-        char err_msg[256];
-        format_win32_error(err, err_msg, sizeof(err_msg));
-        fprintf(stderr, "调用 dee.exe 失败 (error=%lu): %s\n", (unsigned long)err, err_msg);
-        exit_code = (int)err;
+    size_t header_bytes = avail < 64 ? avail : 64;
+    BitReader br = {p, header_bytes * 8, 16, 0};
+    info->strmtyp = (int)bits_read(&br, 2);
+    info->substreamid = (int)bits_read(&br, 3);
+    info->frame_size = ((int)bits_read(&br, 11) + 1) * 2;
+    int fscod = (int)bits_read(&br, 2);
+    int numblkscod;
+    if (fscod == 3) {
+        int fscod2 = (int)bits_read(&br, 2);
+        if (fscod2 == 3) return 0;
+        info->sample_rate = eac3_reduced_rates[fscod2];
+        numblkscod = 3;
     } else {
-        WaitForSingleObject(pi.hProcess, INFINITE);
-        DWORD proc_exit_code = 0;
-        if (!GetExitCodeProcess(pi.hProcess, &proc_exit_code)) {
-            DWORD err = GetLastError();
-            char err_msg[256];
-            format_win32_error(err, err_msg, sizeof(err_msg));
-            fprintf(stderr, "获取 dee.exe 退出码失败 (error=%lu): %s\n", (unsigned long)err, err_msg);
-            exit_code = (int)err;
-        } else {
-            exit_code = (int)proc_exit_code;
+        info->sample_rate = eac3_rates[fscod];
+        numblkscod = (int)bits_read(&br, 2);
+    }
+    info->blocks = block_counts[numblkscod];
+    int acmod = (int)bits_read(&br, 3);
+    int lfeon = (int)bits_read(&br, 1);
+    info->acmod = acmod;
+    info->lfeon = lfeon;
+    if (info->strmtyp == 3 || info->frame_size < 8) return 0;
+    bits_skip(&br, 5 + 5); /* bsid, dialnorm */
+    if (bits_read(&br, 1)) bits_skip(&br, 8);
+    if (acmod == 0) {
+        bits_skip(&br, 5);
+        if (bits_read(&br, 1)) bits_skip(&br, 8);
+    }
+    if (info->strmtyp == 1 && bits_read(&br, 1)) {
+        info->chanmap = (int)bits_read(&br, 16);
+    }
+    if (bits_read(&br, 1)) { /* mixmdate */
+        if (acmod > 2) bits_skip(&br, 2);
+        if ((acmod & 1) && acmod > 2) bits_skip(&br, 6);
+        if (acmod & 4) bits_skip(&br, 6);
+        if (lfeon && bits_read(&br, 1)) bits_skip(&br, 5);
+        if (info->strmtyp == 0) {
+            if (bits_read(&br, 1)) bits_skip(&br, 6);
+            if (acmod == 0 && bits_read(&br, 1)) bits_skip(&br, 6);
+            if (bits_read(&br, 1)) bits_skip(&br, 6);
+            int mixdef = (int)bits_read(&br, 2);
+            if (mixdef == 1) bits_skip(&br, 5);
+            else if (mixdef == 2) bits_skip(&br, 12);
+            else if (mixdef == 3) {
+                int mixdeflen = (int)bits_read(&br, 5);
+                bits_skip(&br, (size_t)(mixdeflen + 2) * 8);
+            }
+            if (acmod < 2) {
+                if (bits_read(&br, 1)) bits_skip(&br, 14);
+                if (acmod == 0 && bits_read(&br, 1)) bits_skip(&br, 14);
+            }
+            if (bits_read(&br, 1)) {
+                if (numblkscod == 0) {
+                    bits_skip(&br, 5);
+                } else {
+                    for (int blk = 0; blk < info->blocks; ++blk) {
+                        if (bits_read(&br, 1)) bits_skip(&br, 5);
+                    }
+                }
+            }
         }
-        CloseHandle(pi.hThread);
-        CloseHandle(pi.hProcess);
     }
-#else
-    exit_code = system(cmd);
-    if (exit_code == -1) {
-        perror("调用 dee.exe 失败");
+    if (bits_read(&br, 1)) { /* infomdate */
+        bits_skip(&br, 5);
+        if (acmod == 2) bits_skip(&br, 4);
+        if (acmod >= 6) bits_skip(&br, 2);
+        if (bits_read(&br, 1)) bits_skip(&br, 8);
+        if (acmod == 0 && bits_read(&br, 1)) bits_skip(&br, 8);
+        if (fscod < 3) bits_skip(&br, 1);
     }
-#endif
+    if (info->strmtyp == 0 && numblkscod != 3) bits_skip(&br, 1);
+    if (info->strmtyp == 2) {
+        int blkid = numblkscod == 3 ? 1 : (int)bits_read(&br, 1);
+        if (blkid) bits_skip(&br, 6);
+    }
+    if (bits_read(&br, 1)) { /* addbsie：首字节最低位为 flag_ec3_extension_type_a（JOC） */
+        bits_skip(&br, 6);
+        bits_skip(&br, 7);
+        info->joc = (int)bits_read(&br, 1);
+        if (info->joc) info->joc_complexity = (int)bits_read(&br, 8);
+    }
+    if (br.overrun) info->joc = 0;
+    return info->frame_size;
+}
 
-    if (exit_code != 0) {
-        if (interactive_mode) system("pause");
-        return exit_code;
+static int eac3_frame_crc_ok(const unsigned char *frame, int frame_size) {
+    return crc16_compute(crc16_table_8005, frame + 2, (size_t)frame_size - 2) == 0;
+}
+
+/* chanmap 位序（A/52 表 E.1.4，bit0 为最高位）中成对声道所在位置 */
+static int eac3_location_channels(int bit) {
+    return (bit == 5 || bit == 6 || bit == 9 || bit == 10 || bit == 11 || bit == 13) ? 2 : 1;
+}
+
+static unsigned eac3_acmod_locations(int acmod) {
+    static const unsigned masks[8] = {
+        (1u << 0) | (1u << 2),                                  /* 1+1 */
+        (1u << 1),                                              /* 1/0 */
+        (1u << 0) | (1u << 2),                                  /* 2/0 */
+        (1u << 0) | (1u << 1) | (1u << 2),                      /* 3/0 */
+        (1u << 0) | (1u << 2) | (1u << 7),                      /* 2/1 */
+        (1u << 0) | (1u << 1) | (1u << 2) | (1u << 7),          /* 3/1 */
+        (1u << 0) | (1u << 2) | (1u << 3) | (1u << 4),          /* 2/2 */
+        (1u << 0) | (1u << 1) | (1u << 2) | (1u << 3) | (1u << 4) /* 3/2 */
+    };
+    return masks[acmod & 7];
+}
+
+static void eac3_channel_layout(const QcStats *stats, int *full_channels, int *lfe_channels) {
+    unsigned locations = eac3_acmod_locations(stats->config.acmod);
+    int lfe = stats->config.lfeon ? 1 : 0;
+    if (stats->dep_chanmap > 0) {
+        for (int bit = 0; bit < 15; ++bit) {
+            if (stats->dep_chanmap & (1 << (15 - bit))) locations |= 1u << bit;
+        }
+        if (stats->dep_chanmap & 1) lfe = 1;
+        if (locations & (1u << 14)) lfe++;
+    }
+    int channels = 0;
+    for (int bit = 0; bit < 14; ++bit) {
+        if (locations & (1u << bit)) channels += eac3_location_channels(bit);
     }
+    *full_channels = channels;
+    *lfe_channels = lfe;
+}
 
-    if (choice == 4) {
-        printf("dee 完成 MLP 导出，开始调用 deew 生成 7.1ch DDP (Blu-ray)...\n");
-        if (!intermediate_mlp_path[0]) {
-            replace_extension(final_output_path, intermediate_mlp_path, sizeof(intermediate_mlp_path), ".mlp");
-        }
-        if (!intermediate_ddp_path[0]) {
-            replace_extension(final_output_path, intermediate_ddp_path, sizeof(intermediate_ddp_path), ".eb3");
-        }
-        if (!intermediate_ddp_alt_ec3[0]) {
-            replace_extension(final_output_path, intermediate_ddp_alt_ec3, sizeof(intermediate_ddp_alt_ec3), ".ec3");
-        }
-        if (!intermediate_ddp_alt_ddp[0]) {
-            replace_extension(final_output_path, intermediate_ddp_alt_ddp, sizeof(intermediate_ddp_alt_ddp), ".ddp");
-        }
-        char intermediate_ddp_alt_eb3[512];
-        char intermediate_ddp_alt_ddp_uc[512];
-        intermediate_ddp_alt_eb3[0] = '\0';
-        intermediate_ddp_alt_ddp_uc[0] = '\0';
-        replace_extension(final_output_path, intermediate_ddp_alt_eb3, sizeof(intermediate_ddp_alt_eb3), ".EB3");
-        replace_extension(final_output_path, intermediate_ddp_alt_ddp_uc, sizeof(intermediate_ddp_alt_ddp_uc), ".DDP");
-
-        char mlp_directory[512];
-        mlp_directory[0] = '\0';
-        if (intermediate_mlp_path[0]) {
-            copy_string(mlp_directory, sizeof(mlp_directory), intermediate_mlp_path);
-            normalize_slashes(mlp_directory);
-            char *last_sep = strrchr(mlp_directory, '\\');
-            if (!last_sep) last_sep = strrchr(mlp_directory, '/');
-            if (last_sep) {
-                if (last_sep == mlp_directory + 2 && mlp_directory[1] == ':') {
-                    *(last_sep + 1) = '\0';
-                } else {
-                    *last_sep = '\0';
+static int eac3_frames_same_config(const Eac3FrameInfo *a, const Eac3FrameInfo *b) {
+    return a->frame_size == b->frame_size && a->sample_rate == b->sample_rate &&
+           a->acmod == b->acmod && a->lfeon == b->lfeon && a->blocks == b->blocks;
+}
+
+static int truehd_major_sync_size(const unsigned char *ms, size_t avail) {
+    if (avail < 28) return -1;
+    int size = 28;
+    if (read_be32(ms) == 0xF8726FBAUL && (ms[25] & 1)) {
+        size += 2 + (ms[26] >> 4) * 2;
+    }
+    return size;
+}
+
+typedef struct {
+    int kind;             /* QC_FORMAT_EAC3 / QC_FORMAT_TRUEHD */
+    const char *path;
+    long long range_end;  /* 扫描范围结束（整个文件或 mdat 负载结束） */
+    long long begin;      /* 本分片查找锚点的起始位置 */
+    long long end;        /* 本分片查找锚点的结束位置 */
+    long long anchor;     /* 本分片第一个可信帧位置，-1 表示无 */
+    long long stop;       /* 行走终点（下一个分片的锚点或范围结束） */
+    long long walk_end;   /* 实际走到的位置 */
+    int substreams;       /* TrueHD：锚点处 major sync 声明的子流数量 */
+    int io_error;
+    QcStats stats;
+} QcChunk;
+
+/* 在 [pos, limit) 中查找可信的帧起点：同步字、帧头合法、CRC/校验通过且下一帧紧随其后 */
+static long long qc_find_anchor(ByteReader *r, int kind, long long pos, long long limit, long long range_end) {
+    const size_t window = kind == QC_FORMAT_EAC3 ? 8192 : 16384;
+    while (pos < limit) {
+        if (!reader_seek(r, pos)) return -1;
+        size_t avail = reader_fill(r, window + 8);
+        if (avail < 8) return -1;
+        const unsigned char *p = r->buf + r->pos;
+        size_t scan = avail - 8;
+        if ((long long)scan > limit - pos) scan = (size_t)(limit - pos);
+        if (scan == 0) scan = 1;
+        for (size_t i = 0; i < scan; ++i) {
+            if (kind == QC_FORMAT_EAC3) {
+                if (p[i] != 0x0B || p[i + 1] != 0x77) continue;
+                long long cand = pos + (long long)i;
+                if (!reader_seek(r, cand)) return -1;
+                size_t got = reader_fill(r, 4096 + 2);
+                const unsigned char *f = r->buf + r->pos;
+                Eac3FrameInfo info;
+                int size = parse_eac3_header(f, got, &info);
+                if (size <= 0 || (size_t)size > got) {
+                    reader_seek(r, pos);
+                    reader_fill(r, window + 8);
+                    p = r->buf + r->pos;
+                    continue;
                 }
+                int next_ok = (cand + size == range_end) ||
+                              ((size_t)size + 2 <= got && f[size] == 0x0B && f[size + 1] == 0x77);
+                if (next_ok && eac3_frame_crc_ok(f, size)) return cand;
+                reader_seek(r, pos);
+                reader_fill(r, window + 8);
+                p = r->buf + r->pos;
             } else {
-                copy_string(mlp_directory, sizeof(mlp_directory), ".");
+                if (i + 8 > avail) break;
+                if (read_be32(p + i + 4) != 0xF8726FBAUL && read_be32(p + i + 4) != 0xF8726FBBUL) continue;
+                long long cand = pos + (long long)i;
+                if (!reader_seek(r, cand)) return -1;
+                size_t got = reader_fill(r, 64);
+                const unsigned char *u = r->buf + r->pos;
+                int ms_size = truehd_major_sync_size(u + 4, got > 4 ? got - 4 : 0);
+                int ok = 0;
+                if (ms_size > 0 && (size_t)ms_size + 4 <= got && read_be16(u + 4 + 8) == 0xB752) {
+                    unsigned short crc = crc16_compute(crc16_table_002d, u + 4, (size_t)ms_size - 4);
+                    crc ^= (unsigned short)(u[4 + ms_size - 4] | (u[4 + ms_size - 3] << 8));
+                    ok = crc == (unsigned short)(u[4 + ms_size - 2] | (u[4 + ms_size - 1] << 8));
+                }
+                if (ok) return cand;
+                reader_seek(r, pos);
+                reader_fill(r, window + 8);
+                p = r->buf + r->pos;
             }
-        } else {
-            copy_string(mlp_directory, sizeof(mlp_directory), ".");
-        }
-
-        char deew_cmd[4096];
-        int deew_len = snprintf(deew_cmd, sizeof(deew_cmd),
-            "cmd /C \"chcp 65001 > nul && cd /d \"%s\" && (deew.exe -i \"%s\" -f ddp -b 1664 -fb || deew -i \"%s\" -f ddp -b 1664 -fb || python -X utf8 -m deew -i \"%s\" -f ddp -b 1664 -fb || py -3 -X utf8 -m deew -i \"%s\" -f ddp -b 1664 -fb || py -3.9 -X utf8 -m deew -i \"%s\" -f ddp -b 1664 -fb)\"",
-            mlp_directory,
-            intermediate_mlp_path,
-            intermediate_mlp_path,
-            intermediate_mlp_path,
-            intermediate_mlp_path,
-            intermediate_mlp_path);
-        if (deew_len < 0 || deew_len >= (int)sizeof(deew_cmd)) {
-            fprintf(stderr, "错误: 构建 deew 命令失败。\n");
-            if (interactive_mode) system("pause");
-            return 1;
         }
+        pos += (long long)scan;
+    }
+    return -1;
+}
 
-        printf("执行命令: %s\n", deew_cmd);
-        fflush(stdout);
-        int deew_code = system(deew_cmd);
-        if (deew_code != 0) {
-            fprintf(stderr, "deew 执行失败 (exit=%d)，请确认已将 deew.exe 加入 PATH 或已通过 pip 安装 deew。当前命令: %s\n", deew_code, deew_cmd);
-            if (interactive_mode) system("pause");
-            return 1;
+static void qc_walk_eac3(QcChunk *chunk, ByteReader *r) {
+    QcStats *st = &chunk->stats;
+    long long pos = chunk->anchor;
+    int in_first_au = 1;
+    while (pos < chunk->stop) {
+        if (!reader_seek(r, pos)) {
+            chunk->io_error = 1;
+            break;
+        }
+        size_t got = reader_fill(r, 4096);
+        const unsigned char *f = r->buf + r->pos;
+        Eac3FrameInfo info;
+        int size = parse_eac3_header(f, got, &info);
+        if (size <= 0) {
+            st->sync_losses++;
+            long long next = qc_find_anchor(r, QC_FORMAT_EAC3, pos + 1, chunk->stop, chunk->range_end);
+            if (next < 0) {
+                st->corrupt_bytes += chunk->stop - pos;
+                pos = chunk->stop;
+                break;
+            }
+            st->corrupt_bytes += next - pos;
+            pos = next;
+            continue;
+        }
+        if ((size_t)size > got) {
+            st->truncated = 1;
+            st->corrupt_bytes += (long long)got;
+            pos += (long long)got;
+            break;
+        }
+        st->frames++;
+        st->payload_bytes += size;
+        if (!eac3_frame_crc_ok(f, size)) st->crc_errors++;
+        int independent = info.strmtyp != 1;
+        if (independent && info.substreamid == 0) {
+            if (st->access_units > 0) in_first_au = 0;
+            st->access_units++;
+            if (info.joc) st->joc_frames++;
+            if (!st->has_config) {
+                st->config = info;
+                st->has_config = 1;
+            } else if (!eac3_frames_same_config(&st->config, &info)) {
+                st->config_changes++;
+            }
+        } else if (!independent) {
+            st->dependent_frames++;
+            if (info.chanmap > 0 && st->dep_chanmap <= 0) st->dep_chanmap = info.chanmap;
+        }
+        if (in_first_au && st->has_config) st->au_bytes += size;
+        pos += size;
+    }
+    chunk->walk_end = pos;
+}
+
+static void qc_walk_truehd(QcChunk *chunk, ByteReader *r) {
+    QcStats *st = &chunk->stats;
+    long long pos = chunk->anchor;
+    int substreams = 0;
+    long long since_major = 0;
+    while (pos < chunk->stop) {
+        if (!reader_seek(r, pos)) {
+            chunk->io_error = 1;
+            break;
+        }
+        size_t got = reader_fill(r, 8192);
+        if (got < 4) {
+            st->truncated = 1;
+            st->corrupt_bytes += (long long)got;
+            pos += (long long)got;
+            break;
+        }
+        const unsigned char *u = r->buf + r->pos;
+        int length = (int)(read_be16(u) & 0x0FFF) * 2;
+        if (length < 4) {
+            st->sync_losses++;
+            long long next = qc_find_anchor(r, QC_FORMAT_TRUEHD, pos + 1, chunk->stop, chunk->range_end);
+            if (next < 0) {
+                st->corrupt_bytes += chunk->stop - pos;
+                pos = chunk->stop;
+                break;
+            }
+            st->corrupt_bytes += next - pos;
+            pos = next;
+            substreams = 0;
+            continue;
+        }
+        if ((size_t)length > got) {
+            st->truncated = 1;
+            st->corrupt_bytes += (long long)got;
+            pos += (long long)got;
+            break;
         }
+        const unsigned char *cursor = u + 4;
+        unsigned char parity = (unsigned char)(u[0] ^ u[1] ^ u[2] ^ u[3]);
+        unsigned long format_sync = length >= 8 ? read_be32(u + 4) : 0;
+        if (format_sync == 0xF8726FBAUL || format_sync == 0xF8726FBBUL) {
+            int ms_size = truehd_major_sync_size(u + 4, (size_t)length - 4);
+            if (ms_size < 0 || ms_size + 4 > length) {
+                st->major_sync_crc_errors++;
+            } else {
+                unsigned short crc = crc16_compute(crc16_table_002d, u + 4, (size_t)ms_size - 4);
+                crc ^= (unsigned short)(u[4 + ms_size - 4] | (u[4 + ms_size - 3] << 8));
+                if (crc != (unsigned short)(u[4 + ms_size - 2] | (u[4 + ms_size - 1] << 8))) {
+                    st->major_sync_crc_errors++;
+                }
+                substreams = u[4 + 16] >> 4;
+                if (st->major_syncs == 0) {
+                    int ratebits = u[4 + 4] >> 4;
+                    st->truehd_stream_type = u[4 + 3];
+                    st->truehd_rate = ratebits == 0xF ? 0 : ((ratebits & 8) ? 44100 : 48000) << (ratebits & 7);
+                    st->truehd_substreams = substreams;
+                }
+                cursor = u + 4 + ms_size;
+            }
+            if (since_major > st->max_major_sync_gap) st->max_major_sync_gap = since_major;
+            since_major = 0;
+            st->major_syncs++;
+        }
+        if (substreams > 0) {
+            for (int s = 0; s < substreams && cursor + 2 <= u + length; ++s) {
+                int extraword = cursor[0] >> 7;
+                parity ^= cursor[0] ^ cursor[1];
+                cursor += 2;
+                if (extraword && cursor + 2 <= u + length) {
+                    parity ^= cursor[0] ^ cursor[1];
+                    cursor += 2;
+                }
+            }
+            if ((((parity >> 4) ^ parity) & 0x0F) != 0x0F) st->parity_errors++;
+        }
+        st->units++;
+        since_major++;
+        st->payload_bytes += length;
+        pos += length;
+    }
+    if (since_major > st->max_major_sync_gap) st->max_major_sync_gap = since_major;
+    chunk->walk_end = pos;
+}
+
+static void qc_anchor_worker(void *arg) {
+    QcChunk *chunk = (QcChunk *)arg;
+    ByteReader r;
+    chunk->anchor = -1;
+    if (!reader_open(&r, chunk->path, 1 << 20, chunk->range_end)) {
+        chunk->io_error = 1;
+        return;
+    }
+    chunk->anchor = qc_find_anchor(&r, chunk->kind, chunk->begin, chunk->end, chunk->range_end);
+    reader_close(&r);
+}
+
+static void qc_walk_worker(void *arg) {
+    QcChunk *chunk = (QcChunk *)arg;
+    ByteReader r;
+    if (chunk->anchor < 0) return;
+    if (!reader_open(&r, chunk->path, 4 << 20, chunk->range_end)) {
+        chunk->io_error = 1;
+        return;
+    }
+    if (chunk->kind == QC_FORMAT_EAC3) {
+        qc_walk_eac3(chunk, &r);
+    } else {
+        qc_walk_truehd(chunk, &r);
+    }
+    reader_close(&r);
+}
+
+static void qc_merge_stats(QcStats *dst, const QcStats *src) {
+    if (!dst->has_config && src->has_config) {
+        dst->config = src->config;
+        dst->has_config = 1;
+        dst->au_bytes = src->au_bytes;
+    } else if (dst->has_config && src->has_config && !eac3_frames_same_config(&dst->config, &src->config)) {
+        dst->config_changes++;
+    }
+    if (dst->dep_chanmap <= 0) dst->dep_chanmap = src->dep_chanmap;
+    if (dst->major_syncs == 0 && src->major_syncs > 0) {
+        dst->truehd_rate = src->truehd_rate;
+        dst->truehd_substreams = src->truehd_substreams;
+        dst->truehd_stream_type = src->truehd_stream_type;
+    }
+    dst->frames += src->frames;
+    dst->access_units += src->access_units;
+    dst->dependent_frames += src->dependent_frames;
+    dst->joc_frames += src->joc_frames;
+    dst->crc_errors += src->crc_errors;
+    dst->config_changes += src->config_changes;
+    dst->units += src->units;
+    dst->major_syncs += src->major_syncs;
+    dst->parity_errors += src->parity_errors;
+    dst->major_sync_crc_errors += src->major_sync_crc_errors;
+    if (src->max_major_sync_gap > dst->max_major_sync_gap) dst->max_major_sync_gap = src->max_major_sync_gap;
+    dst->payload_bytes += src->payload_bytes;
+    dst->sync_losses += src->sync_losses;
+    dst->corrupt_bytes += src->corrupt_bytes;
+    dst->truncated |= src->truncated;
+}
 
-        const char *ddp_source_path = NULL;
-        if (file_exists(intermediate_ddp_path)) {
-            ddp_source_path = intermediate_ddp_path;
-        } else if (file_exists(intermediate_ddp_alt_eb3)) {
-            ddp_source_path = intermediate_ddp_alt_eb3;
-        } else if (file_exists(intermediate_ddp_alt_ec3)) {
-            ddp_source_path = intermediate_ddp_alt_ec3;
-        } else if (file_exists(intermediate_ddp_alt_ddp)) {
-            ddp_source_path = intermediate_ddp_alt_ddp;
-        } else if (file_exists(intermediate_ddp_alt_ddp_uc)) {
-            ddp_source_path = intermediate_ddp_alt_ddp_uc;
+/* 将 [start, end) 按线程数切片并行校验：先并行寻找各分片锚点，再并行逐帧行走，最后检查分片接缝 */
+static void qc_scan_stream(QcReport *report, int kind, long long start, long long end, int threads) {
+    QcChunk chunks[QC_MAX_THREADS];
+    worker_thread_t handles[QC_MAX_THREADS];
+    int started[QC_MAX_THREADS];
+    long long length = end - start;
+    if (length <= 0) return;
+    if (threads < 1) threads = 1;
+    if (threads > QC_MAX_THREADS) threads = QC_MAX_THREADS;
+    while (threads > 1 && length / threads < QC_MIN_CHUNK_BYTES) threads--;
+    if (threads > report->threads_used) report->threads_used = threads;
+
+    for (int i = 0; i < threads; ++i) {
+        memset(&chunks[i], 0, sizeof(chunks[i]));
+        chunks[i].kind = kind;
+        chunks[i].path = report->path;
+        chunks[i].range_end = end;
+        chunks[i].begin = start + length * i / threads;
+        chunks[i].end = start + length * (i + 1) / threads;
+    }
+    /* 第 0 片的锚点必须就是范围起点，否则说明开头有垃圾数据 */
+    for (int i = 0; i < threads; ++i) {
+        started[i] = i > 0 && worker_start(&handles[i], qc_anchor_worker, &chunks[i]);
+        if (i > 0 && !started[i]) qc_anchor_worker(&chunks[i]);
+    }
+    chunks[0].end = end;
+    qc_anchor_worker(&chunks[0]);
+    for (int i = 1; i < threads; ++i) {
+        if (started[i]) worker_join(handles[i]);
+    }
+    if (chunks[0].anchor != start) {
+        if (chunks[0].anchor < 0) {
+            qc_fail(report, "在偏移 %lld 起未找到任何有效的%s帧", start, kind == QC_FORMAT_EAC3 ? " E-AC-3 " : " TrueHD ");
+            report->stats.corrupt_bytes += length;
+            return;
+        }
+        qc_fail(report, "码流起始处有 %lld 字节无法识别的数据", chunks[0].anchor - start);
+        report->stats.corrupt_bytes += chunks[0].anchor - start;
+    }
+    for (int i = 0; i < threads; ++i) {
+        long long stop = end;
+        for (int j = i + 1; j < threads; ++j) {
+            if (chunks[j].anchor >= 0 && chunks[j].anchor > chunks[i].anchor) {
+                stop = chunks[j].anchor;
+                break;
+            }
+        }
+        chunks[i].stop = stop;
+        if (i > 0 && chunks[i].anchor >= 0 && chunks[i].anchor <= chunks[i - 1].anchor) chunks[i].anchor = -1;
+    }
+    for (int i = 0; i < threads; ++i) {
+        started[i] = worker_start(&handles[i], qc_walk_worker, &chunks[i]);
+        if (!started[i]) qc_walk_worker(&chunks[i]);
+    }
+    for (int i = 0; i < threads; ++i) {
+        if (started[i]) worker_join(handles[i]);
+    }
+    for (int i = 0; i < threads; ++i) {
+        if (chunks[i].io_error) qc_fail(report, "读取文件失败: %s", report->path);
+        if (chunks[i].anchor < 0) continue;
+        if (chunks[i].walk_end != chunks[i].stop && !chunks[i].stats.truncated) {
+            qc_fail(report, "分片接缝不一致：帧序列在 %lld 处越过下一个同步点 %lld", chunks[i].walk_end, chunks[i].stop);
         }
+        qc_merge_stats(&report->stats, &chunks[i].stats);
+    }
+}
 
-        if (!ddp_source_path) {
-            fprintf(stderr, "deew 未生成预期的 DDP 文件，请检查命令输出，并确认 deew 默认输出位於與輸入相同的目录。\n");
-            if (interactive_mode) system("pause");
-            return 1;
+static void qc_check_stream_stats(QcReport *report, int kind, const QcExpect *expect) {
+    const QcStats *st = &report->stats;
+    if (kind == QC_FORMAT_EAC3) {
+        if (st->frames == 0) qc_fail(report, "未解析到任何 E-AC-3 同步帧");
+        if (st->crc_errors > 0) qc_fail(report, "%lld 个 E-AC-3 帧 CRC 校验失败", st->crc_errors);
+        if (st->config_changes > 0) qc_fail(report, "码流中途配置变化 %lld 次", st->config_changes);
+        if (expect && expect->require_joc && st->joc_frames == 0) {
+            qc_fail(report, "预期为 Dolby Atmos (JOC)，但码流中未发现 JOC 扩展");
+        }
+        if (expect && expect->min_channels > 0 && st->has_config) {
+            int full = 0, lfe = 0;
+            eac3_channel_layout(st, &full, &lfe);
+            if (full + lfe < expect->min_channels) {
+                qc_fail(report, "声道数不符：期望至少 %d，实际 %d.%d", expect->min_channels, full, lfe);
+            }
         }
+    } else {
+        if (st->units == 0) qc_fail(report, "未解析到任何 TrueHD 访问单元");
+        if (st->major_syncs == 0) qc_fail(report, "未找到 TrueHD major sync");
+        if (st->major_sync_crc_errors > 0) qc_fail(report, "%lld 个 major sync CRC 校验失败", st->major_sync_crc_errors);
+        if (st->parity_errors > 0) qc_fail(report, "%lld 个访问单元 nibble 校验失败", st->parity_errors);
+        if (st->truehd_stream_type != 0xBA && st->major_syncs > 0) qc_fail(report, "major sync 类型不是 TrueHD (0x%02X)", st->truehd_stream_type);
+        if (st->max_major_sync_gap > 128) qc_fail(report, "major sync 间隔过大（%lld 个访问单元）", st->max_major_sync_gap);
+    }
+    if (st->sync_losses > 0) qc_fail(report, "发生 %lld 次失步，%lld 字节数据无法解析", st->sync_losses, st->corrupt_bytes);
+    if (st->truncated) qc_fail(report, "码流末尾被截断");
+}
 
-        printf("找到 DDP 中间文件: %s\n", ddp_source_path);
-        ensure_parent_directory(final_output_path);
+typedef struct {
+    QcReport *report;
+    FILE *fp;
+    long long *mdat_start;
+    long long *mdat_end;
+    int mdat_capacity;
+    int depth;
+} Mp4Walk;
 
-        char ffmpeg_cmd[4096];
-        int ffmpeg_len = snprintf(ffmpeg_cmd, sizeof(ffmpeg_cmd),
-            "ffmpeg -y -i \"%s\" -c:a copy -movflags +faststart -f mp4 \"%s\"",
-            ddp_source_path, final_output_path);
-        if (ffmpeg_len < 0 || ffmpeg_len >= (int)sizeof(ffmpeg_cmd)) {
-            fprintf(stderr, "错误: 构建 ffmpeg 命令失败。\n");
-            if (interactive_mode) system("pause");
-            return 1;
+static int mp4_is_container(const char *type) {
+    static const char *containers[] = {"moov", "trak", "mdia", "minf", "stbl", "edts", "dinf", "mvex", "moof", "traf", "udta", NULL};
+    for (int i = 0; containers[i]; ++i) {
+        if (memcmp(type, containers[i], 4) == 0) return 1;
+    }
+    return 0;
+}
+
+static int mp4_read_at(FILE *fp, long long offset, unsigned char *buf, size_t len) {
+    if (file_seek64(fp, offset) != 0) return 0;
+    return fread(buf, 1, len, fp) == len;
+}
+
+static void mp4_parse_dec3(Mp4Walk *w, const unsigned char *p, size_t len) {
+    QcReport *report = w->report;
+    if (len < 5) {
+        qc_fail(report, "dec3 box 长度异常");
+        return;
+    }
+    BitReader br = {p, len * 8, 0, 0};
+    report->dec3_found = 1;
+    report->dec3_data_rate = (int)bits_read(&br, 13);
+    int num_ind_sub = (int)bits_read(&br, 3) + 1;
+    for (int i = 0; i < num_ind_sub; ++i) {
+        bits_skip(&br, 2 + 5 + 1 + 1 + 3 + 3 + 1 + 3);
+        int num_dep_sub = (int)bits_read(&br, 4);
+        bits_skip(&br, num_dep_sub > 0 ? 9 : 1);
+    }
+    if (!br.overrun && br.pos + 16 <= br.size_bits) {
+        bits_skip(&br, 7);
+        report->dec3_joc = (int)bits_read(&br, 1);
+    }
+}
+
+static void mp4_walk_boxes(Mp4Walk *w, long long start, long long end) {
+    QcReport *report = w->report;
+    long long pos = start;
+    w->depth++;
+    while (pos < end) {
+        unsigned char hdr[16];
+        if (end - pos < 8) {
+            qc_fail(report, "MP4 在偏移 %lld 处有 %lld 字节残留数据", pos, end - pos);
+            break;
+        }
+        if (!mp4_read_at(w->fp, pos, hdr, 8)) {
+            qc_fail(report, "读取 MP4 box 头失败（偏移 %lld）", pos);
+            break;
+        }
+        unsigned long long size = read_be32(hdr);
+        char type[5];
+        memcpy(type, hdr + 4, 4);
+        type[4] = '\0';
+        long long header = 8;
+        if (size == 1) {
+            if (!mp4_read_at(w->fp, pos + 8, hdr + 8, 8)) {
+                qc_fail(report, "读取 64 位 box 长度失败（%s）", type);
+                break;
+            }
+            size = read_be64(hdr + 8);
+            header = 16;
+        } else if (size == 0) {
+            size = (unsigned long long)(end - pos);
         }
+        if (size < (unsigned long long)header || (long long)size > end - pos) {
+            qc_fail(report, "box '%s' 长度 %llu 超出父容器（偏移 %lld），文件可能被截断", type, size, pos);
+            break;
+        }
+        long long body = pos + header;
+        long long body_end = pos + (long long)size;
 
-        printf("执行命令: %s\n", ffmpeg_cmd);
-        fflush(stdout);
-        int ffmpeg_code = system(ffmpeg_cmd);
-        if (ffmpeg_code != 0 || !file_exists(final_output_path)) {
-            fprintf(stderr, "ffmpeg 转封装失败 (exit=%d)，请检查 ffmpeg 是否在 PATH 中。\n", ffmpeg_code);
-            if (interactive_mode) system("pause");
-            return 1;
+        if (w->depth == 1) {
+            if (memcmp(type, "ftyp", 4) == 0 && size >= 12) {
+                unsigned char brand[4];
+                if (mp4_read_at(w->fp, body, brand, 4)) {
+                    memcpy(report->major_brand, brand, 4);
+                    report->major_brand[4] = '\0';
+                }
+            } else if (memcmp(type, "moov", 4) == 0) {
+                report->mp4_has_moov = 1;
+            } else if (memcmp(type, "moof", 4) == 0) {
+                report->mp4_fragments++;
+            } else if (memcmp(type, "mdat", 4) == 0) {
+                if (report->mp4_mdat_count == w->mdat_capacity) {
+                    int capacity = w->mdat_capacity ? w->mdat_capacity * 2 : 16;
+                    long long *starts = (long long *)realloc(w->mdat_start, sizeof(long long) * (size_t)capacity);
+                    if (starts) w->mdat_start = starts;
+                    long long *ends = (long long *)realloc(w->mdat_end, sizeof(long long) * (size_t)capacity);
+                    if (ends) w->mdat_end = ends;
+                    if (starts && ends) w->mdat_capacity = capacity;
+                }
+                if (report->mp4_mdat_count < w->mdat_capacity) {
+                    w->mdat_start[report->mp4_mdat_count] = body;
+                    w->mdat_end[report->mp4_mdat_count] = body_end;
+                    report->mp4_mdat_count++;
+                } else {
+                    qc_fail(report, "内存不足，无法记录 mdat box");
+                }
+            }
         }
 
-        printf("已生成最终输出文件: %s\n", final_output_path);
-
-        remove_file_if_exists(intermediate_mlp_path);
-        remove_file_if_exists(intermediate_ddp_path);
-        remove_file_if_exists(intermediate_ddp_alt_ec3);
-        remove_file_if_exists(intermediate_ddp_alt_ddp);
-        remove_file_if_exists(inter_mll_path);
-        remove_file_if_exists(inter_log_path);
-    } else if (choice == 5) {
-        printf("dee 完成 MLP 导出，开始调用 deezy 生成 Dolby Atmos M4A 7.1 (Blu-ray)...\n");
-        if (!intermediate_mlp_path[0]) {
-            replace_extension(final_output_path, intermediate_mlp_path, sizeof(intermediate_mlp_path), ".mlp");
-        }
-
-        char mlp_directory[512];
-        mlp_directory[0] = '\0';
-        if (intermediate_mlp_path[0]) {
-            copy_string(mlp_directory, sizeof(mlp_directory), intermediate_mlp_path);
-            normalize_slashes(mlp_directory);
-            char *last_sep = strrchr(mlp_directory, '\\');
-            if (!last_sep) last_sep = strrchr(mlp_directory, '/');
-            if (last_sep) {
-                if (last_sep == mlp_directory + 2 && mlp_directory[1] == ':') {
-                    *(last_sep + 1) = '\0';
+        if (mp4_is_container(type)) {
+            mp4_walk_boxes(w, body, body_end);
+        } else if (memcmp(type, "mdhd", 4) == 0 && size >= 32) {
+            unsigned char buf[32];
+            size_t want = size - 8 >= sizeof(buf) ? sizeof(buf) : (size_t)(size - 8);
+            if (mp4_read_at(w->fp, body, buf, want) && (buf[0] != 1 || want >= 32)) {
+                if (buf[0] == 1) {
+                    report->mp4_timescale = read_be32(buf + 20);
+                    report->mp4_duration = read_be64(buf + 24);
                 } else {
-                    *last_sep = '\0';
+                    report->mp4_timescale = read_be32(buf + 12);
+                    report->mp4_duration = read_be32(buf + 16);
                 }
-            } else {
-                copy_string(mlp_directory, sizeof(mlp_directory), ".");
             }
-        } else {
-            copy_string(mlp_directory, sizeof(mlp_directory), ".");
+        } else if (memcmp(type, "stsz", 4) == 0 && size >= 20) {
+            unsigned char buf[12];
+            if (mp4_read_at(w->fp, body, buf, sizeof(buf))) report->mp4_sample_count += read_be32(buf + 8);
+        } else if (memcmp(type, "trun", 4) == 0 && size >= 16) {
+            /* 分片文件的样本数在各 moof 的 trun 中 */
+            unsigned char buf[8];
+            if (mp4_read_at(w->fp, body, buf, sizeof(buf))) report->mp4_sample_count += read_be32(buf + 4);
+        } else if (memcmp(type, "stsd", 4) == 0 && size >= 16) {
+            /* 只关心第一个音频 sample entry 及其中的 dec3 */
+            long long entry = body + 8;
+            unsigned char eh[8];
+            if (entry + 8 <= body_end && mp4_read_at(w->fp, entry, eh, 8)) {
+                long long entry_size = (long long)read_be32(eh);
+                memcpy(report->codec, eh + 4, 4);
+                report->codec[4] = '\0';
+                long long child = entry + 8 + 28;
+                long long entry_end = entry + entry_size;
+                if (entry_end > body_end) {
+                    qc_fail(report, "sample entry '%s' 长度越界", report->codec);
+                    entry_end = body_end;
+                }
+                while (child + 8 <= entry_end) {
+                    unsigned char ch[8];
+                    if (!mp4_read_at(w->fp, child, ch, 8)) break;
+                    long long child_size = (long long)read_be32(ch);
+                    if (child_size < 8 || child + child_size > entry_end) break;
+                    if (memcmp(ch + 4, "dec3", 4) == 0 && child_size <= 64 + 8) {
+                        unsigned char payload[64];
+                        size_t plen = (size_t)(child_size - 8);
+                        if (mp4_read_at(w->fp, child + 8, payload, plen)) mp4_parse_dec3(w, payload, plen);
+                    }
+                    child += child_size;
+                }
+            }
+        }
+        pos = body_end;
+    }
+    w->depth--;
+}
+
+static void qc_verify_mp4_eac3(QcReport *report, const Mp4Walk *walk, const QcExpect *expect, int threads);
+
+static void qc_verify_mp4(QcReport *report, const QcExpect *expect, int threads) {
+    Mp4Walk walk;
+    memset(&walk, 0, sizeof(walk));
+    walk.report = report;
+    walk.fp = fopen(report->path, "rb");
+    if (!walk.fp) {
+        qc_fail(report, "无法打开文件: %s", report->path);
+        return;
+    }
+    mp4_walk_boxes(&walk, 0, report->file_size);
+    fclose(walk.fp);
+    walk.fp = NULL;
+
+    if (report->major_brand[0] == '\0') qc_fail(report, "缺少 ftyp box");
+    if (!report->mp4_has_moov) qc_fail(report, "缺少 moov box");
+    if (report->mp4_mdat_count == 0) qc_fail(report, "缺少 mdat box");
+    if (report->codec[0] == '\0') {
+        qc_fail(report, "moov 中未找到音频 sample entry");
+    } else if (strcmp(report->codec, "ec-3") != 0 && strcmp(report->codec, "ac-3") != 0) {
+        if (expect && expect->container == QC_FORMAT_MP4) qc_fail(report, "MP4 音轨编码为 '%s'，期望 ec-3", report->codec);
+    } else if (report->mp4_mdat_count > 0) {
+        qc_verify_mp4_eac3(report, &walk, expect, threads);
+    }
+    free(walk.mdat_start);
+    free(walk.mdat_end);
+}
+
+static void qc_verify_mp4_eac3(QcReport *report, const Mp4Walk *walk, const QcExpect *expect, int threads) {
+    if (strcmp(report->codec, "ec-3") == 0 && !report->dec3_found) qc_fail(report, "ec-3 sample entry 缺少 dec3 box");
+    if (expect && expect->require_joc && report->dec3_found && !report->dec3_joc) {
+        qc_fail(report, "dec3 未声明 JOC（flag_ec3_extension_type_a），不是 Atmos 轨道");
+    }
+    for (int i = 0; i < report->mp4_mdat_count; ++i) {
+        qc_scan_stream(report, QC_FORMAT_EAC3, walk->mdat_start[i], walk->mdat_end[i], threads);
+    }
+    qc_check_stream_stats(report, QC_FORMAT_EAC3, expect);
+    if (report->mp4_sample_count != report->stats.access_units) {
+        qc_fail(report, "%s 样本数 (%lld) 与 mdat 中的 E-AC-3 访问单元数 (%lld) 不一致",
+                report->mp4_fragments > 0 ? "trun" : "stsz", report->mp4_sample_count, report->stats.access_units);
+    }
+}
+
+static int qc_detect_format(const char *path) {
+    unsigned char head[16];
+    FILE *f = fopen(path, "rb");
+    if (!f) return QC_FORMAT_UNKNOWN;
+    size_t got = fread(head, 1, sizeof(head), f);
+    fclose(f);
+    if (got >= 8 && (memcmp(head + 4, "ftyp", 4) == 0 || memcmp(head + 4, "styp", 4) == 0)) return QC_FORMAT_MP4;
+    if (got >= 2 && head[0] == 0x0B && head[1] == 0x77) return QC_FORMAT_EAC3;
+    if (got >= 8 && (read_be32(head + 4) == 0xF8726FBAUL || read_be32(head + 4) == 0xF8726FBBUL)) return QC_FORMAT_TRUEHD;
+    if (ends_with_extension(path, ".m4a") || ends_with_extension(path, ".mp4")) return QC_FORMAT_MP4;
+    if (ends_with_extension(path, ".mlp") || ends_with_extension(path, ".thd")) return QC_FORMAT_TRUEHD;
+    if (ends_with_extension(path, ".ec3") || ends_with_extension(path, ".eb3") || ends_with_extension(path, ".ddp")) return QC_FORMAT_EAC3;
+    return QC_FORMAT_UNKNOWN;
+}
+
+static const char *qc_format_name(int format) {
+    switch (format) {
+    case QC_FORMAT_EAC3: return "eac3";
+    case QC_FORMAT_TRUEHD: return "truehd";
+    case QC_FORMAT_MP4: return "mp4";
+    default: return "unknown";
+    }
+}
+
+static void qc_expectations_for_choice(int choice, QcExpect *expect) {
+    memset(expect, 0, sizeof(*expect));
+    switch (choice) {
+    case 1: expect->container = QC_FORMAT_EAC3; expect->require_joc = 1; break;
+    case 2: expect->container = QC_FORMAT_MP4; expect->require_joc = 1; break;
+    case 3: expect->container = QC_FORMAT_TRUEHD; break;
+    case 4: expect->container = QC_FORMAT_MP4; expect->min_channels = 8; break;
+    case 5: expect->container = QC_FORMAT_MP4; expect->require_joc = 1; break;
+    default: break;
+    }
+}
+
+static void qc_write_report(const char *report_path, const QcReport *report) {
+    FILE *f = fopen(report_path, "w");
+    if (!f) {
+        job_warn("警告: 无法写入 QC 报告 %s (errno=%d)\n", report_path, errno);
+        return;
+    }
+    const QcStats *st = &report->stats;
+    fprintf(f, "file=%s\n", report->path);
+    fprintf(f, "format=%s\n", qc_format_name(report->format));
+    fprintf(f, "file_size=%lld\n", report->file_size);
+    fprintf(f, "result=%s\n", report->error_count == 0 ? "PASS" : "FAIL");
+    fprintf(f, "threads=%d\n", report->threads_used);
+    fprintf(f, "elapsed_seconds=%.3f\n", report->elapsed_seconds);
+    if (report->format == QC_FORMAT_MP4) {
+        fprintf(f, "major_brand=%s\n", report->major_brand);
+        fprintf(f, "codec=%s\n", report->codec);
+        fprintf(f, "mdat_boxes=%d\n", report->mp4_mdat_count);
+        fprintf(f, "fragments=%d\n", report->mp4_fragments);
+        fprintf(f, "sample_count=%lld\n", report->mp4_sample_count);
+        if (report->mp4_timescale > 0) {
+            fprintf(f, "duration_seconds=%.3f\n", (double)report->mp4_duration / (double)report->mp4_timescale);
+        }
+        if (report->dec3_found) {
+            fprintf(f, "dec3_data_rate_kbps=%d\n", report->dec3_data_rate);
+            fprintf(f, "dec3_joc=%d\n", report->dec3_joc);
+        }
+    }
+    if (report->format == QC_FORMAT_EAC3 || (report->format == QC_FORMAT_MP4 && st->frames > 0)) {
+        int full = 0, lfe = 0;
+        if (st->has_config) eac3_channel_layout(st, &full, &lfe);
+        fprintf(f, "frames=%lld\n", st->frames);
+        fprintf(f, "access_units=%lld\n", st->access_units);
+        fprintf(f, "dependent_frames=%lld\n", st->dependent_frames);
+        fprintf(f, "crc_errors=%lld\n", st->crc_errors);
+        if (st->has_config) {
+            double au_seconds = (double)(st->config.blocks * 256) / (double)st->config.sample_rate;
+            fprintf(f, "bsid=%d\n", st->config.bsid);
+            fprintf(f, "sample_rate=%d\n", st->config.sample_rate);
+            fprintf(f, "channels=%d.%d\n", full, lfe);
+            fprintf(f, "bitrate_kbps=%.0f\n", (double)st->au_bytes * 8.0 / au_seconds / 1000.0);
+            fprintf(f, "duration_seconds=%.3f\n", (double)st->access_units * au_seconds);
+        }
+        fprintf(f, "joc_frames=%lld\n", st->joc_frames);
+    }
+    if (report->format == QC_FORMAT_TRUEHD) {
+        fprintf(f, "access_units=%lld\n", st->units);
+        fprintf(f, "major_syncs=%lld\n", st->major_syncs);
+        fprintf(f, "max_major_sync_gap=%lld\n", st->max_major_sync_gap);
+        fprintf(f, "major_sync_crc_errors=%lld\n", st->major_sync_crc_errors);
+        fprintf(f, "parity_errors=%lld\n", st->parity_errors);
+        fprintf(f, "sample_rate=%d\n", st->truehd_rate);
+        fprintf(f, "substreams=%d\n", st->truehd_substreams);
+        if (st->truehd_rate > 0) {
+            int au_samples = (st->truehd_rate % 44100 == 0 ? 40 * (st->truehd_rate / 44100) : 40 * (st->truehd_rate / 48000));
+            fprintf(f, "duration_seconds=%.3f\n", (double)st->units * au_samples / (double)st->truehd_rate);
         }
+    }
+    fprintf(f, "sync_losses=%lld\n", st->sync_losses);
+    fprintf(f, "corrupt_bytes=%lld\n", st->corrupt_bytes);
+    fprintf(f, "truncated=%d\n", st->truncated);
+    int shown = report->error_count < QC_MAX_ERRORS ? report->error_count : QC_MAX_ERRORS;
+    for (int i = 0; i < shown; ++i) {
+        fprintf(f, "error=%s\n", report->errors[i]);
+    }
+    fclose(f);
+}
 
+static double monotonic_seconds(void) {
 #ifdef _WIN32
-        ULONGLONG search_threshold = get_system_filetime_ticks();
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
 #endif
+}
 
-        char deezy_cmd[4096];
-        int deezy_len = snprintf(deezy_cmd, sizeof(deezy_cmd),
-            "cmd /C \"chcp 65001 > nul && cd /d \"%s\" && (deezy encode atmos --atmos-mode bluray --bitrate 1664 \"%s\" || deezy.exe encode atmos --atmos-mode bluray --bitrate 1664 \"%s\")\"",
-            mlp_directory,
-            intermediate_mlp_path,
-            intermediate_mlp_path);
-        if (deezy_len < 0 || deezy_len >= (int)sizeof(deezy_cmd)) {
-            fprintf(stderr, "错误: 构建 deezy 命令失败。\n");
-            if (interactive_mode) system("pause");
-            return 1;
+/* 校验输出文件并写出 QC 报告，返回 0 表示通过 */
+static int verify_output_file(const char *path, const QcExpect *expect, const char *report_path, int threads) {
+    QcReport *report = (QcReport *)calloc(1, sizeof(QcReport));
+    if (!report) return 1;
+    crc16_init_tables();
+    double started = monotonic_seconds();
+    copy_string(report->path, sizeof(report->path), path);
+    report->file_size = file_size_of(path);
+    if (threads <= 0) threads = cpu_count();
+    job_note("开始 QC 校验: %s\n", path);
+
+    if (report->file_size <= 0) {
+        qc_fail(report, "输出文件不存在或为空");
+    } else {
+        report->format = qc_detect_format(path);
+        if (expect && expect->container && report->format != expect->container) {
+            qc_fail(report, "容器/码流类型为 %s，期望 %s", qc_format_name(report->format), qc_format_name(expect->container));
+        }
+        if (report->format == QC_FORMAT_EAC3 || report->format == QC_FORMAT_TRUEHD) {
+            qc_scan_stream(report, report->format, 0, report->file_size, threads);
+            qc_check_stream_stats(report, report->format, expect);
+        } else if (report->format == QC_FORMAT_MP4) {
+            qc_verify_mp4(report, expect, threads);
+        } else {
+            qc_fail(report, "无法识别的文件格式");
         }
+    }
+    report->elapsed_seconds = monotonic_seconds() - started;
 
-        printf("执行命令: %s\n", deezy_cmd);
-        fflush(stdout);
-        int deezy_code = system(deezy_cmd);
-        if (deezy_code != 0) {
-            fprintf(stderr, "deezy 执行失败 (exit=%d)，请确认 deezy 已安装并在 PATH 中。当前命令: %s\n", deezy_code, deezy_cmd);
-            if (interactive_mode) system("pause");
-            return 1;
+    char default_report[1100];
+    if (!report_path || !*report_path) {
+        snprintf(default_report, sizeof(default_report), "%s.qc.txt", path);
+        report_path = default_report;
+    }
+    qc_write_report(report_path, report);
+
+    int failed = report->error_count > 0;
+    if (failed) {
+        int shown = report->error_count < QC_MAX_ERRORS ? report->error_count : QC_MAX_ERRORS;
+        for (int i = 0; i < shown; ++i) {
+            job_warn("QC 错误: %s\n", report->errors[i]);
         }
+        job_warn("QC 校验失败 (%d 项)，报告: %s\n", report->error_count, report_path);
+    } else {
+        job_note("QC 校验通过 (%s, %.1f 秒, %d 线程)，报告: %s\n",
+               qc_format_name(report->format), report->elapsed_seconds, report->threads_used, report_path);
+    }
+    free(report);
+    return failed;
+}
+// --------- QC 校验结束 ---------
 
-        char deezy_ec3_path[1024];
-        deezy_ec3_path[0] = '\0';
-#ifdef _WIN32
-        if (!find_recent_ec3_in_directory(mlp_directory, search_threshold, deezy_ec3_path, sizeof(deezy_ec3_path))) {
-            fprintf(stderr, "未在目录 %s 下找到 deezy 生成的最新 EC3 文件，请检查 deezy 输出。\n", mlp_directory);
-            if (interactive_mode) system("pause");
-            return 1;
+// --------- 命令行选项（--name value / --name=value，可与位置参数混排） ---------
+/* 外部工具按资源特征分类，调度参数（以及后续的并发上限）按类别设置 */
+typedef enum {
+    TOOL_DEE = 0,   /* dee.exe 编码 */
+    TOOL_PYTHON,    /* deew / deezy（Python） */
+    TOOL_MUX,       /* ffmpeg 转封装 */
+    TOOL_NATIVE,    /* 进程内的 QC 校验等 */
+    TOOL_CLASS_COUNT
+} ToolClass;
+
+enum { PRIORITY_UNSET = 0, PRIORITY_IDLE, PRIORITY_BELOW, PRIORITY_NORMAL, PRIORITY_ABOVE, PRIORITY_HIGH };
+enum { IO_PRIORITY_UNSET = 0, IO_PRIORITY_IDLE, IO_PRIORITY_LOW, IO_PRIORITY_NORMAL, IO_PRIORITY_HIGH };
+/* 任务的队列优先级（--queue-priority），与 encode.h 的 DEE_QUEUE_* 取值一致；决定排队顺序与抢占 */
+enum { QUEUE_UNSET = 0, QUEUE_BACKGROUND, QUEUE_NORMAL, QUEUE_URGENT, QUEUE_LEVEL_COUNT };
+
+static const char *const queue_level_names[QUEUE_LEVEL_COUNT] = {"normal", "background", "normal", "urgent"};
+
+typedef struct {
+    unsigned long long affinity;  /* 核心位掩码（最多 64 核），0 表示使用默认分配 */
+    int priority;                 /* PRIORITY_* */
+    int io_priority;              /* IO_PRIORITY_* */
+    int max_threads;              /* 0 表示不限制；经 OMP_NUM_THREADS 传递，dee/python 工具未必遵守，ffmpeg 另传 -threads */
+    int max_concurrent;           /* 批量模式下同类阶段同时运行的上限（--pool） */
+    int queue_level;              /* 所属任务的 QUEUE_*，子进程按它参与抢占；QUEUE_UNSET 按 normal */
+} StageSchedule;
+
+#ifndef DEE_LIBRARY
+static const char *const tool_class_names[TOOL_CLASS_COUNT] = {"dee", "python", "mux", "native"};
+
+/* 解析核心集，如 "0-3,8,10-11" */
+static unsigned long long parse_core_set(const char *text) {
+    unsigned long long mask = 0;
+    const char *p = text;
+    while (*p) {
+        char *next = NULL;
+        long first = strtol(p, &next, 10);
+        if (next == p) break;
+        long last = first;
+        p = next;
+        if (*p == '-') {
+            last = strtol(p + 1, &next, 10);
+            p = next;
         }
-#else
-        if (!intermediate_ddp_alt_ec3[0] || !file_exists(intermediate_ddp_alt_ec3)) {
-            fprintf(stderr, "未找到 deezy 生成的 EC3 文件。\n");
-            if (interactive_mode) system("pause");
-            return 1;
+        for (long c = first; c <= last && c < 64; ++c) {
+            if (c >= 0) mask |= 1ULL << c;
         }
-        copy_string(deezy_ec3_path, sizeof(deezy_ec3_path), intermediate_ddp_alt_ec3);
-#endif
+        while (*p == ',' || *p == ' ') p++;
+    }
+    return mask;
+}
 
-        if (!file_exists(deezy_ec3_path)) {
-            fprintf(stderr, "deezy 生成的 EC3 文件不存在: %s\n", deezy_ec3_path);
-            if (interactive_mode) system("pause");
-            return 1;
+static int parse_priority_name(const char *name) {
+    if (case_equal(name, "idle") || case_equal(name, "low")) return PRIORITY_IDLE;
+    if (case_equal(name, "below") || case_equal(name, "below-normal")) return PRIORITY_BELOW;
+    if (case_equal(name, "normal")) return PRIORITY_NORMAL;
+    if (case_equal(name, "above") || case_equal(name, "above-normal")) return PRIORITY_ABOVE;
+    if (case_equal(name, "high")) return PRIORITY_HIGH;
+    fprintf(stderr, "警告: 未知优先级 %s，可选 idle/below/normal/above/high。\n", name);
+    return PRIORITY_UNSET;
+}
+
+static int parse_queue_level(const char *name) {
+    if (case_equal(name, "background") || case_equal(name, "low")) return QUEUE_BACKGROUND;
+    if (case_equal(name, "normal")) return QUEUE_NORMAL;
+    if (case_equal(name, "urgent") || case_equal(name, "high")) return QUEUE_URGENT;
+    fprintf(stderr, "警告: 未知队列优先级 %s，可选 background/normal/urgent。\n", name);
+    return QUEUE_UNSET;
+}
+
+static int parse_io_priority_name(const char *name) {
+    if (case_equal(name, "idle") || case_equal(name, "very-low")) return IO_PRIORITY_IDLE;
+    if (case_equal(name, "low")) return IO_PRIORITY_LOW;
+    if (case_equal(name, "normal")) return IO_PRIORITY_NORMAL;
+    if (case_equal(name, "high")) return IO_PRIORITY_HIGH;
+    fprintf(stderr, "警告: 未知 I/O 优先级 %s，可选 idle/low/normal/high。\n", name);
+    return IO_PRIORITY_UNSET;
+}
+
+/*
+ * 解析 "类别=值" 或 "值"（作用于全部类别），如 --priority dee=below、--affinity 0-7。
+ * 对选中的每个类别调用 apply。
+ */
+static void parse_schedule_option(const char *value, StageSchedule *schedules, const char *option,
+                                  void (*apply)(StageSchedule *, const char *)) {
+    const char *eq = strchr(value, '=');
+    if (!eq) {
+        for (int i = 0; i < TOOL_CLASS_COUNT; ++i) apply(&schedules[i], value);
+        return;
+    }
+    char name[32];
+    size_t len = (size_t)(eq - value);
+    if (len >= sizeof(name)) len = sizeof(name) - 1;
+    memcpy(name, value, len);
+    name[len] = '\0';
+    for (int i = 0; i < TOOL_CLASS_COUNT; ++i) {
+        if (case_equal(name, tool_class_names[i])) {
+            apply(&schedules[i], eq + 1);
+            return;
         }
+    }
+    fprintf(stderr, "警告: 选项 --%s 中的类别 %s 无效，可选 dee/python/mux/native。\n", option, name);
+}
 
-        printf("找到 deezy 输出的 EC3 文件: %s\n", deezy_ec3_path);
-        ensure_parent_directory(final_output_path);
+static void apply_affinity_value(StageSchedule *s, const char *v) { s->affinity = parse_core_set(v); }
+static void apply_priority_value(StageSchedule *s, const char *v) { s->priority = parse_priority_name(v); }
+static void apply_io_priority_value(StageSchedule *s, const char *v) { s->io_priority = parse_io_priority_name(v); }
+static void apply_threads_value(StageSchedule *s, const char *v) { s->max_threads = atoi(v); }
+static void apply_pool_value(StageSchedule *s, const char *v) { s->max_concurrent = atoi(v) > 0 ? atoi(v) : 1; }
+#endif
 
-        char ffmpeg_cmd[4096];
-        int ffmpeg_len = snprintf(ffmpeg_cmd, sizeof(ffmpeg_cmd),
-            "ffmpeg -y -i \"%s\" -c:a copy -movflags +faststart -f mp4 \"%s\"",
-            deezy_ec3_path, final_output_path);
-        if (ffmpeg_len < 0 || ffmpeg_len >= (int)sizeof(ffmpeg_cmd)) {
-            fprintf(stderr, "错误: 构建 ffmpeg 命令失败。\n");
-            if (interactive_mode) system("pause");
-            return 1;
+#define SCRATCH_MAX 8
+
+typedef enum {
+    PREFETCH_MODE_OFF = 0,
+    PREFETCH_MODE_CACHE,    /* 顺序预读到页缓存 */
+    PREFETCH_MODE_STAGE     /* 复制到本地临时盘 */
+} PrefetchMode;
+
+typedef struct {
+    int verify_enabled;     /* 编码完成后是否执行 QC 校验 */
+    int verify_threads;     /* 0 表示按 CPU 数量 */
+    int verify_choice;      /* --verify 独立模式下按哪个编码选项设定期望值 */
+    char verify_file[512];  /* --verify：仅校验已有文件 */
+    char qc_report[512];    /* --qc-report：报告输出路径 */
+    int resume_enabled;     /* 是否按任务日志跳过已完成且产物完好的阶段 */
+    unsigned formats;       /* --formats ec3,m4a,mlp：一次任务产出多种格式 */
+    StageSchedule schedule[TOOL_CLASS_COUNT];  /* --affinity/--priority/--io-priority/--threads */
+    int cpu_slots;          /* 多个任务并发时划分核心集的槽位数 */
+    char scratch_dirs[SCRATCH_MAX][512];  /* --scratch / DEE_SCRATCH：临时盘候选目录 */
+    int scratch_count;
+    int scratch_probe;      /* --scratch-probe：重新探测候选目录的读写吞吐 */
+    char publish_path[512]; /* --publish：交付目标（文件或目录） */
+    int publish_hash;       /* --publish-hash none 时跨卷拷贝走内核快路径，不计算校验和 */
+    int write_manifest;     /* --manifest：不移动文件，仅在输出旁写交付清单 */
+    char batch_file[512];   /* --batch：每行一个任务，按阶段跨任务调度 */
+    char sweep_file[512];   /* --sweep：参数矩阵，逐组合测量耗时与输出大小 */
+    char bitrate[16];       /* --bitrate：DDP 码率（kbps） */
+    int eta_only;           /* --eta：只按任务历史输出预计耗时，不执行编码 */
+    char watch_file[512];   /* --watch：监视文件夹配置，导出完成的母版自动入队 */
+    int prefetch_mode;      /* --prefetch off|cache|stage：批量模式下预取排队任务的输入 */
+    double prefetch_rate;   /* --prefetch-rate：预取限速（MB/s），0 表示不限速 */
+    char make_adm[512];     /* --make-adm：生成合成 ADM BWF 后退出 */
+    char adm_spec[512];     /* --adm-spec：声道布局、格式、时长与注入的缺陷 */
+    int calibrate;          /* --calibrate：逐级提高并发测量吞吐，保存本机的并发上限 */
+    int calibrate_max;      /* --calibrate-max：最高测到的并发数，0 表示按 CPU 数量 */
+    int calibrate_choice;   /* --calibrate-choice：校准用的编码选项 */
+    unsigned pool_explicit; /* 命令行 --pool 指定过的类别（位），校准结果不覆盖它们 */
+    int cmaf;               /* --cmaf：转封装改用内置的分片 MP4（CMAF）封装，不再调用 ffmpeg */
+    double fragment_seconds; /* --fragment-duration：CMAF 分片时长（秒） */
+    unsigned stream_manifests; /* --stream-manifest hls|dash|both：CMAF 输出旁生成的播放清单 */
+    char package_file[512]; /* --package：只把已有的 E-AC-3 基本流封装为 CMAF */
+    char edit_file[512];    /* --edit：在已有的 E-AC-3（或其 MP4）上补静音、裁切，不重新编码 */
+    char edit_spec[2048];   /* --edit-spec：start/end/prepend/append/output/silence */
+    char overview_file[512]; /* --overview：为 WAV 建立波形概览缓存（DolbyTemp\overview） */
+    char wrap_adm[512];     /* --wrap-adm：把普通多声道 WAV 床封装为 BW64 ADM 后退出 */
+    char wrap_output[512];  /* --wrap-output：封装结果路径，默认 <源文件名>_adm.wav */
+    int auto_adm;           /* --auto-adm on|off：dee 之前自动把普通 WAV 床封装为 ADM */
+    long long temp_quota;   /* --temp-quota / DEE_TEMP_QUOTA：DolbyTemp 总占用上限（字节），0 表示不限 */
+    double temp_keep_hours; /* --temp-keep：任务日志（断点续跑）的保留时长（小时） */
+    int temp_gc;            /* --temp-gc on|off：后台回收孤儿中间文件 */
+    int temp_report;        /* --temp-report：只报告 DolbyTemp 占用与可回收空间 */
+    int temp_collect;       /* --gc：立即回收一次后报告 */
+    int queue_level;        /* --queue-priority：单任务与批量任务的默认队列优先级 */
+    int preempt;            /* --preempt on|off：高优先级任务运行时暂停低优先级的子进程 */
+    int fair_share[QUEUE_LEVEL_COUNT];  /* --fair-share：被抢占时每个周期仍运行的百分比 */
+    char ranges_file[512];  /* --ranges：按片段列表把一个母版的多个时间段各导出一个文件 */
+    char record_file[512];  /* --record：把每个子进程的输出连同时间与退出码记录到文件 */
+    char replay_file[512];  /* --replay：按记录回放子进程输出，不调用 dee */
+    double replay_speed;    /* --replay-speed：回放倍速，0 为不等待 */
+    int replay_jobs;        /* --replay-jobs：同时回放的份数 */
+    int replay_probe;       /* --replay-probe：回放时穿插带发送时刻的探针行，供 GUI 计算端到端延迟 */
+    char xml_overrides[1024];  /* --set：任务 XML 覆盖，可重复，以 ; 连接 */
+} CliOptions;
+
+static CliOptions g_cli;
+
+#define OUTPUT_FORMAT_EC3 0x1u
+#define OUTPUT_FORMAT_M4A 0x2u
+#define OUTPUT_FORMAT_MLP 0x4u
+
+enum { CMAF_MANIFEST_HLS = 0x1, CMAF_MANIFEST_DASH = 0x2 };
+
+/* 大小：纯数字为字节，可带 K/M/G/T 后缀（1024 进位）；无效时返回 -1 */
+static long long parse_byte_size(const char *text) {
+    char *end = NULL;
+    double value = strtod(text ? text : "", &end);
+    if (!end || end == text || value < 0.0) return -1;
+    while (*end == ' ') ++end;
+    switch (toupper((unsigned char)*end)) {
+    case 'T': value *= 1024.0; /* fall through */
+    case 'G': value *= 1024.0; /* fall through */
+    case 'M': value *= 1024.0; /* fall through */
+    case 'K': value *= 1024.0; ++end; break;
+    case '\0': break;
+    default: return -1;
+    }
+    if (toupper((unsigned char)*end) == 'B') ++end;
+    return *end ? -1 : (long long)value;
+}
+
+static void init_cli_options(CliOptions *opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->verify_enabled = 1;
+    opts->resume_enabled = 1;
+    /* 批量模式的默认并发：dee 吃 CPU，deew/deezy 次之，ffmpeg 转封装几乎只有 I/O */
+    opts->schedule[TOOL_DEE].max_concurrent = 3;
+    opts->schedule[TOOL_PYTHON].max_concurrent = 2;
+    opts->schedule[TOOL_MUX].max_concurrent = 4;
+    opts->schedule[TOOL_NATIVE].max_concurrent = 2;
+    opts->cpu_slots = 0;
+    opts->publish_hash = 1;
+    /* 预取默认只读进缓存，限速在千兆网络带宽的一半左右 */
+    opts->prefetch_mode = PREFETCH_MODE_CACHE;
+    opts->prefetch_rate = 50.0;
+    opts->calibrate_choice = 1;
+    opts->fragment_seconds = 2.0;
+    opts->auto_adm = 1;
+    opts->temp_keep_hours = 24.0;
+    opts->temp_gc = 1;
+    opts->queue_level = QUEUE_NORMAL;
+    opts->preempt = 1;
+    opts->fair_share[QUEUE_BACKGROUND] = 10;
+    opts->fair_share[QUEUE_NORMAL] = 10;
+    opts->replay_speed = 1.0;
+    opts->replay_jobs = 1;
+    const char *env_quota = getenv("DEE_TEMP_QUOTA");
+    if (env_quota && *env_quota) opts->temp_quota = parse_byte_size(env_quota) > 0 ? parse_byte_size(env_quota) : 0;
+
+    /* DEE_SCRATCH 以分号分隔多个候选目录，--scratch 在此基础上追加 */
+    const char *env_scratch = getenv("DEE_SCRATCH");
+    if (env_scratch && *env_scratch) {
+        char buf[2048];
+        copy_string(buf, sizeof(buf), env_scratch);
+        for (char *item = strtok(buf, ";"); item && opts->scratch_count < SCRATCH_MAX; item = strtok(NULL, ";")) {
+            if (*item) copy_string(opts->scratch_dirs[opts->scratch_count++], sizeof(opts->scratch_dirs[0]), item);
         }
+    }
+}
 
-        printf("执行命令: %s\n", ffmpeg_cmd);
-        fflush(stdout);
-        int ffmpeg_code = system(ffmpeg_cmd);
-        if (ffmpeg_code != 0 || !file_exists(final_output_path)) {
-            fprintf(stderr, "ffmpeg 转封装失败 (exit=%d)，请检查 ffmpeg 是否在 PATH 中。\n", ffmpeg_code);
-            if (interactive_mode) system("pause");
-            return 1;
+#ifndef DEE_LIBRARY
+/* 解析 --stream-manifest：hls、dash、both 或 none */
+static unsigned parse_stream_manifests(const char *value) {
+    if (case_equal(value, "hls")) return CMAF_MANIFEST_HLS;
+    if (case_equal(value, "dash")) return CMAF_MANIFEST_DASH;
+    if (case_equal(value, "both") || case_equal(value, "all")) return CMAF_MANIFEST_HLS | CMAF_MANIFEST_DASH;
+    if (!case_equal(value, "none")) fprintf(stderr, "警告: 未知流媒体清单类型 %s（可用 hls、dash、both、none），已忽略。\n", value);
+    return 0;
+}
+
+/* 解析逗号分隔的格式列表，如 "ec3,m4a,mlp" */
+static unsigned parse_output_formats(const char *list) {
+    unsigned formats = 0;
+    char buf[128];
+    copy_string(buf, sizeof(buf), list);
+    for (char *item = strtok(buf, ",; "); item; item = strtok(NULL, ",; ")) {
+        if (case_equal(item, "ec3") || case_equal(item, "eac3") || case_equal(item, "ddp")) {
+            formats |= OUTPUT_FORMAT_EC3;
+        } else if (case_equal(item, "m4a") || case_equal(item, "mp4")) {
+            formats |= OUTPUT_FORMAT_M4A;
+        } else if (case_equal(item, "mlp") || case_equal(item, "thd") || case_equal(item, "truehd")) {
+            formats |= OUTPUT_FORMAT_MLP;
+        } else {
+            fprintf(stderr, "警告: 未知输出格式 %s，已忽略。\n", item);
         }
+    }
+    return formats;
+}
 
-        printf("已生成最终输出文件: %s\n", final_output_path);
+/* 解析 --fair-share：“百分比” 作用于 background 与 normal，“级别=百分比” 只改一级 */
+static void parse_fair_share(const char *value, int *shares) {
+    const char *eq = strchr(value, '=');
+    int percent = atoi(eq ? eq + 1 : value);
+    if (percent < 0) percent = 0;
+    if (percent > 100) percent = 100;
+    if (!eq) {
+        shares[QUEUE_BACKGROUND] = shares[QUEUE_NORMAL] = percent;
+        return;
+    }
+    char name[32];
+    size_t len = (size_t)(eq - value);
+    if (len >= sizeof(name)) len = sizeof(name) - 1;
+    memcpy(name, value, len);
+    name[len] = '\0';
+    int level = parse_queue_level(name);
+    if (level) shares[level] = percent;
+}
 
-        remove_file_if_exists(intermediate_mlp_path);
-        remove_file_if_exists(deezy_ec3_path);
-        remove_file_if_exists(inter_mll_path);
-        remove_file_if_exists(inter_log_path);
+/* 取出选项值：支持 --name=value 与 --name value 两种写法 */
+static const char *take_option_value(int argc, char *argv[], int *index, const char *inline_value) {
+    if (inline_value) return inline_value;
+    if (*index + 1 < argc) {
+        (*index)++;
+        return argv[*index];
     }
- 
-    if (interactive_mode) system("pause");
-    return exit_code;
+    fprintf(stderr, "警告: 选项 %s 缺少参数值。\n", argv[*index]);
+    return "";
 }
+
+/* 解析以 -- 开头的选项，其余参数按原顺序放入 positional（positional[0] 为程序名），返回位置参数个数 */
+static int parse_cli_options(int argc, char *argv[], CliOptions *opts, char **positional, int max_positional) {
+    int count = 0;
+    if (argc > 0 && count < max_positional) positional[count++] = argv[0];
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--", 2) != 0 || arg[2] == '\0') {
+            if (count < max_positional) positional[count++] = argv[i];
+            continue;
+        }
+        char name[64];
+        const char *inline_value = NULL;
+        const char *eq = strchr(arg + 2, '=');
+        size_t name_len = eq ? (size_t)(eq - (arg + 2)) : strlen(arg + 2);
+        if (name_len >= sizeof(name)) name_len = sizeof(name) - 1;
+        memcpy(name, arg + 2, name_len);
+        name[name_len] = '\0';
+        if (eq) inline_value = eq + 1;
+
+        if (strcmp(name, "verify") == 0) {
+            copy_string(opts->verify_file, sizeof(opts->verify_file), take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "no-verify") == 0) {
+            opts->verify_enabled = 0;
+        } else if (strcmp(name, "verify-threads") == 0) {
+            opts->verify_threads = atoi(take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "expect") == 0) {
+            opts->verify_choice = atoi(take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "qc-report") == 0) {
+            copy_string(opts->qc_report, sizeof(opts->qc_report), take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "no-resume") == 0) {
+            opts->resume_enabled = 0;
+        } else if (strcmp(name, "affinity") == 0) {
+            parse_schedule_option(take_option_value(argc, argv, &i, inline_value), opts->schedule, name, apply_affinity_value);
+        } else if (strcmp(name, "priority") == 0) {
+            parse_schedule_option(take_option_value(argc, argv, &i, inline_value), opts->schedule, name, apply_priority_value);
+        } else if (strcmp(name, "io-priority") == 0) {
+            parse_schedule_option(take_option_value(argc, argv, &i, inline_value), opts->schedule, name, apply_io_priority_value);
+        } else if (strcmp(name, "threads") == 0) {
+            parse_schedule_option(take_option_value(argc, argv, &i, inline_value), opts->schedule, name, apply_threads_value);
+        } else if (strcmp(name, "pool") == 0) {
+            /* 先清零再解析，解析后非零的类别即为本次指定的，其余恢复原值 */
+            int previous[TOOL_CLASS_COUNT];
+            for (int c = 0; c < TOOL_CLASS_COUNT; ++c) {
+                previous[c] = opts->schedule[c].max_concurrent;
+                opts->schedule[c].max_concurrent = 0;
+            }
+            parse_schedule_option(take_option_value(argc, argv, &i, inline_value), opts->schedule, name, apply_pool_value);
+            for (int c = 0; c < TOOL_CLASS_COUNT; ++c) {
+                if (opts->schedule[c].max_concurrent > 0) opts->pool_explicit |= 1u << c;
+                else opts->schedule[c].max_concurrent = previous[c];
+            }
+        } else if (strcmp(name, "ranges") == 0) {
+            copy_string(opts->ranges_file, sizeof(opts->ranges_file), take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "set") == 0) {
+            const char *item = take_option_value(argc, argv, &i, inline_value);
+            size_t len = strlen(opts->xml_overrides);
+            if (len + strlen(item) + 2 > sizeof(opts->xml_overrides)) {
+                fprintf(stderr, "警告: --set 总长度超出上限，已忽略 %s。\n", item);
+            } else if (item[0]) {
+                snprintf(opts->xml_overrides + len, sizeof(opts->xml_overrides) - len, "%s%s", len ? ";" : "", item);
+            }
+        } else if (strcmp(name, "record") == 0) {
+            copy_string(opts->record_file, sizeof(opts->record_file), take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "replay") == 0) {
+            copy_string(opts->replay_file, sizeof(opts->replay_file), take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "replay-speed") == 0) {
+            double speed = atof(take_option_value(argc, argv, &i, inline_value));
+            if (speed >= 0.0) opts->replay_speed = speed;
+            else fprintf(stderr, "警告: --replay-speed 不能为负，保持 %.2f。\n", opts->replay_speed);
+        } else if (strcmp(name, "replay-jobs") == 0) {
+            opts->replay_jobs = atoi(take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "replay-probe") == 0) {
+            opts->replay_probe = 1;
+        } else if (strcmp(name, "batch") == 0) {
+            copy_string(opts->batch_file, sizeof(opts->batch_file), take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "make-adm") == 0) {
+            copy_string(opts->make_adm, sizeof(opts->make_adm), take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "adm-spec") == 0) {
+            copy_string(opts->adm_spec, sizeof(opts->adm_spec), take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "prefetch") == 0) {
+            const char *mode = take_option_value(argc, argv, &i, inline_value);
+            if (case_equal(mode, "off") || case_equal(mode, "none")) opts->prefetch_mode = PREFETCH_MODE_OFF;
+            else if (case_equal(mode, "cache")) opts->prefetch_mode = PREFETCH_MODE_CACHE;
+            else if (case_equal(mode, "stage") || case_equal(mode, "copy")) opts->prefetch_mode = PREFETCH_MODE_STAGE;
+            else fprintf(stderr, "警告: 未知预取模式 %s（可用 off、cache、stage），已忽略。\n", mode);
+        } else if (strcmp(name, "prefetch-rate") == 0) {
+            opts->prefetch_rate = atof(take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "watch") == 0) {
+            copy_string(opts->watch_file, sizeof(opts->watch_file), take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "sweep") == 0) {
+            copy_string(opts->sweep_file, sizeof(opts->sweep_file), take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "bitrate") == 0) {
+            copy_string(opts->bitrate, sizeof(opts->bitrate), take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "scratch") == 0) {
+            const char *dir = take_option_value(argc, argv, &i, inline_value);
+            if (*dir && opts->scratch_count < SCRATCH_MAX) {
+                copy_string(opts->scratch_dirs[opts->scratch_count++], sizeof(opts->scratch_dirs[0]), dir);
+            }
+        } else if (strcmp(name, "publish") == 0) {
+            copy_string(opts->publish_path, sizeof(opts->publish_path), take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "publish-hash") == 0) {
+            opts->publish_hash = !case_equal(take_option_value(argc, argv, &i, inline_value), "none");
+        } else if (strcmp(name, "manifest") == 0) {
+            opts->write_manifest = 1;
+        } else if (strcmp(name, "scratch-probe") == 0) {
+            opts->scratch_probe = 1;
+        } else if (strcmp(name, "eta") == 0) {
+            opts->eta_only = 1;
+        } else if (strcmp(name, "calibrate") == 0) {
+            opts->calibrate = 1;
+        } else if (strcmp(name, "calibrate-max") == 0) {
+            opts->calibrate_max = atoi(take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "calibrate-choice") == 0) {
+            opts->calibrate_choice = atoi(take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "cmaf") == 0) {
+            opts->cmaf = 1;
+        } else if (strcmp(name, "fragment-duration") == 0) {
+            double seconds = atof(take_option_value(argc, argv, &i, inline_value));
+            if (seconds > 0.0) opts->fragment_seconds = seconds;
+            else fprintf(stderr, "警告: --fragment-duration 必须大于 0，保持 %.2f 秒。\n", opts->fragment_seconds);
+        } else if (strcmp(name, "stream-manifest") == 0) {
+            opts->stream_manifests = parse_stream_manifests(take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "edit") == 0) {
+            copy_string(opts->edit_file, sizeof(opts->edit_file), take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "edit-spec") == 0) {
+            copy_string(opts->edit_spec, sizeof(opts->edit_spec), take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "overview") == 0) {
+            copy_string(opts->overview_file, sizeof(opts->overview_file), take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "wrap-adm") == 0) {
+            copy_string(opts->wrap_adm, sizeof(opts->wrap_adm), take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "wrap-output") == 0) {
+            copy_string(opts->wrap_output, sizeof(opts->wrap_output), take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "auto-adm") == 0) {
+            opts->auto_adm = !case_equal(take_option_value(argc, argv, &i, inline_value), "off");
+        } else if (strcmp(name, "temp-quota") == 0) {
+            const char *value = take_option_value(argc, argv, &i, inline_value);
+            long long quota = parse_byte_size(value);
+            if (quota >= 0) opts->temp_quota = quota;
+            else fprintf(stderr, "警告: 无效的 --temp-quota %s（例如 200G），已忽略。\n", value);
+        } else if (strcmp(name, "temp-keep") == 0) {
+            double hours = atof(take_option_value(argc, argv, &i, inline_value));
+            if (hours > 0.0) opts->temp_keep_hours = hours;
+            else fprintf(stderr, "警告: --temp-keep 必须大于 0，保持 %.0f 小时。\n", opts->temp_keep_hours);
+        } else if (strcmp(name, "temp-gc") == 0) {
+            opts->temp_gc = !case_equal(take_option_value(argc, argv, &i, inline_value), "off");
+        } else if (strcmp(name, "temp-report") == 0) {
+            opts->temp_report = 1;
+        } else if (strcmp(name, "gc") == 0) {
+            opts->temp_collect = 1;
+        } else if (strcmp(name, "queue-priority") == 0) {
+            int level = parse_queue_level(take_option_value(argc, argv, &i, inline_value));
+            if (level) opts->queue_level = level;
+        } else if (strcmp(name, "preempt") == 0) {
+            opts->preempt = !case_equal(take_option_value(argc, argv, &i, inline_value), "off");
+        } else if (strcmp(name, "fair-share") == 0) {
+            parse_fair_share(take_option_value(argc, argv, &i, inline_value), opts->fair_share);
+        } else if (strcmp(name, "package") == 0) {
+            copy_string(opts->package_file, sizeof(opts->package_file), take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "cpu-slots") == 0) {
+            opts->cpu_slots = atoi(take_option_value(argc, argv, &i, inline_value));
+        } else if (strcmp(name, "formats") == 0) {
+            opts->formats = parse_output_formats(take_option_value(argc, argv, &i, inline_value));
+        } else {
+            fprintf(stderr, "警告: 未知选项 --%s，已忽略。\n", name);
+        }
+    }
+    return count;
+}
+#endif
+// --------- 命令行选项结束 ---------
+
+// --------- 阶段调度：并发任务的核心集分槽、优先级与线程上限 ---------
+#define CPU_SLOT_MAX 16
+
+/* 每个 encode 进程在 DolbyTemp\slots 下锁定一个槽位文件，进程退出时锁随之释放 */
+static int g_cpu_slot = -1;
+static int g_cpu_slot_count = 0;
+static char g_cpu_slot_dir[1024];
+#ifdef _WIN32
+static HANDLE g_cpu_slot_handle = INVALID_HANDLE_VALUE;
+#else
+static int g_cpu_slot_fd = -1;
+#endif
+
+static void cpu_slot_path(int index, char *out, size_t out_size) {
+    char name[32];
+    snprintf(name, sizeof(name), "slot%02d.lock", index);
+    build_path(out, out_size, g_cpu_slot_dir, name);
+}
+
+/* 尝试独占锁定槽位；keep 为 0 时只探测，随即释放。返回 1 表示锁定成功（即槽位空闲） */
+static int cpu_slot_try_lock(int index, int keep) {
+    char path[1100];
+    cpu_slot_path(index, path, sizeof(path));
+#ifdef _WIN32
+    HANDLE h = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                           NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE) return 0;
+    OVERLAPPED ov;
+    ZeroMemory(&ov, sizeof(ov));
+    if (!LockFileEx(h, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, 1, 0, &ov)) {
+        CloseHandle(h);
+        return 0;
+    }
+    if (keep) {
+        g_cpu_slot_handle = h;
+    } else {
+        UnlockFileEx(h, 0, 1, 0, &ov);
+        CloseHandle(h);
+    }
+#else
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return 0;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        close(fd);
+        return 0;
+    }
+    if (keep) {
+        g_cpu_slot_fd = fd;
+    } else {
+        flock(fd, LOCK_UN);
+        close(fd);
+    }
+#endif
+    return 1;
+}
+
+static void cpu_slot_acquire(const char *temp_dir) {
+    int cpus = cpu_count();
+    g_cpu_slot_count = g_cli.cpu_slots > 0 ? g_cli.cpu_slots : cpus / 2;
+    if (g_cpu_slot_count < 1) g_cpu_slot_count = 1;
+    if (g_cpu_slot_count > CPU_SLOT_MAX) g_cpu_slot_count = CPU_SLOT_MAX;
+    build_path(g_cpu_slot_dir, sizeof(g_cpu_slot_dir), temp_dir, "slots");
+    ensure_directory_exists(g_cpu_slot_dir);
+    for (int i = 0; i < g_cpu_slot_count; ++i) {
+        if (cpu_slot_try_lock(i, 1)) {
+            g_cpu_slot = i;
+            return;
+        }
+    }
+    /* 槽位已满：不再绑核，与其他任务共享全部核心 */
+    g_cpu_slot = -1;
+}
+
+/* 库调用在同一进程内反复运行任务：任务结束即释放槽位，空闲的宿主进程不占核心份额 */
+static void cpu_slot_release(void) {
+#ifdef _WIN32
+    if (g_cpu_slot_handle != INVALID_HANDLE_VALUE) {
+        CloseHandle(g_cpu_slot_handle);
+        g_cpu_slot_handle = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (g_cpu_slot_fd >= 0) {
+        flock(g_cpu_slot_fd, LOCK_UN);
+        close(g_cpu_slot_fd);
+        g_cpu_slot_fd = -1;
+    }
+#endif
+    g_cpu_slot = -1;
+}
+
+static unsigned long long core_range_mask(int begin, int end) {
+    unsigned long long mask = 0;
+    for (int c = begin; c < end && c < 64; ++c) mask |= 1ULL << c;
+    return mask;
+}
+
+/*
+ * 默认核心集：按当前仍在运行的任务数把核心均分，本任务取自己排名对应的一段；
+ * 同一任务内并行的多个 pass（part/parts）再在这一段内细分。只有一个任务且无并行 pass 时不绑核。
+ */
+static unsigned long long cpu_slot_default_affinity(int part, int parts) {
+    int cpus = cpu_count();
+    int active = 1;
+    int rank = 0;
+    if (cpus > 64) cpus = 64;
+    if (g_cpu_slot >= 0) {
+        active = 0;
+        for (int i = 0; i < g_cpu_slot_count; ++i) {
+            if (i == g_cpu_slot) {
+                rank = active++;
+            } else if (!cpu_slot_try_lock(i, 0)) {
+                active++;
+            }
+        }
+    }
+    if (active <= 1 && parts <= 1) return 0;
+    int begin = rank * cpus / active;
+    int end = (rank + 1) * cpus / active;
+    if (parts > 1 && end - begin >= parts) {
+        int span = end - begin;
+        int sub_begin = begin + part * span / parts;
+        end = begin + (part + 1) * span / parts;
+        begin = sub_begin;
+    }
+    return end > begin ? core_range_mask(begin, end) : 0;
+}
+
+/* 取某类工具的调度参数；未显式指定核心集时使用分槽得到的默认值 */
+static void resolve_stage_schedule(ToolClass tool, int part, int parts, StageSchedule *out) {
+    *out = g_cli.schedule[tool];
+    if (!out->affinity) out->affinity = cpu_slot_default_affinity(part, parts);
+}
+
+static void format_core_set(unsigned long long mask, char *out, size_t out_size) {
+    size_t len = 0;
+    out[0] = '\0';
+    for (int c = 0; c < 64 && len + 8 < out_size; ) {
+        if (!(mask & (1ULL << c))) {
+            c++;
+            continue;
+        }
+        int last = c;
+        while (last + 1 < 64 && (mask & (1ULL << (last + 1)))) last++;
+        if (last > c) len += (size_t)snprintf(out + len, out_size - len, "%s%d-%d", len ? "," : "", c, last);
+        else len += (size_t)snprintf(out + len, out_size - len, "%s%d", len ? "," : "", c);
+        c = last + 1;
+    }
+}
+
+/* QC 校验线程数：--verify-threads 优先，其次 --threads native=N，都未设置时按 CPU 数量 */
+static int qc_thread_budget(void) {
+    if (g_cli.verify_threads > 0) return g_cli.verify_threads;
+    return g_cli.schedule[TOOL_NATIVE].max_threads;
+}
+
+#ifdef _WIN32
+typedef LONG (WINAPI *NtSetInformationProcessFn)(HANDLE, int, PVOID, ULONG);
+
+/* 在挂起的子进程恢复执行前应用调度参数；亲和性与优先级类会被其后代继承 */
+static void apply_stage_schedule(HANDLE process, const StageSchedule *schedule) {
+    if (schedule->affinity) {
+        DWORD_PTR process_mask = 0;
+        DWORD_PTR system_mask = 0;
+        GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask);
+        DWORD_PTR mask = (DWORD_PTR)schedule->affinity & system_mask;
+        if (mask && !SetProcessAffinityMask(process, mask)) {
+            fprintf(stderr, "警告: 设置 CPU 亲和性失败 (error=%lu)\n", (unsigned long)GetLastError());
+        }
+    }
+    if (schedule->priority) {
+        static const DWORD classes[] = {0, IDLE_PRIORITY_CLASS, BELOW_NORMAL_PRIORITY_CLASS, NORMAL_PRIORITY_CLASS,
+                                        ABOVE_NORMAL_PRIORITY_CLASS, HIGH_PRIORITY_CLASS};
+        SetPriorityClass(process, classes[schedule->priority]);
+    }
+    if (schedule->io_priority) {
+        /* ProcessIoPriority（33）：0 very low、1 low、2 normal、3 high；仅 ntdll 提供 */
+        NtSetInformationProcessFn set_info = (NtSetInformationProcessFn)(void *)GetProcAddress(
+            GetModuleHandleA("ntdll.dll"), "NtSetInformationProcess");
+        ULONG io = (ULONG)(schedule->io_priority - IO_PRIORITY_IDLE);
+        if (set_info) set_info(process, 33, &io, sizeof(io));
+    }
+}
+#else
+/*
+ * 在 fork 之后、exec 之前于子进程内应用；亲和性、nice 与 I/O 优先级都会被后代继承。
+ * 多线程进程 fork 出的子进程里只能做异步信号安全的调用，这里只有系统调用；线程上限由父进程放进 envp。
+ */
+static void apply_stage_schedule(const StageSchedule *schedule) {
+#ifdef __linux__
+    if (schedule->affinity) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int c = 0; c < 64; ++c) {
+            if (schedule->affinity & (1ULL << c)) CPU_SET(c, &set);
+        }
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+    if (schedule->io_priority) {
+        /* ioprio：class 3 为 idle，class 2（best-effort）数据 0 最高、7 最低 */
+        static const int io_values[] = {0, (3 << 13), (2 << 13) | 7, (2 << 13) | 4, (2 << 13) | 0};
+        syscall(SYS_ioprio_set, 1, 0, io_values[schedule->io_priority]);
+    }
+#endif
+    if (schedule->priority) {
+        static const int nice_values[] = {0, 19, 10, 0, -5, -10};
+        setpriority(PRIO_PROCESS, 0, nice_values[schedule->priority]);
+    }
+}
+#endif
+// --------- 阶段调度结束 ---------
+
+// --------- 子进程：启动、等待与输出转发 ---------
+#define CHILD_MAX_RELAYS 8
+
+/* 子进程（含其后代）的资源消耗，供 --sweep 对比不同参数组合 */
+typedef struct {
+    double cpu_seconds;          /* 用户态 + 内核态 */
+    long long peak_memory;       /* 单个进程的峰值内存（字节） */
+    int processes;
+} ResourceUsage;
+
+typedef struct {
+#ifdef _WIN32
+    HANDLE process;
+    HANDLE out_read;
+    HANDLE accounting;       /* 仅用于统计资源的嵌套作业对象 */
+#else
+    pid_t pid;
+    int out_read;
+#endif
+    const char *label;       /* 非空时捕获输出并加前缀转发；为空时直接继承控制台 */
+    double progress;
+    int relaying;
+    worker_thread_t relay;
+    int reaped;              /* POSIX：取消时已在 teardown 中回收 */
+    int status;
+    ResourceUsage *usage;    /* 非空时在结束后累加资源消耗 */
+    int queue_level;         /* QUEUE_*，见队列优先级一节；以下两项在 g_console_lock 下读写 */
+    int preempted;           /* 有更高优先级的工作在运行，处于被抢占期间 */
+    int suspended;           /* 进程树当前已暂停（被抢占期间按 --fair-share 周期性继续） */
+    int trace_id;            /* --record 记录中的编号 */
+} ChildProc;
+
+/* 取消后的退出码，与 shell 中 Ctrl+C 的约定一致 */
+#define EXIT_CANCELLED 130
+/* 取消时给子进程树的宽限时间，超时后强制结束 */
+#define CANCEL_GRACE_SECONDS 3.0
+/* 同时存活的子进程上限：远高于各类 --pool 默认值之和；占满时拒绝再启动，保证每个子进程都能被暂停与结束 */
+#define CHILD_MAX_LIVE 64
+
+static volatile sig_atomic_t g_cancel_requested = 0;
+static int g_teardown_started = 0;
+static volatile int g_teardown_done = 0;
+static int g_stdin_watch_active = 0;
+static ChildProc *g_live_procs[CHILD_MAX_LIVE];
+static int g_live_count = 0;
+static int g_live_reserved = 0;   /* 已预留槽位、正在启动的子进程数 */
+#ifdef _WIN32
+static HANDLE g_job_object = NULL;
+#endif
+
+static worker_mutex_t g_console_lock;
+static worker_mutex_t g_space_lock;     /* DolbyTemp 回收，见空间管理一节 */
+static worker_mutex_t g_spawn_lock;     /* 子进程启动：管道创建到子进程建立，见 spawn_lock */
+static int g_console_lock_ready = 0;
+/* 批量模式下由调度器汇总输出 “Overall progress:”，转发线程只记录各进程的进度 */
+static int g_batch_mode = 0;
+static ChildProc *g_relay_procs[CHILD_MAX_RELAYS];
+static int g_relay_count = 0;
+/* 库调用（encode.h）注册的事件回调：子进程输出与 job_note/job_warn 的提示不再写控制台，逐行交给回调；命令行下为空 */
+static DeeEventCallback g_event_callback = NULL;
+static void *g_event_user = NULL;
+
+static void emit_event(DeeEventType type, const char *text, double value, const double *stage_seconds) {
+    if (!g_event_callback) return;
+    DeeEvent event;
+    event.type = type;
+    event.text = text;
+    event.value = value;
+    event.stage_seconds = stage_seconds;
+    g_event_callback(&event, g_event_user);
+}
+
+/*
+ * encode.c 自身的提示（job_note，对应 stdout）与警告（job_warn，对应 stderr）。库调用时宿主进程的控制台
+ * 不属于我们，按行经 DEE_EVENT_LOG 交给回调，与子进程输出走同一路径；命令行下照常写控制台并立即刷新。
+ */
+static void job_vnote(FILE *stream, const char *fmt, va_list args) {
+    if (!g_event_callback) {
+        vfprintf(stream, fmt, args);
+        fflush(stream);
+        return;
+    }
+    char text[4096];
+    vsnprintf(text, sizeof(text), fmt, args);
+    char *line = text;
+    while (*line) {
+        char *end = strchr(line, '\n');
+        if (end) *end = '\0';
+        size_t len = strlen(line);
+        while (len > 0 && line[len - 1] == '\r') line[--len] = '\0';
+        if (line[0]) emit_event(DEE_EVENT_LOG, line, 0.0, NULL);
+        if (!end) break;
+        line = end + 1;
+    }
+}
+
+static void job_note(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    job_vnote(stdout, fmt, args);
+    va_end(args);
+}
+
+static void job_warn(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    job_vnote(stderr, fmt, args);
+    va_end(args);
+}
+
+static void console_lock_init(void) {
+    if (!g_console_lock_ready) {
+        worker_mutex_init(&g_console_lock);
+        worker_mutex_init(&g_space_lock);
+        worker_mutex_init(&g_spawn_lock);
+        g_console_lock_ready = 1;
+    }
+}
+
+/*
+ * 子进程的输出管道在创建后、子进程建立前可被继承。此时其他线程启动的子进程会带走一份写端，
+ * 转发线程就要等那个无关的子进程退出才读到 EOF。Linux 用 pipe2(O_CLOEXEC) 原子创建，不需要加锁；
+ * 其他平台（Windows 的可继承句柄、没有 pipe2 的 POSIX）把创建管道到 fork/CreateProcess 的整段串行化。
+ */
+static void spawn_lock(void) {
+#ifndef __linux__
+    worker_mutex_lock(&g_spawn_lock);
+#endif
+}
+
+static void spawn_unlock(void) {
+#ifndef __linux__
+    worker_mutex_unlock(&g_spawn_lock);
+#endif
+}
+/*
+ * --record：记录每个子进程的输出。记录文件为 UTF-8 文本，每行一条记录，字段以 Tab 分隔，时间为相对记录开始的毫秒数：
+ *   S  毫秒  编号  前缀  命令行        子进程启动（前缀为批量模式的任务名，单任务为空）
+ *   O  毫秒  编号  输出行              子进程的一行输出（stdout 与 stderr 共用一条管道，保留原有交错顺序）
+ *   X  毫秒  编号  退出码              子进程结束
+ * 回放见 “子进程输出回放” 一节。
+ */
+#define TRACE_MAGIC "# dee-trace 1"
+
+static FILE *g_trace_file = NULL;
+static double g_trace_started = 0.0;
+static double g_trace_flushed = 0.0;
+static int g_trace_next_id = 0;
+
+#ifndef DEE_LIBRARY
+static void trace_open(const char *path) {
+    ensure_parent_directory(path);
+    g_trace_file = fopen(path, "w");
+    if (!g_trace_file) {
+        fprintf(stderr, "警告: 无法创建输出记录文件 %s，本次不记录。\n", path);
+        return;
+    }
+    console_lock_init();
+    g_trace_started = monotonic_seconds();
+    g_trace_flushed = g_trace_started;
+    fprintf(g_trace_file, TRACE_MAGIC "\tstarted=%lld\n", (long long)time(NULL));
+    fflush(g_trace_file);
+}
+#endif
+
+/* 调用方持有 g_console_lock；启动与结束记录立即落盘，输出行最多缓冲 1 秒 */
+static void trace_write(char kind, int id, const char *a, const char *b, int flush) {
+    double now = monotonic_seconds();
+    fprintf(g_trace_file, "%c\t%lld\t%d\t%s", kind, (long long)((now - g_trace_started) * 1000.0), id, a);
+    if (b) fprintf(g_trace_file, "\t%s", b);
+    fputc('\n', g_trace_file);
+    if (flush || now - g_trace_flushed >= 1.0) {
+        fflush(g_trace_file);
+        g_trace_flushed = now;
+    }
+}
+
+static void trace_child_start(ChildProc *proc, const char *label, const char *command) {
+    if (!g_trace_file) return;
+    worker_mutex_lock(&g_console_lock);
+    proc->trace_id = ++g_trace_next_id;
+    trace_write('S', proc->trace_id, label ? label : "", command, 1);
+    worker_mutex_unlock(&g_console_lock);
+}
+
+static void trace_child_line(const ChildProc *proc, const char *line) {
+    if (!g_trace_file || !line[0]) return;
+    worker_mutex_lock(&g_console_lock);
+    trace_write('O', proc->trace_id, line, NULL, 0);
+    worker_mutex_unlock(&g_console_lock);
+}
+
+static void trace_child_exit(const ChildProc *proc, int exit_code) {
+    char code[16];
+    if (!g_trace_file) return;
+    snprintf(code, sizeof(code), "%d", exit_code);
+    worker_mutex_lock(&g_console_lock);
+    trace_write('X', proc->trace_id, code, NULL, 1);
+    worker_mutex_unlock(&g_console_lock);
+}
+
+/* 并行的多个 dee 各自报告进度，GUI 只认一条 “Overall progress:”，这里合并为平均值 */
+static void relay_emit_line(ChildProc *proc, const char *line) {
+    const char *tag = strstr(line, "Overall progress:");
+    trace_child_line(proc, line);
+    worker_mutex_lock(&g_console_lock);
+    if (tag && g_batch_mode) {
+        proc->progress = atof(tag + strlen("Overall progress:"));
+    } else if (tag) {
+        proc->progress = atof(tag + strlen("Overall progress:"));
+        double sum = 0.0;
+        for (int i = 0; i < g_relay_count; ++i) sum += g_relay_procs[i]->progress;
+        double progress = g_relay_count > 0 ? sum / g_relay_count : proc->progress;
+        if (g_event_callback) emit_event(DEE_EVENT_PROGRESS, NULL, progress, NULL);
+        else printf("Overall progress: %.1f\n", progress);
+    } else if (line[0] && g_event_callback) {
+        emit_event(DEE_EVENT_LOG, line, 0.0, NULL);
+    } else if (line[0] && proc->label[0]) {
+        printf("[%s] %s\n", proc->label, line);
+    } else if (line[0]) {
+        printf("%s\n", line);
+    }
+    fflush(stdout);
+    worker_mutex_unlock(&g_console_lock);
+}
+
+static void relay_worker(void *arg) {
+    ChildProc *proc = (ChildProc *)arg;
+    char chunk[4096];
+    char line[4096];
+    size_t line_len = 0;
+    for (;;) {
+#ifdef _WIN32
+        DWORD got = 0;
+        if (!ReadFile(proc->out_read, chunk, sizeof(chunk), &got, NULL) || got == 0) break;
+#else
+        ssize_t got = read(proc->out_read, chunk, sizeof(chunk));
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) break;
+#endif
+        for (size_t i = 0; i < (size_t)got; ++i) {
+            char c = chunk[i];
+            if (c == '\n' || c == '\r' || line_len + 1 >= sizeof(line)) {
+                line[line_len] = '\0';
+                relay_emit_line(proc, line);
+                line_len = 0;
+                if (c == '\n' || c == '\r') continue;
+            }
+            line[line_len++] = c;
+        }
+    }
+    if (line_len > 0) {
+        line[line_len] = '\0';
+        relay_emit_line(proc, line);
+    }
+}
+
+static void relay_register(ChildProc *proc) {
+    worker_mutex_lock(&g_console_lock);
+    if (!g_batch_mode && g_relay_count < CHILD_MAX_RELAYS) g_relay_procs[g_relay_count++] = proc;
+    worker_mutex_unlock(&g_console_lock);
+}
+
+/* 一组并行进程全部结束后清空登记；先结束的进程按 100% 继续参与平均，进度不会回退 */
+static void relay_reset(void) {
+    worker_mutex_lock(&g_console_lock);
+    g_relay_count = 0;
+    worker_mutex_unlock(&g_console_lock);
+}
+
+static int cancel_requested(void) {
+    return g_cancel_requested != 0;
+}
+
+/* 启动前预留一个槽位，之后 live_register 必定成功；已满返回 0 */
+static int live_reserve(void) {
+    int ok = 0;
+    worker_mutex_lock(&g_console_lock);
+    if (g_live_count + g_live_reserved < CHILD_MAX_LIVE) {
+        g_live_reserved++;
+        ok = 1;
+    }
+    worker_mutex_unlock(&g_console_lock);
+    return ok;
+}
+
+static void live_release(void) {
+    worker_mutex_lock(&g_console_lock);
+    if (g_live_reserved > 0) g_live_reserved--;
+    worker_mutex_unlock(&g_console_lock);
+}
+
+/* 占用 live_reserve 预留的槽位 */
+static void live_register(ChildProc *proc) {
+    worker_mutex_lock(&g_console_lock);
+    if (g_live_reserved > 0) g_live_reserved--;
+    g_live_procs[g_live_count++] = proc;
+    worker_mutex_unlock(&g_console_lock);
+}
+
+static void live_unregister(ChildProc *proc) {
+    worker_mutex_lock(&g_console_lock);
+    for (int i = 0; i < g_live_count; ++i) {
+        if (g_live_procs[i] == proc) {
+            g_live_procs[i] = g_live_procs[--g_live_count];
+            break;
+        }
+    }
+    worker_mutex_unlock(&g_console_lock);
+}
+
+#ifndef _WIN32
+static void sleep_milliseconds(int ms) {
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
+/* 进程组中已无任何进程（含 deew/python 等孙进程） */
+static int process_group_gone(ChildProc *proc) {
+    if (proc->pid <= 0) return 1;
+    if (!proc->reaped) {
+        int status = 0;
+        if (waitpid(proc->pid, &status, WNOHANG) == proc->pid) {
+            proc->reaped = 1;
+            proc->status = status;
+        } else {
+            return 0;
+        }
+    }
+    return kill(-proc->pid, 0) != 0 && errno == ESRCH;
+}
+#endif
+
+/*
+ * 结束全部子进程树：Windows 下整个作业对象一次终止；POSIX 下先向各进程组发 SIGTERM，
+ * 宽限期内未退出的再 SIGKILL，总耗时有上限。
+ */
+static void terminate_live_children(void) {
+    worker_mutex_lock(&g_console_lock);
+    /* 批量模式下多个等待线程可能同时发现取消，只由第一个执行拆除 */
+    if (g_teardown_started) {
+        worker_mutex_unlock(&g_console_lock);
+        return;
+    }
+    g_teardown_started = 1;
+    int count = g_live_count;
+    ChildProc *procs[CHILD_MAX_LIVE];
+    memcpy(procs, g_live_procs, sizeof(ChildProc *) * (size_t)count);
+    worker_mutex_unlock(&g_console_lock);
+
+    job_note("收到取消请求，正在结束 %d 个子进程...\n", count);
+#ifdef _WIN32
+    if (g_job_object) {
+        TerminateJobObject(g_job_object, EXIT_CANCELLED);
+    } else {
+        for (int i = 0; i < count; ++i) TerminateProcess(procs[i]->process, EXIT_CANCELLED);
+    }
+#else
+    for (int i = 0; i < count; ++i) {
+        if (procs[i]->pid <= 0) continue;
+        kill(-procs[i]->pid, SIGTERM);
+        /* 被抢占暂停的进程组要先继续运行，才会处理 SIGTERM */
+        kill(-procs[i]->pid, SIGCONT);
+    }
+    double deadline = monotonic_seconds() + CANCEL_GRACE_SECONDS;
+    for (;;) {
+        int remaining = 0;
+        for (int i = 0; i < count; ++i) {
+            if (!process_group_gone(procs[i])) remaining++;
+        }
+        if (remaining == 0) break;
+        if (monotonic_seconds() >= deadline) {
+            job_warn("警告: %d 个进程组在 %.0f 秒内未退出，强制结束。\n", remaining, CANCEL_GRACE_SECONDS);
+            for (int i = 0; i < count; ++i) {
+                if (!process_group_gone(procs[i])) kill(-procs[i]->pid, SIGKILL);
+            }
+            break;
+        }
+        sleep_milliseconds(50);
+    }
+#endif
+    g_teardown_done = 1;
+}
+
+/*
+ * 安装取消处理：Windows 下所有子进程放入同一个作业对象（encode.exe 意外退出时随句柄关闭一并结束），
+ * POSIX 下每个子进程独立成组，SIGINT/SIGTERM/SIGHUP 只置位取消标志，由等待循环负责拆除。
+ */
+static void cancel_state_init(void) {
+    console_lock_init();
+#ifdef _WIN32
+    if (g_job_object) return;
+    g_job_object = CreateJobObjectA(NULL, NULL);
+    if (g_job_object) {
+        JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits;
+        ZeroMemory(&limits, sizeof(limits));
+        limits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+        SetInformationJobObject(g_job_object, JobObjectExtendedLimitInformation, &limits, sizeof(limits));
+    }
+#endif
+}
+
+#ifndef DEE_LIBRARY
+#ifdef _WIN32
+static BOOL WINAPI console_cancel_handler(DWORD ctrl_type) {
+    g_cancel_requested = 1;
+    if (ctrl_type == CTRL_C_EVENT || ctrl_type == CTRL_BREAK_EVENT) return TRUE;
+    /* 控制台关闭/注销时进程即将被系统结束，来不及协作，直接终止作业对象 */
+    if (g_job_object) TerminateJobObject(g_job_object, EXIT_CANCELLED);
+    return FALSE;
+}
+#else
+static void posix_cancel_handler(int sig) {
+    (void)sig;
+    g_cancel_requested = 1;
+}
+#endif
+
+/* 从 stdin 接收 “cancel” 指令（GUI 通过管道发送），EOF 时退出 */
+static void stdin_cancel_watcher(void *arg) {
+    (void)arg;
+    char line[256];
+    while (fgets(line, sizeof(line), stdin)) {
+        trim_newline(line);
+        if (strcmp(line, "cancel") == 0) {
+            g_cancel_requested = 1;
+            break;
+        }
+    }
+}
+
+static void install_cancel_handlers(int watch_stdin) {
+    cancel_state_init();
+#ifdef _WIN32
+    SetConsoleCtrlHandler(console_cancel_handler, TRUE);
+#else
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = posix_cancel_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+#endif
+    if (watch_stdin) {
+        worker_thread_t watcher;
+        if (worker_start(&watcher, stdin_cancel_watcher, NULL)) g_stdin_watch_active = 1;
+    }
+}
+#endif
+
+#ifdef _WIN32
+/* 环境块条目的变量名与 name 比较，按系统的排序规则转大写后比较 */
+static int env_name_compare(const char *entry, const char *name) {
+    const char *a = entry;
+    while (*a && *a != '=' && *name) {
+        int ca = toupper((unsigned char)*a), cb = toupper((unsigned char)*name);
+        if (ca != cb) return ca - cb;
+        ++a;
+        ++name;
+    }
+    if ((*a == '=' || !*a) && !*name) return 0;
+    return (*a == '=' || !*a) ? -1 : 1;
+}
+
+/*
+ * 为子进程构造独立的环境块：复制本进程环境并把 OMP_NUM_THREADS 换成线程上限，按名称有序插入。
+ * 不改动本进程环境（库调用时属于宿主进程，且多个工作线程可能同时启动子进程）。返回值需 free。
+ */
+static char *child_environment_with_threads(int max_threads) {
+    static const char name[] = "OMP_NUM_THREADS";
+    char entry[48];
+    int entry_len = snprintf(entry, sizeof(entry), "%s=%d", name, max_threads);
+    char *source = GetEnvironmentStringsA();
+    if (!source) return NULL;
+    size_t total = 0;
+    for (const char *p = source; *p; p += strlen(p) + 1) total += strlen(p) + 1;
+    char *block = (char *)malloc(total + (size_t)entry_len + 2);
+    if (!block) {
+        FreeEnvironmentStringsA(source);
+        return NULL;
+    }
+    char *out = block;
+    int inserted = 0;
+    for (const char *p = source; *p; p += strlen(p) + 1) {
+        size_t len = strlen(p);
+        /* 以 '=' 开头的是驱动器当前目录等隐藏变量，始终排在最前 */
+        int order = p[0] == '=' ? -1 : env_name_compare(p, name);
+        if (order == 0) continue;
+        if (order > 0 && !inserted) {
+            memcpy(out, entry, (size_t)entry_len + 1);
+            out += entry_len + 1;
+            inserted = 1;
+        }
+        memcpy(out, p, len + 1);
+        out += len + 1;
+    }
+    if (!inserted) {
+        memcpy(out, entry, (size_t)entry_len + 1);
+        out += entry_len + 1;
+    }
+    *out = '\0';
+    FreeEnvironmentStringsA(source);
+    return block;
+}
+#else
+extern char **environ;
+
+/*
+ * 为子进程构造 envp：复制本进程 environ 的指针表，把 OMP_NUM_THREADS 换成线程上限。
+ * 在 fork 之前于父进程内完成，子进程里只剩 execle；返回值（指针表与新条目同一块内存）需 free。
+ */
+static char **child_environment_with_threads(int max_threads) {
+    static const char name[] = "OMP_NUM_THREADS=";
+    size_t count = 0;
+    while (environ[count]) ++count;
+    char **envp = (char **)malloc((count + 2) * sizeof(char *) + 48);
+    if (!envp) return NULL;
+    char *entry = (char *)(envp + count + 2);
+    snprintf(entry, 48, "%s%d", name, max_threads);
+    size_t n = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (strncmp(environ[i], name, sizeof(name) - 1) != 0) envp[n++] = environ[i];
+    }
+    envp[n++] = entry;
+    envp[n] = NULL;
+    return envp;
+}
+#endif
+
+/* child_spawn 的实际启动，调用前已预留存活子进程槽位 */
+static int child_spawn_reserved(ChildProc *proc, const char *application, const char *command, const char *label,
+                                const StageSchedule *schedule, ResourceUsage *usage) {
+    const char *trace_label = label;
+    memset(proc, 0, sizeof(*proc));
+    /* 库调用时宿主进程的控制台不属于我们：一律捕获输出，经事件回调转交；--record 时也要经过转发才能记录 */
+    if (!label && (g_event_callback || g_trace_file)) label = "";
+    proc->label = label;
+    proc->usage = usage;
+    proc->queue_level = schedule && schedule->queue_level ? schedule->queue_level : QUEUE_NORMAL;
+    console_lock_init();
+    if (cancel_requested()) return EXIT_CANCELLED;
+#ifdef _WIN32
+    char command_line[4096];
+    HANDLE out_write = NULL;
+    HANDLE null_input = NULL;
+    copy_string(command_line, sizeof(command_line), command);
+
+    STARTUPINFOA si;
+    PROCESS_INFORMATION pi;
+    ZeroMemory(&si, sizeof(si));
+    si.cb = sizeof(si);
+    ZeroMemory(&pi, sizeof(pi));
+
+    spawn_lock();
+    if (label) {
+        SECURITY_ATTRIBUTES sa;
+        ZeroMemory(&sa, sizeof(sa));
+        sa.nLength = sizeof(sa);
+        sa.bInheritHandle = TRUE;
+        if (!CreatePipe(&proc->out_read, &out_write, &sa, 0)) {
+            spawn_unlock();
+            job_warn("创建输出管道失败 (error=%lu)\n", (unsigned long)GetLastError());
+            return -1;
+        }
+        SetHandleInformation(proc->out_read, HANDLE_FLAG_INHERIT, 0);
+    }
+    if (label || g_stdin_watch_active) {
+        si.dwFlags |= STARTF_USESTDHANDLES;
+        si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+        si.hStdOutput = label ? out_write : GetStdHandle(STD_OUTPUT_HANDLE);
+        si.hStdError = label ? out_write : GetStdHandle(STD_ERROR_HANDLE);
+    }
+    if (g_stdin_watch_active || g_event_callback) {
+        /* stdin 留给取消指令（库调用时属于宿主进程），子进程改读 NUL，避免抢走 “cancel” */
+        SECURITY_ATTRIBUTES nul_sa;
+        ZeroMemory(&nul_sa, sizeof(nul_sa));
+        nul_sa.nLength = sizeof(nul_sa);
+        nul_sa.bInheritHandle = TRUE;
+        null_input = CreateFileA("NUL", GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, &nul_sa, OPEN_EXISTING, 0, NULL);
+        if (null_input != INVALID_HANDLE_VALUE) si.hStdInput = null_input;
+        else null_input = NULL;
+    }
+
+    /* 线程上限经子进程自己的环境块传递（dee、ffmpeg 与 python 工具未必遵守 OMP_NUM_THREADS） */
+    char *environment = NULL;
+    if (schedule && schedule->max_threads > 0) environment = child_environment_with_threads(schedule->max_threads);
+
+    /* 先挂起创建，设置调度参数并放入作业对象后再恢复，保证孙进程也继承这些设置 */
+    BOOL success = CreateProcessA(
+        application,
+        command_line,
+        NULL,
+        NULL,
+        (si.dwFlags & STARTF_USESTDHANDLES) ? TRUE : FALSE,
+        (g_job_object || schedule || usage) ? CREATE_SUSPENDED : 0,
+        environment,
+        NULL,
+        &si,
+        &pi);
+    if (out_write) CloseHandle(out_write);
+    if (null_input) CloseHandle(null_input);
+    spawn_unlock();
+    free(environment);
+
+    if (!success) {
+        DWORD err = GetLastError();
+        char err_msg[256];
+        format_win32_error(err, err_msg, sizeof(err_msg));
+        job_warn("启动进程失败 (error=%lu): %s\n", (unsigned long)err, err_msg);
+        if (proc->out_read) CloseHandle(proc->out_read);
+        proc->out_read = NULL;
+        return (int)err;
+    }
+    if (schedule) apply_stage_schedule(pi.hProcess, schedule);
+    if (g_job_object) {
+        if (!AssignProcessToJobObject(g_job_object, pi.hProcess)) {
+            job_warn("警告: 无法将进程加入作业对象 (error=%lu)，取消时可能残留子进程。\n", (unsigned long)GetLastError());
+        }
+    }
+    /* 嵌套作业对象（Windows 8+）统计 cmd.exe 之下所有后代的 CPU 时间与峰值内存 */
+    if (usage) {
+        proc->accounting = CreateJobObjectA(NULL, NULL);
+        if (proc->accounting && !AssignProcessToJobObject(proc->accounting, pi.hProcess)) {
+            CloseHandle(proc->accounting);
+            proc->accounting = NULL;
+        }
+    }
+    if (g_job_object || schedule || usage) ResumeThread(pi.hThread);
+    CloseHandle(pi.hThread);
+    proc->process = pi.hProcess;
+#else
+    (void)application;
+    /* 线程上限经 envp 传递，在 fork 之前构造好 */
+    char **environment = NULL;
+    if (schedule && schedule->max_threads > 0) environment = child_environment_with_threads(schedule->max_threads);
+    int fds[2] = {-1, -1};
+    spawn_lock();
+    if (label) {
+#ifdef __linux__
+        int piped = pipe2(fds, O_CLOEXEC);
+#else
+        int piped = pipe(fds);
+        if (piped == 0) {
+            fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+            fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+        }
+#endif
+        if (piped != 0) {
+            spawn_unlock();
+            perror("创建输出管道失败");
+            free(environment);
+            return -1;
+        }
+    }
+    pid_t pid = fork();
+    if (pid != 0) spawn_unlock();
+    if (pid < 0) {
+        perror("启动进程失败");
+        free(environment);
+        if (label) {
+            close(fds[0]);
+            close(fds[1]);
+        }
+        return -1;
+    }
+    if (pid == 0) {
+        /* 独立进程组：取消时 kill(-pgid) 一并结束 sh 启动的所有后代 */
+        setpgid(0, 0);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGHUP, SIG_DFL);
+        if (label) {
+            dup2(fds[1], STDOUT_FILENO);
+            dup2(fds[1], STDERR_FILENO);
+        }
+        if (g_stdin_watch_active || g_event_callback) {
+            int null_fd = open("/dev/null", O_RDONLY);
+            if (null_fd >= 0) dup2(null_fd, STDIN_FILENO);
+        }
+        if (schedule) apply_stage_schedule(schedule);
+        execle("/bin/sh", "sh", "-c", command, (char *)NULL, environment ? environment : environ);
+        _exit(127);
+    }
+    free(environment);
+    proc->pid = pid;
+    setpgid(pid, pid);
+    if (label) {
+        close(fds[1]);
+        proc->out_read = fds[0];
+    }
+#endif
+    trace_child_start(proc, trace_label, command);
+    live_register(proc);
+    /*
+     * 取消若在启动与登记之间被处理，terminate_live_children 复制的名单里没有这个进程，在此补杀；
+     * 登记在 g_console_lock 下完成，此后才开始的拆除一定能看到它。
+     */
+    if (cancel_requested()) {
+#ifdef _WIN32
+        if (g_job_object) TerminateJobObject(g_job_object, EXIT_CANCELLED);
+        else TerminateProcess(proc->process, EXIT_CANCELLED);
+#else
+        kill(-proc->pid, SIGKILL);
+#endif
+    }
+    if (label) {
+        relay_register(proc);
+        if (worker_start(&proc->relay, relay_worker, proc)) {
+            proc->relaying = 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * 启动子进程但不等待。Windows 下 application 非空时直接 CreateProcess（与原先调用 dee.exe 的方式一致），
+ * POSIX 下统一经 /bin/sh -c 执行，与 system() 的解析规则相同。成功返回 0。
+ * 存活子进程已达 CHILD_MAX_LIVE 时不启动并警告：未登记的子进程无法被抢占暂停，取消时也不会被结束。
+ */
+static int child_spawn(ChildProc *proc, const char *application, const char *command, const char *label,
+                       const StageSchedule *schedule, ResourceUsage *usage) {
+    if (!live_reserve()) {
+        memset(proc, 0, sizeof(*proc));
+        job_warn("警告: 同时运行的子进程已达上限 %d，拒绝启动: %s\n", CHILD_MAX_LIVE, command);
+        return -1;
+    }
+    int spawn_code = child_spawn_reserved(proc, application, command, label, schedule, usage);
+    if (spawn_code != 0) live_release();
+    return spawn_code;
+}
+
+static void usage_add(ResourceUsage *usage, double cpu_seconds, long long peak_memory) {
+    worker_mutex_lock(&g_console_lock);
+    usage->cpu_seconds += cpu_seconds;
+    if (peak_memory > usage->peak_memory) usage->peak_memory = peak_memory;
+    usage->processes++;
+    worker_mutex_unlock(&g_console_lock);
+}
+
+#ifdef _WIN32
+static void child_collect_usage(ChildProc *proc) {
+    double cpu_seconds = 0.0;
+    long long peak_memory = 0;
+    JOBOBJECT_BASIC_ACCOUNTING_INFORMATION accounting;
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits;
+    if (proc->accounting &&
+        QueryInformationJobObject(proc->accounting, JobObjectBasicAccountingInformation, &accounting, sizeof(accounting), NULL)) {
+        cpu_seconds = (double)(accounting.TotalUserTime.QuadPart + accounting.TotalKernelTime.QuadPart) / 1e7;
+        if (QueryInformationJobObject(proc->accounting, JobObjectExtendedLimitInformation, &limits, sizeof(limits), NULL)) {
+            peak_memory = (long long)limits.PeakProcessMemoryUsed;
+        }
+    } else {
+        FILETIME created, exited, kernel, user;
+        if (GetProcessTimes(proc->process, &created, &exited, &kernel, &user)) {
+            ULONGLONG k = ((ULONGLONG)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+            ULONGLONG u = ((ULONGLONG)user.dwHighDateTime << 32) | user.dwLowDateTime;
+            cpu_seconds = (double)(k + u) / 1e7;
+        }
+    }
+    usage_add(proc->usage, cpu_seconds, peak_memory);
+}
+#endif
+
+/* 等待子进程结束并返回退出码 */
+static int child_wait(ChildProc *proc) {
+    int exit_code = 0;
+#ifdef _WIN32
+    while (WaitForSingleObject(proc->process, 100) == WAIT_TIMEOUT) {
+        if (cancel_requested()) terminate_live_children();
+        queue_preempt_tick();
+    }
+    /* 先退出登记再关闭句柄，抢占检查不会用到已关闭的句柄 */
+    live_unregister(proc);
+    DWORD proc_exit_code = 0;
+    if (!GetExitCodeProcess(proc->process, &proc_exit_code)) {
+        DWORD err = GetLastError();
+        char err_msg[256];
+        format_win32_error(err, err_msg, sizeof(err_msg));
+        job_warn("获取进程退出码失败 (error=%lu): %s\n", (unsigned long)err, err_msg);
+        exit_code = (int)err;
+    } else {
+        exit_code = (int)proc_exit_code;
+    }
+    if (proc->usage) child_collect_usage(proc);
+    if (proc->accounting) CloseHandle(proc->accounting);
+    proc->accounting = NULL;
+    CloseHandle(proc->process);
+    proc->process = NULL;
+#else
+    int status = 0;
+    for (;;) {
+        if (proc->reaped) {
+            status = proc->status;
+            break;
+        }
+        if (cancel_requested() && !g_teardown_started) {
+            terminate_live_children();
+            continue;
+        }
+        /* 其他线程正在拆除并回收进程树，等它结束，避免两边抢着 waitpid */
+        if (g_teardown_started && !g_teardown_done) {
+            sleep_milliseconds(50);
+            continue;
+        }
+        /* wait4 的 rusage 已包含 sh 回收过的全部后代 */
+        struct rusage ru;
+        pid_t r = wait4(proc->pid, &status, WNOHANG, &ru);
+        if (r == proc->pid) {
+            if (proc->usage) {
+                usage_add(proc->usage,
+                          ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6,
+                          (long long)ru.ru_maxrss * 1024);
+            }
+            break;
+        }
+        if (r < 0 && errno != EINTR) {
+            status = -1;
+            break;
+        }
+        queue_preempt_tick();
+        sleep_milliseconds(50);
+    }
+    live_unregister(proc);
+    if (status == -1) exit_code = -1;
+    else if (WIFEXITED(status)) exit_code = WEXITSTATUS(status);
+    else if (WIFSIGNALED(status)) exit_code = 128 + WTERMSIG(status);
+    else exit_code = status;
+    proc->pid = 0;
+#endif
+    if (proc->label) {
+        if (proc->relaying) worker_join(proc->relay);
+        proc->relaying = 0;
+        worker_mutex_lock(&g_console_lock);
+        proc->progress = 100.0;
+        worker_mutex_unlock(&g_console_lock);
+#ifdef _WIN32
+        if (proc->out_read) CloseHandle(proc->out_read);
+        proc->out_read = NULL;
+#else
+        if (proc->out_read >= 0) close(proc->out_read);
+        proc->out_read = -1;
+#endif
+    }
+    trace_child_exit(proc, exit_code);
+    return exit_code;
+}
+
+/*
+ * 等价于 system()：Windows 下经 cmd.exe /c 执行，但进程纳入作业对象/进程组、应用调度参数并响应取消；
+ * label 非空时输出加前缀转发，usage 非空时累加资源消耗。
+ */
+static int run_shell_command(const StageSchedule *schedule, const char *label, ResourceUsage *usage, const char *command) {
+    ChildProc proc;
+    int spawn_code;
+#ifdef _WIN32
+    char shell_command[4096];
+    int len = snprintf(shell_command, sizeof(shell_command), "cmd.exe /c %s", command);
+    if (len < 0 || len >= (int)sizeof(shell_command)) return -1;
+    spawn_code = child_spawn(&proc, NULL, shell_command, label, schedule, usage);
+#else
+    spawn_code = child_spawn(&proc, NULL, command, label, schedule, usage);
+#endif
+    if (spawn_code != 0) return spawn_code;
+    return child_wait(&proc);
+}
+// --------- 子进程结束 ---------
+
+#ifndef DEE_LIBRARY
+// --------- 子进程输出回放（--replay）：按记录时间重放输出，压测进度解析与界面 ---------
+/*
+ * 按记录的时间（可加速）把子进程输出重新交给输出转发，写出的内容与真实编码时 encode.exe 的输出一致，
+ * 不需要安装 dee。--replay-jobs 同时回放多份，模拟多个任务并发的输出压力。
+ * 本进程只能测到自己写 stdout 的延迟；--replay-probe 时每隔 REPLAY_PROBE_INTERVAL 秒在输出中穿插
+ * “Replay probe: seq=N sent=<毫秒>”（sent 与 Date.now() 同一时钟），读取端按收到的时刻减去 sent
+ * 得到经管道、主进程与 IPC 直到界面的端到端延迟。
+ */
+#define REPLAY_MAX_CHILDREN 64
+#define REPLAY_LATE_MS 100.0
+#define REPLAY_PROBE_INTERVAL 0.1
+
+/* 自 1970 年起的毫秒数，与 JS 的 Date.now() 同一时钟，用于跨进程比较时刻 */
+static double wall_clock_ms(void) {
+#ifdef _WIN32
+    /* FILETIME 以 1601 年为起点、100 纳秒为单位 */
+    return (double)(get_system_filetime_ticks() - 116444736000000000ULL) / 10000.0;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+#endif
+}
+
+static int g_replay_probe_seq = 0;
+static double g_replay_probe_at = 0.0;
+
+/* 距上一个探针超过间隔（或 force）时写出一个；与转发的输出行在同一把锁下，保证顺序 */
+static void replay_probe(int force) {
+    worker_mutex_lock(&g_console_lock);
+    double now = monotonic_seconds();
+    if (force || now - g_replay_probe_at >= REPLAY_PROBE_INTERVAL) {
+        g_replay_probe_at = now;
+        printf("Replay probe: seq=%d sent=%.1f\n", ++g_replay_probe_seq, wall_clock_ms());
+        fflush(stdout);
+    }
+    worker_mutex_unlock(&g_console_lock);
+}
+
+typedef struct {
+    int id;                   /* 记录中的编号，0 为空位 */
+    ChildProc proc;
+    char label[64];
+} ReplayChild;
+
+typedef struct {
+    const char *path;
+    int index;                /* 第几份（从 1 开始），多份时用作输出前缀 */
+    int copies;
+    double speed;             /* 回放倍速，0 为不等待 */
+    double started;
+    worker_thread_t thread;
+    int running;
+    ReplayChild children[REPLAY_MAX_CHILDREN];
+    /* 以下统计只由本份的线程写入，结束后汇总 */
+    int processes;
+    int failed;               /* 记录中有子进程以非 0 退出 */
+    long long lines;
+    long long bytes;
+    double lag_sum;           /* 每行实际写出时间相对计划时间的延迟（毫秒），含 stdout 管道的阻塞 */
+    double lag_max;
+    long long late;           /* 延迟超过 REPLAY_LATE_MS 的行数 */
+    int error;
+} ReplayRun;
+
+static ReplayChild *replay_child(ReplayRun *run, int id, int create) {
+    ReplayChild *free_slot = NULL;
+    for (int i = 0; i < REPLAY_MAX_CHILDREN; ++i) {
+        if (run->children[i].id == id) return &run->children[i];
+        if (!free_slot && run->children[i].id == 0) free_slot = &run->children[i];
+    }
+    if (!create || !free_slot) return NULL;
+    memset(free_slot, 0, sizeof(*free_slot));
+    free_slot->id = id;
+    return free_slot;
+}
+
+/* 等到记录时间（按倍速换算）再写出；取消时返回 0 */
+static int replay_wait_until(double due) {
+    for (;;) {
+        if (cancel_requested()) return 0;
+        double ahead = due - monotonic_seconds();
+        if (ahead <= 0.0) return 1;
+        if (ahead > 0.2) ahead = 0.2;
+#ifdef _WIN32
+        Sleep((DWORD)(ahead * 1000.0) + 1);
+#else
+        sleep_milliseconds((int)(ahead * 1000.0) + 1);
+#endif
+    }
+}
+
+static void replay_worker(void *arg) {
+    ReplayRun *run = (ReplayRun *)arg;
+    FILE *f = fopen(run->path, "r");
+    char line[8192];
+    int live = 0;
+    if (!f) {
+        run->error = 1;
+        return;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        char *fields[5] = {0};
+        int field_count = 0;
+        trim_newline(line);
+        if (line[0] == '#' || line[0] == '\0') continue;
+        /* 输出行可能含 Tab：只切前四个字段，其余留在最后一个字段中 */
+        int limit = line[0] == 'S' ? 5 : 4;
+        for (char *p = line; field_count < limit; ) {
+            fields[field_count++] = p;
+            char *tab = field_count < limit ? strchr(p, '\t') : NULL;
+            if (!tab) break;
+            *tab = '\0';
+            p = tab + 1;
+        }
+        if (field_count < 4) continue;
+        double due = run->started + (run->speed > 0.0 ? atof(fields[1]) / 1000.0 / run->speed : 0.0);
+        int id = atoi(fields[2]);
+        if (run->speed > 0.0 && !replay_wait_until(due)) break;
+
+        if (fields[0][0] == 'S') {
+            ReplayChild *child = replay_child(run, id, 1);
+            if (!child) continue;
+            if (run->copies > 1) {
+                snprintf(child->label, sizeof(child->label), "c%d%s%s", run->index, fields[3][0] ? ":" : "", fields[3]);
+            } else {
+                copy_string(child->label, sizeof(child->label), fields[3]);
+            }
+            child->proc.label = child->label;
+            worker_mutex_lock(&g_console_lock);
+            if (child->label[0]) printf("[%s] 执行命令: %s\n", child->label, field_count > 4 ? fields[4] : "");
+            else printf("执行命令: %s\n", field_count > 4 ? fields[4] : "");
+            fflush(stdout);
+            worker_mutex_unlock(&g_console_lock);
+            relay_register(&child->proc);
+            run->processes++;
+            live++;
+        } else if (fields[0][0] == 'O') {
+            ReplayChild *child = replay_child(run, id, 0);
+            if (!child) continue;
+            relay_emit_line(&child->proc, fields[3]);
+            if (g_cli.replay_probe) replay_probe(0);
+            double lag = (monotonic_seconds() - due) * 1000.0;
+            if (run->speed <= 0.0) lag = 0.0;
+            run->lines++;
+            run->bytes += (long long)strlen(fields[3]) + 1;
+            run->lag_sum += lag;
+            if (lag > run->lag_max) run->lag_max = lag;
+            if (lag > REPLAY_LATE_MS) run->late++;
+        } else if (fields[0][0] == 'X') {
+            ReplayChild *child = replay_child(run, id, 0);
+            if (!child) continue;
+            if (atoi(fields[3]) != 0) run->failed = 1;
+            worker_mutex_lock(&g_console_lock);
+            child->proc.progress = 100.0;
+            worker_mutex_unlock(&g_console_lock);
+            /* 编号在一份记录中不重复；槽位保留到本份结束，已登记的转发进度继续按 100% 参与平均 */
+            live--;
+            if (live == 0 && run->copies == 1) relay_reset();
+        }
+    }
+    fclose(f);
+}
+
+/* --replay 入口：回放结束后输出吞吐与调度延迟；记录中有子进程失败时返回 1 */
+static int run_replay(const char *path, double speed, int copies) {
+    char header[64] = "";
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "无法打开输出记录: %s\n", path);
+        return 1;
+    }
+    if (!fgets(header, sizeof(header), f)) header[0] = '\0';
+    fclose(f);
+    if (strncmp(header, TRACE_MAGIC, strlen(TRACE_MAGIC)) != 0) {
+        fprintf(stderr, "不是输出记录文件（--record 生成）: %s\n", path);
+        return 1;
+    }
+    if (copies < 1) copies = 1;
+    ReplayRun *runs = (ReplayRun *)calloc((size_t)copies, sizeof(ReplayRun));
+    if (!runs) return 1;
+    console_lock_init();
+    install_cancel_handlers(1);
+    printf("回放输出记录: %s，%d 份，%s\n", path, copies, speed > 0.0 ? "按记录时间" : "不等待");
+    if (speed > 0.0 && speed != 1.0) printf("回放倍速: %.2fx\n", speed);
+    fflush(stdout);
+
+    double started = monotonic_seconds();
+    for (int i = 0; i < copies; ++i) {
+        runs[i].path = path;
+        runs[i].index = i + 1;
+        runs[i].copies = copies;
+        runs[i].speed = speed;
+        runs[i].started = started;
+    }
+    for (int i = 1; i < copies; ++i) runs[i].running = worker_start(&runs[i].thread, replay_worker, &runs[i]);
+    replay_worker(&runs[0]);
+    for (int i = 1; i < copies; ++i) {
+        if (runs[i].running) worker_join(runs[i].thread);
+        else replay_worker(&runs[i]);
+    }
+    double elapsed = monotonic_seconds() - started;
+    if (g_cli.replay_probe) replay_probe(1);
+
+    int processes = 0;
+    int failed = 0;
+    long long lines = 0;
+    long long bytes = 0;
+    long long late = 0;
+    double lag_sum = 0.0;
+    double lag_max = 0.0;
+    for (int i = 0; i < copies; ++i) {
+        processes += runs[i].processes;
+        failed |= runs[i].failed | runs[i].error;
+        lines += runs[i].lines;
+        bytes += runs[i].bytes;
+        late += runs[i].late;
+        lag_sum += runs[i].lag_sum;
+        if (runs[i].lag_max > lag_max) lag_max = runs[i].lag_max;
+    }
+    free(runs);
+    printf("回放完成: %d 个子进程，%lld 行 / %.2f MB，用时 %.1f 秒（%.0f 行/秒）\n", processes, lines,
+           bytes / (1024.0 * 1024.0), elapsed, elapsed > 0.0 ? lines / elapsed : 0.0);
+    if (speed > 0.0) {
+        printf("写出延迟: 平均 %.1f 毫秒，最大 %.1f 毫秒，超过 %.0f 毫秒 %lld 行\n",
+               lines ? lag_sum / lines : 0.0, lag_max, REPLAY_LATE_MS, late);
+    }
+    fflush(stdout);
+    if (cancel_requested()) return EXIT_CANCELLED;
+    return failed ? 1 : 0;
+}
+// --------- 子进程输出回放结束 ---------
+#endif
+
+// --------- 队列优先级与抢占：高优先级任务暂停低优先级的子进程树 ---------
+/*
+ * 每个任务有队列优先级（background / normal / urgent）。本进程或其他 encode 进程中有更高优先级的子进程在运行时，
+ * 较低优先级的子进程树被暂停（POSIX 整个进程组 SIGSTOP/SIGCONT，Windows 对进程树逐个 NtSuspendProcess），
+ * 让出核心与 I/O；更高优先级的工作结束后原地继续，dee 的进度不受影响。
+ * 被抢占的子进程在每个 QUEUE_FAIR_WINDOW 秒的周期内仍按 --fair-share 的比例运行，低优先级的批量任务不会完全停住。
+ * 各进程锁定 DolbyTemp\queue\<pid>.lock 并写入自己正在运行的最高级别，进程退出时锁随之释放。
+ */
+#define QUEUE_TICK_SECONDS 0.2
+#define QUEUE_REMOTE_SECONDS 1.0
+#define QUEUE_FAIR_WINDOW 60.0
+#define QUEUE_STALE_SECONDS 60
+#define QUEUE_LOCK_OFFSET 4096   /* Windows 的字节锁是强制的，锁在内容之外，其他进程仍可读取级别 */
+#define QUEUE_TREE_MAX 256
+
+static char g_queue_dir[1024];
+static char g_queue_path[1024];
+#ifdef _WIN32
+static HANDLE g_queue_handle = INVALID_HANDLE_VALUE;
+#else
+static int g_queue_fd = -1;
+#endif
+/* 以下状态只由抢到 g_queue_ticking 的线程读写 */
+static int g_queue_ticking = 0;
+static double g_queue_next_tick = 0.0;
+static double g_queue_next_remote = 0.0;
+static int g_queue_published = -1;
+static int g_queue_remote = QUEUE_UNSET;
+
+/* 内容固定为 “level=N\n”，长度不变，原地覆盖即可；未登记时视为成功 */
+static int queue_publish(int level) {
+    char text[32];
+    int len = snprintf(text, sizeof(text), "level=%d\n", level);
+#ifdef _WIN32
+    DWORD written = 0;
+    if (g_queue_handle == INVALID_HANDLE_VALUE) return 1;
+    SetFilePointer(g_queue_handle, 0, NULL, FILE_BEGIN);
+    return WriteFile(g_queue_handle, text, (DWORD)len, &written, NULL) && written == (DWORD)len;
+#else
+    if (g_queue_fd < 0) return 1;
+    return pwrite(g_queue_fd, text, (size_t)len, 0) == len;
+#endif
+}
+
+/* 在 DolbyTemp\queue 下登记本进程；与 cpu_slot_acquire 成对调用 */
+static void queue_open(const char *temp_dir) {
+    char name[32];
+    build_path(g_queue_dir, sizeof(g_queue_dir), temp_dir, "queue");
+    ensure_directory_exists(g_queue_dir);
+#ifdef _WIN32
+    snprintf(name, sizeof(name), "%lu.lock", (unsigned long)GetCurrentProcessId());
+    build_path(g_queue_path, sizeof(g_queue_path), g_queue_dir, name);
+    if (g_queue_handle != INVALID_HANDLE_VALUE) return;
+    HANDLE h = CreateFileA(g_queue_path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                           NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE) return;
+    OVERLAPPED ov;
+    ZeroMemory(&ov, sizeof(ov));
+    ov.Offset = QUEUE_LOCK_OFFSET;
+    if (!LockFileEx(h, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, 1, 0, &ov)) {
+        CloseHandle(h);
+        return;
+    }
+    g_queue_handle = h;
+#else
+    snprintf(name, sizeof(name), "%ld.lock", (long)getpid());
+    build_path(g_queue_path, sizeof(g_queue_path), g_queue_dir, name);
+    if (g_queue_fd >= 0) return;
+    int fd = open(g_queue_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        close(fd);
+        return;
+    }
+    g_queue_fd = fd;
+#endif
+    g_queue_published = -1;
+    g_queue_next_remote = 0.0;
+}
+
+static void queue_close(void) {
+#ifdef _WIN32
+    if (g_queue_handle == INVALID_HANDLE_VALUE) return;
+    CloseHandle(g_queue_handle);
+    g_queue_handle = INVALID_HANDLE_VALUE;
+#else
+    if (g_queue_fd < 0) return;
+    close(g_queue_fd);
+    g_queue_fd = -1;
+#endif
+    remove_file_if_exists(g_queue_path);
+}
+
+/*
+ * 读取其他进程登记的级别。能锁住的登记文件属于已退出的进程：超过 QUEUE_STALE_SECONDS 未更新的顺手删除，
+ * 刚创建、还没来得及加锁的不动。
+ */
+static int queue_read_entry(const char *path) {
+    char text[32];
+    int level = QUEUE_UNSET;
+    int held = 0;
+#ifdef _WIN32
+    HANDLE h = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                           NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h == INVALID_HANDLE_VALUE) return QUEUE_UNSET;
+    OVERLAPPED ov;
+    ZeroMemory(&ov, sizeof(ov));
+    ov.Offset = QUEUE_LOCK_OFFSET;
+    if (LockFileEx(h, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, 1, 0, &ov)) {
+        UnlockFileEx(h, 0, 1, 0, &ov);
+    } else {
+        DWORD got = 0;
+        held = 1;
+        if (ReadFile(h, text, sizeof(text) - 1, &got, NULL)) {
+            text[got] = '\0';
+            if (strncmp(text, "level=", 6) == 0) level = atoi(text + 6);
+        }
+    }
+    CloseHandle(h);
+#else
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return QUEUE_UNSET;
+    if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+        flock(fd, LOCK_UN);
+    } else {
+        ssize_t got = pread(fd, text, sizeof(text) - 1, 0);
+        held = 1;
+        if (got > 0) {
+            text[got] = '\0';
+            if (strncmp(text, "level=", 6) == 0) level = atoi(text + 6);
+        }
+    }
+    close(fd);
+#endif
+    if (!held && (long long)time(NULL) - file_mtime_of(path) > QUEUE_STALE_SECONDS) remove_file_if_exists(path);
+    return level > QUEUE_UNSET && level < QUEUE_LEVEL_COUNT ? level : QUEUE_UNSET;
+}
+
+/* 其他 encode 进程正在运行的最高级别 */
+static int queue_remote_level(void) {
+    const char *dir = g_queue_dir;
+    char path[1100];
+    int top = QUEUE_UNSET;
+    if (!dir[0]) return QUEUE_UNSET;
+#ifdef _WIN32
+    char pattern[1100];
+    WIN32_FIND_DATAA entry;
+    build_path(pattern, sizeof(pattern), dir, "*.lock");
+    HANDLE find = FindFirstFileA(pattern, &entry);
+    if (find == INVALID_HANDLE_VALUE) return QUEUE_UNSET;
+    do {
+        build_path(path, sizeof(path), dir, entry.cFileName);
+        if (strcmp(path, g_queue_path) == 0) continue;
+        int level = queue_read_entry(path);
+        if (level > top) top = level;
+    } while (FindNextFileA(find, &entry));
+    FindClose(find);
+#else
+    DIR *d = opendir(dir);
+    if (!d) return QUEUE_UNSET;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len < 6 || strcmp(entry->d_name + len - 5, ".lock") != 0) continue;
+        build_path(path, sizeof(path), dir, entry->d_name);
+        if (strcmp(path, g_queue_path) == 0) continue;
+        int level = queue_read_entry(path);
+        if (level > top) top = level;
+    }
+    closedir(d);
+#endif
+    return top;
+}
+
+#ifdef _WIN32
+typedef LONG (WINAPI *NtProcessControlFn)(HANDLE);
+
+/*
+ * 暂停或继续子进程及其全部后代（cmd.exe 之下的 python、ffmpeg）。后代按父进程号从快照中收集，
+ * 只处理属于本进程作业对象的进程，避免父进程号被复用时误伤无关进程
+ */
+static void queue_suspend_tree(ChildProc *proc, int suspend) {
+    NtProcessControlFn control = (NtProcessControlFn)(void *)GetProcAddress(
+        GetModuleHandleA("ntdll.dll"), suspend ? "NtSuspendProcess" : "NtResumeProcess");
+    DWORD pids[QUEUE_TREE_MAX];
+    int count = 0;
+    if (!control || !proc->process) return;
+    pids[count++] = GetProcessId(proc->process);
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+    if (snapshot != INVALID_HANDLE_VALUE) {
+        int added = 1;
+        while (added && count < QUEUE_TREE_MAX) {
+            PROCESSENTRY32 entry;
+            added = 0;
+            entry.dwSize = sizeof(entry);
+            for (BOOL ok = Process32First(snapshot, &entry); ok && count < QUEUE_TREE_MAX; ok = Process32Next(snapshot, &entry)) {
+                int known = 0;
+                int child = 0;
+                for (int i = 0; i < count; ++i) {
+                    if (pids[i] == entry.th32ProcessID) known = 1;
+                    if (pids[i] == entry.th32ParentProcessID) child = 1;
+                }
+                if (!known && child) {
+                    pids[count++] = entry.th32ProcessID;
+                    added = 1;
+                }
+            }
+        }
+        CloseHandle(snapshot);
+    }
+    control(proc->process);
+    for (int i = 1; i < count; ++i) {
+        HANDLE h = OpenProcess(PROCESS_SUSPEND_RESUME | PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pids[i]);
+        BOOL in_job = TRUE;
+        if (!h) continue;
+        if (g_job_object) IsProcessInJob(h, g_job_object, &in_job);
+        if (in_job) control(h);
+        CloseHandle(h);
+    }
+}
+#else
+static void queue_suspend_tree(ChildProc *proc, int suspend) {
+    if (proc->pid > 0) kill(-proc->pid, suspend ? SIGSTOP : SIGCONT);
+}
+#endif
+
+/* 在 g_console_lock 下调用 */
+static void queue_note(const ChildProc *proc, int top) {
+    char text[256];
+    const char *name = proc->label && proc->label[0] ? proc->label : "子进程";
+    if (proc->preempted) {
+        snprintf(text, sizeof(text), "抢占: %s（%s）暂停，让位于 %s 任务；每 %.0f 秒仍运行 %d%%", name,
+                 queue_level_names[proc->queue_level], queue_level_names[top], QUEUE_FAIR_WINDOW,
+                 g_cli.fair_share[proc->queue_level]);
+    } else {
+        snprintf(text, sizeof(text), "抢占: %s（%s）恢复运行", name, queue_level_names[proc->queue_level]);
+    }
+    job_note("%s\n", text);
+}
+
+/*
+ * 由等待子进程的线程周期性调用：公布本进程的级别，按本进程与其他进程中的最高级别暂停或继续较低级别的子进程。
+ * 多个线程同时调用时只有一个执行，其余直接返回。
+ */
+static void queue_preempt_tick(void) {
+    if (!g_cli.preempt || cancel_requested()) return;
+    double now = monotonic_seconds();
+    int local = QUEUE_UNSET;
+    worker_mutex_lock(&g_console_lock);
+    if (g_queue_ticking || now < g_queue_next_tick) {
+        worker_mutex_unlock(&g_console_lock);
+        return;
+    }
+    g_queue_ticking = 1;
+    g_queue_next_tick = now + QUEUE_TICK_SECONDS;
+    for (int i = 0; i < g_live_count; ++i) {
+        if (g_live_procs[i]->queue_level > local) local = g_live_procs[i]->queue_level;
+    }
+    worker_mutex_unlock(&g_console_lock);
+
+    if (local != g_queue_published && queue_publish(local)) g_queue_published = local;
+    if (now >= g_queue_next_remote) {
+        g_queue_remote = queue_remote_level();
+        g_queue_next_remote = now + QUEUE_REMOTE_SECONDS;
+    }
+    int top = local > g_queue_remote ? local : g_queue_remote;
+
+    worker_mutex_lock(&g_console_lock);
+    /* 周期的前 fair_share% 让被抢占的子进程运行，其余时间暂停 */
+    double phase = fmod(now, QUEUE_FAIR_WINDOW) * 100.0 / QUEUE_FAIR_WINDOW;
+    for (int i = 0; i < g_live_count && !cancel_requested(); ++i) {
+        ChildProc *proc = g_live_procs[i];
+        int preempted = proc->queue_level < top;
+        if (preempted != proc->preempted) {
+            proc->preempted = preempted;
+            queue_note(proc, top);
+        }
+        int suspend = preempted && phase >= g_cli.fair_share[proc->queue_level];
+        if (suspend != proc->suspended) {
+            queue_suspend_tree(proc, suspend);
+            proc->suspended = suspend;
+        }
+    }
+    g_queue_ticking = 0;
+    worker_mutex_unlock(&g_console_lock);
+}
+// --------- 队列优先级与抢占结束 ---------
+
+// --------- XML 模板缓存 ---------
+/*
+ * 模板按路径缓存在内存中，修改时间或大小变化时重新读取：多段导出、批量任务与多格式 pass 用同一模板
+ * 渲染多份任务 XML 时只读一次磁盘。以文本模式读入，换行与逐行 fgets 读取模板时一致。
+ * 缓存项按引用计数管理，被新内容替换的旧项在最后一个使用者归还后释放。
+ */
+#define XML_TEMPLATE_MAX_BYTES (4 * 1024 * 1024)
+
+/* 编译后的模板：元素在模板文本中的位置，供任务 XML 覆盖按路径定位（见下一节） */
+typedef struct {
+    char name[48];
+    int parent;               /* -1 为根元素 */
+    int ordinal;              /* 同一父元素下同名元素中的序号（从 1 开始） */
+    int has_children;
+    int self_closing;
+    size_t tag_begin;         /* 开始标签的 '<' */
+    size_t tag_end;           /* 开始标签 '>' 之后；自闭合时为 "/>" 的位置 */
+    size_t content_end;       /* 结束标签 "</" 的位置 */
+} XmlNode;
+
+typedef struct {
+    size_t begin;             /* 替换模板文本 [begin, end) */
+    size_t end;
+    char *text;
+} XmlEdit;
+
+/* 一组覆盖对该模板的解析结果，按覆盖文本缓存：批量与参数扫描中同一组覆盖只解析一次 */
+typedef struct XmlOverridePlan {
+    char *spec;
+    XmlEdit *edits;
+    int edit_count;
+    unsigned long long found;  /* 第 i 项在模板中找到时置位 */
+    char error[256];           /* 非空表示覆盖无效 */
+    struct XmlOverridePlan *next;
+} XmlOverridePlan;
+
+typedef struct XmlTemplate {
+    char path[1024];
+    long long mtime;
+    long long size;
+    char *text;
+    size_t length;
+    int refs;
+    int stale;                 /* 已被新内容替换 */
+    int compiled;              /* nodes 已建立；compile_error 非空表示模板不是良构的 XML */
+    XmlNode *nodes;
+    int node_count;
+    char compile_error[128];
+    XmlOverridePlan *plans;
+    struct XmlTemplate *next;
+} XmlTemplate;
+
+static XmlTemplate *g_templates = NULL;   /* 在 g_console_lock 下读写 */
+
+/* 在 g_console_lock 下调用 */
+static void xml_template_unlink(XmlTemplate *entry) {
+    for (XmlTemplate **link = &g_templates; *link; link = &(*link)->next) {
+        if (*link == entry) {
+            *link = entry->next;
+            while (entry->plans) {
+                XmlOverridePlan *plan = entry->plans;
+                entry->plans = plan->next;
+                for (int i = 0; i < plan->edit_count; ++i) free(plan->edits[i].text);
+                free(plan->edits);
+                free(plan->spec);
+                free(plan);
+            }
+            free(entry->nodes);
+            free(entry->text);
+            free(entry);
+            return;
+        }
+    }
+}
+
+static XmlTemplate *xml_template_find(const char *path, long long mtime, long long size) {
+    for (XmlTemplate *entry = g_templates; entry; entry = entry->next) {
+        if (entry->stale || strcmp(entry->path, path) != 0) continue;
+        if (entry->mtime == mtime && entry->size == size) return entry;
+        entry->stale = 1;
+        if (entry->refs == 0) xml_template_unlink(entry);
+        return NULL;
+    }
+    return NULL;
+}
+
+/* 取得模板内容（以 '\0' 结尾），用完交给 xml_template_release；读取失败返回 NULL */
+static const char *xml_template_acquire(const char *path, size_t *length) {
+    long long mtime = file_mtime_of(path);
+    long long size = file_size_of(path);
+    console_lock_init();
+    worker_mutex_lock(&g_console_lock);
+    XmlTemplate *entry = xml_template_find(path, mtime, size);
+    if (entry) entry->refs++;
+    worker_mutex_unlock(&g_console_lock);
+    if (entry) {
+        *length = entry->length;
+        return entry->text;
+    }
+
+    if (size < 0 || size > XML_TEMPLATE_MAX_BYTES) return NULL;
+    FILE *f = fopen(path, "r");
+    if (!f) return NULL;
+    char *text = (char *)malloc((size_t)size + 1);
+    size_t got = text ? fread(text, 1, (size_t)size, f) : 0;
+    fclose(f);
+    if (!text) return NULL;
+    text[got] = '\0';
+
+    worker_mutex_lock(&g_console_lock);
+    /* 另一个线程可能同时读入了同一模板，以先登记的为准 */
+    entry = xml_template_find(path, mtime, size);
+    if (entry) {
+        free(text);
+    } else {
+        entry = (XmlTemplate *)calloc(1, sizeof(XmlTemplate));
+        if (entry) {
+            copy_string(entry->path, sizeof(entry->path), path);
+            entry->mtime = mtime;
+            entry->size = size;
+            entry->text = text;
+            entry->length = got;
+            entry->next = g_templates;
+            g_templates = entry;
+        }
+    }
+    if (entry) entry->refs++;
+    worker_mutex_unlock(&g_console_lock);
+    if (!entry) {
+        free(text);
+        return NULL;
+    }
+    *length = entry->length;
+    return entry->text;
+}
+
+static void xml_template_release(const char *text) {
+    worker_mutex_lock(&g_console_lock);
+    for (XmlTemplate *entry = g_templates; entry; entry = entry->next) {
+        if (entry->text != text) continue;
+        if (--entry->refs == 0 && entry->stale) xml_template_unlink(entry);
+        break;
+    }
+    worker_mutex_unlock(&g_console_lock);
+}
+// --------- XML 模板缓存结束 ---------
+
+// --------- 任务 XML 覆盖（--set）：按路径改写模板中的任意元素与属性 ---------
+/*
+ * 覆盖写作 “路径=值”，多项以 ; 分隔（--set 可重复）。路径以 / 分隔元素名，可用 name[2] 指定同名兄弟中的第几个，
+ * 末段写 @属性 时改写属性；以 / 开头时从根元素匹配，否则按后缀匹配，例如：
+ *   encode_to_atmos_ddp/drc/line_mode_drc_profile=film_light
+ *   /job_config/filter/audio/encode_to_atmos_ddp/@version=1
+ * 校验按模板结构进行：路径必须在模板中唯一匹配到一个叶子元素（或其已有的属性）。起止时间、空白时长、码率
+ * 与输出路径由任务参数控制，不能覆盖。值按原样写入（自动转义 XML 特殊字符）。多格式任务中，一项覆盖只要
+ * 在其中一个模板里找到即可，在其他模板中跳过。
+ */
+#define XML_MAX_NODES 4096
+#define XML_MAX_DEPTH 64
+#define XML_OVERRIDE_MAX 32
+
+static void trim_spaces(char *text) {
+    char *p = text;
+    while (isspace((unsigned char)*p)) p++;
+    memmove(text, p, strlen(p) + 1);
+    size_t len = strlen(text);
+    while (len > 0 && isspace((unsigned char)text[len - 1])) text[--len] = '\0';
+}
+
+static const char *skip_past(const char *text, size_t length, size_t from, const char *marker) {
+    size_t marker_len = strlen(marker);
+    for (size_t i = from; i + marker_len <= length; ++i) {
+        if (memcmp(text + i, marker, marker_len) == 0) return text + i + marker_len;
+    }
+    return NULL;
+}
+
+/* 建立元素索引；在 g_console_lock 下调用，只编译一次 */
+static void xml_template_compile(XmlTemplate *entry) {
+    const char *text = entry->text;
+    size_t length = entry->length;
+    int stack[XML_MAX_DEPTH];
+    int depth = 0;
+    size_t i = 0;
+    entry->compiled = 1;
+    entry->nodes = (XmlNode *)calloc(XML_MAX_NODES, sizeof(XmlNode));
+    if (!entry->nodes) {
+        copy_string(entry->compile_error, sizeof(entry->compile_error), "内存不足");
+        return;
+    }
+    while (i < length) {
+        if (text[i] != '<') {
+            i++;
+            continue;
+        }
+        const char *next = NULL;
+        if (strncmp(text + i, "<!--", 4) == 0) next = skip_past(text, length, i + 4, "-->");
+        else if (strncmp(text + i, "<![CDATA[", 9) == 0) next = skip_past(text, length, i + 9, "]]>");
+        else if (strncmp(text + i, "<?", 2) == 0) next = skip_past(text, length, i + 2, "?>");
+        else if (strncmp(text + i, "<!", 2) == 0) next = skip_past(text, length, i + 2, ">");
+        if (next) {
+            i = (size_t)(next - text);
+            continue;
+        }
+        if (text[i + 1] == '/') {
+            if (depth == 0) break;
+            entry->nodes[stack[--depth]].content_end = i;
+            next = skip_past(text, length, i + 2, ">");
+            if (!next) break;
+            i = (size_t)(next - text);
+            continue;
+        }
+        /* 开始标签：找到不在引号中的 '>' */
+        size_t close = i + 1;
+        char quote = 0;
+        while (close < length && (quote || text[close] != '>')) {
+            if (quote && text[close] == quote) quote = 0;
+            else if (!quote && (text[close] == '"' || text[close] == '\'')) quote = text[close];
+            close++;
+        }
+        if (close >= length || entry->node_count >= XML_MAX_NODES || depth >= XML_MAX_DEPTH) break;
+        XmlNode *node = &entry->nodes[entry->node_count];
+        size_t name_len = 0;
+        while (i + 1 + name_len < close && !isspace((unsigned char)text[i + 1 + name_len]) &&
+               text[i + 1 + name_len] != '/' && text[i + 1 + name_len] != '>') {
+            name_len++;
+        }
+        if (name_len == 0 || name_len >= sizeof(node->name)) break;
+        memcpy(node->name, text + i + 1, name_len);
+        node->name[name_len] = '\0';
+        node->parent = depth > 0 ? stack[depth - 1] : -1;
+        node->ordinal = 1;
+        for (int k = 0; k < entry->node_count; ++k) {
+            if (entry->nodes[k].parent == node->parent && strcmp(entry->nodes[k].name, node->name) == 0) node->ordinal++;
+        }
+        if (node->parent >= 0) entry->nodes[node->parent].has_children = 1;
+        node->tag_begin = i;
+        node->self_closing = text[close - 1] == '/';
+        node->tag_end = node->self_closing ? close - 1 : close + 1;
+        if (!node->self_closing) stack[depth++] = entry->node_count;
+        entry->node_count++;
+        i = close + 1;
+    }
+    if (i < length || depth != 0 || entry->node_count == 0) {
+        copy_string(entry->compile_error, sizeof(entry->compile_error), "模板不是良构的 XML，或元素过多、层级过深");
+    }
+}
+
+/* 在开始标签中找属性值的位置（引号之间） */
+static int xml_find_attribute(const char *text, const XmlNode *node, const char *name, size_t *begin, size_t *end) {
+    size_t name_len = strlen(name);
+    size_t i = node->tag_begin + 1 + strlen(node->name);
+    size_t limit = node->tag_end;
+    while (i < limit) {
+        while (i < limit && isspace((unsigned char)text[i])) i++;
+        size_t attr = i;
+        while (i < limit && text[i] != '=' && !isspace((unsigned char)text[i]) && text[i] != '/' && text[i] != '>') i++;
+        size_t attr_len = i - attr;
+        while (i < limit && isspace((unsigned char)text[i])) i++;
+        if (i >= limit || text[i] != '=') return 0;
+        i++;
+        while (i < limit && isspace((unsigned char)text[i])) i++;
+        if (i >= limit || (text[i] != '"' && text[i] != '\'')) return 0;
+        char quote = text[i++];
+        size_t value = i;
+        while (i < limit && text[i] != quote) i++;
+        if (attr_len == name_len && memcmp(text + attr, name, name_len) == 0) {
+            *begin = value;
+            *end = i;
+            return 1;
+        }
+        i++;
+    }
+    return 0;
+}
+
+static char *xml_escape_value(const char *value, size_t length) {
+    size_t size = 1;
+    for (size_t i = 0; i < length; ++i) size += strchr("&<>\"'", value[i]) && value[i] ? 6 : 1;
+    char *out = (char *)malloc(size);
+    if (!out) return NULL;
+    char *p = out;
+    for (size_t i = 0; i < length; ++i) {
+        const char *entity = NULL;
+        switch (value[i]) {
+        case '&': entity = "&amp;"; break;
+        case '<': entity = "&lt;"; break;
+        case '>': entity = "&gt;"; break;
+        case '"': entity = "&quot;"; break;
+        case '\'': entity = "&apos;"; break;
+        default: break;
+        }
+        if (entity) {
+            strcpy(p, entity);
+            p += strlen(entity);
+        } else {
+            *p++ = value[i];
+        }
+    }
+    *p = '\0';
+    return out;
+}
+
+/* 这些元素由 generate_xml 按任务参数写入 */
+static int xml_reserved_element(const char *text, const XmlNode *node) {
+    static const char *const reserved[] = {"start", "end", "prepend_silence_duration", "append_silence_duration", "data_rate"};
+    for (size_t i = 0; i < sizeof(reserved) / sizeof(reserved[0]); ++i) {
+        if (strcmp(node->name, reserved[i]) == 0) return 1;
+    }
+    size_t len = node->self_closing ? 0 : node->content_end - node->tag_end;
+    return (len == 4 && memcmp(text + node->tag_end, "PATH", 4) == 0) ||
+           (len == 9 && memcmp(text + node->tag_end, "FILE_NAME", 9) == 0);
+}
+
+/* 解析一项覆盖；找不到返回 0，唯一匹配返回 1 并填写 edit，其余情况写 error 返回 -1 */
+static int xml_resolve_override(const XmlTemplate *entry, const char *item, XmlEdit *edit, char *error, size_t error_size) {
+    char path[512];
+    char *segments[XML_MAX_DEPTH];
+    int ordinals[XML_MAX_DEPTH];
+    int segment_count = 0;
+    const char *attribute = NULL;
+    const char *eq = strchr(item, '=');
+    if (!eq || eq == item) {
+        snprintf(error, error_size, "“%s” 应写作 路径=值", item);
+        return -1;
+    }
+    size_t path_len = (size_t)(eq - item);
+    if (path_len >= sizeof(path)) path_len = sizeof(path) - 1;
+    memcpy(path, item, path_len);
+    path[path_len] = '\0';
+    int anchored = path[0] == '/';
+    for (char *token = strtok(path, "/"); token; token = strtok(NULL, "/")) {
+        if (attribute || segment_count >= XML_MAX_DEPTH) {
+            snprintf(error, error_size, "路径 %.*s 无效（@属性只能是最后一段）", (int)(eq - item), item);
+            return -1;
+        }
+        if (token[0] == '@') {
+            attribute = token + 1;
+            continue;
+        }
+        char *bracket = strchr(token, '[');
+        ordinals[segment_count] = 0;
+        if (bracket) {
+            ordinals[segment_count] = atoi(bracket + 1);
+            *bracket = '\0';
+        }
+        segments[segment_count++] = token;
+    }
+    if (segment_count == 0 || (attribute && !attribute[0])) {
+        snprintf(error, error_size, "路径 %.*s 无效", (int)(eq - item), item);
+        return -1;
+    }
+
+    int match = -1;
+    int matches = 0;
+    for (int n = 0; n < entry->node_count; ++n) {
+        int cur = n;
+        int s = segment_count - 1;
+        for (; s >= 0 && cur >= 0; --s, cur = entry->nodes[cur].parent) {
+            if (strcmp(entry->nodes[cur].name, segments[s]) != 0) break;
+            if (ordinals[s] && entry->nodes[cur].ordinal != ordinals[s]) break;
+        }
+        if (s >= 0 || (anchored && cur != -1)) continue;
+        match = n;
+        matches++;
+    }
+    if (matches == 0) return 0;
+    if (matches > 1) {
+        snprintf(error, error_size, "路径 %.*s 在模板中匹配到 %d 个元素，请写出更完整的路径或用 [序号]", (int)(eq - item), item, matches);
+        return -1;
+    }
+
+    const XmlNode *node = &entry->nodes[match];
+    const char *value = eq + 1;
+    if (attribute) {
+        if (!xml_find_attribute(entry->text, node, attribute, &edit->begin, &edit->end)) {
+            snprintf(error, error_size, "模板中的 <%s> 没有属性 %s", node->name, attribute);
+            return -1;
+        }
+        edit->text = xml_escape_value(value, strlen(value));
+    } else if (node->has_children) {
+        snprintf(error, error_size, "<%s> 含有子元素，只能覆盖叶子元素或属性", node->name);
+        return -1;
+    } else if (xml_reserved_element(entry->text, node)) {
+        snprintf(error, error_size, "<%s> 由任务参数控制（起止时间、空白时长、--bitrate 或输出路径），不能覆盖", node->name);
+        return -1;
+    } else if (node->self_closing) {
+        /* <name/> 改写为 <name>值</name> */
+        char *escaped = xml_escape_value(value, strlen(value));
+        size_t size = escaped ? strlen(escaped) + strlen(node->name) + 5 : 0;
+        edit->begin = node->tag_end;
+        edit->end = node->tag_end + 2;
+        edit->text = escaped ? (char *)malloc(size) : NULL;
+        if (edit->text) snprintf(edit->text, size, ">%s</%s>", escaped, node->name);
+        free(escaped);
+    } else {
+        edit->begin = node->tag_end;
+        edit->end = node->content_end;
+        edit->text = xml_escape_value(value, strlen(value));
+    }
+    if (!edit->text) {
+        snprintf(error, error_size, "内存不足");
+        return -1;
+    }
+    return 1;
+}
+
+static int xml_edit_compare(const void *a, const void *b) {
+    const XmlEdit *x = (const XmlEdit *)a;
+    const XmlEdit *y = (const XmlEdit *)b;
+    return x->begin < y->begin ? -1 : x->begin > y->begin ? 1 : 0;
+}
+
+/* 取得（必要时编译模板并解析）一组覆盖的解析结果；在 g_console_lock 下调用 */
+static XmlOverridePlan *xml_template_plan(XmlTemplate *entry, const char *spec) {
+    for (XmlOverridePlan *plan = entry->plans; plan; plan = plan->next) {
+        if (strcmp(plan->spec, spec) == 0) return plan;
+    }
+    XmlOverridePlan *plan = (XmlOverridePlan *)calloc(1, sizeof(XmlOverridePlan));
+    if (!plan) return NULL;
+    plan->spec = (char *)malloc(strlen(spec) + 1);
+    plan->edits = (XmlEdit *)calloc(XML_OVERRIDE_MAX, sizeof(XmlEdit));
+    if (!plan->spec || !plan->edits) {
+        free(plan->spec);
+        free(plan->edits);
+        free(plan);
+        return NULL;
+    }
+    strcpy(plan->spec, spec);
+    if (!entry->compiled) xml_template_compile(entry);
+    if (entry->compile_error[0]) copy_string(plan->error, sizeof(plan->error), entry->compile_error);
+
+    char items[2048];
+    int index = 0;
+    copy_string(items, sizeof(items), spec);
+    char *cursor = items;
+    while (!plan->error[0] && cursor) {
+        char *item = cursor;
+        char *semi = strchr(cursor, ';');
+        if (semi) *semi = '\0';
+        cursor = semi ? semi + 1 : NULL;
+        trim_spaces(item);
+        if (!item[0]) continue;
+        if (index >= XML_OVERRIDE_MAX) {
+            snprintf(plan->error, sizeof(plan->error), "覆盖项过多（上限 %d）", XML_OVERRIDE_MAX);
+            break;
+        }
+        XmlEdit edit;
+        memset(&edit, 0, sizeof(edit));
+        int found = xml_resolve_override(entry, item, &edit, plan->error, sizeof(plan->error));
+        if (found > 0) {
+            for (int k = 0; k < plan->edit_count; ++k) {
+                if (plan->edits[k].begin == edit.begin) {
+                    snprintf(plan->error, sizeof(plan->error), "“%.120s” 与前面的覆盖项改写同一位置", item);
+                }
+            }
+            plan->edits[plan->edit_count++] = edit;
+            plan->found |= 1ull << index;
+        }
+        index++;
+    }
+    qsort(plan->edits, (size_t)plan->edit_count, sizeof(XmlEdit), xml_edit_compare);
+    plan->next = entry->plans;
+    entry->plans = plan;
+    return plan;
+}
+
+static XmlTemplate *xml_template_entry_of(const char *text) {
+    for (XmlTemplate *entry = g_templates; entry; entry = entry->next) {
+        if (entry->text == text) return entry;
+    }
+    return NULL;
+}
+
+/*
+ * 把覆盖应用到 xml_template_acquire 取得的模板文本上，返回新分配的文本（调用方 free）。
+ * 覆盖无效时返回 NULL 并写 error；模板中找不到的项跳过（由 xml_overrides_check（经 job_xml_overrides_valid）事先保证至少在一个模板中存在）。
+ */
+static char *xml_template_render(const char *text, const char *spec, size_t *length, char *error, size_t error_size) {
+    char *rendered = NULL;
+    worker_mutex_lock(&g_console_lock);
+    XmlTemplate *entry = xml_template_entry_of(text);
+    XmlOverridePlan *plan = entry ? xml_template_plan(entry, spec) : NULL;
+    if (!plan) {
+        snprintf(error, error_size, "内存不足");
+    } else if (plan->error[0]) {
+        copy_string(error, error_size, plan->error);
+    } else {
+        size_t size = entry->length + 1;
+        for (int i = 0; i < plan->edit_count; ++i) size += strlen(plan->edits[i].text);
+        rendered = (char *)malloc(size);
+        if (rendered) {
+            size_t from = 0;
+            size_t out = 0;
+            for (int i = 0; i < plan->edit_count; ++i) {
+                const XmlEdit *edit = &plan->edits[i];
+                memcpy(rendered + out, text + from, edit->begin - from);
+                out += edit->begin - from;
+                memcpy(rendered + out, edit->text, strlen(edit->text));
+                out += strlen(edit->text);
+                from = edit->end;
+            }
+            memcpy(rendered + out, text + from, entry->length - from);
+            out += entry->length - from;
+            rendered[out] = '\0';
+            *length = out;
+        } else {
+            snprintf(error, error_size, "内存不足");
+        }
+    }
+    worker_mutex_unlock(&g_console_lock);
+    return rendered;
+}
+
+/* 按任务会用到的全部模板校验覆盖：每一项至少在一个模板中唯一匹配。有效返回 1，否则打印原因返回 0 */
+static int xml_overrides_check(const char *const *templates, int template_count, const char *spec) {
+    unsigned long long found = 0;
+    int items = 0;
+    char error[512] = "";
+    for (int t = 0; t < template_count && !error[0]; ++t) {
+        size_t length = 0;
+        const char *text = xml_template_acquire(templates[t], &length);
+        if (!text) {
+            snprintf(error, sizeof(error), "无法读取模板 %s", templates[t]);
+            break;
+        }
+        worker_mutex_lock(&g_console_lock);
+        XmlOverridePlan *plan = xml_template_plan(xml_template_entry_of(text), spec);
+        if (!plan) copy_string(error, sizeof(error), "内存不足");
+        else if (plan->error[0]) snprintf(error, sizeof(error), "%s（%.200s）", plan->error, path_file_name(templates[t]));
+        else found |= plan->found;
+        worker_mutex_unlock(&g_console_lock);
+        xml_template_release(text);
+    }
+    if (!error[0]) {
+        char list[2048];
+        copy_string(list, sizeof(list), spec);
+        for (char *item = strtok(list, ";"); item; item = strtok(NULL, ";")) {
+            trim_spaces(item);
+            if (!item[0]) continue;
+            if (!(found & (1ull << items))) {
+                snprintf(error, sizeof(error), "模板中没有 %s 对应的元素", item);
+                break;
+            }
+            items++;
+        }
+    }
+    if (error[0]) {
+        job_warn("XML 覆盖无效: %s\n", error);
+        return 0;
+    }
+    return 1;
+}
+// --------- 任务 XML 覆盖结束 ---------
+
+// --------- xxHash64（用于阶段产物校验） ---------
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+typedef struct {
+    unsigned long long total_len;
+    unsigned long long v[4];
+    unsigned char mem[32];
+    size_t memsize;
+} Xxh64State;
+
+static unsigned long long xxh64_rotl(unsigned long long x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static unsigned long long read_le64(const unsigned char *p) {
+    unsigned long long v = 0;
+    for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+    return v;
+}
+
+static unsigned long read_le32(const unsigned char *p) {
+    return (unsigned long)p[0] | ((unsigned long)p[1] << 8) | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static unsigned read_le16(const unsigned char *p) { return (unsigned)p[0] | ((unsigned)p[1] << 8); }
+
+static unsigned long long xxh64_round(unsigned long long acc, unsigned long long input) {
+    acc += input * XXH_PRIME64_2;
+    acc = xxh64_rotl(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static unsigned long long xxh64_merge(unsigned long long acc, unsigned long long val) {
+    acc ^= xxh64_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static void xxh64_init(Xxh64State *s) {
+    memset(s, 0, sizeof(*s));
+    s->v[0] = XXH_PRIME64_1 + XXH_PRIME64_2;
+    s->v[1] = XXH_PRIME64_2;
+    s->v[2] = 0;
+    s->v[3] = 0ULL - XXH_PRIME64_1;
+}
+
+static void xxh64_update(Xxh64State *s, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    const unsigned char *end = p + len;
+    s->total_len += len;
+    if (s->memsize + len < 32) {
+        memcpy(s->mem + s->memsize, p, len);
+        s->memsize += len;
+        return;
+    }
+    if (s->memsize > 0) {
+        size_t fill = 32 - s->memsize;
+        memcpy(s->mem + s->memsize, p, fill);
+        for (int i = 0; i < 4; ++i) s->v[i] = xxh64_round(s->v[i], read_le64(s->mem + i * 8));
+        p += fill;
+        s->memsize = 0;
+    }
+    while (p + 32 <= end) {
+        s->v[0] = xxh64_round(s->v[0], read_le64(p));
+        s->v[1] = xxh64_round(s->v[1], read_le64(p + 8));
+        s->v[2] = xxh64_round(s->v[2], read_le64(p + 16));
+        s->v[3] = xxh64_round(s->v[3], read_le64(p + 24));
+        p += 32;
+    }
+    if (p < end) {
+        s->memsize = (size_t)(end - p);
+        memcpy(s->mem, p, s->memsize);
+    }
+}
+
+static unsigned long long xxh64_digest(const Xxh64State *s) {
+    unsigned long long h;
+    if (s->total_len >= 32) {
+        h = xxh64_rotl(s->v[0], 1) + xxh64_rotl(s->v[1], 7) + xxh64_rotl(s->v[2], 12) + xxh64_rotl(s->v[3], 18);
+        for (int i = 0; i < 4; ++i) h = xxh64_merge(h, s->v[i]);
+    } else {
+        h = s->v[2] + XXH_PRIME64_5;
+    }
+    h += s->total_len;
+    const unsigned char *p = s->mem;
+    const unsigned char *end = s->mem + s->memsize;
+    while (p + 8 <= end) {
+        h ^= xxh64_round(0, read_le64(p));
+        h = xxh64_rotl(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= (unsigned long long)read_le32(p) * XXH_PRIME64_1;
+        h = xxh64_rotl(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * XXH_PRIME64_5;
+        h = xxh64_rotl(h, 11) * XXH_PRIME64_1;
+        p++;
+    }
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static unsigned long long xxh64_string(const char *text) {
+    Xxh64State s;
+    xxh64_init(&s);
+    if (text) xxh64_update(&s, text, strlen(text));
+    return xxh64_digest(&s);
+}
+
+/* 计算整个文件的 xxHash64，成功返回 1 */
+static int xxh64_file(const char *path, unsigned long long *hash, long long *size) {
+    const size_t chunk = 4 << 20;
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    unsigned char *buf = (unsigned char *)malloc(chunk);
+    if (!buf) {
+        fclose(f);
+        return 0;
+    }
+    Xxh64State s;
+    xxh64_init(&s);
+    long long total = 0;
+    size_t got;
+    while ((got = fread(buf, 1, chunk, f)) > 0) {
+        xxh64_update(&s, buf, got);
+        total += (long long)got;
+    }
+    int ok = !ferror(f);
+    fclose(f);
+    free(buf);
+    if (ok) {
+        *hash = xxh64_digest(&s);
+        if (size) *size = total;
+    }
+    return ok;
+}
+// --------- xxHash64 结束 ---------
+
+// --------- SHA-256（交付清单校验和） ---------
+typedef struct {
+    uint32_t state[8];
+    unsigned long long total_len;
+    unsigned char block[64];
+    size_t block_len;
+} Sha256State;
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_transform(Sha256State *s, const unsigned char *p) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) {
+        w[i] = ((uint32_t)p[i * 4] << 24) | ((uint32_t)p[i * 4 + 1] << 16) | ((uint32_t)p[i * 4 + 2] << 8) | p[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = SHA256_ROTR(w[i - 15], 7) ^ SHA256_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = SHA256_ROTR(w[i - 2], 17) ^ SHA256_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = s->state[0], b = s->state[1], c = s->state[2], d = s->state[3];
+    uint32_t e = s->state[4], f = s->state[5], g = s->state[6], h = s->state[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t t1 = h + (SHA256_ROTR(e, 6) ^ SHA256_ROTR(e, 11) ^ SHA256_ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        uint32_t t2 = (SHA256_ROTR(a, 2) ^ SHA256_ROTR(a, 13) ^ SHA256_ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    s->state[0] += a; s->state[1] += b; s->state[2] += c; s->state[3] += d;
+    s->state[4] += e; s->state[5] += f; s->state[6] += g; s->state[7] += h;
+}
+
+static void sha256_init(Sha256State *s) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(s->state, initial, sizeof(initial));
+    s->total_len = 0;
+    s->block_len = 0;
+}
+
+static void sha256_update(Sha256State *s, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *)data;
+    s->total_len += len;
+    if (s->block_len > 0) {
+        size_t fill = 64 - s->block_len;
+        if (fill > len) fill = len;
+        memcpy(s->block + s->block_len, p, fill);
+        s->block_len += fill;
+        p += fill;
+        len -= fill;
+        if (s->block_len < 64) return;
+        sha256_transform(s, s->block);
+        s->block_len = 0;
+    }
+    while (len >= 64) {
+        sha256_transform(s, p);
+        p += 64;
+        len -= 64;
+    }
+    if (len > 0) {
+        memcpy(s->block, p, len);
+        s->block_len = len;
+    }
+}
+
+static void sha256_final_hex(Sha256State *s, char out[65]) {
+    unsigned long long bits = s->total_len * 8;
+    unsigned char pad[72];
+    size_t pad_len = (s->block_len < 56) ? 56 - s->block_len : 120 - s->block_len;
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    for (int i = 0; i < 8; ++i) pad[pad_len + (size_t)i] = (unsigned char)(bits >> (56 - i * 8));
+    sha256_update(s, pad, pad_len + 8);
+    for (int i = 0; i < 8; ++i) snprintf(out + i * 8, 9, "%08x", (unsigned)s->state[i]);
+}
+// --------- SHA-256 结束 ---------
+
+// --------- 交付：跨卷发布、流式校验和与交付清单 ---------
+#define PUBLISH_CHUNK (8 << 20)
+
+typedef struct {
+    long long size;
+    char sha256[65];
+    unsigned long long xxh64;
+    int hashed;
+    const char *method;
+    double seconds;
+} PublishResult;
+
+typedef struct {
+#ifdef _WIN32
+    HANDLE h;
+#else
+    int fd;
+#endif
+} RawFile;
+
+static int raw_open(RawFile *f, const char *path, int for_write) {
+#ifdef _WIN32
+    f->h = CreateFileA(path, for_write ? GENERIC_WRITE : GENERIC_READ, for_write ? 0 : FILE_SHARE_READ, NULL,
+                       for_write ? CREATE_ALWAYS : OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    return f->h != INVALID_HANDLE_VALUE;
+#else
+    f->fd = for_write ? open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : open(path, O_RDONLY | O_CLOEXEC);
+    if (f->fd >= 0 && !for_write) posix_fadvise(f->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return f->fd >= 0;
+#endif
+}
+
+static long long raw_read(RawFile *f, void *buf, size_t len) {
+#ifdef _WIN32
+    DWORD got = 0;
+    if (!ReadFile(f->h, buf, (DWORD)len, &got, NULL)) return -1;
+    return (long long)got;
+#else
+    size_t total = 0;
+    while (total < len) {
+        ssize_t got = read(f->fd, (char *)buf + total, len - total);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) return -1;
+        if (got == 0) break;
+        total += (size_t)got;
+    }
+    return (long long)total;
+#endif
+}
+
+static int raw_write_all(RawFile *f, const void *buf, size_t len) {
+    const char *p = (const char *)buf;
+    while (len > 0) {
+#ifdef _WIN32
+        DWORD written = 0;
+        if (!WriteFile(f->h, p, (DWORD)len, &written, NULL) || written == 0) return 0;
+#else
+        ssize_t written = write(f->fd, p, len);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return 0;
+#endif
+        p += written;
+        len -= (size_t)written;
+    }
+    return 1;
+}
+
+/* 落盘后再改名，保证目标路径上只会出现完整的文件 */
+static int raw_close(RawFile *f, int sync) {
+    int ok = 1;
+#ifdef _WIN32
+    if (sync && !FlushFileBuffers(f->h)) ok = 0;
+    CloseHandle(f->h);
+    f->h = INVALID_HANDLE_VALUE;
+#else
+    if (sync && fsync(f->fd) != 0) ok = 0;
+    close(f->fd);
+    f->fd = -1;
+#endif
+    return ok;
+}
+
+static void *publish_buffer_alloc(void) {
+#ifdef _WIN32
+    return VirtualAlloc(NULL, PUBLISH_CHUNK, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+    void *p = NULL;
+    return posix_memalign(&p, 4096, PUBLISH_CHUNK) == 0 ? p : NULL;
+#endif
+}
+
+static void publish_buffer_free(void *p) {
+    if (!p) return;
+#ifdef _WIN32
+    VirtualFree(p, 0, MEM_RELEASE);
+#else
+    free(p);
+#endif
+}
+
+/* 原子替换：同卷改名，目标已存在时覆盖；跨卷时返回 0 并置 cross_volume */
+static int atomic_replace(const char *from, const char *to, int *cross_volume) {
+    if (cross_volume) *cross_volume = 0;
+#ifdef _WIN32
+    if (MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) return 1;
+    if (cross_volume && GetLastError() == ERROR_NOT_SAME_DEVICE) *cross_volume = 1;
+#else
+    if (rename(from, to) == 0) return 1;
+    if (cross_volume && errno == EXDEV) *cross_volume = 1;
+#endif
+    return 0;
+}
+
+typedef struct {
+    RawFile *out;
+    const unsigned char *buf;
+    size_t len;
+    int ok;
+} PublishWrite;
+
+static void publish_write_worker(void *arg) {
+    PublishWrite *w = (PublishWrite *)arg;
+    w->ok = raw_write_all(w->out, w->buf, w->len);
+}
+
+/*
+ * 读一遍、写一遍：双缓冲，后台线程写出上一块的同时读取并计算下一块的 SHA-256 与 xxHash64。
+ * dest 为空时只计算校验和。
+ */
+static int stream_copy_with_hashes(const char *src, const char *dest, PublishResult *result) {
+    RawFile in;
+    RawFile out;
+    unsigned char *bufs[2];
+    Sha256State sha;
+    Xxh64State xxh;
+    worker_thread_t writer;
+    PublishWrite pending;
+    int has_pending = 0;
+    int ok = 1;
+    int cur = 0;
+
+    if (!raw_open(&in, src, 0)) return 0;
+    if (dest && !raw_open(&out, dest, 1)) {
+        raw_close(&in, 0);
+        return 0;
+    }
+    bufs[0] = (unsigned char *)publish_buffer_alloc();
+    bufs[1] = (unsigned char *)publish_buffer_alloc();
+    sha256_init(&sha);
+    xxh64_init(&xxh);
+    result->size = 0;
+    if (!bufs[0] || !bufs[1]) ok = 0;
+
+    while (ok) {
+        long long got = raw_read(&in, bufs[cur], PUBLISH_CHUNK);
+        if (got < 0) ok = 0;
+        if (got <= 0) break;
+        sha256_update(&sha, bufs[cur], (size_t)got);
+        xxh64_update(&xxh, bufs[cur], (size_t)got);
+        result->size += got;
+        if (!dest) continue;
+        if (has_pending) {
+            worker_join(writer);
+            has_pending = 0;
+            if (!pending.ok) {
+                ok = 0;
+                break;
+            }
+        }
+        pending.out = &out;
+        pending.buf = bufs[cur];
+        pending.len = (size_t)got;
+        pending.ok = 0;
+        if (worker_start(&writer, publish_write_worker, &pending)) {
+            has_pending = 1;
+        } else {
+            publish_write_worker(&pending);
+            if (!pending.ok) ok = 0;
+        }
+        cur ^= 1;
+    }
+    if (has_pending) {
+        worker_join(writer);
+        if (!pending.ok) ok = 0;
+    }
+    raw_close(&in, 0);
+    if (dest && !raw_close(&out, 1)) ok = 0;
+    publish_buffer_free(bufs[0]);
+    publish_buffer_free(bufs[1]);
+    if (ok) {
+        sha256_final_hex(&sha, result->sha256);
+        result->xxh64 = xxh64_digest(&xxh);
+        result->hashed = 1;
+    }
+    return ok;
+}
+
+/* 不需要校验和时交给内核完成拷贝：Linux copy_file_range，Windows CopyFileEx（无缓冲） */
+static int kernel_copy(const char *src, const char *dest, PublishResult *result) {
+#ifdef _WIN32
+    if (!CopyFileExA(src, dest, NULL, NULL, NULL, COPY_FILE_NO_BUFFERING)) return 0;
+    result->size = file_size_of(dest);
+    result->method = "CopyFileEx";
+    return 1;
+#elif defined(__linux__)
+    RawFile in;
+    RawFile out;
+    if (!raw_open(&in, src, 0)) return 0;
+    if (!raw_open(&out, dest, 1)) {
+        raw_close(&in, 0);
+        return 0;
+    }
+    long long total = 0;
+    int ok = 1;
+    for (;;) {
+        ssize_t n = copy_file_range(in.fd, NULL, out.fd, NULL, 1 << 30, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            ok = 0;
+            break;
+        }
+        if (n == 0) break;
+        total += n;
+    }
+    raw_close(&in, 0);
+    if (!raw_close(&out, 1)) ok = 0;
+    result->size = total;
+    result->method = "copy_file_range";
+    return ok;
+#else
+    (void)src;
+    (void)dest;
+    (void)result;
+    return 0;
+#endif
+}
+
+static void write_delivery_manifest(const char *target, const char *source, const PublishResult *r) {
+    char manifest_path[1100];
+    char temp_path[1200];
+    char qc_path[1100];
+    char stamp[32];
+    time_t now = time(NULL);
+    struct tm *tm_now = localtime(&now);
+    const char *name = path_file_name(target);
+
+    snprintf(manifest_path, sizeof(manifest_path), "%s.manifest.txt", target);
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", manifest_path);
+    snprintf(qc_path, sizeof(qc_path), "%s.qc.txt", target);
+    if (tm_now) strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", tm_now);
+    else copy_string(stamp, sizeof(stamp), "");
+
+    FILE *f = fopen(temp_path, "w");
+    if (!f) {
+        job_warn("警告: 无法写入交付清单 %s (errno=%d)\n", manifest_path, errno);
+        return;
+    }
+    fprintf(f, "manifest_version=1\n");
+    fprintf(f, "file=%s\n", name);
+    fprintf(f, "path=%s\n", target);
+    fprintf(f, "size=%lld\n", r->size);
+    if (r->hashed) {
+        fprintf(f, "sha256=%s\n", r->sha256);
+        fprintf(f, "xxh64=%016llx\n", r->xxh64);
+    }
+    fprintf(f, "source=%s\n", source);
+    fprintf(f, "method=%s\n", r->method ? r->method : "");
+    fprintf(f, "published_at=%s\n", stamp);
+    fprintf(f, "elapsed_seconds=%.3f\n", r->seconds);
+    if (file_exists(qc_path)) fprintf(f, "qc_report=%s.qc.txt\n", name);
+    sync_file_to_disk(f);
+    fclose(f);
+    atomic_replace(temp_path, manifest_path, NULL);
+}
+
+/* 把 source 旁的 QC 报告等附属文件一起带到 target 旁 */
+static void publish_sidecar(const char *source, const char *target, const char *suffix) {
+    char from[1100];
+    char to[1100];
+    int cross = 0;
+    snprintf(from, sizeof(from), "%s%s", source, suffix);
+    snprintf(to, sizeof(to), "%s%s", target, suffix);
+    if (!file_exists(from)) return;
+    if (atomic_replace(from, to, &cross)) return;
+    if (cross) {
+        PublishResult ignored;
+        memset(&ignored, 0, sizeof(ignored));
+        if (stream_copy_with_hashes(from, to, &ignored)) remove(from);
+    }
+}
+
+/*
+ * 发布交付文件：同卷时直接原子改名；跨卷时在目标目录写 .partial（一读一写并同时计算校验和），
+ * 落盘后原子改名到位再删除源文件。hash 为 0 时跨卷拷贝走内核快路径，清单中只记录大小。
+ */
+static int publish_output(const char *source, const char *target, int hash, int write_manifest) {
+    PublishResult result;
+    char partial[1100];
+    int cross_volume = 0;
+    double started = monotonic_seconds();
+
+    memset(&result, 0, sizeof(result));
+    if (strcmp(source, target) == 0) {
+        result.method = "in-place";
+        if (hash && !stream_copy_with_hashes(source, NULL, &result)) return 1;
+        if (!hash) result.size = file_size_of(source);
+    } else {
+        ensure_parent_directory(target);
+        if (atomic_replace(source, target, &cross_volume)) {
+            result.method = "rename";
+            if (hash && !stream_copy_with_hashes(target, NULL, &result)) return 1;
+            if (!hash) result.size = file_size_of(target);
+        } else if (!cross_volume) {
+            job_warn("发布失败: 无法将 %s 移动到 %s (errno=%d)\n", source, target, errno);
+            return 1;
+        } else {
+            snprintf(partial, sizeof(partial), "%s.partial", target);
+            int copied;
+            if (hash) {
+                result.method = "stream-copy";
+                copied = stream_copy_with_hashes(source, partial, &result);
+            } else {
+                copied = kernel_copy(source, partial, &result);
+                if (!copied) {
+                    result.method = "stream-copy";
+                    copied = stream_copy_with_hashes(source, partial, &result);
+                }
+            }
+            if (!copied || result.size != file_size_of(source)) {
+                job_warn("发布失败: 跨卷拷贝 %s -> %s 出错\n", source, partial);
+                remove_file_if_exists(partial);
+                return 1;
+            }
+            if (!atomic_replace(partial, target, NULL)) {
+                job_warn("发布失败: 无法将 %s 改名为 %s\n", partial, target);
+                remove_file_if_exists(partial);
+                return 1;
+            }
+            remove_file_if_exists(source);
+        }
+        publish_sidecar(source, target, ".qc.txt");
+    }
+    result.seconds = monotonic_seconds() - started;
+
+    if (write_manifest) write_delivery_manifest(target, source, &result);
+    job_note("已发布: %s (%s, %.1f MB, %.2f 秒%s%s)\n", target, result.method,
+           result.size / (1024.0 * 1024.0), result.seconds,
+           result.hashed ? ", sha256=" : "", result.hashed ? result.sha256 : "");
+    return 0;
+}
+// --------- 交付结束 ---------
+
+// --------- 分片 MP4（CMAF）封装：E-AC-3 基本流 → fMP4 + sidx，可选 HLS/DASH 清单 ---------
+/*
+ * 顺序读一遍 E-AC-3 基本流，每攒够一个分片时长的访问单元就写出 moof + mdat，不缓存整个文件，也没有第二遍。
+ * sidx 紧跟在 moov 之后：条目数按输入大小与首个访问单元大小预估后预留（DDP 为恒定码率），
+ * 全部分片写完后回填，预留的剩余空间写成 free box；实际分片多于预留时相邻分片合并为一个子段。
+ * 每个访问单元（substreamid 0 的独立帧及其后的依赖帧）是一个 sample，时间刻度取采样率。
+ */
+#define CMAF_READ_BUFFER (1 << 20)
+#define CMAF_SIDX_SLACK 16
+#define CMAF_SIDX_HEADER 40   /* sidx（version 1）不含引用条目的字节数 */
+#define CMAF_SIDX_ENTRY 12
+
+typedef struct {
+    double fragment_seconds;
+    unsigned manifests;       /* CMAF_MANIFEST_* */
+} CmafOptions;
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+    int failed;
+} BoxBuffer;
+
+typedef struct {
+    unsigned long long offset;   /* moof 在文件中的偏移 */
+    unsigned long long size;     /* moof + mdat 字节数 */
+    unsigned long long duration; /* 以采样为单位 */
+} CmafFragment;
+
+typedef struct {
+    Eac3FrameInfo core;          /* 首个访问单元的独立帧 */
+    int dependent_count;
+    int dependent_chanmap;       /* 首个访问单元中依赖帧的 chanmap 合集 */
+    int au_bytes;
+    int au_samples;
+} CmafStreamInfo;
+
+static void box_reserve(BoxBuffer *b, size_t extra) {
+    if (b->failed || b->len + extra <= b->cap) return;
+    size_t cap = b->cap ? b->cap : 4096;
+    while (cap < b->len + extra) cap *= 2;
+    unsigned char *data = (unsigned char *)realloc(b->data, cap);
+    if (!data) {
+        b->failed = 1;
+        return;
+    }
+    b->data = data;
+    b->cap = cap;
+}
+
+static void box_put_bytes(BoxBuffer *b, const void *p, size_t n) {
+    box_reserve(b, n);
+    if (b->failed) return;
+    memcpy(b->data + b->len, p, n);
+    b->len += n;
+}
+
+static void box_put8(BoxBuffer *b, unsigned v) {
+    unsigned char c = (unsigned char)v;
+    box_put_bytes(b, &c, 1);
+}
+
+static void box_put16(BoxBuffer *b, unsigned v) {
+    unsigned char c[2] = {(unsigned char)(v >> 8), (unsigned char)v};
+    box_put_bytes(b, c, 2);
+}
+
+static void box_put32(BoxBuffer *b, unsigned long v) {
+    unsigned char c[4] = {(unsigned char)(v >> 24), (unsigned char)(v >> 16), (unsigned char)(v >> 8), (unsigned char)v};
+    box_put_bytes(b, c, 4);
+}
+
+static void box_put64(BoxBuffer *b, unsigned long long v) {
+    box_put32(b, (unsigned long)(v >> 32));
+    box_put32(b, (unsigned long)(v & 0xFFFFFFFFUL));
+}
+
+static void box_put_zeros(BoxBuffer *b, size_t n) {
+    box_reserve(b, n);
+    if (b->failed) return;
+    memset(b->data + b->len, 0, n);
+    b->len += n;
+}
+
+static void box_patch32(BoxBuffer *b, size_t at, unsigned long v) {
+    if (b->failed || at + 4 > b->len) return;
+    b->data[at] = (unsigned char)(v >> 24);
+    b->data[at + 1] = (unsigned char)(v >> 16);
+    b->data[at + 2] = (unsigned char)(v >> 8);
+    b->data[at + 3] = (unsigned char)v;
+}
+
+/* 开始一个 box，返回其起始位置，由 box_end 回填长度 */
+static size_t box_begin(BoxBuffer *b, const char *type) {
+    size_t at = b->len;
+    box_put32(b, 0);
+    box_put_bytes(b, type, 4);
+    return at;
+}
+
+static size_t box_begin_full(BoxBuffer *b, const char *type, unsigned version, unsigned long flags) {
+    size_t at = box_begin(b, type);
+    box_put32(b, ((unsigned long)version << 24) | (flags & 0xFFFFFFUL));
+    return at;
+}
+
+static void box_end(BoxBuffer *b, size_t at) {
+    box_patch32(b, at, (unsigned long)(b->len - at));
+}
+
+static void box_put_matrix(BoxBuffer *b) {
+    static const unsigned long unity[9] = {0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000};
+    for (int i = 0; i < 9; ++i) box_put32(b, unity[i]);
+}
+
+/* E-AC-3 的 acmod/lfeon 与 chanmap 按 Dolby DASH 的 audio_channel_configuration 位序合并，如 5.1 为 F801 */
+static unsigned cmaf_channel_mask(const CmafStreamInfo *s) {
+    static const unsigned acmod_masks[8] = {0xA000, 0x4000, 0xA000, 0xE000, 0xA100, 0xE100, 0xB800, 0xF800};
+    unsigned mask = acmod_masks[s->core.acmod & 7];
+    if (s->core.lfeon) mask |= 0x0001;
+    return mask | (unsigned)s->dependent_chanmap;
+}
+
+static int cmaf_data_rate_kbps(const CmafStreamInfo *s) {
+    if (s->au_samples <= 0) return 0;
+    return (int)((long long)s->au_bytes * 8 * s->core.sample_rate / s->au_samples / 1000);
+}
+
+/* dec3（ETSI TS 102 366 Annex F）：单个独立子流，依赖子流的声道位置取自 chanmap，带 JOC 时写 flag_ec3_extension_type_a */
+static void cmaf_put_dec3(BoxBuffer *b, const CmafStreamInfo *s) {
+    int fscod = s->core.sample_rate == 44100 ? 1 : s->core.sample_rate == 32000 ? 2 : 0;
+    unsigned chan_loc = ((unsigned)s->dependent_chanmap >> 2) & 0x1FF;
+    size_t at = box_begin(b, "dec3");
+    box_put16(b, ((unsigned)cmaf_data_rate_kbps(s) & 0x1FFF) << 3);          /* data_rate, num_ind_sub = 0 */
+    box_put8(b, ((unsigned)fscod << 6) | (((unsigned)s->core.bsid & 0x1F) << 1)); /* fscod, bsid, reserved */
+    box_put8(b, ((unsigned)s->core.acmod & 7) << 1 | ((unsigned)s->core.lfeon & 1)); /* asvc, bsmod = 0 */
+    if (s->dependent_count > 0) {
+        box_put16(b, ((unsigned)(s->dependent_count & 0xF) << 9) | chan_loc);   /* reserved, num_dep_sub, chan_loc */
+    } else {
+        box_put8(b, 0);
+    }
+    if (s->core.joc) {
+        box_put8(b, 0x01);
+        box_put8(b, (unsigned)s->core.joc_complexity);
+    }
+    box_end(b, at);
+}
+
+/* 初始化段：ftyp + moov（无样本表，mvex/trex 声明后续为分片） */
+static void cmaf_build_init(BoxBuffer *b, const CmafStreamInfo *s) {
+    size_t at = box_begin(b, "ftyp");
+    box_put_bytes(b, "iso6", 4);
+    box_put32(b, 0);
+    box_put_bytes(b, "iso6cmfcdashmp41", 16);
+    box_end(b, at);
+
+    size_t moov = box_begin(b, "moov");
+    at = box_begin_full(b, "mvhd", 0, 0);
+    box_put32(b, 0);
+    box_put32(b, 0);
+    box_put32(b, 1000);
+    box_put32(b, 0);
+    box_put32(b, 0x00010000);
+    box_put16(b, 0x0100);
+    box_put_zeros(b, 10);
+    box_put_matrix(b);
+    box_put_zeros(b, 24);
+    box_put32(b, 2);
+    box_end(b, at);
+
+    size_t trak = box_begin(b, "trak");
+    at = box_begin_full(b, "tkhd", 0, 0x3);
+    box_put32(b, 0);
+    box_put32(b, 0);
+    box_put32(b, 1);
+    box_put32(b, 0);
+    box_put32(b, 0);
+    box_put_zeros(b, 8);
+    box_put16(b, 0);
+    box_put16(b, 0);
+    box_put16(b, 0x0100);
+    box_put16(b, 0);
+    box_put_matrix(b);
+    box_put32(b, 0);
+    box_put32(b, 0);
+    box_end(b, at);
+
+    size_t mdia = box_begin(b, "mdia");
+    at = box_begin_full(b, "mdhd", 0, 0);
+    box_put32(b, 0);
+    box_put32(b, 0);
+    box_put32(b, (unsigned long)s->core.sample_rate);
+    box_put32(b, 0);
+    box_put16(b, 0x55C4); /* und */
+    box_put16(b, 0);
+    box_end(b, at);
+    at = box_begin_full(b, "hdlr", 0, 0);
+    box_put32(b, 0);
+    box_put_bytes(b, "soun", 4);
+    box_put_zeros(b, 12);
+    box_put_bytes(b, "SoundHandler", 13);
+    box_end(b, at);
+
+    size_t minf = box_begin(b, "minf");
+    at = box_begin_full(b, "smhd", 0, 0);
+    box_put32(b, 0);
+    box_end(b, at);
+    size_t dinf = box_begin(b, "dinf");
+    at = box_begin_full(b, "dref", 0, 0);
+    box_put32(b, 1);
+    box_end(b, box_begin_full(b, "url ", 0, 1));
+    box_end(b, at);
+    box_end(b, dinf);
+
+    size_t stbl = box_begin(b, "stbl");
+    at = box_begin_full(b, "stsd", 0, 0);
+    box_put32(b, 1);
+    size_t entry = box_begin(b, "ec-3");
+    box_put_zeros(b, 6);
+    box_put16(b, 1);
+    box_put_zeros(b, 8);
+    box_put16(b, 2);
+    box_put16(b, 16);
+    box_put32(b, 0);
+    box_put32(b, (unsigned long)s->core.sample_rate << 16);
+    cmaf_put_dec3(b, s);
+    box_end(b, entry);
+    box_end(b, at);
+    static const char *const empty_tables[] = {"stts", "stsc", "stco"};
+    for (int i = 0; i < 3; ++i) {
+        at = box_begin_full(b, empty_tables[i], 0, 0);
+        box_put32(b, 0);
+        box_end(b, at);
+    }
+    at = box_begin_full(b, "stsz", 0, 0);
+    box_put32(b, 0);
+    box_put32(b, 0);
+    box_end(b, at);
+    box_end(b, stbl);
+    box_end(b, minf);
+    box_end(b, mdia);
+    box_end(b, trak);
+
+    size_t mvex = box_begin(b, "mvex");
+    at = box_begin_full(b, "trex", 0, 0);
+    box_put32(b, 1);
+    box_put32(b, 1);
+    box_put32(b, (unsigned long)s->au_samples);
+    box_put32(b, 0);
+    box_put32(b, 0x02000000UL); /* sample_depends_on = 2：每个访问单元都可独立解码 */
+    box_end(b, at);
+    box_end(b, mvex);
+    box_end(b, moov);
+}
+
+/* sidx（version 1）：references 为 0 时只写头部 */
+static void cmaf_build_sidx(BoxBuffer *b, const CmafStreamInfo *s, const CmafFragment *refs, int count,
+                            unsigned long long first_offset) {
+    size_t at = box_begin_full(b, "sidx", 1, 0);
+    box_put32(b, 1);
+    box_put32(b, (unsigned long)s->core.sample_rate);
+    box_put64(b, 0);
+    box_put64(b, first_offset);
+    box_put16(b, 0);
+    box_put16(b, (unsigned)count);
+    for (int i = 0; i < count; ++i) {
+        box_put32(b, (unsigned long)(refs[i].size & 0x7FFFFFFFULL));
+        box_put32(b, (unsigned long)refs[i].duration);
+        box_put32(b, 0x90000000UL); /* starts_with_SAP = 1，SAP_type = 1 */
+    }
+    box_end(b, at);
+}
+
+typedef struct {
+    FILE *out;
+    const CmafStreamInfo *stream;
+    BoxBuffer moof;
+    BoxBuffer mdat;              /* 当前分片的样本数据 */
+    unsigned long *sample_sizes;
+    unsigned long *sample_durations;
+    int sample_count;
+    int sample_cap;
+    unsigned long long decode_time;
+    unsigned long long offset;   /* 下一个分片在文件中的偏移 */
+    unsigned long sequence;
+    CmafFragment *fragments;
+    int fragment_count;
+    int fragment_cap;
+} CmafWriter;
+
+/* 当前访问单元的字节已追加到 mdat，登记为一个 sample */
+static int cmaf_end_sample(CmafWriter *w, unsigned long size, unsigned long duration) {
+    if (w->sample_count == w->sample_cap) {
+        int cap = w->sample_cap ? w->sample_cap * 2 : 256;
+        unsigned long *sizes = (unsigned long *)realloc(w->sample_sizes, sizeof(unsigned long) * (size_t)cap);
+        if (!sizes) return 0;
+        w->sample_sizes = sizes;
+        unsigned long *durations = (unsigned long *)realloc(w->sample_durations, sizeof(unsigned long) * (size_t)cap);
+        if (!durations) return 0;
+        w->sample_durations = durations;
+        w->sample_cap = cap;
+    }
+    w->sample_sizes[w->sample_count] = size;
+    w->sample_durations[w->sample_count] = duration;
+    w->sample_count++;
+    return 1;
+}
+
+/* 写出当前分片：moof（mfhd + traf：tfhd/tfdt/trun）+ mdat，时长不一致时在 trun 中逐样本给出 */
+static int cmaf_flush_fragment(CmafWriter *w) {
+    if (w->sample_count == 0) return 1;
+    unsigned long default_duration = w->sample_durations[0];
+    unsigned long long duration = 0;
+    int uniform = 1;
+    for (int i = 0; i < w->sample_count; ++i) {
+        duration += w->sample_durations[i];
+        if (w->sample_durations[i] != default_duration) uniform = 0;
+    }
+
+    BoxBuffer *b = &w->moof;
+    b->len = 0;
+    size_t moof = box_begin(b, "moof");
+    size_t at = box_begin_full(b, "mfhd", 0, 0);
+    box_put32(b, ++w->sequence);
+    box_end(b, at);
+    size_t traf = box_begin(b, "traf");
+    at = box_begin_full(b, "tfhd", 0, uniform ? 0x020008UL : 0x020000UL); /* default-base-is-moof */
+    box_put32(b, 1);
+    if (uniform) box_put32(b, default_duration);
+    box_end(b, at);
+    at = box_begin_full(b, "tfdt", 1, 0);
+    box_put64(b, w->decode_time);
+    box_end(b, at);
+    at = box_begin_full(b, "trun", 0, uniform ? 0x000201UL : 0x000301UL);
+    box_put32(b, (unsigned long)w->sample_count);
+    size_t data_offset_at = b->len;
+    box_put32(b, 0);
+    for (int i = 0; i < w->sample_count; ++i) {
+        if (!uniform) box_put32(b, w->sample_durations[i]);
+        box_put32(b, w->sample_sizes[i]);
+    }
+    box_end(b, at);
+    box_end(b, traf);
+    box_end(b, moof);
+    box_patch32(b, data_offset_at, (unsigned long)(b->len + 8));
+    box_put32(b, (unsigned long)(w->mdat.len + 8));
+    box_put_bytes(b, "mdat", 4);
+    if (b->failed) return 0;
+
+    if (fwrite(b->data, 1, b->len, w->out) != b->len) return 0;
+    if (w->mdat.len > 0 && fwrite(w->mdat.data, 1, w->mdat.len, w->out) != w->mdat.len) return 0;
+
+    if (w->fragment_count == w->fragment_cap) {
+        int cap = w->fragment_cap ? w->fragment_cap * 2 : 64;
+        CmafFragment *fragments = (CmafFragment *)realloc(w->fragments, sizeof(CmafFragment) * (size_t)cap);
+        if (!fragments) return 0;
+        w->fragments = fragments;
+        w->fragment_cap = cap;
+    }
+    CmafFragment *f = &w->fragments[w->fragment_count++];
+    f->offset = w->offset;
+    f->size = (unsigned long long)b->len + w->mdat.len;
+    f->duration = duration;
+    w->offset += f->size;
+    w->decode_time += duration;
+    w->mdat.len = 0;
+    w->sample_count = 0;
+    return 1;
+}
+
+/* 实际分片多于预留条目时，把相邻分片合并成子段，使条目数不超过 limit；返回子段数 */
+static int cmaf_merge_references(const CmafFragment *fragments, int count, int limit, CmafFragment *refs) {
+    int per_ref = limit > 0 ? (count + limit - 1) / limit : count;
+    if (per_ref < 1) per_ref = 1;
+    int n = 0;
+    for (int i = 0; i < count; i += per_ref) {
+        refs[n] = fragments[i];
+        for (int j = i + 1; j < count && j < i + per_ref; ++j) {
+            refs[n].size += fragments[j].size;
+            refs[n].duration += fragments[j].duration;
+        }
+        n++;
+    }
+    return n;
+}
+
+/* 读首个访问单元，得到 dec3 所需的流参数与每个访问单元的大小和采样数 */
+static int cmaf_probe_stream(const char *path, CmafStreamInfo *s) {
+    unsigned char head[64];
+    long long pos = 0;
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    memset(s, 0, sizeof(*s));
+    for (;;) {
+        Eac3FrameInfo info;
+        if (file_seek64(f, pos) != 0) break;
+        size_t got = fread(head, 1, sizeof(head), f);
+        int size = parse_eac3_header(head, got, &info);
+        if (size <= 0) break;
+        int starts_au = info.strmtyp != 1 && info.substreamid == 0;
+        if (starts_au && s->au_bytes > 0) break;
+        if (s->au_bytes == 0) {
+            if (!starts_au || info.bsid <= 8) break;
+            s->core = info;
+            s->au_samples = info.blocks * 256;
+        } else if (info.strmtyp == 1) {
+            s->dependent_count++;
+            if (info.chanmap > 0) s->dependent_chanmap |= info.chanmap;
+        }
+        s->au_bytes += size;
+        pos += size;
+    }
+    fclose(f);
+    return s->au_bytes > 0;
+}
+
+static void cmaf_format_seconds(double seconds, char *out, size_t out_size) {
+    snprintf(out, out_size, "PT%.3fS", seconds);
+}
+
+/* HLS：单文件字节范围播放列表，EXT-X-MAP 指向初始化段，每个子段一条 */
+static int cmaf_write_hls(const char *media_path, unsigned long long init_size, const CmafStreamInfo *s,
+                          const CmafFragment *refs, int count) {
+    char path[1024];
+    double max_seconds = 0.0;
+    replace_extension(media_path, path, sizeof(path), ".m3u8");
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        job_warn("无法写入 HLS 播放列表: %s\n", path);
+        return 1;
+    }
+    for (int i = 0; i < count; ++i) {
+        double seconds = (double)refs[i].duration / s->core.sample_rate;
+        if (seconds > max_seconds) max_seconds = seconds;
+    }
+    /* EXT-X-TARGETDURATION 不得小于任何一段的时长，向上取整 */
+    int target = (int)max_seconds + (max_seconds > (int)max_seconds ? 1 : 0);
+    fprintf(f, "#EXTM3U\n#EXT-X-VERSION:7\n#EXT-X-TARGETDURATION:%d\n#EXT-X-PLAYLIST-TYPE:VOD\n#EXT-X-INDEPENDENT-SEGMENTS\n",
+            target);
+    fprintf(f, "#EXT-X-MAP:URI=\"%s\",BYTERANGE=\"%llu@0\"\n", path_file_name(media_path), init_size);
+    for (int i = 0; i < count; ++i) {
+        fprintf(f, "#EXTINF:%.6f,\n#EXT-X-BYTERANGE:%llu@%llu\n%s\n", (double)refs[i].duration / s->core.sample_rate,
+                refs[i].size, refs[i].offset, path_file_name(media_path));
+    }
+    fprintf(f, "#EXT-X-ENDLIST\n");
+    int failed = ferror(f);
+    if (fclose(f) != 0 || failed) return 1;
+    job_note("已生成 HLS 播放列表: %s\n", path);
+    return 0;
+}
+
+/* DASH：on-demand profile，SegmentBase 的 indexRange 指向 sidx；JOC 按 Dolby 的 SupplementalProperty 声明 */
+static int cmaf_write_dash(const char *media_path, unsigned long long init_size, unsigned long long sidx_size,
+                           const CmafStreamInfo *s, unsigned long long total_samples, double max_fragment) {
+    char path[1024];
+    char duration[32];
+    char buffer[32];
+    replace_extension(media_path, path, sizeof(path), ".mpd");
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        job_warn("无法写入 DASH 清单: %s\n", path);
+        return 1;
+    }
+    cmaf_format_seconds((double)total_samples / s->core.sample_rate, duration, sizeof(duration));
+    cmaf_format_seconds(max_fragment > 0.0 ? max_fragment : 2.0, buffer, sizeof(buffer));
+    fprintf(f, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    fprintf(f, "<MPD xmlns=\"urn:mpeg:dash:schema:mpd:2011\" profiles=\"urn:mpeg:dash:profile:isoff-on-demand:2011\" "
+               "type=\"static\" mediaPresentationDuration=\"%s\" minBufferTime=\"%s\">\n", duration, buffer);
+    fprintf(f, "  <Period id=\"0\" start=\"PT0S\">\n");
+    fprintf(f, "    <AdaptationSet id=\"0\" contentType=\"audio\" mimeType=\"audio/mp4\" lang=\"und\" "
+               "segmentAlignment=\"true\" startWithSAP=\"1\">\n");
+    fprintf(f, "      <Representation id=\"0\" codecs=\"ec-3\" bandwidth=\"%d\" audioSamplingRate=\"%d\">\n",
+            cmaf_data_rate_kbps(s) * 1000, s->core.sample_rate);
+    fprintf(f, "        <AudioChannelConfiguration schemeIdUri=\"tag:dolby.com,2014:dash:audio_channel_configuration:2011\" "
+               "value=\"%04X\"/>\n", cmaf_channel_mask(s));
+    if (s->core.joc) {
+        fprintf(f, "        <SupplementalProperty schemeIdUri=\"tag:dolby.com,2018:dash:EC3_ExtensionType:2018\" value=\"JOC\"/>\n");
+        fprintf(f, "        <SupplementalProperty schemeIdUri=\"tag:dolby.com,2018:dash:EC3_ExtensionComplexityIndex:2018\" "
+                   "value=\"%d\"/>\n", s->core.joc_complexity);
+    }
+    fprintf(f, "        <BaseURL>%s</BaseURL>\n", path_file_name(media_path));
+    fprintf(f, "        <SegmentBase indexRange=\"%llu-%llu\">\n", init_size, init_size + sidx_size - 1);
+    fprintf(f, "          <Initialization range=\"0-%llu\"/>\n", init_size - 1);
+    fprintf(f, "        </SegmentBase>\n      </Representation>\n    </AdaptationSet>\n  </Period>\n</MPD>\n");
+    int failed = ferror(f);
+    if (fclose(f) != 0 || failed) return 1;
+    job_note("已生成 DASH 清单: %s\n", path);
+    return 0;
+}
+
+/* 把 E-AC-3 基本流封装为分片 MP4；失败时删除不完整的输出 */
+static int cmaf_package_file(const char *source_path, const char *target_path, const CmafOptions *options) {
+    CmafStreamInfo stream;
+    CmafWriter w;
+    ByteReader r;
+    BoxBuffer head = {0};
+    CmafFragment *refs = NULL;
+    int ok = 0;
+    int ref_count = 0;
+    double started = monotonic_seconds();
+
+    if (!cmaf_probe_stream(source_path, &stream)) {
+        job_warn("CMAF 封装失败: %s 不是 E-AC-3 基本流\n", source_path);
+        return 1;
+    }
+    long long source_size = file_size_of(source_path);
+    unsigned long long fragment_samples = (unsigned long long)(options->fragment_seconds * stream.core.sample_rate + 0.5);
+    if (fragment_samples < (unsigned long long)stream.au_samples) fragment_samples = (unsigned long long)stream.au_samples;
+    /* 分片在访问单元边界切开，预留条目按每片访问单元数向上取整估算 */
+    unsigned long long aus_per_fragment = (fragment_samples + (unsigned long long)stream.au_samples - 1) / (unsigned long long)stream.au_samples;
+    long long estimated_aus = source_size / stream.au_bytes + 1;
+    int reserved = (int)((unsigned long long)estimated_aus / aus_per_fragment) + 1 + CMAF_SIDX_SLACK;
+
+    memset(&w, 0, sizeof(w));
+    w.stream = &stream;
+    ensure_parent_directory(target_path);
+    w.out = fopen(target_path, "wb");
+    if (!w.out) {
+        job_warn("CMAF 封装失败: 无法写入 %s\n", target_path);
+        return 1;
+    }
+    if (!reader_open(&r, source_path, CMAF_READ_BUFFER, source_size)) {
+        fclose(w.out);
+        remove_file_if_exists(target_path);
+        job_warn("CMAF 封装失败: 无法读取 %s\n", source_path);
+        return 1;
+    }
+
+    cmaf_build_init(&head, &stream);
+    unsigned long long init_size = head.len;
+    unsigned long long sidx_reserved = CMAF_SIDX_HEADER + (unsigned long long)reserved * CMAF_SIDX_ENTRY;
+    box_put_zeros(&head, (size_t)sidx_reserved);
+    if (head.failed || fwrite(head.data, 1, head.len, w.out) != head.len) goto done;
+    w.offset = head.len;
+
+    job_note("CMAF 封装: %s -> %s（%d Hz，%d kbps%s，分片 %.2f 秒）\n", source_path, target_path,
+           stream.core.sample_rate, cmaf_data_rate_kbps(&stream), stream.core.joc ? "，JOC" : "",
+           (double)aus_per_fragment * stream.au_samples / stream.core.sample_rate);
+
+    /*
+     * 逐帧读取并直接追加到 mdat：遇到下一个访问单元的独立帧时上一个访问单元成为一个 sample，
+     * 分片攒够时长后先写出，再追加新访问单元的帧
+     */
+    long long pos = 0;
+    unsigned long au_bytes = 0;
+    unsigned long au_duration = 0;
+    unsigned long long fragment_filled = 0;
+    for (;;) {
+        Eac3FrameInfo info;
+        if (cancel_requested()) goto done;
+        size_t avail = reader_fill(&r, 64);
+        int size = avail > 0 ? parse_eac3_header(r.buf + r.pos, avail, &info) : 0;
+        int starts_au = size > 0 && info.strmtyp != 1 && info.substreamid == 0;
+        if (avail == 0 || starts_au) {
+            if (au_bytes > 0) {
+                if (!cmaf_end_sample(&w, au_bytes, au_duration)) goto done;
+                fragment_filled += au_duration;
+                au_bytes = 0;
+            }
+            if (avail == 0 || fragment_filled >= fragment_samples) {
+                if (!cmaf_flush_fragment(&w)) goto done;
+                fragment_filled = 0;
+            }
+            if (avail == 0) break;
+            au_duration = (unsigned long)info.blocks * 256;
+        }
+        if (size <= 0) {
+            job_warn("CMAF 封装失败: %s 在偏移 %lld 处失步\n", source_path, pos);
+            goto done;
+        }
+        if (reader_fill(&r, (size_t)size) < (size_t)size) {
+            job_warn("CMAF 封装失败: %s 末尾的帧被截断（偏移 %lld）\n", source_path, pos);
+            goto done;
+        }
+        box_put_bytes(&w.mdat, r.buf + r.pos, (size_t)size);
+        if (w.mdat.failed) goto done;
+        r.pos += (size_t)size;
+        au_bytes += (unsigned long)size;
+        pos += size;
+    }
+
+    /* 回填 sidx，剩余的预留空间写成 free box */
+    refs = (CmafFragment *)malloc(sizeof(CmafFragment) * (size_t)(w.fragment_count > 0 ? w.fragment_count : 1));
+    if (!refs) goto done;
+    ref_count = cmaf_merge_references(w.fragments, w.fragment_count, reserved, refs);
+    if (ref_count < w.fragment_count) {
+        job_note("CMAF 封装: 分片数 %d 超过预留的 %d 个 sidx 条目，每 %d 个分片合并为一个子段\n",
+               w.fragment_count, reserved, (w.fragment_count + ref_count - 1) / ref_count);
+    }
+    head.len = 0;
+    unsigned long long sidx_size = CMAF_SIDX_HEADER + (unsigned long long)ref_count * CMAF_SIDX_ENTRY;
+    unsigned long long free_size = sidx_reserved - sidx_size;
+    cmaf_build_sidx(&head, &stream, refs, ref_count, free_size);
+    if (free_size > 0) {
+        box_put32(&head, (unsigned long)free_size);
+        box_put_bytes(&head, "free", 4);
+        box_put_zeros(&head, (size_t)(free_size - 8));
+    }
+    if (head.failed || file_seek64(w.out, (long long)init_size) != 0 || fwrite(head.data, 1, head.len, w.out) != head.len) goto done;
+    if (fflush(w.out) != 0) goto done;
+    ok = 1;
+
+done:
+    reader_close(&r);
+    if (w.out && fclose(w.out) != 0) ok = 0;
+    if (!ok) {
+        if (!cancel_requested()) job_warn("CMAF 封装失败: 写入 %s 出错\n", target_path);
+        remove_file_if_exists(target_path);
+    } else {
+        unsigned long long total = w.decode_time;
+        double max_fragment = 0.0;
+        for (int i = 0; i < ref_count; ++i) {
+            double seconds = (double)refs[i].duration / stream.core.sample_rate;
+            if (seconds > max_fragment) max_fragment = seconds;
+        }
+        job_note("CMAF 封装完成: %d 个分片，%d 个 sidx 条目，时长 %.3f 秒，用时 %.2f 秒\n", w.fragment_count, ref_count,
+               (double)total / stream.core.sample_rate, monotonic_seconds() - started);
+        if ((options->manifests & CMAF_MANIFEST_HLS) && cmaf_write_hls(target_path, init_size, &stream, refs, ref_count) != 0) ok = 0;
+        if ((options->manifests & CMAF_MANIFEST_DASH) &&
+            cmaf_write_dash(target_path, init_size, CMAF_SIDX_HEADER + (unsigned long long)ref_count * CMAF_SIDX_ENTRY,
+                            &stream, total, max_fragment) != 0) ok = 0;
+    }
+    free(refs);
+    free(head.data);
+    free(w.moof.data);
+    free(w.mdat.data);
+    free(w.sample_sizes);
+    free(w.sample_durations);
+    free(w.fragments);
+    return ok ? 0 : 1;
+}
+
+// --------- 分片 MP4 封装结束 ---------
+
+// --------- 测试素材：合成 ADM BWF（--make-adm） ---------
+/*
+ * 生成结构合法的 ADM BWF，供解析、校验与 I/O 路径的测试和基准使用，不需要真实母版。
+ * --adm-spec 为逗号分隔的 key=value：beds（7.1.4/7.1.2/7.1/5.1/2.0/0）、objects、rate、bits（16/24/32）、
+ * seconds、container（bw64/rf64/riff）、signal（tone/silence）、defect（以 + 连接多个缺陷：
+ * missing-chna、missing-axml、bad-chna、bad-size、truncated）。
+ * chna 与 axml 在写入前一次生成，音频按 PUBLISH_CHUNK 为单位重复写同一块可无缝循环的波形，速度只受磁盘限制。
+ */
+#define ADM_MAX_CHANNELS 128
+
+#define ADM_DEFECT_MISSING_CHNA 0x01u
+#define ADM_DEFECT_MISSING_AXML 0x02u
+#define ADM_DEFECT_BAD_CHNA     0x04u   /* chna 的轨道数与 axml 不符，且引用不存在的 pack */
+#define ADM_DEFECT_BAD_SIZE     0x08u   /* 头部声明的 data 大小比实际多一秒 */
+#define ADM_DEFECT_TRUNCATED    0x10u   /* 头部完整，数据在一半处截断（不落在帧边界） */
+
+typedef struct {
+    char beds[16];
+    int objects;
+    int rate;
+    int bits;
+    double seconds;
+    char container[8];
+    int tone;
+    unsigned defects;
+    char title[128];      /* audioProgrammeName/audioContentName */
+} AdmSpec;
+
+typedef struct {
+    const char *label;    /* BS.2051 扬声器标签 */
+    const char *name;
+    double azimuth;
+    double elevation;
+} AdmSpeaker;
+
+/* 床声道按 Dolby 的声道顺序：L R C LFE Lss Rss Lrs Rrs 顶置... */
+static const AdmSpeaker adm_speakers_714[] = {
+    {"M+030", "RoomCentricLeft", 30.0, 0.0},   {"M-030", "RoomCentricRight", -30.0, 0.0},
+    {"M+000", "RoomCentricCenter", 0.0, 0.0},  {"LFE1", "RoomCentricLFE", 0.0, -30.0},
+    {"M+090", "RoomCentricLeftSideSurround", 90.0, 0.0}, {"M-090", "RoomCentricRightSideSurround", -90.0, 0.0},
+    {"M+135", "RoomCentricLeftRearSurround", 135.0, 0.0}, {"M-135", "RoomCentricRightRearSurround", -135.0, 0.0},
+    {"U+045", "RoomCentricLeftTopFront", 45.0, 30.0}, {"U-045", "RoomCentricRightTopFront", -45.0, 30.0},
+    {"U+135", "RoomCentricLeftTopRear", 135.0, 30.0}, {"U-135", "RoomCentricRightTopRear", -135.0, 30.0},
+};
+static const AdmSpeaker adm_speakers_712_top[] = {
+    {"U+090", "RoomCentricLeftTopSurround", 90.0, 30.0}, {"U-090", "RoomCentricRightTopSurround", -90.0, 30.0},
+};
+static const AdmSpeaker adm_speakers_51_surround[] = {
+    {"M+110", "RoomCentricLeftSurround", 110.0, 0.0}, {"M-110", "RoomCentricRightSurround", -110.0, 0.0},
+};
+
+/* 按床格式列出扬声器，返回声道数；未知格式返回 -1 */
+static int adm_bed_layout(const char *beds, const AdmSpeaker **out) {
+    if (strcmp(beds, "0") == 0 || case_equal(beds, "none")) return 0;
+    if (strcmp(beds, "2.0") == 0) { for (int i = 0; i < 2; ++i) out[i] = &adm_speakers_714[i]; return 2; }
+    if (strcmp(beds, "5.1") == 0) {
+        for (int i = 0; i < 4; ++i) out[i] = &adm_speakers_714[i];
+        out[4] = &adm_speakers_51_surround[0];
+        out[5] = &adm_speakers_51_surround[1];
+        return 6;
+    }
+    if (strcmp(beds, "7.1") == 0) { for (int i = 0; i < 8; ++i) out[i] = &adm_speakers_714[i]; return 8; }
+    if (strcmp(beds, "7.1.2") == 0) {
+        for (int i = 0; i < 8; ++i) out[i] = &adm_speakers_714[i];
+        out[8] = &adm_speakers_712_top[0];
+        out[9] = &adm_speakers_712_top[1];
+        return 10;
+    }
+    if (strcmp(beds, "7.1.4") == 0) { for (int i = 0; i < 12; ++i) out[i] = &adm_speakers_714[i]; return 12; }
+    return -1;
+}
+
+static void adm_spec_parse(const char *text, AdmSpec *spec) {
+    char buf[512];
+    memset(spec, 0, sizeof(*spec));
+    copy_string(spec->beds, sizeof(spec->beds), "7.1.4");
+    spec->objects = 16;
+    spec->rate = 48000;
+    spec->bits = 24;
+    spec->seconds = 60.0;
+    copy_string(spec->container, sizeof(spec->container), "bw64");
+    spec->tone = 1;
+    copy_string(spec->title, sizeof(spec->title), "Fixture");
+    copy_string(buf, sizeof(buf), text ? text : "");
+    for (char *item = strtok(buf, ","); item; item = strtok(NULL, ",")) {
+        char *eq = strchr(item, '=');
+        if (!eq) continue;
+        *eq = '\0';
+        const char *value = eq + 1;
+        if (strcmp(item, "beds") == 0) copy_string(spec->beds, sizeof(spec->beds), value);
+        else if (strcmp(item, "objects") == 0) spec->objects = atoi(value);
+        else if (strcmp(item, "rate") == 0) spec->rate = atoi(value);
+        else if (strcmp(item, "bits") == 0) spec->bits = atoi(value);
+        else if (strcmp(item, "seconds") == 0) spec->seconds = atof(value);
+        else if (strcmp(item, "container") == 0) copy_string(spec->container, sizeof(spec->container), value);
+        else if (strcmp(item, "signal") == 0) spec->tone = !case_equal(value, "silence");
+        else if (strcmp(item, "defect") == 0) {
+            char defects[256];
+            copy_string(defects, sizeof(defects), value);
+            for (char *d = defects; d && *d; ) {
+                char *next = strchr(d, '+');
+                if (next) *next++ = '\0';
+                if (case_equal(d, "missing-chna")) spec->defects |= ADM_DEFECT_MISSING_CHNA;
+                else if (case_equal(d, "missing-axml")) spec->defects |= ADM_DEFECT_MISSING_AXML;
+                else if (case_equal(d, "bad-chna")) spec->defects |= ADM_DEFECT_BAD_CHNA;
+                else if (case_equal(d, "bad-size")) spec->defects |= ADM_DEFECT_BAD_SIZE;
+                else if (case_equal(d, "truncated")) spec->defects |= ADM_DEFECT_TRUNCATED;
+                else if (*d && !case_equal(d, "none")) fprintf(stderr, "警告: 未知缺陷类型 %s，已忽略。\n", d);
+                d = next;
+            }
+        } else {
+            fprintf(stderr, "警告: 未知 --adm-spec 字段 %s，已忽略。\n", item);
+        }
+    }
+}
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} TextBuffer;
+
+static void text_appendf(TextBuffer *tb, const char *fmt, ...) {
+    va_list args;
+    for (;;) {
+        size_t room = tb->cap - tb->len;
+        va_start(args, fmt);
+        int n = tb->data ? vsnprintf(tb->data + tb->len, room, fmt, args) : -1;
+        va_end(args);
+        if (n >= 0 && (size_t)n < room) {
+            tb->len += (size_t)n;
+            return;
+        }
+        size_t cap = tb->cap ? tb->cap * 2 : 65536;
+        while (n >= 0 && cap - tb->len <= (size_t)n) cap *= 2;
+        char *grown = (char *)realloc(tb->data, cap);
+        if (!grown) return;
+        tb->data = grown;
+        tb->cap = cap;
+    }
+}
+
+static void adm_timecode(double seconds, char *out, size_t out_size) {
+    long long whole = (long long)seconds;
+    long long fraction = (long long)((seconds - (double)whole) * 100000.0 + 0.5);
+    snprintf(out, out_size, "%02lld:%02lld:%02lld.%05lld", whole / 3600, (whole / 60) % 60, whole % 60, fraction);
+}
+
+/* 一条轨道对应一组 pack/channel/stream/track 格式；床共用一个 DirectSpeakers pack，每个对象一个 Objects pack */
+static void adm_track_ids(int track, int bed_channels, char *pack, char *channel, char *stream, char *track_format) {
+    int is_bed = track < bed_channels;
+    unsigned type = is_bed ? 0x0001u : 0x0003u;
+    unsigned pack_index = is_bed ? 0x1001u : 0x1001u + (unsigned)(track - bed_channels);
+    unsigned channel_index = is_bed ? 0x1001u + (unsigned)track : pack_index;
+    sprintf(pack, "AP_%04X%04X", type, pack_index);
+    sprintf(channel, "AC_%04X%04X", type, channel_index);
+    sprintf(stream, "AS_%04X%04X", type, channel_index);
+    sprintf(track_format, "AT_%04X%04X_01", type, channel_index);
+}
+
+static void adm_build_axml(const AdmSpec *spec, const AdmSpeaker **bed, int bed_channels, TextBuffer *tb) {
+    int channels = bed_channels + spec->objects;
+    char duration[32];
+    char pack[16], channel[16], stream[16], track_format[20];
+    adm_timecode(spec->seconds, duration, sizeof(duration));
+
+    text_appendf(tb, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                     "<ebuCoreMain xmlns:dc=\"http://purl.org/dc/elements/1.1/\" xmlns=\"urn:ebu:metadata-schema:ebuCore_2014\" "
+                     "schema=\"EBU_CORE_20140201.xsd\" xml:lang=\"en\">\n<coreMetadata>\n<format>\n"
+                     "<audioFormatExtended version=\"ITU-R_BS.2076-2\">\n");
+    text_appendf(tb, "<audioProgramme audioProgrammeID=\"APR_1001\" audioProgrammeName=\"%s\" "
+                     "start=\"00:00:00.00000\" end=\"%s\">\n<audioContentIDRef>ACO_1001</audioContentIDRef>\n</audioProgramme>\n",
+                 spec->title, duration);
+    text_appendf(tb, "<audioContent audioContentID=\"ACO_1001\" audioContentName=\"%s\">\n", spec->title);
+    if (bed_channels) text_appendf(tb, "<audioObjectIDRef>AO_1001</audioObjectIDRef>\n");
+    for (int i = 0; i < spec->objects; ++i) text_appendf(tb, "<audioObjectIDRef>AO_%04X</audioObjectIDRef>\n", 0x1002 + i);
+    text_appendf(tb, "</audioContent>\n");
+
+    /* audioObject：床一个，对象各一个 */
+    if (bed_channels) {
+        text_appendf(tb, "<audioObject audioObjectID=\"AO_1001\" audioObjectName=\"Bed %s\" start=\"00:00:00.00000\" duration=\"%s\">\n"
+                         "<audioPackFormatIDRef>AP_00011001</audioPackFormatIDRef>\n", spec->beds, duration);
+        for (int t = 0; t < bed_channels; ++t) text_appendf(tb, "<audioTrackUIDRef>ATU_%08X</audioTrackUIDRef>\n", t + 1);
+        text_appendf(tb, "</audioObject>\n");
+    }
+    for (int i = 0; i < spec->objects; ++i) {
+        int t = bed_channels + i;
+        adm_track_ids(t, bed_channels, pack, channel, stream, track_format);
+        text_appendf(tb, "<audioObject audioObjectID=\"AO_%04X\" audioObjectName=\"Object %d\" start=\"00:00:00.00000\" duration=\"%s\">\n"
+                         "<audioPackFormatIDRef>%s</audioPackFormatIDRef>\n<audioTrackUIDRef>ATU_%08X</audioTrackUIDRef>\n</audioObject>\n",
+                     0x1002 + i, i + 1, duration, pack, t + 1);
+    }
+
+    /* audioPackFormat */
+    if (bed_channels) {
+        text_appendf(tb, "<audioPackFormat audioPackFormatID=\"AP_00011001\" audioPackFormatName=\"Bed %s\" "
+                         "typeLabel=\"0001\" typeDefinition=\"DirectSpeakers\">\n", spec->beds);
+        for (int t = 0; t < bed_channels; ++t) {
+            adm_track_ids(t, bed_channels, pack, channel, stream, track_format);
+            text_appendf(tb, "<audioChannelFormatIDRef>%s</audioChannelFormatIDRef>\n", channel);
+        }
+        text_appendf(tb, "</audioPackFormat>\n");
+    }
+    for (int i = 0; i < spec->objects; ++i) {
+        adm_track_ids(bed_channels + i, bed_channels, pack, channel, stream, track_format);
+        text_appendf(tb, "<audioPackFormat audioPackFormatID=\"%s\" audioPackFormatName=\"Object %d\" typeLabel=\"0003\" typeDefinition=\"Objects\">\n"
+                         "<audioChannelFormatIDRef>%s</audioChannelFormatIDRef>\n</audioPackFormat>\n", pack, i + 1, channel);
+    }
+
+    /* audioChannelFormat：床按扬声器位置，对象沿水平面均匀分布、奇数号抬高 30 度 */
+    for (int t = 0; t < channels; ++t) {
+        int is_bed = t < bed_channels;
+        adm_track_ids(t, bed_channels, pack, channel, stream, track_format);
+        if (is_bed) {
+            const AdmSpeaker *sp = bed[t];
+            text_appendf(tb, "<audioChannelFormat audioChannelFormatID=\"%s\" audioChannelFormatName=\"%s\" typeLabel=\"0001\" typeDefinition=\"DirectSpeakers\">\n"
+                             "<audioBlockFormat audioBlockFormatID=\"AB_%s_00000001\">\n<speakerLabel>%s</speakerLabel>\n"
+                             "<position coordinate=\"azimuth\">%.1f</position>\n<position coordinate=\"elevation\">%.1f</position>\n"
+                             "<position coordinate=\"distance\">1.0</position>\n</audioBlockFormat>\n</audioChannelFormat>\n",
+                         channel, sp->name, channel + 3, sp->label, sp->azimuth, sp->elevation);
+        } else {
+            int i = t - bed_channels;
+            double azimuth = 180.0 - 360.0 * (i + 0.5) / (spec->objects > 0 ? spec->objects : 1);
+            text_appendf(tb, "<audioChannelFormat audioChannelFormatID=\"%s\" audioChannelFormatName=\"Object %d\" typeLabel=\"0003\" typeDefinition=\"Objects\">\n"
+                             "<audioBlockFormat audioBlockFormatID=\"AB_%s_00000001\" rtime=\"00:00:00.00000\" duration=\"%s\">\n"
+                             "<position coordinate=\"azimuth\">%.1f</position>\n<position coordinate=\"elevation\">%.1f</position>\n"
+                             "<position coordinate=\"distance\">1.0</position>\n<gain>1.0</gain>\n</audioBlockFormat>\n</audioChannelFormat>\n",
+                         channel, i + 1, channel + 3, duration, azimuth, (i & 1) ? 30.0 : 0.0);
+        }
+    }
+
+    /* audioStreamFormat / audioTrackFormat / audioTrackUID */
+    for (int t = 0; t < channels; ++t) {
+        adm_track_ids(t, bed_channels, pack, channel, stream, track_format);
+        text_appendf(tb, "<audioStreamFormat audioStreamFormatID=\"%s\" audioStreamFormatName=\"PCM_%s\" formatLabel=\"0001\" formatDefinition=\"PCM\">\n"
+                         "<audioChannelFormatIDRef>%s</audioChannelFormatIDRef>\n<audioTrackFormatIDRef>%s</audioTrackFormatIDRef>\n</audioStreamFormat>\n"
+                         "<audioTrackFormat audioTrackFormatID=\"%s\" audioTrackFormatName=\"PCM_%s\" formatLabel=\"0001\" formatDefinition=\"PCM\">\n"
+                         "<audioStreamFormatIDRef>%s</audioStreamFormatIDRef>\n</audioTrackFormat>\n",
+                     stream, channel, channel, track_format, track_format, channel, stream);
+    }
+    for (int t = 0; t < channels; ++t) {
+        text_appendf(tb, "<audioTrackUID UID=\"ATU_%08X\" sampleRate=\"%d\" bitDepth=\"%d\"/>\n", t + 1, spec->rate, spec->bits);
+    }
+    text_appendf(tb, "</audioFormatExtended>\n</format>\n</coreMetadata>\n</ebuCoreMain>\n");
+}
+
+/* chna：每条轨道一项（trackIndex 2 + UID 12 + trackRef 14 + packRef 11 + 填充 1 = 40 字节） */
+static void adm_build_chna(const AdmSpec *spec, int bed_channels, TextBuffer *tb) {
+    int channels = bed_channels + spec->objects;
+    int entries = (spec->defects & ADM_DEFECT_BAD_CHNA) && channels > 1 ? channels - 1 : channels;
+    char pack[16], channel[16], stream[16], track_format[20];
+    unsigned char head[4];
+    head[0] = (unsigned char)(channels & 0xFF);
+    head[1] = (unsigned char)(channels >> 8);
+    head[2] = (unsigned char)(entries & 0xFF);
+    head[3] = (unsigned char)(entries >> 8);
+    tb->data = (char *)malloc(4 + 40 * (size_t)entries);
+    if (!tb->data) return;
+    memcpy(tb->data, head, 4);
+    tb->len = 4;
+    for (int t = 0; t < entries; ++t) {
+        unsigned char *entry = (unsigned char *)tb->data + tb->len;
+        char uid[16];
+        adm_track_ids(t, bed_channels, pack, channel, stream, track_format);
+        if ((spec->defects & ADM_DEFECT_BAD_CHNA) && t == entries - 1) copy_string(pack, sizeof(pack), "AP_0003FFFF");
+        snprintf(uid, sizeof(uid), "ATU_%08X", t + 1);
+        memset(entry, 0, 40);
+        entry[0] = (unsigned char)((t + 1) & 0xFF);
+        entry[1] = (unsigned char)((t + 1) >> 8);
+        memcpy(entry + 2, uid, 12);
+        memcpy(entry + 14, track_format, 14);
+        memcpy(entry + 28, pack, 11);
+        tb->len += 40;
+    }
+}
+
+static void put_le16(unsigned char *p, unsigned v) {
+    p[0] = (unsigned char)(v & 0xFF);
+    p[1] = (unsigned char)((v >> 8) & 0xFF);
+}
+
+static void put_le32(unsigned char *p, unsigned long v) {
+    for (int i = 0; i < 4; ++i) p[i] = (unsigned char)((v >> (8 * i)) & 0xFF);
+}
+
+static void put_le64(unsigned char *p, unsigned long long v) {
+    for (int i = 0; i < 8; ++i) p[i] = (unsigned char)((v >> (8 * i)) & 0xFF);
+}
+
+/*
+ * 头部：RIFF/BW64 + ds64（RIFF 时为同样大小的 JUNK，便于之后升级为 BW64）+ fmt + chna + axml + data 块头。
+ * chna/axml 的 data 为 NULL 时不写该块。align 非 0 时在 data 前插入 JUNK，使 data 内容的起点 ≡ align_offset (mod align)，
+ * 便于按文件系统块对齐后克隆音频数据。RIFF 超过 4 GB 或内存不足时返回 NULL
+ */
+static unsigned char *adm_build_header(const char *container, int channels, int rate, int bits, const TextBuffer *chna,
+                                       const TextBuffer *axml, unsigned long long declared_data, size_t align,
+                                       size_t align_offset, size_t *header_size) {
+    int riff = case_equal(container, "riff") || case_equal(container, "wav");
+    long long frame_bytes = (long long)channels * (bits / 8);
+    size_t header_cap = 12 + 36 + 24 + 8 + chna->len + 1 + 8 + axml->len + 1 + 8 + align + 8;
+    unsigned char *header = (unsigned char *)calloc(1, header_cap);
+    if (!header) {
+        job_warn("内存不足，无法生成 ADM 头部。\n");
+        return NULL;
+    }
+    size_t pos = 12;
+    memcpy(header + pos, riff ? "JUNK" : "ds64", 4);
+    put_le32(header + pos + 4, 28);
+    size_t ds64_pos = pos + 8;
+    pos += 36;
+    memcpy(header + pos, "fmt ", 4);
+    put_le32(header + pos + 4, 16);
+    put_le16(header + pos + 8, 1);
+    put_le16(header + pos + 10, (unsigned)channels);
+    put_le32(header + pos + 12, (unsigned long)rate);
+    put_le32(header + pos + 16, (unsigned long)(rate * frame_bytes));
+    put_le16(header + pos + 20, (unsigned)frame_bytes);
+    put_le16(header + pos + 22, (unsigned)bits);
+    pos += 24;
+    if (chna->data) {
+        memcpy(header + pos, "chna", 4);
+        put_le32(header + pos + 4, (unsigned long)chna->len);
+        memcpy(header + pos + 8, chna->data, chna->len);
+        pos += 8 + chna->len + (chna->len & 1);
+    }
+    if (axml->data) {
+        memcpy(header + pos, "axml", 4);
+        put_le32(header + pos + 4, (unsigned long)axml->len);
+        memcpy(header + pos + 8, axml->data, axml->len);
+        pos += 8 + axml->len + (axml->len & 1);
+    }
+    if (align) {
+        /* JUNK 块至少 8 字节，差额不足时多补一个 align */
+        size_t pad = (align_offset % align + align - (pos + 8) % align) % align;
+        if (pad > 0 && pad < 8) pad += align;
+        if (pad > 0) {
+            memcpy(header + pos, "JUNK", 4);
+            put_le32(header + pos + 4, (unsigned long)(pad - 8));
+            pos += pad;
+        }
+    }
+    memcpy(header + pos, "data", 4);
+    size_t data_size_pos = pos + 4;
+    pos += 8;
+    *header_size = pos;
+
+    unsigned long long riff_size = pos - 8 + declared_data + (declared_data & 1);
+    if (riff && riff_size > 0xFFFFFFFFull) {
+        job_warn("RIFF 容器不能超过 4 GB（当前 %.2f GB），请使用 container=bw64。\n", riff_size / 1073741824.0);
+        free(header);
+        return NULL;
+    }
+    memcpy(header, riff ? "RIFF" : case_equal(container, "rf64") ? "RF64" : "BW64", 4);
+    memcpy(header + 8, "WAVE", 4);
+    if (riff) {
+        put_le32(header + 4, (unsigned long)riff_size);
+        put_le32(header + data_size_pos, (unsigned long)declared_data);
+    } else {
+        put_le32(header + 4, 0xFFFFFFFFul);
+        put_le32(header + data_size_pos, 0xFFFFFFFFul);
+        put_le64(header + ds64_pos, riff_size);
+        put_le64(header + ds64_pos + 8, declared_data);
+        put_le64(header + ds64_pos + 16, declared_data / (unsigned long long)frame_bytes);
+    }
+    return header;
+}
+
+#ifndef DEE_LIBRARY
+/*
+ * 填充一整块音频：每个声道一个三角波，周期取块长的整数分之一，块与块首尾相接无断点，
+ * 因此整个文件只需重复写同一块。电平约 -20 dBFS，各声道频率不同，便于肉眼区分。
+ */
+static void adm_fill_pattern(unsigned char *buf, long long frames, int channels, int bytes_per_sample, int rate, int tone) {
+    long long frame_bytes = (long long)channels * bytes_per_sample;
+    memset(buf, 0, (size_t)(frames * frame_bytes));
+    if (!tone) return;
+    double full_scale = (double)(1LL << (bytes_per_sample * 8 - 1)) * 0.1;
+    for (int c = 0; c < channels; ++c) {
+        double target_hz = 110.0 * (1 + c % 16);
+        long long cycles = (long long)(target_hz * (double)frames / rate + 0.5);
+        if (cycles < 1) cycles = 1;
+        for (long long n = 0; n < frames; ++n) {
+            /* 相位 0..1：三角波在 0.25 处达到峰值 */
+            double phase = (double)((n * cycles) % frames) / (double)frames;
+            double value = phase < 0.25 ? phase * 4.0 : phase < 0.75 ? 2.0 - phase * 4.0 : phase * 4.0 - 4.0;
+            long long sample = (long long)(value * full_scale);
+            unsigned char *p = buf + n * frame_bytes + (long long)c * bytes_per_sample;
+            for (int b = 0; b < bytes_per_sample; ++b) p[b] = (unsigned char)((unsigned long long)sample >> (8 * b));
+        }
+    }
+}
+
+static int make_adm_fixture(const char *path, const char *spec_text) {
+    AdmSpec spec;
+    const AdmSpeaker *bed[16];
+    TextBuffer axml = {0};
+    TextBuffer chna = {0};
+    adm_spec_parse(spec_text, &spec);
+
+    int bed_channels = adm_bed_layout(spec.beds, bed);
+    int channels = bed_channels + spec.objects;
+    int bytes_per_sample = spec.bits / 8;
+    int riff = case_equal(spec.container, "riff") || case_equal(spec.container, "wav");
+    if (bed_channels < 0 || spec.objects < 0 || channels < 1 || channels > ADM_MAX_CHANNELS ||
+        (spec.bits != 16 && spec.bits != 24 && spec.bits != 32) || spec.rate < 8000 || spec.seconds <= 0.0 ||
+        (!riff && !case_equal(spec.container, "bw64") && !case_equal(spec.container, "rf64"))) {
+        fprintf(stderr, "无效的 --adm-spec：beds=%s objects=%d rate=%d bits=%d seconds=%.3f container=%s（声道总数 1-%d）\n",
+                spec.beds, spec.objects, spec.rate, spec.bits, spec.seconds, spec.container, ADM_MAX_CHANNELS);
+        return 1;
+    }
+
+    long long frame_bytes = (long long)channels * bytes_per_sample;
+    long long frames = (long long)(spec.seconds * spec.rate + 0.5);
+    unsigned long long data_bytes = (unsigned long long)(frames * frame_bytes);
+    unsigned long long written_bytes = spec.defects & ADM_DEFECT_TRUNCATED ? data_bytes / 2 + 1 : data_bytes;
+    unsigned long long declared_data = spec.defects & ADM_DEFECT_BAD_SIZE ? data_bytes + (unsigned long long)spec.rate * frame_bytes : data_bytes;
+
+    if (!(spec.defects & ADM_DEFECT_MISSING_AXML)) adm_build_axml(&spec, bed, bed_channels, &axml);
+    if (!(spec.defects & ADM_DEFECT_MISSING_CHNA)) adm_build_chna(&spec, bed_channels, &chna);
+    if ((!(spec.defects & ADM_DEFECT_MISSING_AXML) && !axml.data) || (!(spec.defects & ADM_DEFECT_MISSING_CHNA) && !chna.data)) {
+        free(axml.data);
+        free(chna.data);
+        fprintf(stderr, "内存不足，无法生成 ADM 元数据。\n");
+        return 1;
+    }
+
+    size_t header_size;
+    unsigned char *header = adm_build_header(spec.container, channels, spec.rate, spec.bits, &chna, &axml, declared_data, 0, 0,
+                                             &header_size);
+    if (!header) {
+        free(axml.data);
+        free(chna.data);
+        return 1;
+    }
+
+    RawFile out;
+    void *buffer = publish_buffer_alloc();
+    ensure_parent_directory(path);
+    if (!buffer || !raw_open(&out, path, 1)) {
+        fprintf(stderr, "无法创建文件: %s\n", path);
+        publish_buffer_free(buffer);
+        free(header);
+        free(axml.data);
+        free(chna.data);
+        return 1;
+    }
+
+    double started = monotonic_seconds();
+    int ok = raw_write_all(&out, header, header_size);
+    long long block_frames = PUBLISH_CHUNK / frame_bytes;
+    size_t block_bytes = (size_t)(block_frames * frame_bytes);
+    adm_fill_pattern((unsigned char *)buffer, block_frames, channels, bytes_per_sample, spec.rate, spec.tone);
+    for (unsigned long long done = 0; ok && done < written_bytes && !cancel_requested(); ) {
+        unsigned long long left = written_bytes - done;
+        size_t n = left < block_bytes ? (size_t)left : block_bytes;
+        ok = raw_write_all(&out, buffer, n);
+        done += n;
+    }
+    /* 奇数长度的 data 块按 RIFF 规则补一个填充字节；截断的文件不补 */
+    if (ok && (written_bytes & 1) && !(spec.defects & ADM_DEFECT_TRUNCATED)) ok = raw_write_all(&out, "\0", 1);
+    ok = raw_close(&out, 1) && ok && !cancel_requested();
+    double seconds = monotonic_seconds() - started;
+
+    if (ok) {
+        long long size = file_size_of(path);
+        printf("已生成 ADM BWF: %s\n", path);
+        printf("  容器 %s，床 %s（%d 声道）+ %d 个对象 = %d 声道，%d Hz / %d bit，时长 %.3f 秒%s\n",
+               riff ? "RIFF" : case_equal(spec.container, "rf64") ? "RF64" : "BW64", spec.beds, bed_channels,
+               spec.objects, channels, spec.rate, spec.bits, spec.seconds, spec.tone ? "" : "（静音）");
+        printf("  chna %zu 字节，axml %zu 字节，文件 %.2f MB，写入 %.1f 秒（%.1f MB/s）\n", chna.len, axml.len,
+               size / (1024.0 * 1024.0), seconds, seconds > 0.0 ? size / (1024.0 * 1024.0) / seconds : 0.0);
+        if (spec.defects) {
+            printf("  注入缺陷:%s%s%s%s%s\n", spec.defects & ADM_DEFECT_MISSING_CHNA ? " missing-chna" : "",
+                   spec.defects & ADM_DEFECT_MISSING_AXML ? " missing-axml" : "", spec.defects & ADM_DEFECT_BAD_CHNA ? " bad-chna" : "",
+                   spec.defects & ADM_DEFECT_BAD_SIZE ? " bad-size" : "", spec.defects & ADM_DEFECT_TRUNCATED ? " truncated" : "");
+        }
+    } else {
+        fprintf(stderr, "写入 %s 失败或已取消 (errno=%d)\n", path, errno);
+        remove_file_if_exists(path);
+    }
+    publish_buffer_free(buffer);
+    free(header);
+    free(axml.data);
+    free(chna.data);
+    return ok ? 0 : 1;
+}
+#endif
+// --------- 测试素材结束 ---------
+
+// --------- 临时盘（scratch）选择与吞吐探测 ---------
+#define SCRATCH_PROBE_BYTES (64LL << 20)
+#define SCRATCH_PROBE_CHUNK (4 << 20)
+#define SCRATCH_CACHE_MAX_AGE (7 * 24 * 3600)
+
+typedef struct {
+    char path[512];
+    long long free_bytes;
+    double write_mbps;
+    double read_mbps;
+    long long probed_at;    /* 0 表示没有探测结果 */
+} ScratchCandidate;
+
+static long long volume_free_bytes(const char *dir) {
+#ifdef _WIN32
+    ULARGE_INTEGER available;
+    if (!GetDiskFreeSpaceExA(dir, &available, NULL, NULL)) return -1;
+    return (long long)available.QuadPart;
+#else
+    struct statvfs st;
+    if (statvfs(dir, &st) != 0) return -1;
+    return (long long)st.f_bavail * (long long)st.f_frsize;
+#endif
+}
+
+/*
+ * 顺序写入 64 MB（绕过缓存并落盘）再读回，得到近似的持续吞吐。
+ * Windows 用 FILE_FLAG_NO_BUFFERING + 页对齐缓冲；POSIX 写后 fsync，读前丢弃页缓存。
+ */
+static int scratch_probe(ScratchCandidate *c) {
+    char probe_path[600];
+    double started;
+    long long done = 0;
+    build_path(probe_path, sizeof(probe_path), c->path, "dolby_scratch_probe.tmp");
+#ifdef _WIN32
+    unsigned char *buf = (unsigned char *)VirtualAlloc(NULL, SCRATCH_PROBE_CHUNK, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!buf) return 0;
+    for (int i = 0; i < SCRATCH_PROBE_CHUNK; ++i) buf[i] = (unsigned char)(i * 131 + 7);
+    HANDLE h = CreateFileA(probe_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                           FILE_FLAG_NO_BUFFERING | FILE_FLAG_WRITE_THROUGH, NULL);
+    if (h == INVALID_HANDLE_VALUE) {
+        VirtualFree(buf, 0, MEM_RELEASE);
+        return 0;
+    }
+    started = monotonic_seconds();
+    while (done < SCRATCH_PROBE_BYTES) {
+        DWORD written = 0;
+        if (!WriteFile(h, buf, SCRATCH_PROBE_CHUNK, &written, NULL) || written == 0) break;
+        done += written;
+    }
+    FlushFileBuffers(h);
+    CloseHandle(h);
+    double write_seconds = monotonic_seconds() - started;
+    int ok = done >= SCRATCH_PROBE_BYTES;
+    long long read_done = 0;
+    double read_seconds = 0.0;
+    if (ok) {
+        h = CreateFileA(probe_path, GENERIC_READ, 0, NULL, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, NULL);
+        if (h != INVALID_HANDLE_VALUE) {
+            started = monotonic_seconds();
+            DWORD got = 0;
+            while (ReadFile(h, buf, SCRATCH_PROBE_CHUNK, &got, NULL) && got > 0) read_done += got;
+            read_seconds = monotonic_seconds() - started;
+            CloseHandle(h);
+        }
+    }
+    VirtualFree(buf, 0, MEM_RELEASE);
+#else
+    unsigned char *buf = (unsigned char *)malloc(SCRATCH_PROBE_CHUNK);
+    if (!buf) return 0;
+    for (int i = 0; i < SCRATCH_PROBE_CHUNK; ++i) buf[i] = (unsigned char)(i * 131 + 7);
+    int fd = open(probe_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        free(buf);
+        return 0;
+    }
+    started = monotonic_seconds();
+    while (done < SCRATCH_PROBE_BYTES) {
+        ssize_t written = write(fd, buf, SCRATCH_PROBE_CHUNK);
+        if (written <= 0) break;
+        done += written;
+    }
+    fsync(fd);
+    close(fd);
+    double write_seconds = monotonic_seconds() - started;
+    int ok = done >= SCRATCH_PROBE_BYTES;
+    long long read_done = 0;
+    double read_seconds = 0.0;
+    if (ok) {
+        fd = open(probe_path, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            started = monotonic_seconds();
+            ssize_t got;
+            while ((got = read(fd, buf, SCRATCH_PROBE_CHUNK)) > 0) read_done += got;
+            read_seconds = monotonic_seconds() - started;
+            close(fd);
+        }
+    }
+    free(buf);
+#endif
+    remove(probe_path);
+    if (!ok || read_done < SCRATCH_PROBE_BYTES) return 0;
+    if (write_seconds < 1e-6) write_seconds = 1e-6;
+    if (read_seconds < 1e-6) read_seconds = 1e-6;
+    c->write_mbps = (double)done / (1024.0 * 1024.0) / write_seconds;
+    c->read_mbps = (double)read_done / (1024.0 * 1024.0) / read_seconds;
+    c->probed_at = (long long)time(NULL);
+    return 1;
+}
+
+/* 探测结果缓存在 DolbyTemp\scratch_probe.txt，每行一个目录 */
+static void scratch_cache_load(const char *cache_path, ScratchCandidate *list, int count) {
+    FILE *f = fopen(cache_path, "r");
+    char line[1024];
+    if (!f) return;
+    long long now = (long long)time(NULL);
+    while (fgets(line, sizeof(line), f)) {
+        trim_newline(line);
+        ScratchCandidate entry;
+        memset(&entry, 0, sizeof(entry));
+        for (char *field = strtok(line, "\t"); field; field = strtok(NULL, "\t")) {
+            char *eq = strchr(field, '=');
+            if (!eq) continue;
+            *eq = '\0';
+            if (strcmp(field, "path") == 0) copy_string(entry.path, sizeof(entry.path), eq + 1);
+            else if (strcmp(field, "write_mbps") == 0) entry.write_mbps = atof(eq + 1);
+            else if (strcmp(field, "read_mbps") == 0) entry.read_mbps = atof(eq + 1);
+            else if (strcmp(field, "probed_at") == 0) entry.probed_at = atoll(eq + 1);
+        }
+        if (entry.probed_at <= 0 || now - entry.probed_at > SCRATCH_CACHE_MAX_AGE) continue;
+        for (int i = 0; i < count; ++i) {
+            if (case_equal(list[i].path, entry.path)) {
+                list[i].write_mbps = entry.write_mbps;
+                list[i].read_mbps = entry.read_mbps;
+                list[i].probed_at = entry.probed_at;
+            }
+        }
+    }
+    fclose(f);
+}
+
+static void scratch_cache_save(const char *cache_path, const ScratchCandidate *list, int count) {
+    FILE *f = fopen(cache_path, "w");
+    if (!f) return;
+    for (int i = 0; i < count; ++i) {
+        if (list[i].probed_at <= 0) continue;
+        fprintf(f, "path=%s\twrite_mbps=%.1f\tread_mbps=%.1f\tprobed_at=%lld\n",
+                list[i].path, list[i].write_mbps, list[i].read_mbps, list[i].probed_at);
+    }
+    fclose(f);
+}
+
+static double scratch_score(const ScratchCandidate *c) {
+    if (c->probed_at <= 0) return 0.0;
+    return c->write_mbps < c->read_mbps ? c->write_mbps : c->read_mbps;
+}
+
+/*
+ * 在 --scratch / DEE_SCRATCH 给出的候选目录中选出剩余空间足够、吞吐最高的一个。
+ * 没有探测结果时按给出的顺序取第一个空间足够的目录。选中返回 1。
+ */
+static int select_scratch_dir(const char *temp_dir, long long needed_bytes, char *out, size_t out_size) {
+    ScratchCandidate list[SCRATCH_MAX];
+    char cache_path[1100];
+    int count = g_cli.scratch_count;
+    int best = -1;
+
+    if (count <= 0) return 0;
+    memset(list, 0, sizeof(list));
+    for (int i = 0; i < count; ++i) {
+        copy_string(list[i].path, sizeof(list[i].path), g_cli.scratch_dirs[i]);
+        normalize_slashes(list[i].path);
+        ensure_directory_exists(list[i].path);
+        list[i].free_bytes = volume_free_bytes(list[i].path);
+    }
+    build_path(cache_path, sizeof(cache_path), temp_dir, "scratch_probe.txt");
+    scratch_cache_load(cache_path, list, count);
+
+    if (g_cli.scratch_probe) {
+        for (int i = 0; i < count; ++i) {
+            if (list[i].free_bytes < SCRATCH_PROBE_BYTES * 2) continue;
+            job_note("探测临时盘吞吐: %s ...\n", list[i].path);
+            if (!scratch_probe(&list[i])) {
+                job_warn("警告: 临时盘 %s 探测失败，可能不可写。\n", list[i].path);
+                list[i].free_bytes = -1;
+            }
+        }
+        scratch_cache_save(cache_path, list, count);
+    }
+
+    for (int i = 0; i < count; ++i) {
+        const ScratchCandidate *c = &list[i];
+        char speed[64] = "";
+        if (c->probed_at > 0) snprintf(speed, sizeof(speed), "  写 %.0f MB/s  读 %.0f MB/s", c->write_mbps, c->read_mbps);
+        job_note("临时盘候选: %s  剩余 %.1f GB%s\n", c->path, c->free_bytes > 0 ? c->free_bytes / 1073741824.0 : 0.0, speed);
+        if (c->free_bytes < needed_bytes) continue;
+        if (best < 0 || scratch_score(c) > scratch_score(&list[best])) best = i;
+    }
+    if (best < 0) {
+        job_warn("警告: 没有剩余空间足够（需要 %.1f GB）的临时盘，沿用默认位置。\n", needed_bytes / 1073741824.0);
+        return 0;
+    }
+    copy_string(out, out_size, list[best].path);
+    job_note("使用临时盘: %s\n", out);
+    return 1;
+}
+// --------- 临时盘选择结束 ---------
+
+// --------- 编码任务：阶段划分与断点续跑日志 ---------
+typedef enum {
+    STAGE_DEE = 0,  /* dee 主编码（choice 1-3 直接产出最终文件，4/5 产出 MLP） */
+    STAGE_DEEW,     /* deew 生成 7.1ch DDP */
+    STAGE_DEEZY,    /* deezy 生成 Atmos Blu-ray EC3 */
+    STAGE_REMUX,    /* ffmpeg 封装为最终 m4a */
+    STAGE_DEE_MLP,  /* 多格式输出时与 DDP 并行的 TrueHD pass */
+    STAGE_COUNT
+} StageId;
+
+static const char *const stage_names[STAGE_COUNT] = {"dee", "deew", "deezy", "remux", "dee_mlp"};
+/* encode.h 对外公布的阶段数必须与这里一致 */
+typedef char stage_count_matches_header[STAGE_COUNT == DEE_STAGE_COUNT ? 1 : -1];
+typedef char queue_levels_match_header[QUEUE_URGENT == DEE_QUEUE_URGENT && QUEUE_BACKGROUND == DEE_QUEUE_BACKGROUND ? 1 : -1];
+
+typedef struct {
+    int done;
+    char artifact[1024];
+    long long size;
+    unsigned long long hash;
+} StageCheckpoint;
+
+typedef struct {
+    int enabled;
+    char path[1024];
+    char job_key[17];
+    StageCheckpoint stages[STAGE_COUNT];
+} JobJournal;
+
+/* 一个任务最多登记的新建文件：两个 dee pass 的产物与日志、deew/deezy 的候选产物与转封装目标 */
+#define JOB_CLAIMS_MAX 16
+
+typedef struct {
+    int choice;
+    char start[64];
+    char end[64];
+    char prepend_silence[64];
+    char append_silence[64];
+    char input_file[512];
+    char output_file[512];
+    char final_output_path[512];
+    char template_xml[1024];
+    char dee_exe_path[1024];
+    char temp_xml_path[1024];
+    char temp_dir_path[1024];
+    char dee_output_target[512];      /* dee 的 -o 目标 */
+    char intermediate_mlp_path[512];
+    char post_source_path[1024];      /* deew/deezy 产物，作为 ffmpeg 输入 */
+    unsigned formats;                 /* --formats 选择的交付格式（OUTPUT_FORMAT_*），0 表示按 choice 输出单一格式 */
+    char ec3_output[512];
+    char m4a_output[512];
+    char mlp_output[512];
+    char template_ec3[1024];
+    char template_m4a[1024];
+    char template_mlp[1024];
+    char scratch_temp_dir[1024];      /* dee --temp 的根目录；未选临时盘时为空，使用 temp_dir_path */
+    char label[32];                   /* 批量模式下子进程输出的前缀，如 "j3"；单任务为空，直接使用控制台 */
+    char bitrate[16];                 /* 码率（kbps）：覆盖 DDP 模板的 data_rate 与 deew/deezy 的 1664；为空时保持默认 */
+    char xml_overrides[1024];         /* 任务 XML 覆盖（“路径=值” 以 ; 分隔），见任务 XML 覆盖一节 */
+    unsigned long long affinity;      /* 任务级核心集与线程上限（--sweep 的组合），0 表示按 --affinity/--threads */
+    int max_threads;
+    char key_scope[96];               /* 任务标识的附加区分：--sweep 的组合带上线程与核心集维度，普通任务为空 */
+    int queue_level;                  /* 队列优先级（QUEUE_*）：批量调度的启动顺序与抢占 */
+    ResourceUsage *usage;             /* 非空时累计本任务全部子进程的 CPU 时间与峰值内存 */
+    double started_at;                /* 第一个阶段开始的时刻（monotonic_seconds） */
+    double stage_seconds[STAGE_COUNT];/* 各阶段实际耗时，写入任务历史 */
+    double qc_seconds;
+    char staged_input[1024];          /* --prefetch stage 复制到本地的输入副本，dee 优先读取；任务结束时删除 */
+    char adm_input[1024];             /* 普通 WAV 床自动封装成的 ADM BWF，dee 优先读取；任务结束时删除 */
+    char shared_input[1024];          /* 多段导出各段共用的 ADM 封装，由整组在全部结束后删除 */
+    int adm_state;                    /* AdmWrapState，在 g_console_lock 下读写 */
+    int prefetch_state;               /* PrefetchState，在 g_console_lock 下读写 */
+    volatile int prefetch_urgent;     /* dee 已在等待暂存，取消限速 */
+    JobJournal journal;
+    char claimed[JOB_CLAIMS_MAX][512];/* 本次运行新建的文件（阶段开始写入时还不存在），取消时只删这些；在 g_console_lock 下读写 */
+    int claimed_count;
+} EncodeJob;
+
+static long long file_mtime_of(const char *path) {
+#ifdef _WIN32
+    struct _stati64 st;
+    if (_stati64(path, &st) != 0) return 0;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0) return 0;
+#endif
+    return (long long)st.st_mtime;
+}
+
+/* 任务标识只由“会影响产物内容”的参数决定，不含输出路径：GUI 每次都会换一个临时输出名 */
+static void compute_job_key(const EncodeJob *job, char *out, size_t out_size) {
+    char material[4096];
+    int len = snprintf(material, sizeof(material), "%d|%u|%s|%s|%s|%s|%s|%lld|%s|%lld|%lld",
+             job->choice, job->formats, job->start, job->end, job->prepend_silence, job->append_silence,
+             job->template_xml, file_mtime_of(job->template_xml),
+             job->input_file, file_size_of(job->input_file), file_mtime_of(job->input_file));
+    /* 以下字段只在设置时参与计算，未设置时与旧版本的任务标识一致，断点仍可复用 */
+    if (job->bitrate[0] && len > 0 && len < (int)sizeof(material)) {
+        len += snprintf(material + len, sizeof(material) - (size_t)len, "|b=%s", job->bitrate);
+    }
+    if (job->key_scope[0] && len > 0 && len < (int)sizeof(material)) {
+        len += snprintf(material + len, sizeof(material) - (size_t)len, "|k=%s", job->key_scope);
+    }
+    if (job->xml_overrides[0] && len > 0 && len < (int)sizeof(material)) {
+        snprintf(material + len, sizeof(material) - (size_t)len, "|x=%s", job->xml_overrides);
+    }
+    snprintf(out, out_size, "%016llx", xxh64_string(material));
+}
+
+/* 按任务实际渲染的模板校验 XML 覆盖：多格式任务为各 dee pass 的模板 */
+static int job_xml_overrides_valid(const EncodeJob *job) {
+    const char *templates[2];
+    int count = 0;
+    if (!job->xml_overrides[0]) return 1;
+    if (job->formats) {
+        if (job->formats & OUTPUT_FORMAT_EC3) templates[count++] = job->template_ec3;
+        else if (job->formats & OUTPUT_FORMAT_M4A) templates[count++] = job->template_m4a;
+        if (job->formats & OUTPUT_FORMAT_MLP) templates[count++] = job->template_mlp;
+    } else {
+        templates[count++] = job->template_xml;
+    }
+    return xml_overrides_check(templates, count, job->xml_overrides);
+}
+
+static int stage_from_name(const char *name) {
+    for (int i = 0; i < STAGE_COUNT; ++i) {
+        if (strcmp(name, stage_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+/* 读取日志。每行以 commit=1 结尾，断电造成的半行会被忽略；同一阶段以最后一条为准 */
+static void journal_load(JobJournal *journal) {
+    FILE *f = fopen(journal->path, "r");
+    char line[2048];
+    memset(journal->stages, 0, sizeof(journal->stages));
+    if (!f) return;
+    while (fgets(line, sizeof(line), f)) {
+        trim_newline(line);
+        if (!strstr(line, "\tcommit=1")) continue;
+        StageCheckpoint cp;
+        int stage = -1;
+        int invalidated = 0;
+        memset(&cp, 0, sizeof(cp));
+        char *field = strtok(line, "\t");
+        while (field) {
+            char *eq = strchr(field, '=');
+            if (eq) {
+                *eq = '\0';
+                const char *value = eq + 1;
+                if (strcmp(field, "stage") == 0) stage = stage_from_name(value);
+                else if (strcmp(field, "size") == 0) cp.size = atoll(value);
+                else if (strcmp(field, "xxh64") == 0) cp.hash = strtoull(value, NULL, 16);
+                else if (strcmp(field, "artifact") == 0) copy_string(cp.artifact, sizeof(cp.artifact), value);
+                else if (strcmp(field, "invalidated") == 0) invalidated = atoi(value);
+            }
+            field = strtok(NULL, "\t");
+        }
+        if (stage < 0) continue;
+        if (invalidated) {
+            memset(&journal->stages[stage], 0, sizeof(StageCheckpoint));
+        } else {
+            cp.done = 1;
+            journal->stages[stage] = cp;
+        }
+    }
+    fclose(f);
+}
+
+static void journal_append(JobJournal *journal, const char *line) {
+    FILE *f = fopen(journal->path, "a");
+    if (!f) {
+        job_warn("警告: 无法写入任务日志 %s (errno=%d)\n", journal->path, errno);
+        return;
+    }
+    fprintf(f, "%s\tcommit=1\n", line);
+    sync_file_to_disk(f);
+    fclose(f);
+}
+
+static void journal_open(JobJournal *journal, const EncodeJob *job, int resume) {
+    char jobs_dir[1024];
+    char file_name[64];
+    build_path(jobs_dir, sizeof(jobs_dir), job->temp_dir_path, "jobs");
+    ensure_directory_exists(jobs_dir);
+    compute_job_key(job, journal->job_key, sizeof(journal->job_key));
+    snprintf(file_name, sizeof(file_name), "%s.journal", journal->job_key);
+    build_path(journal->path, sizeof(journal->path), jobs_dir, file_name);
+    journal->enabled = 1;
+    if (resume) {
+        journal_load(journal);
+    } else {
+        memset(journal->stages, 0, sizeof(journal->stages));
+        remove_file_if_exists(journal->path);
+    }
+    if (!file_exists(journal->path)) {
+        char header[2048];
+        snprintf(header, sizeof(header), "job=%s\tchoice=%d\tinput=%s\toutput=%s",
+                 journal->job_key, job->choice, job->input_file, job->final_output_path);
+        journal_append(journal, header);
+    }
+}
+
+/* 阶段完成后记录产物的大小与哈希 */
+static void journal_record(JobJournal *journal, StageId stage, const char *artifact) {
+    if (!journal->enabled) return;
+    StageCheckpoint cp;
+    memset(&cp, 0, sizeof(cp));
+    if (!xxh64_file(artifact, &cp.hash, &cp.size)) {
+        job_warn("警告: 无法计算 %s 的哈希，阶段 %s 不记录断点。\n", artifact, stage_names[stage]);
+        return;
+    }
+    copy_string(cp.artifact, sizeof(cp.artifact), artifact);
+    cp.done = 1;
+    journal->stages[stage] = cp;
+    char line[2048];
+    snprintf(line, sizeof(line), "stage=%s\tsize=%lld\txxh64=%016llx\tartifact=%s",
+             stage_names[stage], cp.size, cp.hash, cp.artifact);
+    journal_append(journal, line);
+}
+
+static void journal_invalidate(JobJournal *journal, StageId stage) {
+    if (!journal->enabled || !journal->stages[stage].done) return;
+    memset(&journal->stages[stage], 0, sizeof(StageCheckpoint));
+    char line[128];
+    snprintf(line, sizeof(line), "stage=%s\tinvalidated=1", stage_names[stage]);
+    journal_append(journal, line);
+}
+
+/* 核对断点：产物仍在、大小一致且哈希一致才可复用 */
+static int journal_stage_valid(JobJournal *journal, StageId stage) {
+    StageCheckpoint *cp = &journal->stages[stage];
+    if (!journal->enabled || !cp->done) return 0;
+    if (file_size_of(cp->artifact) != cp->size) return 0;
+    unsigned long long hash = 0;
+    long long size = 0;
+    if (!xxh64_file(cp->artifact, &hash, &size) || hash != cp->hash || size != cp->size) {
+        job_note("阶段 %s 的产物 %s 与断点记录不一致，将重新执行。\n", stage_names[stage], cp->artifact);
+        return 0;
+    }
+    return 1;
+}
+
+static void journal_finish(JobJournal *journal) {
+    if (!journal->enabled) return;
+    remove_file_if_exists(journal->path);
+    journal->enabled = 0;
+}
+
+/* 取路径所在目录；无目录时返回 "."，盘符根目录保留反斜杠 */
+static void directory_of(const char *path, char *dir, size_t dir_size) {
+    copy_string(dir, dir_size, path);
+    normalize_slashes(dir);
+    char *last_sep = strrchr(dir, '\\');
+    if (!last_sep) last_sep = strrchr(dir, '/');
+    if (last_sep) {
+        if (last_sep == dir + 2 && dir[1] == ':') {
+            *(last_sep + 1) = '\0';
+        } else {
+            *last_sep = '\0';
+        }
+    } else {
+        copy_string(dir, dir_size, ".");
+    }
+}
+
+typedef struct {
+    long long bytes;
+    int files;
+} ReclaimStats;
+
+static void reclaim_file(const char *path, ReclaimStats *stats) {
+    long long size = file_size_of(path);
+    if (size < 0 || !file_exists(path)) return;
+    if (remove(path) == 0) {
+        stats->bytes += size;
+        stats->files++;
+    } else {
+        job_warn("警告: 无法删除 %s (errno=%d)\n", path, errno);
+    }
+}
+
+/* 递归删除目录（dee 的 --temp 目录），统计回收的字节数 */
+static void reclaim_directory_tree(const char *dir, ReclaimStats *stats) {
+    char child[1024];
+#ifdef _WIN32
+    char pattern[1024];
+    WIN32_FIND_DATAA data;
+    build_path(pattern, sizeof(pattern), dir, "*");
+    HANDLE handle = FindFirstFileA(pattern, &data);
+    if (handle == INVALID_HANDLE_VALUE) return;
+    do {
+        if (strcmp(data.cFileName, ".") == 0 || strcmp(data.cFileName, "..") == 0) continue;
+        build_path(child, sizeof(child), dir, data.cFileName);
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            reclaim_directory_tree(child, stats);
+        } else {
+            reclaim_file(child, stats);
+        }
+    } while (FindNextFileA(handle, &data));
+    FindClose(handle);
+    RemoveDirectoryA(dir);
+#else
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        struct stat st;
+        snprintf(child, sizeof(child), "%s/%s", dir, entry->d_name);
+        if (lstat(child, &st) != 0) continue;
+        if (S_ISDIR(st.st_mode)) {
+            reclaim_directory_tree(child, stats);
+        } else {
+            reclaim_file(child, stats);
+        }
+    }
+    closedir(d);
+    rmdir(dir);
+#endif
+}
+
+/* 每个 dee pass 使用独立的 --temp 子目录，取消或完成后整体删除 */
+static void job_pass_temp_dir(const EncodeJob *job, StageId stage, char *out, size_t out_size) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s_%s", job->journal.job_key, stage_names[stage]);
+    build_path(out, out_size, job->scratch_temp_dir[0] ? job->scratch_temp_dir : job->temp_dir_path, name);
+}
+
+/* 已写入断点且仍有效的产物保留下来，重新运行时可直接续跑 */
+static int is_checkpoint_artifact(const EncodeJob *job, const char *path) {
+    if (!g_cli.resume_enabled || !job->journal.enabled) return 0;
+    for (int i = 0; i < STAGE_COUNT; ++i) {
+        if (job->journal.stages[i].done && strcmp(job->journal.stages[i].artifact, path) == 0) return 1;
+    }
+    return 0;
+}
+
+static void reclaim_job_file(const EncodeJob *job, const char *path, ReclaimStats *stats) {
+    if (!path || !path[0] || is_checkpoint_artifact(job, path)) return;
+    reclaim_file(path, stats);
+}
+
+/* dee 输出 MLP 时旁边生成的文件 */
+static const char *const mlp_side_extensions[] = {".mlp.mll", ".mll", ".mlp.log"};
+
+/*
+ * 取消后删除本次运行新建的文件（job_claim_output 登记的，含未写完的输出）与 --temp 目录，并报告回收的空间。
+ * 取消发生在写入某个文件的阶段之前时，那个路径上已有的文件（以前的交付物）不属于本任务，保持不动。
+ */
+static void reclaim_cancelled_job(EncodeJob *job) {
+    ReclaimStats stats = {0, 0};
+    char path[1024];
+
+    for (int i = 0; i < job->claimed_count; ++i) reclaim_job_file(job, job->claimed[i], &stats);
+    job_pass_temp_dir(job, STAGE_DEE, path, sizeof(path));
+    reclaim_directory_tree(path, &stats);
+    job_pass_temp_dir(job, STAGE_DEE_MLP, path, sizeof(path));
+    reclaim_directory_tree(path, &stats);
+
+    job_note("任务已取消：删除 %d 个未完成的中间文件，回收 %.2f MB (reclaimed_bytes=%lld)\n",
+           stats.files, stats.bytes / (1024.0 * 1024.0), stats.bytes);
+}
+
+// --------- DolbyTemp 空间管理：产物登记、配额与后台回收 ---------
+/*
+ * 任务开始时在 jobs\<任务标识>.owner 登记本任务的 --temp 目录与临时文件（连同进程号），正常结束时删除登记。
+ * 输出旁的中间文件（中间 MLP、deew/deezy 的产物）在阶段开始写入时才追加为 artifact 项，且只登记当时还不存在的路径
+ * （job_claim_output），同名的既有文件不会进登记。进程崩溃或被强杀后登记留下，回收时发现进程已不在就按登记删除：
+ * temp 项直接删除，artifact 项只删修改时间不早于其登记时刻的，且任务日志仍新鲜（--temp-keep 以内，可断点续跑）时保留。
+ * 最终交付物不登记，崩溃后也不删除：它可能已经完整写出，而且是唯一的一份。
+ * 没有登记的残留（旧版本或登记前崩溃）按文件名中的任务标识识别，超过一小时且不属于运行中的任务或新鲜的任务日志才回收。
+ * DolbyTemp 之外只会删除登记里的中间文件；GUI 在输入/输出目录留下的备份是用户文件本身，由 GUI 负责恢复，这里不碰。
+ * --temp-quota 限制 DolbyTemp（含临时盘上的 DolbyTemp）的总占用：超出时先回收孤儿，再按最久未用淘汰缓存
+ * （波形概览、静音帧、校准与码流编辑的工作目录）；仍不够时批量调度暂缓启动新的 dee，单任务给出警告。
+ * 后台回收线程以 idle I/O 优先级运行，每十分钟一轮。
+ */
+#define SPACE_GRACE_SECONDS 3600
+#define SPACE_GC_INTERVAL 600
+#define SPACE_KEYS_MAX 256
+#define SPACE_CACHE_MAX 4096
+#define SPACE_USAGE_TTL 10.0
+
+typedef struct {
+    long long total;          /* DolbyTemp（含临时盘）总占用 */
+    long long active;         /* 运行中任务的文件，以及一小时内、归属不明的文件 */
+    long long resumable;      /* 新鲜任务日志保护的断点产物 */
+    long long orphans;        /* 已退出任务遗留的中间文件，可立即回收 */
+    long long caches;         /* 可按最久未用淘汰的缓存 */
+    long long reclaimed;
+    int orphan_files;
+    int reclaimed_files;
+} SpaceReport;
+
+typedef struct {
+    char live[SPACE_KEYS_MAX][17];     /* 登记进程仍在运行 */
+    int live_count;
+    char dead[SPACE_KEYS_MAX][17];     /* 登记进程已退出，登记项已计入或回收 */
+    int dead_count;
+    char fresh[SPACE_KEYS_MAX][17];    /* 任务日志在保留期内 */
+    int fresh_count;
+} SpaceKeys;
+
+typedef struct {
+    char path[1024];
+    long long size;
+    long long mtime;
+} SpaceCacheEntry;
+
+/* 一轮扫描的上下文；collect 为 0 时只统计 */
+typedef struct {
+    const char *temp_dir;
+    int collect;
+    long long now;
+    long long keep_seconds;
+    volatile int *stop;
+    SpaceKeys keys;
+    SpaceReport *report;
+    SpaceCacheEntry *caches;
+    int cache_count;
+    const char *dir;           /* space_list_dir 回调中当前目录的用途 */
+} SpaceScan;
+
+typedef struct {
+    volatile int stop;
+    int threaded;
+    char temp_dir[1024];
+    worker_thread_t thread;
+} SpaceCollector;
+
+static SpaceCollector g_space_gc;
+static long long g_space_usage = -1;    /* 最近一次统计的总占用，在 g_console_lock 下读写 */
+static double g_space_measured_at;
+
+typedef void (*space_entry_fn)(const char *dir, const char *name, int is_dir, void *ctx);
+
+static void space_list_dir(const char *dir, space_entry_fn fn, void *ctx) {
+#ifdef _WIN32
+    char pattern[1024];
+    WIN32_FIND_DATAA data;
+    build_path(pattern, sizeof(pattern), dir, "*");
+    HANDLE handle = FindFirstFileA(pattern, &data);
+    if (handle == INVALID_HANDLE_VALUE) return;
+    do {
+        if (strcmp(data.cFileName, ".") == 0 || strcmp(data.cFileName, "..") == 0) continue;
+        fn(dir, data.cFileName, (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0, ctx);
+    } while (FindNextFileA(handle, &data));
+    FindClose(handle);
+#else
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *entry;
+    char child[1024];
+    while ((entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        struct stat st;
+        build_path(child, sizeof(child), dir, entry->d_name);
+        if (lstat(child, &st) != 0) continue;
+        fn(dir, entry->d_name, S_ISDIR(st.st_mode), ctx);
+    }
+    closedir(d);
+#endif
+}
+
+static void space_tree_entry(const char *dir, const char *name, int is_dir, void *ctx) {
+    char child[1024];
+    build_path(child, sizeof(child), dir, name);
+    if (is_dir) {
+        space_list_dir(child, space_tree_entry, ctx);
+    } else {
+        long long size = file_size_of(child);
+        if (size > 0) *(long long *)ctx += size;
+    }
+}
+
+/* 文件或整个目录树的大小；不存在时为 0 */
+static long long space_tree_bytes(const char *path) {
+    long long total = 0;
+    if (path_is_directory(path)) {
+        space_list_dir(path, space_tree_entry, &total);
+    } else {
+        total = file_size_of(path);
+    }
+    return total > 0 ? total : 0;
+}
+
+static void space_remove(const char *path, SpaceReport *r) {
+    ReclaimStats stats = {0, 0};
+    if (path_is_directory(path)) reclaim_directory_tree(path, &stats);
+    else reclaim_file(path, &stats);
+    r->reclaimed += stats.bytes;
+    r->reclaimed_files += stats.files;
+}
+
+/* 名称中独立出现的 16 位小写十六进制即任务标识（compute_job_key） */
+static int space_name_key(const char *name, char *key) {
+    for (const char *p = name; *p; ++p) {
+        if (p != name && isxdigit((unsigned char)p[-1])) continue;
+        int n = 0;
+        while (n < 16 && (isdigit((unsigned char)p[n]) || (p[n] >= 'a' && p[n] <= 'f'))) ++n;
+        if (n == 16 && !isxdigit((unsigned char)p[16])) {
+            memcpy(key, p, 16);
+            key[16] = '\0';
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int space_key_in(char keys[][17], int count, const char *key) {
+    for (int i = 0; i < count; ++i) {
+        if (strcmp(keys[i], key) == 0) return 1;
+    }
+    return 0;
+}
+
+static void space_key_add(char keys[][17], int *count, const char *key) {
+    if (*count < SPACE_KEYS_MAX && !space_key_in(keys, *count, key)) copy_string(keys[(*count)++], 17, key);
+}
+
+static int space_process_alive(long pid) {
+    if (pid <= 0) return 0;
+#ifdef _WIN32
+    HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, (DWORD)pid);
+    if (!process) return GetLastError() == ERROR_ACCESS_DENIED;
+    DWORD code = 0;
+    int alive = GetExitCodeProcess(process, &code) && code == STILL_ACTIVE;
+    CloseHandle(process);
+    return alive;
+#else
+    return kill((pid_t)pid, 0) == 0 || errno == EPERM;
+#endif
+}
+
+static long space_current_pid(void) {
+#ifdef _WIN32
+    return (long)GetCurrentProcessId();
+#else
+    return (long)getpid();
+#endif
+}
+
+static void space_owner_path(const char *temp_dir, const char *key, char *out, size_t out_size) {
+    char jobs_dir[1024];
+    char name[64];
+    build_path(jobs_dir, sizeof(jobs_dir), temp_dir, "jobs");
+    snprintf(name, sizeof(name), "%s.owner", key);
+    build_path(out, out_size, jobs_dir, name);
+}
+
+/* dee 临时文件与 MLP 中间文件都与输入同量级，另留 512 MB 余量 */
+static long long job_scratch_bytes(const EncodeJob *job) {
+    long long input_size = file_size_of(job->input_file);
+    return (input_size > 0 ? input_size * 2 : 0) + (512LL << 20);
+}
+
+/* 任务开始：登记本任务可能留下的中间文件；进程异常退出后由回收线程按登记清理 */
+static void space_ledger_open(const EncodeJob *job) {
+    char owner[1024];
+    char path[1100];
+    char dir[1024];
+    char name[600];
+    const char *key = job->journal.job_key;
+    const char *scratch = job->scratch_temp_dir[0] ? job->scratch_temp_dir : job->temp_dir_path;
+    if (!key[0]) return;
+
+    space_owner_path(job->temp_dir_path, key, owner, sizeof(owner));
+    FILE *f = fopen(owner, "w");
+    if (!f) {
+        job_warn("警告: 无法写入产物登记 %s (errno=%d)\n", owner, errno);
+        return;
+    }
+    fprintf(f, "pid=%ld\tstarted=%lld\n", space_current_pid(), (long long)time(NULL));
+    static const StageId dee_stages[] = {STAGE_DEE, STAGE_DEE_MLP};
+    for (int i = 0; i < 2; ++i) {
+        job_pass_temp_dir(job, dee_stages[i], path, sizeof(path));
+        fprintf(f, "temp=%s\n", path);
+        snprintf(name, sizeof(name), "temp_job_%s_%s.xml", key, stage_names[dee_stages[i]]);
+        build_path(path, sizeof(path), job->temp_dir_path, name);
+        fprintf(f, "temp=%s\n", path);
+    }
+    snprintf(name, sizeof(name), "%s_%s", key, path_file_name(job->input_file));
+    build_path(dir, sizeof(dir), scratch, "staged");
+    build_path(path, sizeof(path), dir, name);
+    fprintf(f, "temp=%s\ntemp=%s.partial\n", path, path);
+    build_path(dir, sizeof(dir), scratch, "adm");
+    build_path(path, sizeof(path), dir, name);
+    fprintf(f, "temp=%s\ntemp=%s.partial\n", path, path);
+    sync_file_to_disk(f);
+    fclose(f);
+}
+
+/* 最终输出与多格式输出是交付物，即使由本任务新建也不进产物登记 */
+static int job_is_deliverable(const EncodeJob *job, const char *path) {
+    if (strcmp(path, job->final_output_path) == 0) return 1;
+    if (!job->formats) return 0;
+    return strcmp(path, job->ec3_output) == 0 || strcmp(path, job->m4a_output) == 0 || strcmp(path, job->mlp_output) == 0;
+}
+
+/*
+ * 阶段开始写入 path 之前调用。只有此时还不存在的文件才算本次运行新建：取消时由 reclaim_cancelled_job 删除，
+ * 其中的中间文件另追加到产物登记（附登记时刻），崩溃后按登记回收。已存在的同名文件
+ * （用户或其他任务的交付物）既不登记也不删除。
+ */
+static void job_claim_output(EncodeJob *job, const char *path) {
+    char owner[1024];
+    if (!path || !path[0] || file_exists(path)) return;
+    worker_mutex_lock(&g_console_lock);
+    int known = 0;
+    for (int i = 0; i < job->claimed_count && !known; ++i) known = strcmp(job->claimed[i], path) == 0;
+    if (!known && job->claimed_count < JOB_CLAIMS_MAX) {
+        copy_string(job->claimed[job->claimed_count++], sizeof(job->claimed[0]), path);
+    }
+    worker_mutex_unlock(&g_console_lock);
+    if (known || job_is_deliverable(job, path) || !job->journal.job_key[0]) return;
+
+    space_owner_path(job->temp_dir_path, job->journal.job_key, owner, sizeof(owner));
+    FILE *f = fopen(owner, "a");
+    if (!f) return;
+    fprintf(f, "artifact=%s\tcreated=%lld\n", path, (long long)time(NULL));
+    sync_file_to_disk(f);
+    fclose(f);
+}
+
+static void space_ledger_close(const EncodeJob *job) {
+    char owner[1024];
+    if (!job->journal.job_key[0]) return;
+    space_owner_path(job->temp_dir_path, job->journal.job_key, owner, sizeof(owner));
+    remove_file_if_exists(owner);
+}
+
+static int space_stopping(const SpaceScan *scan) {
+    return (scan->stop && *scan->stop) || cancel_requested();
+}
+
+/* jobs\ 第一遍：新鲜的任务日志，以及仍在运行的登记 */
+static void space_scan_keys(const char *dir, const char *name, int is_dir, void *ctx) {
+    SpaceScan *scan = (SpaceScan *)ctx;
+    char path[1024];
+    char key[17];
+    if (is_dir || !space_name_key(name, key)) return;
+    build_path(path, sizeof(path), dir, name);
+    if (ends_with_extension(name, ".journal")) {
+        if (scan->now - file_mtime_of(path) < scan->keep_seconds) space_key_add(scan->keys.fresh, &scan->keys.fresh_count, key);
+    } else if (ends_with_extension(name, ".owner")) {
+        FILE *f = fopen(path, "r");
+        char line[64] = "";
+        if (f) {
+            if (!fgets(line, sizeof(line), f)) line[0] = '\0';
+            fclose(f);
+        }
+        if (space_process_alive(strncmp(line, "pid=", 4) == 0 ? atol(line + 4) : 0)) {
+            space_key_add(scan->keys.live, &scan->keys.live_count, key);
+        }
+    }
+}
+
+/* 进程已退出的登记：逐项计入孤儿并在 collect 时删除，最后删除登记本身 */
+static void space_reap_owner(SpaceScan *scan, const char *owner, const char *key) {
+    char line[1200];
+    int fresh = space_key_in(scan->keys.fresh, scan->keys.fresh_count, key);
+    FILE *f = fopen(owner, "r");
+    if (!f) return;
+    while (fgets(line, sizeof(line), f) && !space_stopping(scan)) {
+        trim_newline(line);
+        int is_temp = strncmp(line, "temp=", 5) == 0;
+        int is_artifact = strncmp(line, "artifact=", 9) == 0;
+        long long created = 0;
+        if (is_artifact) {
+            /* artifact 项必须带登记时刻（job_claim_output 写入时文件尚不存在）；旧格式的项不回收 */
+            char *mark = strrchr(line, '\t');
+            if (!mark || strncmp(mark, "\tcreated=", 9) != 0) continue;
+            created = atoll(mark + 9);
+            *mark = '\0';
+        }
+        const char *path = line + (is_temp ? 5 : 9);
+        if ((!is_temp && !is_artifact) || !path[0] || !file_exists(path)) continue;
+        long long bytes = space_tree_bytes(path);
+        /* 修改时间早于登记的同名文件不是本任务写的 */
+        if (is_artifact && (fresh || file_mtime_of(path) + 1 < created)) {
+            if (fresh) scan->report->resumable += bytes;
+            continue;
+        }
+        scan->report->orphans += bytes;
+        scan->report->orphan_files++;
+        if (scan->collect) space_remove(path, scan->report);
+    }
+    fclose(f);
+    if (scan->collect && !space_stopping(scan)) remove_file_if_exists(owner);
+}
+
+/* jobs\ 第二遍：回收已退出的登记与过期的任务日志 */
+static void space_scan_jobs(const char *dir, const char *name, int is_dir, void *ctx) {
+    SpaceScan *scan = (SpaceScan *)ctx;
+    char path[1024];
+    char key[17];
+    if (is_dir || space_stopping(scan) || !space_name_key(name, key)) return;
+    build_path(path, sizeof(path), dir, name);
+    int live = space_key_in(scan->keys.live, scan->keys.live_count, key);
+    if (ends_with_extension(name, ".owner") && !live) {
+        space_key_add(scan->keys.dead, &scan->keys.dead_count, key);
+        space_reap_owner(scan, path, key);
+    } else if (ends_with_extension(name, ".journal") && !live &&
+               !space_key_in(scan->keys.fresh, scan->keys.fresh_count, key)) {
+        scan->report->orphans += file_size_of(path);
+        scan->report->orphan_files++;
+        if (scan->collect) space_remove(path, scan->report);
+    }
+}
+
+/* 带任务标识的中间文件、--temp 目录与 .partial：按标识归属分类，归属不明的超过一小时算孤儿 */
+static void space_scan_stray(const char *dir, const char *name, int is_dir, void *ctx) {
+    SpaceScan *scan = (SpaceScan *)ctx;
+    char path[1024];
+    char key[17];
+    if (space_stopping(scan)) return;
+    build_path(path, sizeof(path), dir, name);
+    int has_key = space_name_key(name, key);
+    if (!has_key && !ends_with_extension(name, ".partial")) return;
+    long long bytes = space_tree_bytes(path);
+    if (has_key && space_key_in(scan->keys.live, scan->keys.live_count, key)) {
+        scan->report->active += bytes;
+    } else if (has_key && space_key_in(scan->keys.fresh, scan->keys.fresh_count, key)) {
+        scan->report->resumable += bytes;
+    } else if (has_key && space_key_in(scan->keys.dead, scan->keys.dead_count, key)) {
+        /* 登记里列出的已在上一步计入；只在回收时清理登记之外的残留 */
+        if (!scan->collect) return;
+        scan->report->orphans += bytes;
+        scan->report->orphan_files++;
+        space_remove(path, scan->report);
+    } else if (scan->now - file_mtime_of(path) < SPACE_GRACE_SECONDS) {
+        scan->report->active += bytes;
+    } else {
+        scan->report->orphans += bytes;
+        scan->report->orphan_files++;
+        if (scan->collect) space_remove(path, scan->report);
+    }
+    (void)is_dir;
+}
+
+static void space_scan_cache(const char *dir, const char *name, int is_dir, void *ctx) {
+    SpaceScan *scan = (SpaceScan *)ctx;
+    if (scan->cache_count >= SPACE_CACHE_MAX) return;
+    SpaceCacheEntry *entry = &scan->caches[scan->cache_count];
+    build_path(entry->path, sizeof(entry->path), dir, name);
+    entry->size = space_tree_bytes(entry->path);
+    entry->mtime = file_mtime_of(entry->path);
+    /* 工作目录中一小时内的文件可能仍在使用 */
+    if (strcmp(scan->dir, "work") == 0 && scan->now - entry->mtime < SPACE_GRACE_SECONDS) {
+        scan->report->active += entry->size;
+        return;
+    }
+    scan->report->caches += entry->size;
+    scan->cache_count++;
+    (void)is_dir;
+}
+
+/* 临时盘上的 DolbyTemp 与主 DolbyTemp 一起管理，返回根目录个数 */
+static int space_roots(const char *temp_dir, char roots[][1024], int max_roots) {
+    int count = 0;
+    copy_string(roots[count++], 1024, temp_dir);
+    for (int i = 0; i < g_cli.scratch_count && count < max_roots; ++i) {
+        char root[1024];
+        build_path(root, sizeof(root), g_cli.scratch_dirs[i], "DolbyTemp");
+        int seen = 0;
+        for (int k = 0; k < count; ++k) seen |= strcmp(roots[k], root) == 0;
+        if (!seen && path_is_directory(root)) copy_string(roots[count++], 1024, root);
+    }
+    return count;
+}
+
+static int space_cache_older(const void *a, const void *b) {
+    long long ma = ((const SpaceCacheEntry *)a)->mtime;
+    long long mb = ((const SpaceCacheEntry *)b)->mtime;
+    return ma < mb ? -1 : ma > mb;
+}
+
+/*
+ * 一轮统计或回收。evict_target 大于等于 0 时，回收孤儿后若总占用仍超过它，按最久未用淘汰缓存。
+ * 返回 0；stop 被置位或取消时提前结束，报告只反映已扫描的部分
+ */
+static int space_collect(const char *temp_dir, int collect, long long evict_target, volatile int *stop, SpaceReport *report) {
+    static const char *const cache_dirs[] = {"overview", "silence"};
+    static const char *const work_dirs[] = {"calibrate", "edit"};
+    char roots[SCRATCH_MAX + 1][1024];
+    char dir[1024];
+    SpaceScan *scan = (SpaceScan *)calloc(1, sizeof(SpaceScan));
+    memset(report, 0, sizeof(*report));
+    if (!scan) return 1;
+    /* 后台线程与调度线程的回收互斥，避免同时删除同一批文件 */
+    worker_mutex_lock(&g_space_lock);
+    scan->temp_dir = temp_dir;
+    scan->collect = collect;
+    scan->now = (long long)time(NULL);
+    scan->keep_seconds = (long long)(g_cli.temp_keep_hours * 3600.0);
+    scan->stop = stop;
+    scan->report = report;
+    scan->caches = (SpaceCacheEntry *)malloc(sizeof(SpaceCacheEntry) * SPACE_CACHE_MAX);
+
+    build_path(dir, sizeof(dir), temp_dir, "jobs");
+    space_list_dir(dir, space_scan_keys, scan);
+    space_list_dir(dir, space_scan_jobs, scan);
+
+    int root_count = space_roots(temp_dir, roots, SCRATCH_MAX + 1);
+    for (int r = 0; r < root_count && !space_stopping(scan); ++r) {
+        space_list_dir(roots[r], space_scan_stray, scan);
+        build_path(dir, sizeof(dir), roots[r], "staged");
+        space_list_dir(dir, space_scan_stray, scan);
+        build_path(dir, sizeof(dir), roots[r], "adm");
+        space_list_dir(dir, space_scan_stray, scan);
+        for (int i = 0; scan->caches && i < 2; ++i) {
+            scan->dir = "cache";
+            build_path(dir, sizeof(dir), roots[r], cache_dirs[i]);
+            space_list_dir(dir, space_scan_cache, scan);
+            scan->dir = "work";
+            build_path(dir, sizeof(dir), roots[r], work_dirs[i]);
+            space_list_dir(dir, space_scan_cache, scan);
+        }
+    }
+
+    for (int r = 0; r < root_count; ++r) report->total += space_tree_bytes(roots[r]);
+
+    if (collect && evict_target >= 0 && report->total > evict_target && scan->caches) {
+        qsort(scan->caches, (size_t)scan->cache_count, sizeof(SpaceCacheEntry), space_cache_older);
+        long long total = report->total;
+        for (int i = 0; i < scan->cache_count && total > evict_target && !space_stopping(scan); ++i) {
+            long long before = report->reclaimed;
+            space_remove(scan->caches[i].path, report);
+            total -= report->reclaimed - before;
+            report->caches -= report->reclaimed - before;
+        }
+    }
+    if (collect) {
+        report->total = 0;
+        for (int r = 0; r < root_count; ++r) report->total += space_tree_bytes(roots[r]);
+        report->orphans = 0;
+        report->orphan_files = 0;
+    }
+    worker_mutex_unlock(&g_space_lock);
+    worker_mutex_lock(&g_console_lock);
+    g_space_usage = report->total;
+    g_space_measured_at = monotonic_seconds();
+    worker_mutex_unlock(&g_console_lock);
+    free(scan->caches);
+    free(scan);
+    return 0;
+}
+
+#ifndef DEE_LIBRARY
+static void space_print_report(const SpaceReport *r) {
+    const double mb = 1024.0 * 1024.0;
+    printf("DolbyTemp 占用 %.1f MB%s", r->total / mb, g_cli.temp_quota > 0 ? "" : "\n");
+    if (g_cli.temp_quota > 0) printf("（配额 %.1f MB）\n", g_cli.temp_quota / mb);
+    printf("  运行中/一小时内: %.1f MB\n", r->active / mb);
+    printf("  断点续跑保留:    %.1f MB（任务日志 %.0f 小时内）\n", r->resumable / mb, g_cli.temp_keep_hours);
+    printf("  孤儿中间文件:    %.1f MB（%d 项）\n", r->orphans / mb, r->orphan_files);
+    printf("  缓存:            %.1f MB\n", r->caches / mb);
+    if (r->reclaimed_files) printf("  本次回收:        %.1f MB（%d 个文件）\n", r->reclaimed / mb, r->reclaimed_files);
+    /* 供 GUI 读取：可立即回收的空间（孤儿）与缓存 */
+    printf("Reclaimable: %lld\nCache: %lld\n", r->orphans, r->caches);
+    fflush(stdout);
+}
+#endif
+
+/*
+ * 超出配额或所在卷的剩余空间放不下 need 时先回收（磁盘不足时淘汰全部缓存）；返回 1 表示回收后仍然不够。
+ * 结论缓存 SPACE_USAGE_TTL 秒，批量调度每轮询问也不会反复扫描
+ */
+static int space_pressure(const char *temp_dir, long long need) {
+    static double checked_at = -1.0;
+    static int pressed = 0;
+    long long free_bytes = volume_free_bytes(temp_dir);
+    int low_disk = free_bytes >= 0 && free_bytes < need;
+    if (g_cli.temp_quota <= 0 && !low_disk) return 0;
+
+    worker_mutex_lock(&g_console_lock);
+    long long usage = g_space_usage;
+    int fresh = usage >= 0 && monotonic_seconds() - g_space_measured_at < SPACE_USAGE_TTL;
+    int recent = checked_at >= 0.0 && monotonic_seconds() - checked_at < SPACE_USAGE_TTL;
+    int was_pressed = pressed;
+    worker_mutex_unlock(&g_console_lock);
+    if (!low_disk && fresh && usage + need <= g_cli.temp_quota) return 0;
+    if (recent && was_pressed) return 1;
+
+    SpaceReport report;
+    long long target = low_disk ? 0 : g_cli.temp_quota - need;
+    space_collect(temp_dir, 1, target > 0 ? target : 0, NULL, &report);
+    if (report.reclaimed_files) {
+        worker_mutex_lock(&g_console_lock);
+        job_note("空间回收: 删除 %d 个文件，回收 %.1f MB\n", report.reclaimed_files, report.reclaimed / (1024.0 * 1024.0));
+        worker_mutex_unlock(&g_console_lock);
+    }
+    free_bytes = volume_free_bytes(temp_dir);
+    int still = (free_bytes >= 0 && free_bytes < need) || (g_cli.temp_quota > 0 && report.total + need > g_cli.temp_quota);
+    worker_mutex_lock(&g_console_lock);
+    checked_at = monotonic_seconds();
+    pressed = still;
+    worker_mutex_unlock(&g_console_lock);
+    return still;
+}
+
+/* 单任务的 dee 开始前：空间不够时只能提示，由用户决定是否清理别处的文件 */
+static void space_check_job(const EncodeJob *job) {
+    long long need = job_scratch_bytes(job);
+    const char *dir = job->scratch_temp_dir[0] ? job->scratch_temp_dir : job->temp_dir_path;
+    if (!space_pressure(dir, need)) return;
+    job_note("警告: DolbyTemp 空间不足：本任务约需 %.1f MB，回收孤儿与缓存后仍超出 --temp-quota 或磁盘剩余空间。\n",
+           need / (1024.0 * 1024.0));
+}
+
+static void space_lower_thread_priority(void) {
+#ifdef _WIN32
+    /* 后台模式同时降低 CPU、I/O 与内存优先级 */
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+#elif defined(__linux__)
+    long tid = syscall(SYS_gettid);
+    syscall(SYS_ioprio_set, 1, (int)tid, 3 << 13);
+    setpriority(PRIO_PROCESS, (id_t)tid, 19);
+#endif
+}
+
+static void space_gc_worker(void *arg) {
+    SpaceCollector *gc = (SpaceCollector *)arg;
+    space_lower_thread_priority();
+    while (!gc->stop && !cancel_requested()) {
+        SpaceReport report;
+        space_collect(gc->temp_dir, 1, g_cli.temp_quota > 0 ? g_cli.temp_quota : -1, &gc->stop, &report);
+        if (report.reclaimed_files) {
+            worker_mutex_lock(&g_console_lock);
+            job_note("后台回收: 删除 %d 个孤儿文件，回收 %.1f MB，DolbyTemp 现占用 %.1f MB\n", report.reclaimed_files,
+                   report.reclaimed / (1024.0 * 1024.0), report.total / (1024.0 * 1024.0));
+            worker_mutex_unlock(&g_console_lock);
+        }
+        for (int waited = 0; waited < SPACE_GC_INTERVAL * 5 && !gc->stop && !cancel_requested(); ++waited) {
+#ifdef _WIN32
+            Sleep(200);
+#else
+            sleep_milliseconds(200);
+#endif
+        }
+    }
+}
+
+static void space_gc_start(const char *temp_dir) {
+    if (!g_cli.temp_gc || g_space_gc.threaded) return;
+    g_space_gc.stop = 0;
+    copy_string(g_space_gc.temp_dir, sizeof(g_space_gc.temp_dir), temp_dir);
+    g_space_gc.threaded = worker_start(&g_space_gc.thread, space_gc_worker, &g_space_gc);
+}
+
+static void space_gc_stop(void) {
+    if (!g_space_gc.threaded) return;
+    g_space_gc.stop = 1;
+    worker_join(g_space_gc.thread);
+    g_space_gc.threaded = 0;
+}
+// --------- 空间管理结束 ---------
+
+// --------- 任务历史与耗时预估 ---------
+/*
+ * job_history.log 与 last_params.txt 放在同一目录，只追加不改写：每个任务结束时写一行
+ * Tab 分隔的 key=value，以 commit=1 结尾。崩溃留下的半行没有结束标记，读取时忽略。
+ * 预估取同类任务（choice 与 --formats 相同）最近若干次“每秒素材的阶段耗时”的中位数，
+ * 没有同类记录时退回全部记录；GUI 追加的 type=output_moved 等事件行不参与预估。
+ */
+#define HISTORY_FILE "job_history.log"
+/* 库调用可把历史放到 DeeJobDesc.state_dir 下 */
+static char g_history_path[1024] = HISTORY_FILE;
+#define HISTORY_SAMPLES 20
+#define HISTORY_QC STAGE_COUNT   /* 预估数组中 QC 的下标，排在各阶段之后 */
+
+typedef struct {
+    double seconds[STAGE_COUNT + 1];  /* 各阶段与 QC 的预估耗时 */
+    double total;
+    int samples;                      /* 参与预估的历史任务数，0 表示没有可用记录 */
+} EtaEstimate;
+
+/* 以一次写入追加整行：多个 encode 进程同时结束时行不会交错，写完立即落盘 */
+static int append_record_line(const char *path, const char *line) {
+    size_t len = strlen(line);
+#ifdef _WIN32
+    HANDLE h = CreateFileA(path, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                           NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    DWORD written = 0;
+    if (h == INVALID_HANDLE_VALUE) return 0;
+    int ok = WriteFile(h, line, (DWORD)len, &written, NULL) && written == (DWORD)len;
+    FlushFileBuffers(h);
+    CloseHandle(h);
+    return ok;
+#else
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) return 0;
+    int ok = write(fd, line, len) == (ssize_t)len;
+    fsync(fd);
+    close(fd);
+    return ok;
+#endif
+}
+
+/* 时间码转秒：HH:MM:SS:FF 按 24 fps 折算帧，HH:MM:SS.xx 直接取小数；空或无法解析时返回 -1 */
+static double timecode_seconds(const char *text) {
+    double parts[4] = {0, 0, 0, 0};
+    int count = 0;
+    const char *p = text;
+    while (*p && count < 4) {
+        char *end = NULL;
+        parts[count++] = strtod(p, &end);
+        if (end == p) return -1.0;
+        p = end;
+        if (*p == ':') ++p;
+        else break;
+    }
+    if (count < 3 || *p) return -1.0;
+    return parts[0] * 3600.0 + parts[1] * 60.0 + parts[2] + (count == 4 ? parts[3] / 24.0 : 0.0);
+}
+
+typedef struct {
+    int is64;                      /* RF64/BW64，大小取自 ds64 块 */
+    unsigned long long riff_size;  /* 头部声明的文件大小（不含开头 8 字节） */
+    long long data_offset;         /* data 块内容的起点，未找到 data 时为 0 */
+    unsigned long long data_size;
+    unsigned long byte_rate;
+    unsigned format_tag;           /* 1 整数 PCM，3 浮点；WAVE_FORMAT_EXTENSIBLE 取子格式 */
+    unsigned channels;
+    unsigned long sample_rate;
+    unsigned block_align;
+    unsigned bits_per_sample;
+    unsigned long channel_mask;    /* WAVE_FORMAT_EXTENSIBLE 的声道掩码，没有时为 0 */
+    int has_chna;                  /* 已是 ADM BWF（带 chna 块） */
+    int has_axml;
+} WavLayout;
+
+/* 解析 WAV/RF64/BW64 的块布局，记录第一个 fmt 与 data，并留意 chna/axml 是否存在；不是 WAV 时返回 0 */
+static int wav_probe(const char *path, WavLayout *out) {
+    unsigned char header[12];
+    unsigned char chunk[40];
+    long long offset = 12;
+    memset(out, 0, sizeof(*out));
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    if (fread(header, 1, sizeof(header), f) != sizeof(header) || memcmp(header + 8, "WAVE", 4) != 0 ||
+        (memcmp(header, "RIFF", 4) != 0 && memcmp(header, "RF64", 4) != 0 && memcmp(header, "BW64", 4) != 0)) {
+        fclose(f);
+        return 0;
+    }
+    out->is64 = memcmp(header, "RIFF", 4) != 0;
+    out->riff_size = read_le32(header + 4);
+    unsigned long long ds64_data = 0;
+    /* ADM BWF 的 chna/axml 可能在 data 之前或之后，逐块跳过，最多看 64 个块 */
+    for (int guard = 0; guard < 64; ++guard) {
+        if (file_seek64(f, offset) != 0 || fread(chunk, 1, 8, f) != 8) break;
+        unsigned long long size = read_le32(chunk + 4);
+        if (memcmp(chunk, "ds64", 4) == 0) {
+            if (fread(chunk, 1, 16, f) == 16) {
+                out->riff_size = read_le64(chunk);
+                ds64_data = read_le64(chunk + 8);
+            }
+        } else if (memcmp(chunk, "fmt ", 4) == 0 && !out->byte_rate) {
+            size_t want = size < sizeof(chunk) ? (size_t)size : sizeof(chunk);
+            if (want >= 16 && fread(chunk, 1, want, f) == want) {
+                out->format_tag = read_le16(chunk);
+                out->channels = read_le16(chunk + 2);
+                out->sample_rate = read_le32(chunk + 4);
+                out->byte_rate = read_le32(chunk + 8);
+                out->block_align = read_le16(chunk + 12);
+                out->bits_per_sample = read_le16(chunk + 14);
+                if (out->format_tag == 0xFFFEu && want >= 26) {
+                    out->channel_mask = read_le32(chunk + 20);
+                    out->format_tag = read_le16(chunk + 24);
+                }
+            }
+        } else if (memcmp(chunk, "chna", 4) == 0) {
+            out->has_chna = 1;
+        } else if (memcmp(chunk, "axml", 4) == 0) {
+            out->has_axml = 1;
+        } else if (memcmp(chunk, "data", 4) == 0 && !out->data_offset) {
+            if (size == 0xFFFFFFFFull && out->is64) size = ds64_data;
+            out->data_offset = offset + 8;
+            out->data_size = size;
+        }
+        offset += 8 + (long long)size + (long long)(size & 1);
+    }
+    fclose(f);
+    return 1;
+}
+
+/* WAV/RF64/BW64 的音频时长（秒）；无法识别时返回 0 */
+static double wav_media_seconds(const char *path) {
+    WavLayout layout;
+    if (!wav_probe(path, &layout) || !layout.byte_rate || !layout.data_offset) return 0.0;
+    return (double)layout.data_size / (double)layout.byte_rate;
+}
+
+/* 本任务实际渲染的素材长度：起止时间截取后的窗口加上首尾静音 */
+static double job_media_seconds(const EncodeJob *job) {
+    double seconds = wav_media_seconds(job->input_file);
+    double start = timecode_seconds(job->start);
+    double end = timecode_seconds(job->end);
+    if (seconds <= 0.0) return 0.0;
+    if (end > 0.0 && end < seconds) seconds = end;
+    if (start > 0.0) seconds -= start;
+    if (seconds <= 0.0) return 0.0;
+    return seconds + atof(job->prepend_silence) + atof(job->append_silence);
+}
+
+/* 阶段开始：输出 “Stage: 名称” 供 GUI 切换进度估算，返回开始时间 */
+static double job_stage_begin(const EncodeJob *job, const char *name) {
+    if (!job->label[0]) {
+        job_note("Stage: %s\n", name);
+        emit_event(DEE_EVENT_STAGE, name, 0.0, NULL);
+    }
+    return monotonic_seconds();
+}
+
+static void job_stage_end(EncodeJob *job, StageId stage, double began) {
+    job->stage_seconds[stage] += monotonic_seconds() - began;
+}
+
+/* 任务结束时追加一条历史记录；status 为 ok / failed / cancelled */
+static void history_record(const EncodeJob *job, const char *status) {
+    char line[4096];
+    char output[1024];
+    long long output_bytes = 0;
+    double total = job->started_at > 0.0 ? monotonic_seconds() - job->started_at : 0.0;
+    if (job->formats) {
+        output[0] = '\0';
+        const char *paths[3] = {job->ec3_output, job->m4a_output, job->mlp_output};
+        static const unsigned formats[3] = {OUTPUT_FORMAT_EC3, OUTPUT_FORMAT_M4A, OUTPUT_FORMAT_MLP};
+        for (int i = 0; i < 3; ++i) {
+            if (!(job->formats & formats[i])) continue;
+            long long size = file_size_of(paths[i]);
+            if (size > 0) output_bytes += size;
+            if (!output[0]) copy_string(output, sizeof(output), paths[i]);
+        }
+    } else {
+        copy_string(output, sizeof(output), job->final_output_path);
+        output_bytes = file_size_of(output);
+    }
+
+    int len = snprintf(line, sizeof(line),
+                       "v=1\ttime=%lld\tstatus=%s\tchoice=%d\tformats=%u\tbitrate=%s\tinput=%s\tinput_bytes=%lld\t"
+                       "media=%.3f\tstart=%s\tend=%s\toutput=%s\toutput_bytes=%lld\ttotal=%.3f",
+                       (long long)time(NULL), status, job->choice, job->formats, job->bitrate, job->input_file,
+                       file_size_of(job->input_file), job_media_seconds(job), job->start, job->end, output,
+                       output_bytes < 0 ? 0 : output_bytes, total);
+    for (int s = 0; s < STAGE_COUNT && len > 0 && len < (int)sizeof(line); ++s) {
+        if (job->stage_seconds[s] <= 0.0) continue;
+        len += snprintf(line + len, sizeof(line) - (size_t)len, "\tt_%s=%.3f", stage_names[s], job->stage_seconds[s]);
+    }
+    if (len > 0 && len < (int)sizeof(line)) {
+        snprintf(line + len, sizeof(line) - (size_t)len, "\tqc=%.3f\tcommit=1\n", job->qc_seconds);
+    }
+    if (!append_record_line(g_history_path, line)) {
+        job_warn("警告: 无法写入任务历史 %s (errno=%d)\n", g_history_path, errno);
+    }
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static double median_of(double *values, int count) {
+    if (count <= 0) return 0.0;
+    qsort(values, (size_t)count, sizeof(double), compare_doubles);
+    return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2.0;
+}
+
+/*
+ * 按历史预估本任务各阶段耗时。素材时长可知时以“秒/素材秒”为单位，否则以“秒/输入字节”为单位；
+ * 每个阶段各自保留最近 HISTORY_SAMPLES 个样本（环形覆盖），同类样本不足时用全部记录补。
+ */
+static int predict_job_eta(const EncodeJob *job, EtaEstimate *eta) {
+    static double ratios[2][STAGE_COUNT + 1][HISTORY_SAMPLES];
+    int counts[2][STAGE_COUNT + 1];
+    int samples[2] = {0, 0};
+    char buf[4096];
+    double media = job_media_seconds(job);
+    long long input_bytes = file_size_of(job->input_file);
+    double amount = media > 0.0 ? media : (double)input_bytes;
+
+    memset(eta, 0, sizeof(*eta));
+    memset(counts, 0, sizeof(counts));
+    if (amount <= 0.0) return 0;
+    FILE *f = fopen(g_history_path, "r");
+    if (!f) return 0;
+
+    while (fgets(buf, sizeof(buf), f)) {
+        double values[STAGE_COUNT + 1];
+        double record_amount = 0.0;
+        int choice = -1;
+        unsigned formats = 0;
+        int ok = 0;
+        int committed = 0;
+        for (int s = 0; s <= STAGE_COUNT; ++s) values[s] = -1.0;
+        buf[strcspn(buf, "\r\n")] = '\0';
+        for (char *field = strtok(buf, "\t"); field; field = strtok(NULL, "\t")) {
+            char *eq = strchr(field, '=');
+            if (!eq) continue;
+            *eq = '\0';
+            const char *value = eq + 1;
+            if (strcmp(field, "commit") == 0) committed = strcmp(value, "1") == 0;
+            else if (strcmp(field, "status") == 0) ok = strcmp(value, "ok") == 0;
+            else if (strcmp(field, "choice") == 0) choice = atoi(value);
+            else if (strcmp(field, "formats") == 0) formats = (unsigned)strtoul(value, NULL, 10);
+            else if (strcmp(field, media > 0.0 ? "media" : "input_bytes") == 0) record_amount = atof(value);
+            else if (strcmp(field, "qc") == 0) values[HISTORY_QC] = atof(value);
+            else if (strncmp(field, "t_", 2) == 0) {
+                int stage = stage_from_name(field + 2);
+                if (stage >= 0) values[stage] = atof(value);
+            }
+        }
+        if (!committed || !ok || record_amount <= 0.0) continue;
+        for (int group = 0; group < 2; ++group) {
+            if (group == 0 && (choice != job->choice || formats != job->formats)) continue;
+            samples[group]++;
+            for (int s = 0; s <= STAGE_COUNT; ++s) {
+                if (values[s] < 0.0) continue;
+                ratios[group][s][counts[group][s] % HISTORY_SAMPLES] = values[s] / record_amount;
+                counts[group][s]++;
+            }
+        }
+    }
+    fclose(f);
+
+    int group = samples[0] > 0 ? 0 : 1;
+    eta->samples = samples[group];
+    if (eta->samples == 0) return 0;
+    for (int s = 0; s <= STAGE_COUNT; ++s) {
+        int n = counts[group][s] < HISTORY_SAMPLES ? counts[group][s] : HISTORY_SAMPLES;
+        eta->seconds[s] = median_of(ratios[group][s], n) * amount;
+    }
+    /* 多格式输出的两个 dee pass 并行，取较长者 */
+    double dee = eta->seconds[STAGE_DEE];
+    if (job->formats && eta->seconds[STAGE_DEE_MLP] > dee) dee = eta->seconds[STAGE_DEE_MLP];
+    else if (!job->formats) dee += eta->seconds[STAGE_DEE_MLP];
+    eta->total = dee + eta->seconds[STAGE_DEEW] + eta->seconds[STAGE_DEEZY] + eta->seconds[STAGE_REMUX] + eta->seconds[HISTORY_QC];
+    return 1;
+}
+
+static void format_duration(double seconds, char *out, size_t out_size) {
+    long long s = (long long)(seconds + 0.5);
+    if (s >= 3600) snprintf(out, out_size, "%lld:%02lld:%02lld", s / 3600, (s / 60) % 60, s % 60);
+    else snprintf(out, out_size, "%lld:%02lld", s / 60, s % 60);
+}
+
+/*
+ * 输出预估：一行给人看，一行 “ETA: total=秒 dee=秒 ...” 给 GUI 解析。
+ * 没有历史记录时只提示，不输出 ETA 行。
+ */
+static void print_job_eta(const EncodeJob *job) {
+    EtaEstimate eta;
+    char text[32];
+    const char *prefix = job->label[0] ? job->label : "";
+    const char *sep = job->label[0] ? ": " : "";
+    if (!predict_job_eta(job, &eta)) {
+        job_note("%s%s暂无可参考的任务历史，完成后将记录本次耗时用于预估。\n", prefix, sep);
+        return;
+    }
+    format_duration(eta.total, text, sizeof(text));
+    job_note("%s%s预计耗时 %s（参考 %d 次历史任务）\n", prefix, sep, text, eta.samples);
+    char line[512];
+    int len = snprintf(line, sizeof(line), "%s%sETA: total=%.1f", prefix, sep, eta.total);
+    for (int s = 0; s < STAGE_COUNT && len > 0 && len < (int)sizeof(line); ++s) {
+        if (eta.seconds[s] > 0.0) len += snprintf(line + len, sizeof(line) - (size_t)len, " %s=%.1f", stage_names[s], eta.seconds[s]);
+    }
+    job_note("%s qc=%.1f samples=%d\n", line, eta.seconds[HISTORY_QC], eta.samples);
+    if (!job->label[0]) emit_event(DEE_EVENT_ETA, NULL, eta.total, eta.seconds);
+}
+// --------- 任务历史与耗时预估结束 ---------
+
+// --------- ADM 封装（--wrap-adm）：普通多声道 WAV 床 → BW64 ADM ---------
+/*
+ * 床 stem 常以普通多声道 WAV 导出，没有 chna/axml，dee 的 Atmos 模板不接受。这里按声道数选床格式
+ * （2/6/8/10/12 → 2.0/5.1/7.1/7.1.2/7.1.4，--adm-spec beds= 可指定），有 WAVE_FORMAT_EXTENSIBLE 声道掩码时
+ * 按掩码给每条轨道找扬声器，否则按 Dolby 声道顺序，生成 chna/axml 后写一个 BW64 外壳。
+ * 新文件在 data 前补 JUNK，使音频与源文件在 64 KiB 块内同余：对齐的中段按块克隆（Linux FICLONERANGE、
+ * Windows ReFS 的 FSCTL_DUPLICATE_EXTENTS_TO_FILE），不支持时用 copy_file_range，最后退回缓冲复制，音频只读写一遍。
+ */
+#define ADM_WRAP_ALIGN 65536
+#define ADM_CLONE_STEP (1LL << 30)
+
+typedef enum {
+    ADM_WRAP_PENDING = 0,
+    ADM_WRAP_RUNNING,     /* 另一个 dee pass 正在封装，需等待 */
+    ADM_WRAP_DONE         /* 已封装，或输入无需封装 */
+} AdmWrapState;
+
+typedef struct {
+    unsigned long bit;       /* SPEAKER_* 掩码位 */
+    const char *labels[2];   /* 床中依次尝试的扬声器 */
+} AdmMaskSpeaker;
+
+static const AdmMaskSpeaker adm_mask_speakers[] = {
+    {0x1ul, {"M+030", NULL}},     {0x2ul, {"M-030", NULL}},     {0x4ul, {"M+000", NULL}},
+    {0x8ul, {"LFE1", NULL}},      {0x10ul, {"M+135", "M+110"}}, {0x20ul, {"M-135", "M-110"}},
+    {0x200ul, {"M+090", "M+110"}}, {0x400ul, {"M-090", "M-110"}},
+    {0x1000ul, {"U+045", "U+090"}}, {0x4000ul, {"U-045", "U-090"}},
+    {0x8000ul, {"U+135", NULL}},  {0x20000ul, {"U-135", NULL}},
+};
+
+static const char *adm_bed_for_channels(unsigned channels) {
+    switch (channels) {
+    case 2: return "2.0";
+    case 6: return "5.1";
+    case 8: return "7.1";
+    case 10: return "7.1.2";
+    case 12: return "7.1.4";
+    default: return NULL;
+    }
+}
+
+/* WAV 的声道按掩码位从低到高排列；每一位在床中找一个尚未占用的扬声器，有一位找不到就保持 Dolby 顺序 */
+static int adm_order_by_mask(unsigned long mask, const AdmSpeaker **bed, int bed_channels) {
+    const AdmSpeaker *ordered[16];
+    int used[16] = {0};
+    int track = 0;
+    for (size_t i = 0; i < sizeof(adm_mask_speakers) / sizeof(adm_mask_speakers[0]); ++i) {
+        if (!(mask & adm_mask_speakers[i].bit)) continue;
+        if (track >= bed_channels) return 0;
+        int found = -1;
+        for (int k = 0; k < 2 && found < 0 && adm_mask_speakers[i].labels[k]; ++k) {
+            for (int s = 0; s < bed_channels; ++s) {
+                if (!used[s] && strcmp(bed[s]->label, adm_mask_speakers[i].labels[k]) == 0) {
+                    found = s;
+                    break;
+                }
+            }
+        }
+        if (found < 0) return 0;
+        used[found] = 1;
+        ordered[track++] = bed[found];
+    }
+    if (track != bed_channels) return 0;
+    memcpy(bed, ordered, sizeof(ordered[0]) * (size_t)bed_channels);
+    return 1;
+}
+
+/*
+ * 检查 WAV 能否按床封装并填写 spec/bed；quiet 时不打印原因（自动封装时不适用的输入直接原样交给 dee）。
+ * 返回床的声道数，不能封装时返回 -1
+ */
+static int adm_wrap_plan(const char *src, const WavLayout *wav, const char *beds, AdmSpec *spec, const AdmSpeaker **bed,
+                         int *mask_ordered, int quiet) {
+    const char *reason = NULL;
+    if (!wav->data_offset || !wav->block_align) reason = "不是可识别的 WAV";
+    else if (wav->has_chna || wav->has_axml) reason = "已是 ADM BWF（带 chna/axml）";
+    else if (wav->format_tag != 1) reason = "只支持整数 PCM，浮点 WAV 请先转换为 24 bit";
+    else if (wav->bits_per_sample != 16 && wav->bits_per_sample != 24 && wav->bits_per_sample != 32) reason = "位深不是 16/24/32 bit";
+    else if (wav->block_align != wav->channels * (wav->bits_per_sample / 8)) reason = "fmt 块的 block_align 与声道数不符";
+    if (reason) {
+        if (!quiet) job_warn("无法封装 %s: %s。\n", src, reason);
+        return -1;
+    }
+
+    adm_spec_parse(NULL, spec);
+    spec->objects = 0;
+    spec->rate = (int)wav->sample_rate;
+    spec->bits = (int)wav->bits_per_sample;
+    copy_string(spec->container, sizeof(spec->container), "bw64");
+    copy_string(spec->title, sizeof(spec->title), path_file_name(src));
+    char *dot = strrchr(spec->title, '.');
+    if (dot) *dot = '\0';
+    /* 名称直接写进 axml 的属性，去掉需要转义的字符 */
+    for (char *c = spec->title; *c; ++c) {
+        if (strchr("<>&\"'", *c)) *c = '_';
+    }
+    const char *bed_name = beds && *beds ? beds : adm_bed_for_channels(wav->channels);
+    int bed_channels = bed_name ? adm_bed_layout(bed_name, bed) : -1;
+    if (bed_channels <= 0 || bed_channels != (int)wav->channels) {
+        if (!quiet) {
+            job_warn("无法封装 %s: %u 声道没有对应的床格式%s%s（支持 2.0/5.1/7.1/7.1.2/7.1.4）。\n", src, wav->channels,
+                    bed_name ? "，或与 " : "", bed_name ? bed_name : "");
+        }
+        return -1;
+    }
+    copy_string(spec->beds, sizeof(spec->beds), bed_name);
+    spec->seconds = (double)wav->data_size / (double)wav->byte_rate;
+    *mask_ordered = 0;
+    if (wav->channel_mask) {
+        *mask_ordered = adm_order_by_mask(wav->channel_mask, bed, bed_channels);
+        if (!*mask_ordered && !quiet) {
+            job_note("警告: 声道掩码 0x%lX 与 %s 床不匹配，按 Dolby 声道顺序（L R C LFE Ls Rs ...）封装。\n", wav->channel_mask, bed_name);
+        }
+    }
+    return bed_channels;
+}
+
+static int raw_seek(RawFile *f, long long offset) {
+#ifdef _WIN32
+    LARGE_INTEGER pos;
+    pos.QuadPart = offset;
+    return SetFilePointerEx(f->h, pos, NULL, FILE_BEGIN) != 0;
+#else
+    return lseek(f->fd, (off_t)offset, SEEK_SET) == (off_t)offset;
+#endif
+}
+
+/* 把 src 的 [src_pos, src_pos+len) 复制到 dest 的 dest_pos；每块检查取消 */
+static int adm_copy_range(RawFile *in, RawFile *out, long long src_pos, long long dest_pos, long long len, void *buffer) {
+    if (len <= 0) return 1;
+    if (!raw_seek(in, src_pos) || !raw_seek(out, dest_pos)) return 0;
+    while (len > 0) {
+        if (cancel_requested()) return 0;
+        size_t want = len < PUBLISH_CHUNK ? (size_t)len : PUBLISH_CHUNK;
+        long long got = raw_read(in, buffer, want);
+        if (got <= 0 || !raw_write_all(out, buffer, (size_t)got)) return 0;
+        len -= got;
+    }
+    return 1;
+}
+
+/* 按块共享数据区（写时复制），不真正读写音频；文件系统不支持或未对齐时返回 0，由调用方改为复制 */
+static int adm_clone_range(RawFile *in, RawFile *out, long long src_pos, long long dest_pos, long long len, long long dest_size) {
+#if defined(_WIN32) && defined(FSCTL_DUPLICATE_EXTENTS_TO_FILE)
+    /* ReFS 要求目标先扩展到足够长度 */
+    LARGE_INTEGER end;
+    end.QuadPart = dest_size;
+    if (!SetFilePointerEx(out->h, end, NULL, FILE_BEGIN) || !SetEndOfFile(out->h)) return 0;
+    for (long long done = 0; done < len; done += ADM_CLONE_STEP) {
+        DUPLICATE_EXTENTS_DATA extents;
+        DWORD returned = 0;
+        extents.FileHandle = in->h;
+        extents.SourceFileOffset.QuadPart = src_pos + done;
+        extents.TargetFileOffset.QuadPart = dest_pos + done;
+        extents.ByteCount.QuadPart = len - done < ADM_CLONE_STEP ? len - done : ADM_CLONE_STEP;
+        if (cancel_requested() || !DeviceIoControl(out->h, FSCTL_DUPLICATE_EXTENTS_TO_FILE, &extents, sizeof(extents), NULL, 0,
+                                                   &returned, NULL)) {
+            return 0;
+        }
+    }
+    return 1;
+#elif defined(__linux__) && defined(FICLONERANGE)
+    (void)dest_size;
+    for (long long done = 0; done < len; done += ADM_CLONE_STEP) {
+        struct file_clone_range range;
+        range.src_fd = in->fd;
+        range.src_offset = (unsigned long long)(src_pos + done);
+        range.src_length = (unsigned long long)(len - done < ADM_CLONE_STEP ? len - done : ADM_CLONE_STEP);
+        range.dest_offset = (unsigned long long)(dest_pos + done);
+        if (cancel_requested() || ioctl(out->fd, FICLONERANGE, &range) != 0) return 0;
+    }
+    return 1;
+#else
+    (void)in;
+    (void)out;
+    (void)src_pos;
+    (void)dest_pos;
+    (void)len;
+    (void)dest_size;
+    return 0;
+#endif
+}
+
+/* 同一文件系统内由内核复制（NFS/SMB 上可在服务器端完成），不经过用户态缓冲 */
+static int adm_kernel_copy_range(RawFile *in, RawFile *out, long long src_pos, long long dest_pos, long long len) {
+#if defined(__linux__)
+    loff_t src_off = (loff_t)src_pos;
+    loff_t dest_off = (loff_t)dest_pos;
+    while (len > 0) {
+        if (cancel_requested()) return 0;
+        ssize_t n = copy_file_range(in->fd, &src_off, out->fd, &dest_off, len < (1LL << 30) ? (size_t)len : (size_t)1 << 30, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        len -= n;
+    }
+    return 1;
+#else
+    (void)in;
+    (void)out;
+    (void)src_pos;
+    (void)dest_pos;
+    (void)len;
+    return 0;
+#endif
+}
+
+/*
+ * 封装一个普通 WAV 床：先写 .partial 再改名。beds 为空时按声道数选床；quiet 用于自动封装，不适用的输入返回 2
+ * 且不打印原因。成功返回 0
+ */
+static int adm_wrap_file(const char *src, const char *dest, const char *beds, int quiet) {
+    WavLayout wav;
+    AdmSpec spec;
+    const AdmSpeaker *bed[16];
+    TextBuffer axml = {0};
+    TextBuffer chna = {0};
+    int mask_ordered = 0;
+    char partial[1100];
+
+    if (!wav_probe(src, &wav)) {
+        if (!quiet) job_warn("无法封装 %s: 不是 WAV/RF64/BW64 文件。\n", src);
+        return 2;
+    }
+    /* 头部声明的大小可能比文件实际内容长（导出中断），按实际可读的整帧封装 */
+    long long src_size = file_size_of(src);
+    unsigned long long available = src_size > wav.data_offset ? (unsigned long long)(src_size - wav.data_offset) : 0;
+    if (wav.data_size > available) wav.data_size = available;
+    if (wav.block_align) wav.data_size -= wav.data_size % wav.block_align;
+    int bed_channels = adm_wrap_plan(src, &wav, beds, &spec, bed, &mask_ordered, quiet);
+    if (bed_channels < 0) return 2;
+    if (wav.data_size == 0) {
+        if (!quiet) job_warn("无法封装 %s: data 块为空。\n", src);
+        return 2;
+    }
+
+    adm_build_axml(&spec, bed, bed_channels, &axml);
+    adm_build_chna(&spec, bed_channels, &chna);
+    size_t header_size = 0;
+    unsigned char *header = axml.data && chna.data
+        ? adm_build_header("bw64", bed_channels, spec.rate, spec.bits, &chna, &axml, wav.data_size, ADM_WRAP_ALIGN,
+                           (size_t)(wav.data_offset % ADM_WRAP_ALIGN), &header_size)
+        : NULL;
+    free(axml.data);
+    free(chna.data);
+    if (!header) {
+        job_warn("无法生成 %s 的 ADM 头部。\n", src);
+        return 1;
+    }
+
+    RawFile in;
+    RawFile out;
+    void *buffer = publish_buffer_alloc();
+    snprintf(partial, sizeof(partial), "%s.partial", dest);
+    ensure_parent_directory(dest);
+    if (!buffer || !raw_open(&in, src, 0)) {
+        job_warn("无法读取 %s\n", src);
+        publish_buffer_free(buffer);
+        free(header);
+        return 1;
+    }
+    if (!raw_open(&out, partial, 1)) {
+        job_warn("无法创建文件: %s\n", partial);
+        raw_close(&in, 0);
+        publish_buffer_free(buffer);
+        free(header);
+        return 1;
+    }
+
+    /* 源与目标的 data 起点在 ADM_WRAP_ALIGN 内同余，[clone_begin, clone_end) 两边都落在块边界上 */
+    double started = monotonic_seconds();
+    long long data_bytes = (long long)wav.data_size;
+    long long src_begin = wav.data_offset;
+    long long shift = (long long)header_size - src_begin;
+    long long clone_begin = (src_begin + ADM_WRAP_ALIGN - 1) / ADM_WRAP_ALIGN * ADM_WRAP_ALIGN;
+    long long clone_end = (src_begin + data_bytes) / ADM_WRAP_ALIGN * ADM_WRAP_ALIGN;
+    long long dest_size = (long long)header_size + data_bytes + (data_bytes & 1);
+    const char *method = "stream";
+    int ok = raw_write_all(&out, header, header_size);
+    if (ok && clone_end > clone_begin) {
+        ok = adm_copy_range(&in, &out, src_begin, src_begin + shift, clone_begin - src_begin, buffer);
+        if (ok && adm_clone_range(&in, &out, clone_begin, clone_begin + shift, clone_end - clone_begin, dest_size)) {
+            method = "clone";
+        } else if (ok && adm_kernel_copy_range(&in, &out, clone_begin, clone_begin + shift, clone_end - clone_begin)) {
+            method = "copy_file_range";
+        } else if (ok) {
+            ok = adm_copy_range(&in, &out, clone_begin, clone_begin + shift, clone_end - clone_begin, buffer);
+        }
+        if (ok) ok = adm_copy_range(&in, &out, clone_end, clone_end + shift, src_begin + data_bytes - clone_end, buffer);
+    } else if (ok) {
+        ok = adm_copy_range(&in, &out, src_begin, src_begin + shift, data_bytes, buffer);
+    }
+    /* 奇数长度的 data 块按 RIFF 规则补一个填充字节 */
+    if (ok && (data_bytes & 1)) ok = raw_seek(&out, dest_size - 1) && raw_write_all(&out, "\0", 1);
+    raw_close(&in, 0);
+    ok = raw_close(&out, 1) && ok && !cancel_requested() && file_size_of(partial) == dest_size;
+    if (ok && !atomic_replace(partial, dest, NULL)) ok = 0;
+    double seconds = monotonic_seconds() - started;
+    publish_buffer_free(buffer);
+    free(header);
+    if (!ok) {
+        job_warn("封装 %s 失败或已取消 (errno=%d)\n", src, errno);
+        remove_file_if_exists(partial);
+        return cancel_requested() ? EXIT_CANCELLED : 1;
+    }
+
+    job_note("已封装 ADM BWF: %s\n", dest);
+    job_note("  床 %s（%d 声道，%s），%d Hz / %d bit，时长 %.3f 秒\n", spec.beds, bed_channels,
+           mask_ordered ? "按声道掩码排列" : "Dolby 声道顺序", spec.rate, spec.bits, spec.seconds);
+    job_note("  音频 %.2f MB，方式 %s，%.2f 秒（%.1f MB/s）\n", data_bytes / (1024.0 * 1024.0), method, seconds,
+           seconds > 0.0 ? data_bytes / (1024.0 * 1024.0) / seconds : 0.0);
+    return 0;
+}
+
+/* 普通 WAV 床封装到 <临时盘>\adm\<key>_<文件名>；不适用或失败返回 0，dee 仍读取原输入 */
+static int adm_wrap_for_dee(const EncodeJob *job, const char *source, const char *key, char *target, size_t target_size) {
+    WavLayout wav;
+    char dir[1024];
+    char name[600];
+    if (!wav_probe(source, &wav) || !wav.data_offset || wav.has_chna || wav.has_axml || !adm_bed_for_channels(wav.channels)) {
+        return 0;
+    }
+    build_path(dir, sizeof(dir), job->scratch_temp_dir[0] ? job->scratch_temp_dir : job->temp_dir_path, "adm");
+    ensure_directory_exists(dir);
+    snprintf(name, sizeof(name), "%s_%s", key, path_file_name(job->input_file));
+    build_path(target, target_size, dir, name);
+    job_note("输入为普通 %u 声道 WAV，封装为 ADM BWF 供 dee 读取。\n", wav.channels);
+    return adm_wrap_file(source, target, NULL, 1) == 0;
+}
+
+/*
+ * dee 之前的自动封装：每个任务只做一次，多格式的两个 dee pass 中后到的一个等待先到的完成。
+ * 封装结果放在 <临时盘>\adm\<任务标识>_<文件名>，失败或不适用时 dee 仍读取原输入
+ */
+static void adm_wrap_job_input(EncodeJob *job) {
+    if (!g_cli.auto_adm) return;
+    worker_mutex_lock(&g_console_lock);
+    int claimed = job->adm_state == ADM_WRAP_PENDING;
+    if (claimed) job->adm_state = ADM_WRAP_RUNNING;
+    worker_mutex_unlock(&g_console_lock);
+    if (!claimed) {
+        for (;;) {
+            worker_mutex_lock(&g_console_lock);
+            int state = job->adm_state;
+            worker_mutex_unlock(&g_console_lock);
+            if (state == ADM_WRAP_DONE || cancel_requested()) return;
+#ifdef _WIN32
+            Sleep(50);
+#else
+            sleep_milliseconds(50);
+#endif
+        }
+    }
+
+    const char *source = job->staged_input[0] ? job->staged_input : job->input_file;
+    char key[17];
+    char target[1024];
+    compute_job_key(job, key, sizeof(key));
+    if (adm_wrap_for_dee(job, source, key, target, sizeof(target))) {
+        copy_string(job->adm_input, sizeof(job->adm_input), target);
+    }
+    worker_mutex_lock(&g_console_lock);
+    job->adm_state = ADM_WRAP_DONE;
+    worker_mutex_unlock(&g_console_lock);
+}
+// --------- ADM 封装结束 ---------
+
+/* 一次 dee 调用：模板、专用的临时 XML 与 --temp 目录，可与其他 pass 并行 */
+typedef struct {
+    const char *label;           /* 并行时作为输出前缀；单独运行时为空，直接使用控制台 */
+    const char *template_xml;
+    char xml_path[1024];
+    char output[512];
+    char temp_dir[1024];
+    int part;                    /* 并行 pass 中的序号与总数，用于细分核心集 */
+    int parts;
+    ChildProc proc;
+} DeePass;
+
+/* 任务级调度：--sweep 的组合可覆盖核心集与线程上限 */
+static void resolve_job_schedule(const EncodeJob *job, ToolClass tool, int part, int parts, StageSchedule *out) {
+    resolve_stage_schedule(tool, part, parts, out);
+    out->queue_level = job->queue_level;
+    /* 紧急任务不按分槽绑核：被它抢占的任务暂停后，它可以用满全部核心 */
+    if (job->queue_level == QUEUE_URGENT) out->affinity = g_cli.schedule[tool].affinity;
+    if (job->affinity) out->affinity = job->affinity;
+    if (job->max_threads > 0) out->max_threads = job->max_threads;
+}
+
+static const char *job_bitrate(const EncodeJob *job) {
+    return job->bitrate[0] ? job->bitrate : "1664";
+}
+
+static int dee_pass_start(EncodeJob *job, DeePass *pass) {
+    char cmd[4096];
+    int cmd_len = 0;
+
+    adm_wrap_job_input(job);
+    const char *input_file = job->adm_input[0] ? job->adm_input : job->shared_input[0] ? job->shared_input
+                           : job->staged_input[0] ? job->staged_input : job->input_file;
+
+    ensure_directory_exists(pass->temp_dir);
+    job_claim_output(job, pass->output);
+    if (ends_with_extension(pass->output, ".mlp")) {
+        char side[1024];
+        for (size_t i = 0; i < sizeof(mlp_side_extensions) / sizeof(mlp_side_extensions[0]); ++i) {
+            replace_extension(pass->output, side, sizeof(side), mlp_side_extensions[i]);
+            job_claim_output(job, side);
+        }
+    }
+    if (generate_xml(pass->template_xml, pass->xml_path, input_file, pass->output,
+                     job->start, job->end, job->prepend_silence, job->append_silence, job->bitrate, job->xml_overrides) != 0) {
+        return 1;
+    }
+
+#ifdef _WIN32
+    char quoted_dee_exe[1024];
+    char quoted_temp_xml[2048];
+    char quoted_input_file[2048];
+    char quoted_output_file[2048];
+    char quoted_temp_dir[2048];
+
+    quote_argument(quoted_dee_exe, sizeof(quoted_dee_exe), job->dee_exe_path);
+    quote_argument(quoted_temp_xml, sizeof(quoted_temp_xml), pass->xml_path);
+    quote_argument(quoted_input_file, sizeof(quoted_input_file), input_file);
+    quote_argument(quoted_output_file, sizeof(quoted_output_file), pass->output);
+    quote_argument(quoted_temp_dir, sizeof(quoted_temp_dir), pass->temp_dir);
+
+    cmd_len = snprintf(cmd, sizeof(cmd),
+        "%s -x %s -a %s -o %s --temp %s",
+        quoted_dee_exe, quoted_temp_xml, quoted_input_file, quoted_output_file, quoted_temp_dir);
+#else
+    cmd_len = snprintf(cmd, sizeof(cmd),
+        "\"%s\" -x \"%s\" -a \"%s\" -o \"%s\" --temp \"%s\"",
+        job->dee_exe_path, pass->xml_path, input_file, pass->output, pass->temp_dir);
+#endif
+    if (cmd_len < 0 || cmd_len >= (int)sizeof(cmd)) {
+        job_warn("错误: 构建命令行失败或过长，请检查路径设置。\n");
+        return 1;
+    }
+
+    // ========== DEBUG: 打印生成的 temp_job.xml 内容 ==========
+    job_note("\n========== START temp_job.xml CONTENT ===========\n");
+    FILE *debug_f = fopen(pass->xml_path, "r");
+    if (debug_f) {
+        char debug_line[1024];
+        while (fgets(debug_line, sizeof(debug_line), debug_f)) {
+            job_note("%s", debug_line);
+        }
+        fclose(debug_f);
+    } else {
+        job_note("无法打开 temp_job.xml 进行调试读取！\n");
+    }
+    job_note("========== END temp_job.xml CONTENT ===========\n\n");
+    // ========================================================
+
+    job_note("执行命令: %s\n", cmd);
+
+    StageSchedule schedule;
+    resolve_job_schedule(job, TOOL_DEE, pass->part, pass->parts > 0 ? pass->parts : 1, &schedule);
+    if (schedule.affinity) {
+        char cores[256];
+        format_core_set(schedule.affinity, cores, sizeof(cores));
+        job_note("dee%s%s 使用核心集: %s\n", pass->label ? " " : "", pass->label ? pass->label : "", cores);
+    }
+    int spawn_code = child_spawn(&pass->proc, job->dee_exe_path, cmd, pass->label, &schedule, job->usage);
+    if (spawn_code != 0) {
+        job_warn("调用 dee.exe 失败: %s\n", job->dee_exe_path);
+    }
+    return spawn_code;
+}
+
+static const char *job_label(const EncodeJob *job) {
+    return job->label[0] ? job->label : NULL;
+}
+
+/* 单一格式的 dee 主编码；part/parts 为批量模式下该 pass 在 dee 池中的槽位 */
+static int run_dee_stage(EncodeJob *job, DeePass *pass, int part, int parts) {
+    memset(pass, 0, sizeof(*pass));
+    pass->label = job_label(job);
+    pass->template_xml = job->template_xml;
+    pass->part = part;
+    pass->parts = parts;
+    copy_string(pass->xml_path, sizeof(pass->xml_path), job->temp_xml_path);
+    copy_string(pass->output, sizeof(pass->output), job->dee_output_target);
+    job_pass_temp_dir(job, STAGE_DEE, pass->temp_dir, sizeof(pass->temp_dir));
+
+    int exit_code = dee_pass_start(job, pass);
+    if (exit_code != 0) return exit_code;
+    return child_wait(&pass->proc);
+}
+
+static int run_deew_stage(EncodeJob *job) {
+    char mlp_directory[512];
+    char candidates[5][512];
+    static const char *const extensions[5] = {".eb3", ".EB3", ".ec3", ".ddp", ".DDP"};
+
+    directory_of(job->intermediate_mlp_path, mlp_directory, sizeof(mlp_directory));
+    /* deew 的输出与输入 MLP 同目录同名，只是扩展名不同 */
+    for (int i = 0; i < 5; ++i) {
+        replace_extension(job->intermediate_mlp_path, candidates[i], sizeof(candidates[i]), extensions[i]);
+        job_claim_output(job, candidates[i]);
+    }
+
+    char deew_cmd[4096];
+    int deew_len = snprintf(deew_cmd, sizeof(deew_cmd),
+        "cmd /C \"chcp 65001 > nul && cd /d \"%s\" && (deew.exe -i \"%s\" -f ddp -b %s -fb || deew -i \"%s\" -f ddp -b %s -fb || python -X utf8 -m deew -i \"%s\" -f ddp -b %s -fb || py -3 -X utf8 -m deew -i \"%s\" -f ddp -b %s -fb || py -3.9 -X utf8 -m deew -i \"%s\" -f ddp -b %s -fb)\"",
+        mlp_directory,
+        job->intermediate_mlp_path, job_bitrate(job),
+        job->intermediate_mlp_path, job_bitrate(job),
+        job->intermediate_mlp_path, job_bitrate(job),
+        job->intermediate_mlp_path, job_bitrate(job),
+        job->intermediate_mlp_path, job_bitrate(job));
+    if (deew_len < 0 || deew_len >= (int)sizeof(deew_cmd)) {
+        job_warn("错误: 构建 deew 命令失败。\n");
+        return 1;
+    }
+
+    job_note("执行命令: %s\n", deew_cmd);
+    StageSchedule schedule;
+    resolve_job_schedule(job, TOOL_PYTHON, 0, 1, &schedule);
+    int deew_code = run_shell_command(&schedule, job_label(job), job->usage, deew_cmd);
+    if (deew_code != 0) {
+        job_warn("deew 执行失败 (exit=%d)，请确认已将 deew.exe 加入 PATH 或已通过 pip 安装 deew。当前命令: %s\n", deew_code, deew_cmd);
+        return 1;
+    }
+
+    job->post_source_path[0] = '\0';
+    for (int i = 0; i < 5; ++i) {
+        if (file_exists(candidates[i])) {
+            copy_string(job->post_source_path, sizeof(job->post_source_path), candidates[i]);
+            break;
+        }
+    }
+    if (!job->post_source_path[0]) {
+        job_warn("deew 未生成预期的 DDP 文件，请检查命令输出，并确认 deew 默认输出位於與輸入相同的目录。\n");
+        return 1;
+    }
+
+    job_note("找到 DDP 中间文件: %s\n", job->post_source_path);
+    return 0;
+}
+
+static int run_deezy_stage(EncodeJob *job) {
+    char mlp_directory[512];
+    char expected[512];
+    directory_of(job->intermediate_mlp_path, mlp_directory, sizeof(mlp_directory));
+    /* deezy 默认在 MLP 旁边写同名 EC3 */
+    replace_extension(job->intermediate_mlp_path, expected, sizeof(expected), ".ec3");
+    job_claim_output(job, expected);
+
+#ifdef _WIN32
+    ULONGLONG search_threshold = get_system_filetime_ticks();
+#endif
+
+    char deezy_cmd[4096];
+    int deezy_len = snprintf(deezy_cmd, sizeof(deezy_cmd),
+        "cmd /C \"chcp 65001 > nul && cd /d \"%s\" && (deezy encode atmos --atmos-mode bluray --bitrate %s \"%s\" || deezy.exe encode atmos --atmos-mode bluray --bitrate %s \"%s\")\"",
+        mlp_directory,
+        job_bitrate(job), job->intermediate_mlp_path,
+        job_bitrate(job), job->intermediate_mlp_path);
+    if (deezy_len < 0 || deezy_len >= (int)sizeof(deezy_cmd)) {
+        job_warn("错误: 构建 deezy 命令失败。\n");
+        return 1;
+    }
+
+    job_note("执行命令: %s\n", deezy_cmd);
+    StageSchedule schedule;
+    resolve_job_schedule(job, TOOL_PYTHON, 0, 1, &schedule);
+    int deezy_code = run_shell_command(&schedule, job_label(job), job->usage, deezy_cmd);
+    if (deezy_code != 0) {
+        job_warn("deezy 执行失败 (exit=%d)，请确认 deezy 已安装并在 PATH 中。当前命令: %s\n", deezy_code, deezy_cmd);
+        return 1;
+    }
+
+    job->post_source_path[0] = '\0';
+#ifdef _WIN32
+    /* 批量模式下同目录可能有其他任务的 deezy 同时产出 EC3，优先取与 MLP 同名的文件 */
+    WIN32_FILE_ATTRIBUTE_DATA same_stem;
+    char same_stem_path[512];
+    replace_extension(job->intermediate_mlp_path, same_stem_path, sizeof(same_stem_path), ".ec3");
+    if (GetFileAttributesExA(same_stem_path, GetFileExInfoStandard, &same_stem) &&
+        (((ULONGLONG)same_stem.ftLastWriteTime.dwHighDateTime << 32) | same_stem.ftLastWriteTime.dwLowDateTime) >= search_threshold) {
+        copy_string(job->post_source_path, sizeof(job->post_source_path), same_stem_path);
+    } else if (!find_recent_ec3_in_directory(mlp_directory, search_threshold, job->post_source_path, sizeof(job->post_source_path))) {
+        job_warn("未在目录 %s 下找到 deezy 生成的最新 EC3 文件，请检查 deezy 输出。\n", mlp_directory);
+        return 1;
+    }
+#else
+    replace_extension(job->intermediate_mlp_path, job->post_source_path, sizeof(job->post_source_path), ".ec3");
+    if (!file_exists(job->post_source_path)) {
+        job_warn("未找到 deezy 生成的 EC3 文件。\n");
+        return 1;
+    }
+#endif
+
+    if (!file_exists(job->post_source_path)) {
+        job_warn("deezy 生成的 EC3 文件不存在: %s\n", job->post_source_path);
+        return 1;
+    }
+
+    job_note("找到 deezy 输出的 EC3 文件: %s\n", job->post_source_path);
+    return 0;
+}
+
+/* 只换容器不重新编码：默认由 ffmpeg -c:a copy 把 E-AC-3 基本流封装进 MP4，--cmaf 时改用内置的分片封装 */
+static int run_remux_stage(EncodeJob *job, const char *source_path, const char *target_path) {
+    StageSchedule schedule;
+    ensure_parent_directory(target_path);
+    job_claim_output(job, target_path);
+
+    if (g_cli.cmaf) {
+        CmafOptions options;
+        options.fragment_seconds = g_cli.fragment_seconds;
+        options.manifests = g_cli.stream_manifests;
+        if (cmaf_package_file(source_path, target_path, &options) != 0) return 1;
+        job_note("已生成最终输出文件: %s\n", target_path);
+        return 0;
+    }
+
+    resolve_job_schedule(job, TOOL_MUX, 0, 1, &schedule);
+
+    char thread_arg[32] = "";
+    if (schedule.max_threads > 0) {
+        snprintf(thread_arg, sizeof(thread_arg), " -threads %d", schedule.max_threads);
+    }
+
+    char ffmpeg_cmd[4096];
+    int ffmpeg_len = snprintf(ffmpeg_cmd, sizeof(ffmpeg_cmd),
+        "ffmpeg -y%s -i \"%s\" -c:a copy -movflags +faststart -f mp4 \"%s\"",
+        thread_arg, source_path, target_path);
+    if (ffmpeg_len < 0 || ffmpeg_len >= (int)sizeof(ffmpeg_cmd)) {
+        job_warn("错误: 构建 ffmpeg 命令失败。\n");
+        return 1;
+    }
+
+    job_note("执行命令: %s\n", ffmpeg_cmd);
+    int ffmpeg_code = run_shell_command(&schedule, job_label(job), job->usage, ffmpeg_cmd);
+    if (ffmpeg_code != 0 || !file_exists(target_path)) {
+        job_warn("ffmpeg 转封装失败 (exit=%d)，请检查 ffmpeg 是否在 PATH 中。\n", ffmpeg_code);
+        return 1;
+    }
+
+    job_note("已生成最终输出文件: %s\n", target_path);
+    return 0;
+}
+
+static void cleanup_job_intermediates(EncodeJob *job) {
+    char path[512];
+    static const char *const mlp_side_files[] = {".eb3", ".ec3", ".ddp", ".mlp.mll", ".mll", ".mlp.log"};
+    if (!job->intermediate_mlp_path[0]) return;
+    for (size_t i = 0; i < sizeof(mlp_side_files) / sizeof(mlp_side_files[0]); ++i) {
+        replace_extension(job->intermediate_mlp_path, path, sizeof(path), mlp_side_files[i]);
+        remove_file_if_exists(path);
+    }
+    if (job->post_source_path[0]) remove_file_if_exists(job->post_source_path);
+    remove_file_if_exists(job->intermediate_mlp_path);
+}
+
+/* 复用上次已完成的阶段。返回应从哪个阶段开始执行 */
+static int resume_job_from_journal(EncodeJob *job, int post_stage) {
+    JobJournal *journal = &job->journal;
+    if (!journal_stage_valid(journal, STAGE_DEE)) return STAGE_DEE;
+
+    const char *dee_artifact = journal->stages[STAGE_DEE].artifact;
+    if (job->choice == 4 || job->choice == 5) {
+        /* 上次的 MLP 可能位于旧的临时输出名下，直接沿用其路径 */
+        copy_string(job->intermediate_mlp_path, sizeof(job->intermediate_mlp_path), dee_artifact);
+        job_note("断点续跑: 复用已完成的 dee 产物 %s\n", dee_artifact);
+        if (!journal_stage_valid(journal, post_stage)) return post_stage;
+        copy_string(job->post_source_path, sizeof(job->post_source_path), journal->stages[post_stage].artifact);
+        job_note("断点续跑: 复用已完成的 %s 产物 %s\n", stage_names[post_stage], job->post_source_path);
+        return STAGE_REMUX;
+    }
+
+    if (strcmp(dee_artifact, job->dee_output_target) != 0) {
+        ensure_parent_directory(job->dee_output_target);
+        remove_file_if_exists(job->dee_output_target);
+        if (rename(dee_artifact, job->dee_output_target) != 0) {
+            job_warn("警告: 无法将上次产物 %s 移动到 %s (errno=%d)，重新编码。\n", dee_artifact, job->dee_output_target, errno);
+            return STAGE_DEE;
+        }
+    }
+    job_note("断点续跑: 复用已完成的 dee 产物 %s\n", job->dee_output_target);
+    return STAGE_COUNT;
+}
+
+/* 复用上次完成的某个 dee pass；产物位于旧路径时移动到本次的目标路径 */
+static int reuse_pass_artifact(JobJournal *journal, StageId stage, const char *target) {
+    if (!journal_stage_valid(journal, stage)) return 0;
+    const char *artifact = journal->stages[stage].artifact;
+    if (strcmp(artifact, target) != 0) {
+        ensure_parent_directory(target);
+        remove_file_if_exists(target);
+        if (rename(artifact, target) != 0) return 0;
+        copy_string(journal->stages[stage].artifact, sizeof(journal->stages[stage].artifact), target);
+    }
+    job_note("断点续跑: 复用已完成的 %s 产物 %s\n", stage_names[stage], target);
+    return 1;
+}
+
+/* 准备多格式输出中的一个 dee pass：并行的 pass 不能共用 temp_job.xml 与 DolbyTemp，否则会互相覆盖 */
+static void prepare_multi_pass(const EncodeJob *job, StageId stage, DeePass *pass, const char *label, int part, int parts) {
+    int want_ec3 = (job->formats & OUTPUT_FORMAT_EC3) != 0;
+    char name[64];
+
+    memset(pass, 0, sizeof(*pass));
+    pass->label = label;
+    pass->part = part;
+    pass->parts = parts;
+    if (stage == STAGE_DEE) {
+        pass->template_xml = want_ec3 ? job->template_ec3 : job->template_m4a;
+        copy_string(pass->output, sizeof(pass->output), want_ec3 ? job->ec3_output : job->m4a_output);
+    } else {
+        pass->template_xml = job->template_mlp;
+        copy_string(pass->output, sizeof(pass->output), job->mlp_output);
+    }
+    snprintf(name, sizeof(name), "temp_job_%s_%s.xml", job->journal.job_key, stage_names[stage]);
+    build_path(pass->xml_path, sizeof(pass->xml_path), job->temp_dir_path, name);
+    job_pass_temp_dir(job, stage, pass->temp_dir, sizeof(pass->temp_dir));
+}
+
+/* 多格式收尾：逐个校验交付文件，通过后结束任务日志 */
+static int finish_multi_format_job(EncodeJob *job) {
+    int want_ec3 = (job->formats & OUTPUT_FORMAT_EC3) != 0;
+    int want_m4a = (job->formats & OUTPUT_FORMAT_M4A) != 0;
+    int want_mlp = (job->formats & OUTPUT_FORMAT_MLP) != 0;
+    int remux_m4a = want_ec3 && want_m4a;
+    int failed = 0;
+
+    if (g_cli.verify_enabled) {
+        static const struct { unsigned format; int choice; StageId stage; } checks[] = {
+            {OUTPUT_FORMAT_EC3, 1, STAGE_DEE},
+            {OUTPUT_FORMAT_M4A, 2, STAGE_REMUX},
+            {OUTPUT_FORMAT_MLP, 3, STAGE_DEE_MLP},
+        };
+        int outputs = want_ec3 + want_m4a + want_mlp;
+        double began = job_stage_begin(job, "qc");
+        for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); ++i) {
+            if (!(job->formats & checks[i].format)) continue;
+            const char *path = checks[i].format == OUTPUT_FORMAT_EC3 ? job->ec3_output
+                             : checks[i].format == OUTPUT_FORMAT_M4A ? job->m4a_output : job->mlp_output;
+            StageId stage = checks[i].stage;
+            if (checks[i].format == OUTPUT_FORMAT_M4A && !remux_m4a) stage = STAGE_DEE;
+            QcExpect expect;
+            qc_expectations_for_choice(checks[i].choice, &expect);
+            /* 多个输出时 --qc-report 无法共用一个路径，各自写到输出旁 */
+            if (verify_output_file(path, &expect, outputs == 1 ? g_cli.qc_report : NULL, qc_thread_budget()) != 0) {
+                journal_invalidate(&job->journal, stage);
+                failed = 1;
+            }
+        }
+        job->qc_seconds += monotonic_seconds() - began;
+        if (failed) return 1;
+    }
+
+    journal_finish(&job->journal);
+    return 0;
+}
+
+/*
+ * 多格式输出：EC3 与 M4A 是同一条 E-AC-3 码流的不同封装，只跑一次 DDP pass，再用 ffmpeg 转封装得到 M4A；
+ * 需要 MLP 时另起一个 TrueHD pass，两个 dee 进程并行执行。
+ */
+static int run_multi_format_job(EncodeJob *job) {
+    int want_ec3 = (job->formats & OUTPUT_FORMAT_EC3) != 0;
+    int want_m4a = (job->formats & OUTPUT_FORMAT_M4A) != 0;
+    int want_mlp = (job->formats & OUTPUT_FORMAT_MLP) != 0;
+    int remux_m4a = want_ec3 && want_m4a;
+    DeePass passes[2];
+    StageId pass_stages[2];
+    int pass_count = 0;
+    int failed = 0;
+
+    journal_open(&job->journal, job, g_cli.resume_enabled);
+    space_ledger_open(job);
+    if (want_ec3 || want_m4a) pass_stages[pass_count++] = STAGE_DEE;
+    if (want_mlp) pass_stages[pass_count++] = STAGE_DEE_MLP;
+
+    job_note("多格式输出: %s%s%s%s%s，计划 %d 个 dee pass%s\n",
+           want_ec3 ? "ec3" : "", want_ec3 && (want_m4a || want_mlp) ? "," : "",
+           want_m4a ? "m4a" : "", want_m4a && want_mlp ? "," : "", want_mlp ? "mlp" : "",
+           pass_count, remux_m4a ? " + 1 次 M4A 转封装" : "");
+
+    int started[2] = {0, 0};
+    double began = job_stage_begin(job, "dee");
+    for (int i = 0; i < pass_count; ++i) {
+        DeePass *pass = &passes[i];
+        const char *label = pass_count == 1 ? NULL : (pass_stages[i] == STAGE_DEE ? "ddp" : "mlp");
+        prepare_multi_pass(job, pass_stages[i], pass, label, i, pass_count);
+        if (g_cli.resume_enabled && reuse_pass_artifact(&job->journal, pass_stages[i], pass->output)) continue;
+        if (dee_pass_start(job, pass) != 0) {
+            failed = 1;
+            break;
+        }
+        started[i] = 1;
+    }
+
+    for (int i = 0; i < pass_count; ++i) {
+        if (!started[i]) continue;
+        int code = child_wait(&passes[i].proc);
+        job_stage_end(job, pass_stages[i], began);
+        remove_file_if_exists(passes[i].xml_path);
+        if (code != 0) {
+            job_warn("dee pass %s 失败 (exit=%d)\n", stage_names[pass_stages[i]], code);
+            failed = 1;
+        } else {
+            journal_record(&job->journal, pass_stages[i], passes[i].output);
+        }
+    }
+    relay_reset();
+    if (failed) return 1;
+
+    if (remux_m4a) {
+        if (!(g_cli.resume_enabled && reuse_pass_artifact(&job->journal, STAGE_REMUX, job->m4a_output))) {
+            began = job_stage_begin(job, "remux");
+            int code = run_remux_stage(job, job->ec3_output, job->m4a_output);
+            job_stage_end(job, STAGE_REMUX, began);
+            if (code != 0) return 1;
+            journal_record(&job->journal, STAGE_REMUX, job->m4a_output);
+        }
+    }
+
+    return finish_multi_format_job(job);
+}
+
+static StageId post_stage_of(const EncodeJob *job) {
+    return job->choice == 4 ? STAGE_DEEW : STAGE_DEEZY;
+}
+
+/* 打开任务日志；开启断点续跑时复用已完成的阶段，返回应从哪个阶段开始 */
+static int open_single_format_job(EncodeJob *job) {
+    int start_stage = STAGE_DEE;
+    journal_open(&job->journal, job, g_cli.resume_enabled);
+    space_ledger_open(job);
+    if (g_cli.resume_enabled) {
+        start_stage = resume_job_from_journal(job, post_stage_of(job));
+        if (start_stage != STAGE_DEE && start_stage < STAGE_COUNT) {
+            job_note("断点续跑: 从阶段 %s 继续（任务日志: %s）\n", stage_names[start_stage], job->journal.path);
+        }
+    }
+    return start_stage;
+}
+
+/* 蓝光流程的第二阶段：deew 生成 7.1ch DDP，或 deezy 生成 Atmos Blu-ray EC3 */
+static int run_post_stage(EncodeJob *job) {
+    if (job->choice == 4) {
+        job_note("dee 完成 MLP 导出，开始调用 deew 生成 7.1ch DDP (Blu-ray)...\n");
+        return run_deew_stage(job);
+    }
+    job_note("dee 完成 MLP 导出，开始调用 deezy 生成 Dolby Atmos M4A 7.1 (Blu-ray)...\n");
+    return run_deezy_stage(job);
+}
+
+/* 单一格式收尾：逐帧校验最终输出，通过后删除蓝光流程的中间文件并结束任务日志 */
+static int finish_single_format_job(EncodeJob *job) {
+    int bluray = job->choice == 4 || job->choice == 5;
+
+    /* 退出码与文件存在都不足以证明交付物完好，逐帧校验最终输出 */
+    if (g_cli.verify_enabled) {
+        QcExpect expect;
+        double began = job_stage_begin(job, "qc");
+        qc_expectations_for_choice(job->choice, &expect);
+        int code = verify_output_file(job->final_output_path, &expect, g_cli.qc_report, qc_thread_budget());
+        job->qc_seconds += monotonic_seconds() - began;
+        if (code != 0) {
+            /* 产出坏文件的阶段不能作为断点被复用 */
+            journal_invalidate(&job->journal, bluray ? STAGE_REMUX : STAGE_DEE);
+            return 1;
+        }
+    }
+
+    if (bluray) cleanup_job_intermediates(job);
+    journal_finish(&job->journal);
+    return 0;
+}
+
+/* 单一格式：dee → (deew|deezy → ffmpeg) → QC，每个阶段完成后写入断点 */
+static int run_single_format_job(EncodeJob *job) {
+    int bluray = job->choice == 4 || job->choice == 5;
+    int post_stage = post_stage_of(job);
+    int start_stage = open_single_format_job(job);
+
+    if (start_stage == STAGE_DEE) {
+        DeePass pass;
+        double began = job_stage_begin(job, "dee");
+        int exit_code = run_dee_stage(job, &pass, 0, 1);
+        job_stage_end(job, STAGE_DEE, began);
+        if (exit_code != 0) return exit_code;
+        journal_record(&job->journal, STAGE_DEE, job->dee_output_target);
+        start_stage = bluray ? post_stage : STAGE_COUNT;
+    }
+
+    if (bluray) {
+        if (start_stage == post_stage) {
+            double began = job_stage_begin(job, stage_names[post_stage]);
+            int code = run_post_stage(job);
+            job_stage_end(job, (StageId)post_stage, began);
+            if (code != 0) return 1;
+            journal_record(&job->journal, post_stage, job->post_source_path);
+            start_stage = STAGE_REMUX;
+        }
+        if (start_stage == STAGE_REMUX) {
+            double began = job_stage_begin(job, "remux");
+            int code = run_remux_stage(job, job->post_source_path, job->final_output_path);
+            job_stage_end(job, STAGE_REMUX, began);
+            if (code != 0) return 1;
+            journal_record(&job->journal, STAGE_REMUX, job->final_output_path);
+        }
+    }
+
+    return finish_single_format_job(job);
+}
+
+/* dee 的 --temp 与蓝光流程的 MLP/EC3 中间文件放到最快的临时盘；交付文件仍写到用户指定的位置 */
+static void place_job_on_scratch(EncodeJob *job) {
+    char scratch[512];
+    if (!select_scratch_dir(job->temp_dir_path, job_scratch_bytes(job), scratch, sizeof(scratch))) return;
+
+    build_path(job->scratch_temp_dir, sizeof(job->scratch_temp_dir), scratch, "DolbyTemp");
+    ensure_directory_exists(job->scratch_temp_dir);
+    if (job->formats || (job->choice != 4 && job->choice != 5)) return;
+
+    /* 多个任务可能共用同一临时盘，中间文件名带上任务标识 */
+    char key[17];
+    char stem[256];
+    char file_name[300];
+    copy_string(stem, sizeof(stem), path_file_name(job->final_output_path));
+    char *dot = strrchr(stem, '.');
+    if (dot) *dot = '\0';
+    compute_job_key(job, key, sizeof(key));
+    snprintf(file_name, sizeof(file_name), "%s_%s.mlp", stem, key);
+    build_path(job->intermediate_mlp_path, sizeof(job->intermediate_mlp_path), job->scratch_temp_dir, file_name);
+    copy_string(job->dee_output_target, sizeof(job->dee_output_target), job->intermediate_mlp_path);
+    job_note("MLP 中间文件: %s\n", job->intermediate_mlp_path);
+}
+
+/* 任务成功后发布交付文件：--publish 指向目录（或多格式输出、批量模式）时保留原文件名 */
+static int publish_job_outputs(EncodeJob *job) {
+    const char *outputs[3];
+    int count = 0;
+    int failed = 0;
+    if (!g_cli.publish_path[0] && !g_cli.write_manifest) return 0;
+
+    if (job->formats) {
+        if (job->formats & OUTPUT_FORMAT_EC3) outputs[count++] = job->ec3_output;
+        if (job->formats & OUTPUT_FORMAT_M4A) outputs[count++] = job->m4a_output;
+        if (job->formats & OUTPUT_FORMAT_MLP) outputs[count++] = job->mlp_output;
+    } else {
+        outputs[count++] = job->final_output_path;
+    }
+
+    size_t publish_len = strlen(g_cli.publish_path);
+    int into_directory = count > 1 || g_batch_mode || path_is_directory(g_cli.publish_path) ||
+                         (publish_len > 0 && (g_cli.publish_path[publish_len - 1] == '\\' || g_cli.publish_path[publish_len - 1] == '/'));
+    for (int i = 0; i < count; ++i) {
+        char target[1024];
+        if (!g_cli.publish_path[0]) {
+            copy_string(target, sizeof(target), outputs[i]);
+        } else if (into_directory) {
+            ensure_directory_exists(g_cli.publish_path);
+            build_path(target, sizeof(target), g_cli.publish_path, path_file_name(outputs[i]));
+        } else {
+            copy_string(target, sizeof(target), g_cli.publish_path);
+        }
+        if (publish_output(outputs[i], target, g_cli.publish_hash, 1) != 0) failed = 1;
+    }
+    return failed;
+}
+
+/*
+ * 任务收尾：取消时拆除子进程树后回收本任务的中间文件；否则清理 dee 临时目录，成功时发布交付文件。
+ * 无论结果如何都追加一条任务历史。
+ */
+static int complete_encode_job(EncodeJob *job, int exit_code) {
+    char temp_dir[1024];
+    ReclaimStats stats = {0, 0};
+
+    if (job->staged_input[0]) {
+        remove_file_if_exists(job->staged_input);
+        job->staged_input[0] = '\0';
+    }
+    if (job->adm_input[0]) {
+        remove_file_if_exists(job->adm_input);
+        job->adm_input[0] = '\0';
+    }
+    if (cancel_requested()) {
+        reclaim_cancelled_job(job);
+        space_ledger_close(job);
+        history_record(job, "cancelled");
+        return EXIT_CANCELLED;
+    }
+    /* dee 正常结束时一般会清理 --temp，这里兜底删除空目录或残留 */
+    job_pass_temp_dir(job, STAGE_DEE, temp_dir, sizeof(temp_dir));
+    reclaim_directory_tree(temp_dir, &stats);
+    job_pass_temp_dir(job, STAGE_DEE_MLP, temp_dir, sizeof(temp_dir));
+    reclaim_directory_tree(temp_dir, &stats);
+    space_ledger_close(job);
+    if (exit_code == 0 && publish_job_outputs(job) != 0) exit_code = 1;
+    history_record(job, exit_code == 0 ? "ok" : "failed");
+    return exit_code;
+}
+
+/* 执行一个编码任务 */
+static int run_encode_job(EncodeJob *job) {
+    print_job_eta(job);
+    space_check_job(job);
+    job->started_at = monotonic_seconds();
+    int exit_code = job->formats ? run_multi_format_job(job) : run_single_format_job(job);
+    return complete_encode_job(job, exit_code);
+}
+// --------- 编码任务结束 ---------
+
+#ifndef DEE_LIBRARY
+// --------- 输入预取：排队任务的输入预读到页缓存或暂存到本地临时盘 ---------
+/*
+ * 母版放在 NAS 上时，dee 的第一遍受网络读取限制。批量调度启动第一批阶段后，后台线程按队列顺序
+ * 处理 dee 尚未开始的任务：cache 模式顺序读一遍输入，让 dee 读到页缓存中的热数据；stage 模式把输入
+ * 复制到临时盘的 staged 目录，dee 改读本地副本。读取按 --prefetch-rate 限速，避免挤占正在编码的任务。
+ * dee 开始时 cache 预读随即停止；stage 复制未完成时 dee 取消限速并等待复制完成。
+ */
+typedef enum {
+    PREFETCH_PENDING = 0,
+    PREFETCH_ACTIVE,      /* 正在预读到页缓存，dee 开始时中止 */
+    PREFETCH_STAGING,     /* 正在复制到本地，dee 需等待 */
+    PREFETCH_DONE,
+    PREFETCH_SKIPPED      /* dee 已先开始，或无需预取 */
+} PrefetchState;
+
+typedef struct {
+    EncodeJob *jobs;
+    int count;
+    volatile int stop;
+    int started;
+    int threaded;
+    worker_thread_t thread;
+} PrefetchQueue;
+
+static int prefetch_state_of(EncodeJob *job) {
+    worker_mutex_lock(&g_console_lock);
+    int state = job->prefetch_state;
+    worker_mutex_unlock(&g_console_lock);
+    return state;
+}
+
+static int prefetch_transition(EncodeJob *job, int from, int to) {
+    worker_mutex_lock(&g_console_lock);
+    int ok = job->prefetch_state == from;
+    if (ok) job->prefetch_state = to;
+    worker_mutex_unlock(&g_console_lock);
+    return ok;
+}
+
+/* 可用物理内存；页缓存放不下的文件预读了也会在 dee 开始前被挤出 */
+static long long available_memory_bytes(void) {
+#ifdef _WIN32
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (!GlobalMemoryStatusEx(&status)) return -1;
+    return (long long)status.ullAvailPhys;
+#else
+    long pages = sysconf(_SC_AVPHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || page_size <= 0) return -1;
+    return (long long)pages * page_size;
+#endif
+}
+
+/* 读取进度超前于速率上限时睡眠；dee 已在等待该任务时不限速 */
+static void prefetch_throttle(const EncodeJob *job, long long done, double began) {
+    double rate = g_cli.prefetch_rate * 1024.0 * 1024.0;
+    if (rate <= 0.0 || job->prefetch_urgent) return;
+    double ahead = (double)done / rate - (monotonic_seconds() - began);
+    if (ahead <= 0.0) return;
+    if (ahead > 1.0) ahead = 1.0;
+#ifdef _WIN32
+    Sleep((DWORD)(ahead * 1000.0));
+#else
+    sleep_milliseconds((int)(ahead * 1000.0));
+#endif
+}
+
+static int prefetch_should_stop(const PrefetchQueue *queue) {
+    return queue->stop || cancel_requested();
+}
+
+/* 顺序读一遍输入；dee 开始（状态不再是 ACTIVE）或队列停止时提前结束，返回读取的字节数 */
+static long long prefetch_into_cache(PrefetchQueue *queue, EncodeJob *job, void *buffer) {
+    RawFile f;
+    long long done = 0;
+    double began = monotonic_seconds();
+    if (!raw_open(&f, job->input_file, 0)) return -1;
+#ifndef _WIN32
+    posix_fadvise(f.fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+    for (;;) {
+        if (prefetch_should_stop(queue) || prefetch_state_of(job) != PREFETCH_ACTIVE) break;
+        long long got = raw_read(&f, buffer, PUBLISH_CHUNK);
+        if (got <= 0) break;
+        done += got;
+        prefetch_throttle(job, done, began);
+    }
+    raw_close(&f, 0);
+    return done;
+}
+
+/* 复制到 <临时盘>\staged\<任务标识>_<文件名>，先写 .partial 再改名；成功时设置 staged_input */
+static int prefetch_stage_input(PrefetchQueue *queue, EncodeJob *job, void *buffer) {
+    char dir[1024];
+    char key[17];
+    char name[600];
+    char target[1024];
+    char partial[1100];
+    RawFile in;
+    RawFile out;
+    long long done = 0;
+    int ok = 1;
+    double began = monotonic_seconds();
+
+    build_path(dir, sizeof(dir), job->scratch_temp_dir[0] ? job->scratch_temp_dir : job->temp_dir_path, "staged");
+    ensure_directory_exists(dir);
+    compute_job_key(job, key, sizeof(key));
+    snprintf(name, sizeof(name), "%s_%s", key, path_file_name(job->input_file));
+    build_path(target, sizeof(target), dir, name);
+    snprintf(partial, sizeof(partial), "%s.partial", target);
+
+    if (!raw_open(&in, job->input_file, 0)) return 0;
+    if (!raw_open(&out, partial, 1)) {
+        raw_close(&in, 0);
+        return 0;
+    }
+    for (;;) {
+        if (prefetch_should_stop(queue)) {
+            ok = 0;
+            break;
+        }
+        long long got = raw_read(&in, buffer, PUBLISH_CHUNK);
+        if (got < 0 || (got > 0 && !raw_write_all(&out, buffer, (size_t)got))) {
+            ok = 0;
+            break;
+        }
+        if (got == 0) break;
+        done += got;
+        prefetch_throttle(job, done, began);
+    }
+    raw_close(&in, 0);
+    if (!raw_close(&out, 0) || done != file_size_of(job->input_file)) ok = 0;
+    if (ok && atomic_replace(partial, target, NULL)) {
+        copy_string(job->staged_input, sizeof(job->staged_input), target);
+        return 1;
+    }
+    remove_file_if_exists(partial);
+    return 0;
+}
+
+static void prefetch_worker(void *arg) {
+    PrefetchQueue *queue = (PrefetchQueue *)arg;
+    void *buffer = publish_buffer_alloc();
+    if (!buffer) return;
+
+    for (int i = 0; i < queue->count && !prefetch_should_stop(queue); ++i) {
+        EncodeJob *job = &queue->jobs[i];
+        long long size = file_size_of(job->input_file);
+        int stage = g_cli.prefetch_mode == PREFETCH_MODE_STAGE;
+        if (size <= 0) continue;
+        if (stage) {
+            const char *root = job->scratch_temp_dir[0] ? job->scratch_temp_dir : job->temp_dir_path;
+            long long free_bytes = volume_free_bytes(root);
+            /* 暂存副本与 dee 临时文件、MLP 中间文件共用临时盘，另留 1 GB 余量 */
+            if (free_bytes >= 0 && free_bytes < size * 3 + (1LL << 30)) {
+                worker_mutex_lock(&g_console_lock);
+                job_note("预取 %s: 临时盘空间不足，改为预读到缓存。\n", job->label);
+                worker_mutex_unlock(&g_console_lock);
+                stage = 0;
+            }
+        }
+        if (!stage) {
+            long long memory = available_memory_bytes();
+            if (memory >= 0 && size > memory / 2) continue;
+        }
+        if (!prefetch_transition(job, PREFETCH_PENDING, stage ? PREFETCH_STAGING : PREFETCH_ACTIVE)) continue;
+
+        double began = monotonic_seconds();
+        long long done = size;
+        int ok = stage ? prefetch_stage_input(queue, job, buffer) : (done = prefetch_into_cache(queue, job, buffer)) >= 0;
+        double seconds = monotonic_seconds() - began;
+        worker_mutex_lock(&g_console_lock);
+        job->prefetch_state = PREFETCH_DONE;
+        if (ok && done > 0) {
+            job_note("预取 %s: %s %.1f MB，用时 %.1f 秒（%.1f MB/s）%s%s\n", job->label, stage ? "已暂存" : "已读入缓存",
+                   done / (1024.0 * 1024.0), seconds, seconds > 0.0 ? done / (1024.0 * 1024.0) / seconds : 0.0,
+                   stage ? " -> " : "", stage ? job->staged_input : "");
+        } else if (!ok && !prefetch_should_stop(queue)) {
+            job_note("预取 %s: 失败，dee 将直接读取原始输入。\n", job->label);
+        }
+        worker_mutex_unlock(&g_console_lock);
+    }
+    publish_buffer_free(buffer);
+}
+
+/* 批量调度启动第一批阶段后调用：此时仍在 PENDING 的任务都在排队 */
+static void prefetch_start(PrefetchQueue *queue) {
+    if (queue->started) return;
+    queue->started = 1;
+    if (g_cli.prefetch_mode == PREFETCH_MODE_OFF || queue->count < 2) return;
+    queue->threaded = worker_start(&queue->thread, prefetch_worker, queue);
+}
+
+static void prefetch_stop(PrefetchQueue *queue) {
+    queue->stop = 1;
+    if (queue->threaded) worker_join(queue->thread);
+    queue->threaded = 0;
+}
+
+/* dee 即将开始：中止该任务的缓存预读；返回 1 表示暂存仍在进行，dee 需要等待 */
+static int prefetch_hold_dee(EncodeJob *job) {
+    worker_mutex_lock(&g_console_lock);
+    int waiting = job->prefetch_state == PREFETCH_STAGING;
+    if (waiting) job->prefetch_urgent = 1;
+    else if (job->prefetch_state == PREFETCH_PENDING || job->prefetch_state == PREFETCH_ACTIVE) job->prefetch_state = PREFETCH_SKIPPED;
+    worker_mutex_unlock(&g_console_lock);
+    return waiting;
+}
+// --------- 输入预取结束 ---------
+#endif
+
+#ifndef DEE_LIBRARY
+// --------- 批量任务：按阶段跨任务调度 ---------
+/*
+ * 每个任务拆成阶段 DAG（dee → deew/deezy → ffmpeg → 收尾，多格式时两个 dee pass 并行），
+ * 所有任务的就绪阶段按工具类别进入各自的池：前一个任务转封装时，下一个任务的 dee 已经可以开始。
+ * 池的上限由 --pool 设置。就绪阶段按任务的队列优先级启动，同级先到先得；池满时 urgent 阶段借用
+ * 较低优先级阶段的槽位直接启动，被借用者的子进程随即被抢占（见队列优先级一节），借用者结束后归还。
+ */
+#define BATCH_STAGE_FINISH STAGE_COUNT   /* 收尾节点：QC 校验、清理与发布 */
+#define BATCH_MAX_DEPS 2
+#define BATCH_POOL_MAX 32
+#define BATCH_AGING_SECONDS 600.0        /* background 阶段就绪后等待超过这么久，按 normal 排队 */
+
+typedef enum { NODE_PENDING = 0, NODE_RUNNING, NODE_EXITED, NODE_DONE, NODE_FAILED, NODE_SKIPPED } NodeState;
+
+typedef struct {
+    EncodeJob *job;
+    int job_index;
+    int stage;                    /* StageId，或 BATCH_STAGE_FINISH */
+    ToolClass tool;
+    int deps[BATCH_MAX_DEPS];
+    int dep_count;
+    int weight;                   /* 估算耗时占比，用于汇总进度 */
+    NodeState state;              /* 与进度一同受 g_console_lock 保护 */
+    int slot;                     /* 在所属池中的槽位，dee 按槽位细分核心集 */
+    int threaded;                 /* 是否在独立线程中运行（结束后需要 join） */
+    int space_held;               /* 已因 DolbyTemp 空间不足暂缓过，只提示一次 */
+    int borrowed_from;            /* 抢占启动时借用其槽位的节点，-1 表示无 */
+    int lent_to;                  /* 借走本节点槽位的节点，-1 表示无 */
+    double ready_at;              /* 依赖全部完成的时刻，用于 background 阶段的排队老化 */
+    double started_at;            /* monotonic_seconds()，供 --sweep 统计每个任务的编码耗时 */
+    double ended_at;
+    int exit_code;
+    char label[48];
+    char artifact[1024];          /* 成功后写入任务日志的产物 */
+    DeePass pass;
+    worker_thread_t thread;
+} StageNode;
+
+typedef struct {
+    StageNode *nodes;
+    int count;
+    int capacity;
+    unsigned pool_busy[TOOL_CLASS_COUNT];  /* 各池已占用槽位的位图 */
+    PrefetchQueue *prefetch;               /* 非空时在启动第一批阶段后开始预取排队任务的输入 */
+} StageGraph;
+
+static int stage_graph_add(StageGraph *graph, EncodeJob *job, int job_index, int stage, ToolClass tool, int weight) {
+    if (graph->count == graph->capacity) {
+        int capacity = graph->capacity ? graph->capacity * 2 : 64;
+        StageNode *grown = (StageNode *)realloc(graph->nodes, sizeof(StageNode) * (size_t)capacity);
+        if (!grown) return -1;
+        graph->nodes = grown;
+        graph->capacity = capacity;
+    }
+    StageNode *node = &graph->nodes[graph->count];
+    memset(node, 0, sizeof(*node));
+    node->job = job;
+    node->job_index = job_index;
+    node->stage = stage;
+    node->tool = tool;
+    node->weight = weight;
+    node->slot = -1;
+    node->borrowed_from = -1;
+    node->lent_to = -1;
+    return graph->count++;
+}
+
+static void stage_graph_depend(StageGraph *graph, int node, int dep) {
+    if (node < 0 || dep < 0) return;
+    StageNode *n = &graph->nodes[node];
+    if (n->dep_count < BATCH_MAX_DEPS) n->deps[n->dep_count++] = dep;
+}
+
+/*
+ * 把一个任务展开为阶段节点。断点续跑已完成的阶段直接标记为完成，不再占用池。
+ * 返回收尾节点的下标，失败返回 -1。
+ */
+static int build_job_stages(StageGraph *graph, EncodeJob *job, int job_index) {
+    int finish;
+    if (job->formats) {
+        int want_ec3 = (job->formats & OUTPUT_FORMAT_EC3) != 0;
+        int want_m4a = (job->formats & OUTPUT_FORMAT_M4A) != 0;
+        int ddp = -1;
+        int mlp = -1;
+        int remux = -1;
+        journal_open(&job->journal, job, g_cli.resume_enabled);
+        space_ledger_open(job);
+        if (want_ec3 || want_m4a) ddp = stage_graph_add(graph, job, job_index, STAGE_DEE, TOOL_DEE, 8);
+        if (job->formats & OUTPUT_FORMAT_MLP) mlp = stage_graph_add(graph, job, job_index, STAGE_DEE_MLP, TOOL_DEE, 8);
+        if (want_ec3 && want_m4a) {
+            remux = stage_graph_add(graph, job, job_index, STAGE_REMUX, TOOL_MUX, 1);
+            stage_graph_depend(graph, remux, ddp);
+        }
+        finish = stage_graph_add(graph, job, job_index, BATCH_STAGE_FINISH, TOOL_NATIVE, 1);
+        if (ddp < 0 && mlp < 0) return -1;
+        stage_graph_depend(graph, finish, remux >= 0 ? remux : ddp);
+        stage_graph_depend(graph, finish, mlp);
+        if (g_cli.resume_enabled) {
+            if (ddp >= 0 && reuse_pass_artifact(&job->journal, STAGE_DEE, want_ec3 ? job->ec3_output : job->m4a_output)) {
+                graph->nodes[ddp].state = NODE_DONE;
+            }
+            if (mlp >= 0 && reuse_pass_artifact(&job->journal, STAGE_DEE_MLP, job->mlp_output)) {
+                graph->nodes[mlp].state = NODE_DONE;
+            }
+            if (remux >= 0 && reuse_pass_artifact(&job->journal, STAGE_REMUX, job->m4a_output)) {
+                graph->nodes[remux].state = NODE_DONE;
+            }
+        }
+    } else {
+        int bluray = job->choice == 4 || job->choice == 5;
+        int start_stage = open_single_format_job(job);
+        int dee = stage_graph_add(graph, job, job_index, STAGE_DEE, TOOL_DEE, 8);
+        int last = dee;
+        if (start_stage > STAGE_DEE && dee >= 0) graph->nodes[dee].state = NODE_DONE;
+        if (bluray) {
+            int post = stage_graph_add(graph, job, job_index, post_stage_of(job), TOOL_PYTHON, 2);
+            int remux = stage_graph_add(graph, job, job_index, STAGE_REMUX, TOOL_MUX, 1);
+            stage_graph_depend(graph, post, dee);
+            stage_graph_depend(graph, remux, post);
+            if (start_stage == STAGE_REMUX && post >= 0) graph->nodes[post].state = NODE_DONE;
+            last = remux;
+        }
+        finish = stage_graph_add(graph, job, job_index, BATCH_STAGE_FINISH, TOOL_NATIVE, 1);
+        stage_graph_depend(graph, finish, last);
+    }
+    return finish;
+}
+
+static void stage_node_worker(void *arg) {
+    StageNode *node = (StageNode *)arg;
+    EncodeJob *job = node->job;
+    int parts = g_cli.schedule[node->tool].max_concurrent;
+    int code = 1;
+
+    switch (node->stage) {
+    case STAGE_DEE:
+    case STAGE_DEE_MLP:
+        if (job->formats) {
+            snprintf(node->label, sizeof(node->label), "%s/%s", job->label, node->stage == STAGE_DEE ? "ddp" : "mlp");
+            prepare_multi_pass(job, (StageId)node->stage, &node->pass, node->label, node->slot, parts);
+            code = dee_pass_start(job, &node->pass);
+            if (code == 0) code = child_wait(&node->pass.proc);
+            remove_file_if_exists(node->pass.xml_path);
+            copy_string(node->artifact, sizeof(node->artifact), node->pass.output);
+        } else {
+            code = run_dee_stage(job, &node->pass, node->slot, parts);
+            copy_string(node->artifact, sizeof(node->artifact), job->dee_output_target);
+        }
+        break;
+    case STAGE_DEEW:
+    case STAGE_DEEZY:
+        code = run_post_stage(job);
+        copy_string(node->artifact, sizeof(node->artifact), job->post_source_path);
+        break;
+    case STAGE_REMUX:
+        if (job->formats) {
+            code = run_remux_stage(job, job->ec3_output, job->m4a_output);
+            copy_string(node->artifact, sizeof(node->artifact), job->m4a_output);
+        } else {
+            code = run_remux_stage(job, job->post_source_path, job->final_output_path);
+            copy_string(node->artifact, sizeof(node->artifact), job->final_output_path);
+        }
+        break;
+    default:
+        code = job->formats ? finish_multi_format_job(job) : finish_single_format_job(job);
+        code = complete_encode_job(job, code);
+        break;
+    }
+    worker_mutex_lock(&g_console_lock);
+    node->exit_code = code;
+    node->state = NODE_EXITED;
+    worker_mutex_unlock(&g_console_lock);
+}
+
+static const char *stage_node_name(const StageNode *node) {
+    return node->stage == BATCH_STAGE_FINISH ? "finish" : stage_names[node->stage];
+}
+
+static NodeState stage_node_state(StageNode *node) {
+    worker_mutex_lock(&g_console_lock);
+    NodeState state = node->state;
+    worker_mutex_unlock(&g_console_lock);
+    return state;
+}
+
+/*
+ * DolbyTemp 超出配额或磁盘放不下时，只要还有别的阶段在运行就暂缓启动新的 dee，等它们结束释放空间；
+ * 没有任何阶段在运行时照常启动，避免整批任务停住
+ */
+static int stage_graph_hold_for_space(StageGraph *graph, StageNode *node) {
+    int running = 0;
+    for (int i = 0; i < graph->count && !running; ++i) {
+        NodeState state = stage_node_state(&graph->nodes[i]);
+        running = state == NODE_RUNNING || state == NODE_EXITED;
+    }
+    EncodeJob *job = node->job;
+    if (!running || !space_pressure(job->scratch_temp_dir[0] ? job->scratch_temp_dir : job->temp_dir_path, job_scratch_bytes(job))) {
+        return 0;
+    }
+    if (!node->space_held) {
+        node->space_held = 1;
+        worker_mutex_lock(&g_console_lock);
+        job_note("批量调度: DolbyTemp 空间不足，%s/%s 等待其他任务释放空间后再启动\n", job->label, stage_node_name(node));
+        worker_mutex_unlock(&g_console_lock);
+    }
+    return 1;
+}
+
+static int stage_node_ready(const StageGraph *graph, const StageNode *node) {
+    for (int i = 0; i < node->dep_count; ++i) {
+        if (graph->nodes[node->deps[i]].state != NODE_DONE) return 0;
+    }
+    return 1;
+}
+
+/* 某个阶段失败后，同一任务中尚未开始的阶段全部跳过 */
+static void stage_graph_skip_job(StageGraph *graph, int job_index) {
+    for (int i = 0; i < graph->count; ++i) {
+        StageNode *node = &graph->nodes[i];
+        if (node->job_index == job_index && node->state == NODE_PENDING) node->state = NODE_SKIPPED;
+    }
+}
+
+static int pool_take_slot(StageGraph *graph, ToolClass tool) {
+    int limit = g_cli.schedule[tool].max_concurrent;
+    if (limit > BATCH_POOL_MAX) limit = BATCH_POOL_MAX;
+    for (int i = 0; i < limit; ++i) {
+        if (!(graph->pool_busy[tool] & (1u << i))) {
+            graph->pool_busy[tool] |= 1u << i;
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* 按节点权重汇总全部任务的进度；运行中的 dee 取其自身报告的进度 */
+static int stage_node_queue_level(const StageNode *node) {
+    return node->job->queue_level ? node->job->queue_level : QUEUE_NORMAL;
+}
+
+/* 启动顺序用的级别：background 阶段等待过久后按 normal 排队，不会被源源不断的新任务饿死 */
+static int stage_node_rank(const StageNode *node, double now) {
+    int level = stage_node_queue_level(node);
+    if (level == QUEUE_BACKGROUND && node->ready_at > 0.0 && now - node->ready_at >= BATCH_AGING_SECONDS) level = QUEUE_NORMAL;
+    return level;
+}
+
+/*
+ * 池满时为 urgent 阶段找一个可借用槽位的运行中阶段：同一个池、级别更低、没有借出或借入过，
+ * 优先级最低者优先，同级取最晚启动的（它丢掉的进度最少）。进程内的校验与收尾不可暂停，不参与借用
+ */
+static int stage_graph_find_lender(StageGraph *graph, const StageNode *node) {
+    int level = stage_node_queue_level(node);
+    int best = -1;
+    if (!g_cli.preempt || level != QUEUE_URGENT || node->tool == TOOL_NATIVE) return -1;
+    for (int i = 0; i < graph->count; ++i) {
+        const StageNode *other = &graph->nodes[i];
+        if (other->tool != node->tool || other->lent_to >= 0 || other->borrowed_from >= 0) continue;
+        if (stage_node_state(&graph->nodes[i]) != NODE_RUNNING || stage_node_queue_level(other) >= level) continue;
+        if (best < 0 || stage_node_queue_level(other) < stage_node_queue_level(&graph->nodes[best]) ||
+            (stage_node_queue_level(other) == stage_node_queue_level(&graph->nodes[best]) &&
+             other->started_at > graph->nodes[best].started_at)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+/* 阶段结束时归还槽位：借用者把槽位还给出借者，出借者先结束则由借用者接管 */
+static void stage_graph_release_slot(StageGraph *graph, StageNode *node) {
+    if (node->borrowed_from >= 0) {
+        graph->nodes[node->borrowed_from].lent_to = -1;
+    } else if (node->lent_to >= 0) {
+        graph->nodes[node->lent_to].borrowed_from = -1;
+    } else {
+        graph->pool_busy[node->tool] &= ~(1u << node->slot);
+    }
+    node->borrowed_from = -1;
+    node->lent_to = -1;
+}
+
+static double stage_graph_progress(StageGraph *graph) {
+    double total = 0.0;
+    double done = 0.0;
+    worker_mutex_lock(&g_console_lock);
+    for (int i = 0; i < graph->count; ++i) {
+        StageNode *node = &graph->nodes[i];
+        total += node->weight;
+        if (node->state == NODE_DONE || node->state == NODE_FAILED || node->state == NODE_SKIPPED) {
+            done += node->weight;
+        } else if (node->state == NODE_RUNNING && node->tool == TOOL_DEE) {
+            done += node->weight * node->pass.proc.progress / 100.0;
+        }
+    }
+    worker_mutex_unlock(&g_console_lock);
+    return total > 0.0 ? done * 100.0 / total : 100.0;
+}
+
+/* 调度循环：回收已结束的阶段，按队列优先级与任务顺序把就绪阶段放进有空位的池，直到全部结束 */
+static void stage_graph_run(StageGraph *graph) {
+    double last_progress = -1.0;
+    for (;;) {
+        int running = 0;
+        int launchable = 0;
+
+        for (int i = 0; i < graph->count; ++i) {
+            StageNode *node = &graph->nodes[i];
+            if (stage_node_state(node) != NODE_EXITED) continue;
+            if (node->threaded) worker_join(node->thread);
+            node->ended_at = monotonic_seconds();
+            stage_graph_release_slot(graph, node);
+            if (node->stage != BATCH_STAGE_FINISH) node->job->stage_seconds[node->stage] += node->ended_at - node->started_at;
+            if (node->exit_code == 0) {
+                /* 任务日志只在调度线程中写入，并行的 pass 不会同时追加同一文件 */
+                if (node->stage != BATCH_STAGE_FINISH) journal_record(&node->job->journal, (StageId)node->stage, node->artifact);
+                node->state = NODE_DONE;
+            } else {
+                node->state = NODE_FAILED;
+                if (!cancel_requested()) {
+                    job_warn("批量任务 %s 的阶段 %s 失败 (exit=%d)，跳过该任务的后续阶段。\n",
+                            node->job->label, stage_node_name(node), node->exit_code);
+                }
+                stage_graph_skip_job(graph, node->job_index);
+            }
+        }
+
+        for (int i = 0; i < graph->count; ++i) {
+            NodeState state = stage_node_state(&graph->nodes[i]);
+            /* EXITED 的阶段下一轮回收 */
+            if (state == NODE_RUNNING || state == NODE_EXITED) running++;
+        }
+
+        double now = monotonic_seconds();
+        for (int level = QUEUE_URGENT; level >= QUEUE_BACKGROUND; --level) {
+            for (int i = 0; i < graph->count; ++i) {
+                StageNode *node = &graph->nodes[i];
+                if (node->state != NODE_PENDING || cancel_requested() || !stage_node_ready(graph, node)) continue;
+                if (node->ready_at <= 0.0) node->ready_at = now;
+                if (stage_node_rank(node, now) != level) continue;
+                launchable++;
+                int lender = -1;
+                int slot = pool_take_slot(graph, node->tool);
+                if (slot < 0) {
+                    lender = stage_graph_find_lender(graph, node);
+                    if (lender < 0) continue;
+                    slot = graph->nodes[lender].slot;
+                }
+                if ((node->stage == STAGE_DEE || node->stage == STAGE_DEE_MLP) &&
+                    (stage_graph_hold_for_space(graph, node) || prefetch_hold_dee(node->job))) {
+                    if (lender < 0) graph->pool_busy[node->tool] &= ~(1u << slot);
+                    continue;
+                }
+                node->slot = slot;
+                worker_mutex_lock(&g_console_lock);
+                node->state = NODE_RUNNING;
+                worker_mutex_unlock(&g_console_lock);
+                if (lender >= 0) {
+                    StageNode *victim = &graph->nodes[lender];
+                    node->borrowed_from = lender;
+                    victim->lent_to = i;
+                    job_note("批量调度: 启动 %s/%s（urgent，借用 %s/%s 的 %s 池槽位 %d，后者被抢占）\n", node->job->label,
+                           stage_node_name(node), victim->job->label, stage_node_name(victim), tool_class_names[node->tool], slot + 1);
+                } else {
+                    job_note("批量调度: 启动 %s/%s（%s 池槽位 %d/%d）\n", node->job->label, stage_node_name(node),
+                           tool_class_names[node->tool], slot + 1, g_cli.schedule[node->tool].max_concurrent);
+                }
+                running++;
+                node->started_at = monotonic_seconds();
+                if (node->job->started_at <= 0.0) node->job->started_at = node->started_at;
+                node->threaded = worker_start(&node->thread, stage_node_worker, node);
+                /* 无法创建线程时退化为在调度线程中同步执行 */
+                if (!node->threaded) stage_node_worker(node);
+            }
+        }
+
+        if (graph->prefetch) prefetch_start(graph->prefetch);
+
+        double progress = stage_graph_progress(graph);
+        if (progress - last_progress >= 0.1) {
+            worker_mutex_lock(&g_console_lock);
+            job_note("Overall progress: %.1f\n", progress);
+            worker_mutex_unlock(&g_console_lock);
+            last_progress = progress;
+        }
+
+        if (running == 0 && launchable == 0) break;
+#ifdef _WIN32
+        Sleep(100);
+#else
+        sleep_milliseconds(100);
+#endif
+    }
+}
+
+/* 按位置参数的含义填写一个批量任务，规则与单任务的命令行一致 */
+static void setup_batch_job(EncodeJob *job, const EncodeJob *base, int choice, const char *start, const char *end,
+                            const char *prepend_silence, const char *append_silence, const char *output, const char *input) {
+    *job = *base;
+    job->choice = choice;
+    copy_string(job->start, sizeof(job->start), start);
+    copy_string(job->end, sizeof(job->end), end);
+    copy_string(job->prepend_silence, sizeof(job->prepend_silence), prepend_silence);
+    copy_string(job->append_silence, sizeof(job->append_silence), append_silence);
+    copy_string(job->output_file, sizeof(job->output_file), output);
+    copy_string(job->input_file, sizeof(job->input_file), input);
+    normalize_slashes(job->output_file);
+    normalize_slashes(job->input_file);
+    ensure_extension(job->output_file, sizeof(job->output_file),
+                     choice == 1 ? ".ec3" : choice == 3 ? ".mlp" : ".m4a");
+    copy_string(job->final_output_path, sizeof(job->final_output_path), job->output_file);
+    copy_string(job->template_xml, sizeof(job->template_xml),
+                choice == 1 ? base->template_ec3 : choice == 2 ? base->template_m4a : base->template_mlp);
+    if (choice == 4 || choice == 5) {
+        replace_extension(job->final_output_path, job->intermediate_mlp_path, sizeof(job->intermediate_mlp_path), ".mlp");
+        copy_string(job->dee_output_target, sizeof(job->dee_output_target), job->intermediate_mlp_path);
+    } else {
+        copy_string(job->dee_output_target, sizeof(job->dee_output_target), job->output_file);
+    }
+    if (job->formats) {
+        replace_extension(job->output_file, job->ec3_output, sizeof(job->ec3_output), ".ec3");
+        replace_extension(job->output_file, job->m4a_output, sizeof(job->m4a_output), ".m4a");
+        replace_extension(job->output_file, job->mlp_output, sizeof(job->mlp_output), ".mlp");
+    }
+}
+
+/*
+ * 参数与输入完全相同的两个任务会共用任务日志和临时目录，这种任务返回 0；
+ * 否则按任务标识给它单独的 temp_job.xml（并发的任务不能共用）。
+ */
+static int assign_batch_job_key(const EncodeJob *jobs, int count, EncodeJob *job) {
+    char key[17];
+    char other_key[17];
+    char xml_dir[1024];
+    char xml_name[64];
+    compute_job_key(job, key, sizeof(key));
+    for (int i = 0; i < count; ++i) {
+        compute_job_key(&jobs[i], other_key, sizeof(other_key));
+        if (strcmp(key, other_key) == 0) return 0;
+    }
+    directory_of(job->temp_xml_path, xml_dir, sizeof(xml_dir));
+    snprintf(xml_name, sizeof(xml_name), "temp_job_%s.xml", key);
+    build_path(job->temp_xml_path, sizeof(job->temp_xml_path), xml_dir, xml_name);
+    return 1;
+}
+
+/*
+ * 读取批量任务文件：每行一个任务，字段以 Tab 分隔，顺序与位置参数相同：
+ * 编码选项、起始时间、结束时间、开头空白、结尾空白、输出文件、输入文件，可再跟队列优先级
+ * （background/normal/urgent，省略时取 --queue-priority）与任务 XML 覆盖（“路径=值” 以 ; 分隔，省略时取 --set）。
+ * 空行与 # 开头的行忽略。
+ */
+static int load_batch_jobs(const char *path, const EncodeJob *base, EncodeJob **out_jobs) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "无法打开批量任务文件: %s\n", path);
+        return -1;
+    }
+    EncodeJob *jobs = NULL;
+    int count = 0;
+    int capacity = 0;
+    char line[4096];
+    int line_no = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        char *fields[9] = {0};
+        int field_count = 0;
+        line_no++;
+        trim_newline(line);
+        if (line[0] == '\0' || line[0] == '#') continue;
+        for (char *p = line; field_count < 9; ) {
+            fields[field_count++] = p;
+            char *tab = strchr(p, '\t');
+            if (!tab) break;
+            *tab = '\0';
+            p = tab + 1;
+        }
+        int choice = atoi(fields[0]);
+        if (field_count < 7 || choice < 1 || choice > 5 || !fields[5][0] || !fields[6][0]) {
+            fprintf(stderr, "批量任务文件第 %d 行无效（需要 7 个 Tab 分隔字段，编码选项 1-5，输出与输入不能为空），已跳过。\n", line_no);
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            EncodeJob *grown = (EncodeJob *)realloc(jobs, sizeof(EncodeJob) * (size_t)capacity);
+            if (!grown) break;
+            jobs = grown;
+        }
+
+        EncodeJob *job = &jobs[count];
+        setup_batch_job(job, base, choice, fields[1], fields[2], fields[3], fields[4], fields[5], fields[6]);
+        if (field_count > 7 && fields[7][0]) {
+            int level = parse_queue_level(fields[7]);
+            if (level) job->queue_level = level;
+        }
+        if (field_count > 8 && fields[8][0]) copy_string(job->xml_overrides, sizeof(job->xml_overrides), fields[8]);
+        if (!job_xml_overrides_valid(job)) {
+            fprintf(stderr, "批量任务文件第 %d 行的 XML 覆盖无效，已跳过。\n", line_no);
+            continue;
+        }
+        snprintf(job->label, sizeof(job->label), "j%d", count + 1);
+        if (!assign_batch_job_key(jobs, count, job)) {
+            fprintf(stderr, "批量任务文件第 %d 行与前面的任务参数和输入完全相同，已跳过。\n", line_no);
+            continue;
+        }
+        count++;
+    }
+    fclose(f);
+    *out_jobs = jobs;
+    return count;
+}
+
+typedef struct {
+    int ok;
+    double encode_seconds;   /* 第一个阶段开始到最后一个编码阶段结束，不含 QC 与发布 */
+} JobOutcome;
+
+/* 按阶段 DAG 流水线执行一组任务，outcomes 与 jobs 一一对应；返回失败（含取消）的任务数 */
+static int run_jobs_pipelined(EncodeJob *jobs, int job_count, JobOutcome *outcomes) {
+    StageGraph graph;
+    memset(&graph, 0, sizeof(graph));
+    int *finish_nodes = (int *)calloc((size_t)job_count, sizeof(int));
+    if (!finish_nodes) return job_count;
+    g_batch_mode = 1;
+    /* 多个任务无法共用一个 --qc-report 路径，各自写到输出旁 */
+    g_cli.qc_report[0] = '\0';
+
+    for (int i = 0; i < job_count; ++i) {
+        place_job_on_scratch(&jobs[i]);
+        finish_nodes[i] = build_job_stages(&graph, &jobs[i], i);
+        printf("批量任务 %s: choice=%d, %s -> %s", jobs[i].label, jobs[i].choice, jobs[i].input_file, jobs[i].output_file);
+        if (jobs[i].queue_level != QUEUE_NORMAL) printf("（%s）", queue_level_names[jobs[i].queue_level]);
+        printf("\n");
+        print_job_eta(&jobs[i]);
+    }
+    printf("批量模式: %d 个任务，%d 个阶段；并发上限 dee=%d, python=%d, mux=%d, native=%d\n",
+           job_count, graph.count,
+           g_cli.schedule[TOOL_DEE].max_concurrent, g_cli.schedule[TOOL_PYTHON].max_concurrent,
+           g_cli.schedule[TOOL_MUX].max_concurrent, g_cli.schedule[TOOL_NATIVE].max_concurrent);
+    fflush(stdout);
+
+    PrefetchQueue prefetch;
+    memset(&prefetch, 0, sizeof(prefetch));
+    prefetch.jobs = jobs;
+    prefetch.count = job_count;
+    graph.prefetch = &prefetch;
+    stage_graph_run(&graph);
+    prefetch_stop(&prefetch);
+
+    int failed = 0;
+    for (int i = 0; i < job_count; ++i) {
+        int finish = finish_nodes[i];
+        JobOutcome *outcome = &outcomes[i];
+        double first = 0.0;
+        double last = 0.0;
+        outcome->ok = finish >= 0 && graph.nodes[finish].state == NODE_DONE;
+        if (!outcome->ok && finish >= 0 && graph.nodes[finish].state != NODE_FAILED) {
+            /* 收尾节点未运行：清理临时目录，取消时回收未完成的中间文件 */
+            complete_encode_job(&jobs[i], 1);
+        }
+        for (int n = 0; n < graph.count; ++n) {
+            const StageNode *node = &graph.nodes[n];
+            if (node->job_index != i || node->stage == BATCH_STAGE_FINISH || node->started_at <= 0.0) continue;
+            if (first == 0.0 || node->started_at < first) first = node->started_at;
+            if (node->ended_at > last) last = node->ended_at;
+        }
+        outcome->encode_seconds = last > first ? last - first : 0.0;
+        if (!outcome->ok) failed++;
+        printf("批量任务 %s: %s  %s\n", jobs[i].label,
+               outcome->ok ? "成功" : cancel_requested() ? "已取消" : "失败", jobs[i].final_output_path);
+    }
+
+    free(graph.nodes);
+    free(finish_nodes);
+    return failed;
+}
+
+/* 批量模式入口：全部任务成功返回 0，取消返回 EXIT_CANCELLED，否则返回 1 */
+static int run_batch(const EncodeJob *base) {
+    EncodeJob *jobs = NULL;
+    int job_count = load_batch_jobs(g_cli.batch_file, base, &jobs);
+    if (job_count <= 0) {
+        if (job_count == 0) fprintf(stderr, "批量任务文件中没有有效任务: %s\n", g_cli.batch_file);
+        free(jobs);
+        return 1;
+    }
+    JobOutcome *outcomes = (JobOutcome *)calloc((size_t)job_count, sizeof(JobOutcome));
+    if (!outcomes) {
+        free(jobs);
+        return 1;
+    }
+
+    double started = monotonic_seconds();
+    int failed = run_jobs_pipelined(jobs, job_count, outcomes);
+    printf("批量模式完成: 成功 %d，失败 %d，总耗时 %.1f 秒\n", job_count - failed, failed, monotonic_seconds() - started);
+
+    free(outcomes);
+    free(jobs);
+    if (cancel_requested()) return EXIT_CANCELLED;
+    return failed ? 1 : 0;
+}
+// --------- 批量任务结束 ---------
+#endif
+
+#ifndef DEE_LIBRARY
+// --------- 多段导出（--ranges）：同一母版的多个时间段在一个任务中并发编码 ---------
+/*
+ * 片段列表每行一段，字段以 Tab 分隔：名称、起始时间、结束时间，可再跟开头空白、结尾空白（留空时取位置参数中的值）。
+ * 每段是一个独立任务（各自的任务 XML、dee 临时目录与断点日志），输出为 <输出文件名>_<名称>.<扩展名>，
+ * 经批量流水线按 dee 池并发执行。各段的任务 XML 由同一份缓存的模板渲染；并发的 dee 读取同一输入，
+ * 母版只需从磁盘冷读一次，其余读取落在页缓存中。普通 WAV 床只封装一次 ADM，由全部片段共用。
+ */
+#define RANGE_NAME_MAX 64
+
+/* 片段名用于输出文件名：去掉路径分隔符与 Windows 文件名中不允许的字符 */
+static void range_safe_name(const char *name, int index, char *out, size_t out_size) {
+    size_t len = 0;
+    for (const char *p = name; *p && len + 1 < out_size; ++p) {
+        unsigned char c = (unsigned char)*p;
+        out[len++] = (c < 0x20 || strchr("\\/:*?\"<>|", c)) ? '_' : (char)c;
+    }
+    out[len] = '\0';
+    if (len == 0) snprintf(out, out_size, "r%d", index + 1);
+}
+
+/* <输出文件名>_<片段名>.<扩展名>；输出没有扩展名时由 setup_batch_job 按编码选项补齐 */
+static void range_output_path(const char *output, const char *name, char *out, size_t out_size) {
+    char stem[1024];
+    copy_string(stem, sizeof(stem), output);
+    const char *slash = strrchr(stem, '\\');
+    const char *slash_alt = strrchr(stem, '/');
+    if (slash_alt && (!slash || slash_alt > slash)) slash = slash_alt;
+    char *dot = strrchr(stem, '.');
+    const char *ext = "";
+    if (dot && (!slash || dot > slash)) {
+        ext = output + (dot - stem);
+        *dot = '\0';
+    }
+    snprintf(out, out_size, "%s_%s%s", stem, name, ext);
+}
+
+static int load_range_jobs(const char *path, const EncodeJob *base, EncodeJob **out_jobs) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "无法打开片段列表: %s\n", path);
+        return -1;
+    }
+    EncodeJob *jobs = NULL;
+    int count = 0;
+    int capacity = 0;
+    char line[2048];
+    int line_no = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        char *fields[5] = {0};
+        int field_count = 0;
+        char name[RANGE_NAME_MAX];
+        char output[1100];
+        line_no++;
+        trim_newline(line);
+        if (line[0] == '\0' || line[0] == '#') continue;
+        for (char *p = line; field_count < 5; ) {
+            fields[field_count++] = p;
+            char *tab = strchr(p, '\t');
+            if (!tab) break;
+            *tab = '\0';
+            p = tab + 1;
+        }
+        if (field_count < 3 || (!fields[1][0] && !fields[2][0])) {
+            fprintf(stderr, "片段列表第 %d 行无效（需要名称、起始时间、结束时间，起止不能都为空），已跳过。\n", line_no);
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            EncodeJob *grown = (EncodeJob *)realloc(jobs, sizeof(EncodeJob) * (size_t)capacity);
+            if (!grown) break;
+            jobs = grown;
+        }
+
+        EncodeJob *job = &jobs[count];
+        const char *prepend = field_count > 3 && fields[3][0] ? fields[3] : base->prepend_silence;
+        const char *append = field_count > 4 && fields[4][0] ? fields[4] : base->append_silence;
+        range_safe_name(fields[0], count, name, sizeof(name));
+        range_output_path(base->output_file, name, output, sizeof(output));
+        setup_batch_job(job, base, base->choice, fields[1], fields[2], prepend, append, output, base->input_file);
+        /* setup_batch_job 按编码选项取模板，这里保留单任务解析出的模板（可能来自上次参数） */
+        copy_string(job->template_xml, sizeof(job->template_xml), base->template_xml);
+        copy_string(job->label, sizeof(job->label), name);
+        if (!assign_batch_job_key(jobs, count, job)) {
+            fprintf(stderr, "片段列表第 %d 行与前面的片段时间段完全相同，已跳过。\n", line_no);
+            continue;
+        }
+        count++;
+    }
+    fclose(f);
+    *out_jobs = jobs;
+    return count;
+}
+
+/*
+ * 普通 WAV 床只为整组封装一次，各段的 dee 都读这一份。它登记在组标识下（jobs\<组标识>.owner），
+ * 单个片段结束时不会被删除，进程意外退出后由空间回收清理。预取对并发读取同一输入的片段没有意义，一并跳过。
+ */
+static void range_share_input(EncodeJob *jobs, int count, const char *group_key) {
+    char shared[1024] = "";
+    if (g_cli.auto_adm && adm_wrap_for_dee(&jobs[0], jobs[0].input_file, group_key, shared, sizeof(shared))) {
+        char owner[1024];
+        space_owner_path(jobs[0].temp_dir_path, group_key, owner, sizeof(owner));
+        FILE *f = fopen(owner, "w");
+        if (f) {
+            fprintf(f, "pid=%ld\tstarted=%lld\ntemp=%s\n", space_current_pid(), (long long)time(NULL), shared);
+            fclose(f);
+        }
+    } else {
+        shared[0] = '\0';
+    }
+    for (int i = 0; i < count; ++i) {
+        copy_string(jobs[i].shared_input, sizeof(jobs[i].shared_input), shared);
+        jobs[i].adm_state = ADM_WRAP_DONE;
+        jobs[i].prefetch_state = PREFETCH_SKIPPED;
+    }
+}
+
+static void range_release_input(const EncodeJob *job, const char *group_key) {
+    char owner[1024];
+    if (!job->shared_input[0]) return;
+    remove_file_if_exists(job->shared_input);
+    space_owner_path(job->temp_dir_path, group_key, owner, sizeof(owner));
+    remove_file_if_exists(owner);
+}
+
+/* 多段导出入口：base 为按位置参数解析出的任务，其起止时间不使用。全部成功返回 0，取消返回 EXIT_CANCELLED */
+static int run_ranges(const EncodeJob *base) {
+    EncodeJob *jobs = NULL;
+    char base_key[17];
+    char group_key[17];
+    char material[1200];
+    int count = load_range_jobs(g_cli.ranges_file, base, &jobs);
+    if (count <= 0) {
+        if (count == 0) fprintf(stderr, "片段列表中没有有效片段: %s\n", g_cli.ranges_file);
+        free(jobs);
+        return 1;
+    }
+    JobOutcome *outcomes = (JobOutcome *)calloc((size_t)count, sizeof(JobOutcome));
+    if (!outcomes) {
+        free(jobs);
+        return 1;
+    }
+    if (base->start[0] || base->end[0]) printf("多段导出: 位置参数中的起止时间不使用，以片段列表为准。\n");
+    compute_job_key(base, base_key, sizeof(base_key));
+    snprintf(material, sizeof(material), "ranges|%s|%s", base_key, g_cli.ranges_file);
+    snprintf(group_key, sizeof(group_key), "%016llx", xxh64_string(material));
+    printf("多段导出: %d 段，输入 %s\n", count, base->input_file);
+    fflush(stdout);
+
+    double started = monotonic_seconds();
+    range_share_input(jobs, count, group_key);
+    int failed = run_jobs_pipelined(jobs, count, outcomes);
+    range_release_input(&jobs[0], group_key);
+    printf("多段导出完成: 成功 %d，失败 %d，总耗时 %.1f 秒\n", count - failed, failed, monotonic_seconds() - started);
+
+    free(outcomes);
+    free(jobs);
+    if (cancel_requested()) return EXIT_CANCELLED;
+    return failed ? 1 : 0;
+}
+// --------- 多段导出结束 ---------
+#endif
+
+#ifndef DEE_LIBRARY
+// --------- 参数扫描（--sweep） ---------
+/*
+ * 矩阵文件为 key=value，每个值用 | 分隔若干候选（留空的候选表示保持默认），组合取笛卡尔积：
+ *   input=D:\ADM.wav
+ *   output_dir=D:\sweep
+ *   choice=1|4
+ *   bitrate=448|768|1664
+ *   window=|00:00:00:00-00:05:00:00
+ *   threads=|4
+ *   affinity=|0-7
+ *   set=|encode_to_atmos_ddp/drc/line_mode_drc_profile=film_light
+ *   parallel=2
+ * set 的每个候选是一组任务 XML 覆盖（多项以 ; 分隔，与 --set 相同），与命令行的 --set 合并。
+ * 各组合走批量流水线并行执行，结束后输出耗时、CPU 时间、峰值内存与输出大小的对照表。
+ */
+#define SWEEP_MAX_VALUES 16
+#define SWEEP_MAX_CASES 512
+
+typedef struct {
+    char values[SWEEP_MAX_VALUES][256];
+    int count;
+} SweepAxis;
+
+typedef struct {
+    int choice;
+    char bitrate[16];
+    char window[64];
+    char threads[16];
+    char affinity[64];
+    char set[256];
+    ResourceUsage usage;
+} SweepCase;
+
+static void sweep_axis_parse(SweepAxis *axis, const char *value) {
+    const char *p = value;
+    axis->count = 0;
+    for (;;) {
+        const char *bar = strchr(p, '|');
+        size_t len = bar ? (size_t)(bar - p) : strlen(p);
+        if (axis->count < SWEEP_MAX_VALUES) {
+            if (len >= sizeof(axis->values[0])) len = sizeof(axis->values[0]) - 1;
+            memcpy(axis->values[axis->count], p, len);
+            axis->values[axis->count][len] = '\0';
+            axis->count++;
+        }
+        if (!bar) break;
+        p = bar + 1;
+    }
+}
+
+/* 窗口写作 起始-结束，任一端可留空 */
+static void sweep_split_window(const char *window, EncodeJob *job) {
+    const char *dash = strchr(window, '-');
+    if (!dash) {
+        copy_string(job->start, sizeof(job->start), window);
+        return;
+    }
+    size_t len = (size_t)(dash - window);
+    if (len >= sizeof(job->start)) len = sizeof(job->start) - 1;
+    memcpy(job->start, window, len);
+    job->start[len] = '\0';
+    copy_string(job->end, sizeof(job->end), dash + 1);
+}
+
+/* 结果表同时打印到控制台并写成 TSV，便于用表格软件排序筛选 */
+static void sweep_write_report(const char *report_path, const EncodeJob *jobs, const SweepCase *cases,
+                               const JobOutcome *outcomes, int count) {
+    FILE *f = fopen(report_path, "w");
+    if (f) {
+        fprintf(f, "id\tchoice\tbitrate\tstart\tend\tthreads\taffinity\tset\tstatus\twall_seconds\tcpu_seconds\tpeak_memory_mb\toutput_bytes\toutput\n");
+    }
+    printf("\n%-5s %-6s %-8s %-27s %-7s %-10s %-6s %9s %9s %10s %14s  %s\n",
+           "id", "choice", "bitrate", "window", "threads", "affinity", "status", "wall(s)", "cpu(s)", "peak(MB)", "output(bytes)", "set");
+    for (int i = 0; i < count; ++i) {
+        const EncodeJob *job = &jobs[i];
+        const SweepCase *c = &cases[i];
+        long long size = outcomes[i].ok ? file_size_of(job->final_output_path) : -1;
+        const char *status = outcomes[i].ok ? "ok" : cancel_requested() ? "cancel" : "failed";
+        double peak_mb = c->usage.peak_memory / (1024.0 * 1024.0);
+        printf("%-5s %-6d %-8s %-27s %-7s %-10s %-6s %9.1f %9.1f %10.1f %14lld  %s\n",
+               job->label, c->choice, c->bitrate[0] ? c->bitrate : "-", c->window[0] ? c->window : "-",
+               c->threads[0] ? c->threads : "-", c->affinity[0] ? c->affinity : "-", status,
+               outcomes[i].encode_seconds, c->usage.cpu_seconds, peak_mb, size, c->set[0] ? c->set : "-");
+        if (f) {
+            fprintf(f, "%s\t%d\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%.3f\t%.3f\t%.1f\t%lld\t%s\n",
+                    job->label, c->choice, c->bitrate, job->start, job->end, c->threads, c->affinity, c->set, status,
+                    outcomes[i].encode_seconds, c->usage.cpu_seconds, peak_mb, size, job->final_output_path);
+        }
+    }
+    if (f) {
+        fclose(f);
+        printf("\n参数扫描结果已写入: %s\n", report_path);
+    } else {
+        fprintf(stderr, "无法写入参数扫描结果: %s\n", report_path);
+    }
+}
+
+static int run_sweep(const EncodeJob *base) {
+    FILE *f = fopen(g_cli.sweep_file, "r");
+    if (!f) {
+        fprintf(stderr, "无法打开参数矩阵文件: %s\n", g_cli.sweep_file);
+        return 1;
+    }
+    char input[512] = "";
+    char output_dir[512] = "";
+    SweepAxis choices, bitrates, windows, threads, affinities, sets;
+    sweep_axis_parse(&choices, "1");
+    sweep_axis_parse(&bitrates, "");
+    sweep_axis_parse(&windows, "");
+    sweep_axis_parse(&threads, "");
+    sweep_axis_parse(&affinities, "");
+    sweep_axis_parse(&sets, "");
+
+    char line[2048];
+    while (fgets(line, sizeof(line), f)) {
+        trim_newline(line);
+        if (line[0] == '\0' || line[0] == '#') continue;
+        char *eq = strchr(line, '=');
+        if (!eq) continue;
+        *eq = '\0';
+        const char *key = line;
+        const char *value = eq + 1;
+        if (strcmp(key, "input") == 0) copy_string(input, sizeof(input), value);
+        else if (strcmp(key, "output_dir") == 0) copy_string(output_dir, sizeof(output_dir), value);
+        else if (strcmp(key, "choice") == 0) sweep_axis_parse(&choices, value);
+        else if (strcmp(key, "bitrate") == 0) sweep_axis_parse(&bitrates, value);
+        else if (strcmp(key, "window") == 0) sweep_axis_parse(&windows, value);
+        else if (strcmp(key, "threads") == 0) sweep_axis_parse(&threads, value);
+        else if (strcmp(key, "affinity") == 0) sweep_axis_parse(&affinities, value);
+        else if (strcmp(key, "set") == 0) sweep_axis_parse(&sets, value);
+        else if (strcmp(key, "parallel") == 0 && atoi(value) > 0) g_cli.schedule[TOOL_DEE].max_concurrent = atoi(value);
+        else fprintf(stderr, "警告: 参数矩阵中的未知键 %s，已忽略。\n", key);
+    }
+    fclose(f);
+    if (!input[0]) {
+        fprintf(stderr, "参数矩阵缺少 input=\n");
+        return 1;
+    }
+    normalize_slashes(input);
+    if (!output_dir[0]) build_path(output_dir, sizeof(output_dir), base->temp_dir_path, "sweep");
+    normalize_slashes(output_dir);
+    ensure_directory_exists(output_dir);
+
+    int total = choices.count * bitrates.count * windows.count * threads.count * affinities.count * sets.count;
+    if (total > SWEEP_MAX_CASES) {
+        fprintf(stderr, "参数组合过多（%d 个，上限 %d），请缩小矩阵。\n", total, SWEEP_MAX_CASES);
+        return 1;
+    }
+    EncodeJob *jobs = (EncodeJob *)calloc((size_t)total, sizeof(EncodeJob));
+    SweepCase *cases = (SweepCase *)calloc((size_t)total, sizeof(SweepCase));
+    JobOutcome *outcomes = (JobOutcome *)calloc((size_t)total, sizeof(JobOutcome));
+    if (!jobs || !cases || !outcomes) {
+        free(jobs);
+        free(cases);
+        free(outcomes);
+        return 1;
+    }
+
+    /* 每次都要重新测量：不复用断点，也不搬运输出；预取会让后面的组合读到热缓存，测量失真 */
+    g_cli.resume_enabled = 0;
+    g_cli.publish_path[0] = '\0';
+    g_cli.write_manifest = 0;
+    g_cli.prefetch_mode = PREFETCH_MODE_OFF;
+
+    char stem[256];
+    copy_string(stem, sizeof(stem), path_file_name(input));
+    char *dot = strrchr(stem, '.');
+    if (dot) *dot = '\0';
+
+    int count = 0;
+    for (int a = 0; a < choices.count; ++a)
+    for (int b = 0; b < bitrates.count; ++b)
+    for (int w = 0; w < windows.count; ++w)
+    for (int t = 0; t < threads.count; ++t)
+    for (int x = 0; x < affinities.count; ++x)
+    for (int o = 0; o < sets.count; ++o) {
+        SweepCase *c = &cases[count];
+        EncodeJob *job = &jobs[count];
+        char file_name[300];
+        char output[1024];
+        c->choice = atoi(choices.values[a]);
+        if (c->choice < 1 || c->choice > 5) {
+            fprintf(stderr, "警告: 参数矩阵中的编码选项 %s 无效，已跳过。\n", choices.values[a]);
+            continue;
+        }
+        /* TrueHD 无损，码率维度对它没有意义，只跑一次 */
+        if (c->choice == 3 && b > 0) continue;
+        copy_string(c->bitrate, sizeof(c->bitrate), c->choice == 3 ? "" : bitrates.values[b]);
+        copy_string(c->window, sizeof(c->window), windows.values[w]);
+        copy_string(c->threads, sizeof(c->threads), threads.values[t]);
+        copy_string(c->affinity, sizeof(c->affinity), affinities.values[x]);
+        copy_string(c->set, sizeof(c->set), sets.values[o]);
+
+        snprintf(file_name, sizeof(file_name), "%s_s%03d", stem, count + 1);
+        build_path(output, sizeof(output), output_dir, file_name);
+        setup_batch_job(job, base, c->choice, "", "", "", "", output, input);
+        sweep_split_window(c->window, job);
+        copy_string(job->bitrate, sizeof(job->bitrate), c->bitrate);
+        job->max_threads = atoi(c->threads);
+        job->affinity = parse_core_set(c->affinity);
+        /* 调度维度不改变输出，不进普通任务标识；扫描单独成域，各组合互不复用断点与临时文件 */
+        snprintf(job->key_scope, sizeof(job->key_scope), "sweep|t=%s|a=%s", c->threads, c->affinity);
+        if (c->set[0]) {
+            size_t len = strlen(job->xml_overrides);
+            snprintf(job->xml_overrides + len, sizeof(job->xml_overrides) - len, "%s%s", len ? ";" : "", c->set);
+        }
+        if (!job_xml_overrides_valid(job)) {
+            fprintf(stderr, "警告: 参数矩阵中的 set 候选 %s 无效，已跳过。\n", c->set);
+            continue;
+        }
+        job->usage = &c->usage;
+        snprintf(job->label, sizeof(job->label), "s%03d", count + 1);
+        if (!assign_batch_job_key(jobs, count, job)) {
+            fprintf(stderr, "警告: 参数矩阵中有重复的组合，已跳过。\n");
+            continue;
+        }
+        count++;
+    }
+    if (count == 0) {
+        free(jobs);
+        free(cases);
+        free(outcomes);
+        return 1;
+    }
+
+    printf("参数扫描: %d 个组合，同时运行 %d 个 dee\n", count, g_cli.schedule[TOOL_DEE].max_concurrent);
+    fflush(stdout);
+    int failed = run_jobs_pipelined(jobs, count, outcomes);
+
+    char report_name[64];
+    char report_path[1024];
+    time_t now = time(NULL);
+    struct tm *tm_now = localtime(&now);
+    strftime(report_name, sizeof(report_name), "sweep_%Y%m%d_%H%M%S.tsv", tm_now);
+    build_path(report_path, sizeof(report_path), output_dir, report_name);
+    sweep_write_report(report_path, jobs, cases, outcomes, count);
+
+    free(jobs);
+    free(cases);
+    free(outcomes);
+    if (cancel_requested()) return EXIT_CANCELLED;
+    return failed ? 1 : 0;
+}
+// --------- 参数扫描结束 ---------
+#endif
+
+#ifndef DEE_LIBRARY
+// --------- 并发校准（--calibrate） ---------
+/*
+ * 用合成的 ADM 母版跑一组短编码：每一级同时提交 n 个等长的任务（各取母版中不同的一段，任务标识互不相同），
+ * 所有类别的并发上限都设为 n，测量整体吞吐（实时倍数）与各类阶段单任务耗时随并发的变慢程度。
+ * 吞吐连续两级几乎不再增长、明显回落或内存放不下下一级时停止。
+ * 整体吞吐达到最高值 CALIBRATE_KNEE_RATIO 的最小并发即为拐点，作为 dee 的并发上限；
+ * python/mux/native 按各自阶段的吞吐曲线分别取拐点。结果写入 DolbyTemp\calibration.txt，
+ * 之后的批量、参数扫描与监视模式以它为默认值，命令行 --pool 仍然优先。
+ */
+#define CALIBRATION_FILE "calibration.txt"
+#define CALIBRATE_SEGMENT_SECONDS 30.0
+#define CALIBRATE_MAX_LEVELS 16
+#define CALIBRATE_KNEE_RATIO 0.9
+#define CALIBRATE_MIN_GAIN 0.05
+#define CALIBRATE_FIXTURE_SPEC "objects=8,signal=tone"
+
+typedef struct {
+    int level;
+    int ok;                              /* 成功的任务数 */
+    double wall_seconds;
+    double throughput;                   /* 整体吞吐：每秒编码的素材秒数 */
+    double cpu_seconds;
+    long long peak_memory;               /* 单个进程的最大峰值内存 */
+    double class_seconds[TOOL_CLASS_COUNT];  /* 各类阶段的单任务平均耗时，0 表示未经过该类阶段 */
+} CalibrationLevel;
+
+/* 读取校准结果，把命令行未指定的类别的并发上限改为校准值 */
+static void calibration_apply(const char *temp_dir) {
+    char path[1024];
+    char line[256];
+    int applied = 0;
+    int cpus = 0;
+    int pools[TOOL_CLASS_COUNT] = {0};
+    build_path(path, sizeof(path), temp_dir, CALIBRATION_FILE);
+    FILE *f = fopen(path, "r");
+    if (!f) return;
+    while (fgets(line, sizeof(line), f)) {
+        trim_newline(line);
+        if (line[0] == '\0' || line[0] == '#') continue;
+        char *eq = strchr(line, '=');
+        if (!eq) continue;
+        *eq = '\0';
+        if (strcmp(line, "cpus") == 0) {
+            cpus = atoi(eq + 1);
+        } else if (strncmp(line, "pool.", 5) == 0) {
+            for (int c = 0; c < TOOL_CLASS_COUNT; ++c) {
+                if (strcmp(line + 5, tool_class_names[c]) == 0) pools[c] = atoi(eq + 1);
+            }
+        }
+    }
+    fclose(f);
+    /* DolbyTemp 可能放在共享盘上：别的机器测出的结果不适用 */
+    if (cpus != cpu_count()) {
+        fprintf(stderr, "警告: %s 是在 %d 核的机器上校准的（本机 %d 核），已忽略，请重新运行 --calibrate。\n",
+                path, cpus, cpu_count());
+        return;
+    }
+    for (int c = 0; c < TOOL_CLASS_COUNT; ++c) {
+        if (pools[c] <= 0 || (g_cli.pool_explicit & (1u << c))) continue;
+        g_cli.schedule[c].max_concurrent = pools[c];
+        applied = 1;
+    }
+    if (applied) printf("已按本机校准结果设定并发上限: %s\n", path);
+}
+
+static void calibration_save(const char *temp_dir, int choice, const int *pools, double throughput) {
+    char path[1024];
+    char stamp[32];
+    time_t now = time(NULL);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    build_path(path, sizeof(path), temp_dir, CALIBRATION_FILE);
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "无法写入校准结果: %s\n", path);
+        return;
+    }
+    fprintf(f, "# --calibrate %s\n", stamp);
+    fprintf(f, "cpus=%d\n", cpu_count());
+    fprintf(f, "choice=%d\n", choice);
+    fprintf(f, "throughput=%.2f\n", throughput);
+    for (int c = 0; c < TOOL_CLASS_COUNT; ++c) {
+        if (pools[c] > 0) fprintf(f, "pool.%s=%d\n", tool_class_names[c], pools[c]);
+    }
+    fclose(f);
+    printf("校准结果已写入: %s\n", path);
+}
+
+/* 阶段所属的工具类别，与 build_job_stages 中的划分一致 */
+static int calibration_stage_class(int stage) {
+    switch (stage) {
+        case STAGE_DEEW:
+        case STAGE_DEEZY: return TOOL_PYTHON;
+        case STAGE_REMUX: return TOOL_MUX;
+        default: return TOOL_DEE;
+    }
+}
+
+/* 吞吐达到最高值一定比例的最小并发；rates[i] 对应 levels[i] */
+static int calibration_knee(const CalibrationLevel *levels, const double *rates, int count) {
+    double best = 0.0;
+    for (int i = 0; i < count; ++i) {
+        if (rates[i] > best) best = rates[i];
+    }
+    if (best <= 0.0) return 0;
+    for (int i = 0; i < count; ++i) {
+        if (rates[i] >= best * CALIBRATE_KNEE_RATIO) return levels[i].level;
+    }
+    return levels[count - 1].level;
+}
+
+/* 跑一级：n 个任务，所有类别的并发上限都是 n */
+static int calibration_run_level(const EncodeJob *base, const char *fixture, const char *output_dir,
+                                 int choice, int n, CalibrationLevel *out) {
+    EncodeJob *jobs = (EncodeJob *)calloc((size_t)n, sizeof(EncodeJob));
+    JobOutcome *outcomes = (JobOutcome *)calloc((size_t)n, sizeof(JobOutcome));
+    ResourceUsage *usage = (ResourceUsage *)calloc((size_t)n, sizeof(ResourceUsage));
+    if (!jobs || !outcomes || !usage) {
+        free(jobs);
+        free(outcomes);
+        free(usage);
+        return 0;
+    }
+    for (int c = 0; c < TOOL_CLASS_COUNT; ++c) g_cli.schedule[c].max_concurrent = n;
+    for (int i = 0; i < n; ++i) {
+        char start[32];
+        char end[32];
+        char file_name[64];
+        char output[1024];
+        adm_timecode(i * CALIBRATE_SEGMENT_SECONDS, start, sizeof(start));
+        adm_timecode((i + 1) * CALIBRATE_SEGMENT_SECONDS, end, sizeof(end));
+        snprintf(file_name, sizeof(file_name), "c%02d_%02d", n, i + 1);
+        build_path(output, sizeof(output), output_dir, file_name);
+        setup_batch_job(&jobs[i], base, choice, start, end, "", "", output, fixture);
+        jobs[i].usage = &usage[i];
+        snprintf(jobs[i].label, sizeof(jobs[i].label), "c%d.%d", n, i + 1);
+        assign_batch_job_key(jobs, i, &jobs[i]);
+    }
+
+    double began = monotonic_seconds();
+    run_jobs_pipelined(jobs, n, outcomes);
+    memset(out, 0, sizeof(*out));
+    out->level = n;
+    out->wall_seconds = monotonic_seconds() - began;
+
+    int per_class[TOOL_CLASS_COUNT] = {0};
+    for (int i = 0; i < n; ++i) {
+        const EncodeJob *job = &jobs[i];
+        out->cpu_seconds += usage[i].cpu_seconds;
+        if (usage[i].peak_memory > out->peak_memory) out->peak_memory = usage[i].peak_memory;
+        if (outcomes[i].ok) {
+            double seconds[TOOL_CLASS_COUNT] = {0};
+            out->ok++;
+            for (int s = 0; s < STAGE_COUNT; ++s) seconds[calibration_stage_class(s)] += job->stage_seconds[s];
+            seconds[TOOL_NATIVE] += job->qc_seconds;
+            for (int c = 0; c < TOOL_CLASS_COUNT; ++c) {
+                if (seconds[c] <= 0.0) continue;
+                out->class_seconds[c] += seconds[c];
+                per_class[c]++;
+            }
+        }
+        remove(job->final_output_path);
+    }
+    for (int c = 0; c < TOOL_CLASS_COUNT; ++c) {
+        if (per_class[c] > 0) out->class_seconds[c] /= per_class[c];
+    }
+    if (out->wall_seconds > 0.0) out->throughput = out->ok * CALIBRATE_SEGMENT_SECONDS / out->wall_seconds;
+
+    free(jobs);
+    free(outcomes);
+    free(usage);
+    return out->ok == n;
+}
+
+static void calibration_print_level(const CalibrationLevel *level, const CalibrationLevel *first, double previous) {
+    int cpus = cpu_count();
+    double util = level->wall_seconds > 0.0 ? level->cpu_seconds / (level->wall_seconds * cpus) * 100.0 : 0.0;
+    char gain[16] = "-";
+    if (previous > 0.0) snprintf(gain, sizeof(gain), "%+.0f%%", (level->throughput / previous - 1.0) * 100.0);
+    printf("%-5d %9.1f %10.2fx %7s %7.0f%% %10.1f", level->level, level->wall_seconds, level->throughput, gain,
+           util, level->peak_memory / (1024.0 * 1024.0));
+    /* 各类阶段的单任务耗时相对单并发的倍数：接近 1 表示未饱和，接近并发数表示完全排队 */
+    for (int c = 0; c < TOOL_CLASS_COUNT; ++c) {
+        if (first->class_seconds[c] > 0.0 && level->class_seconds[c] > 0.0) {
+            printf(" %7.2fx", level->class_seconds[c] / first->class_seconds[c]);
+        } else {
+            printf(" %8s", "-");
+        }
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+static int run_calibration(const EncodeJob *base) {
+    int choice = g_cli.calibrate_choice;
+    if (choice < 1 || choice > 5) {
+        fprintf(stderr, "校准用的编码选项 %d 无效（1-5）。\n", choice);
+        return 1;
+    }
+    int max_level = g_cli.calibrate_max > 0 ? g_cli.calibrate_max : cpu_count();
+    if (max_level > CALIBRATE_MAX_LEVELS) max_level = CALIBRATE_MAX_LEVELS;
+    if (max_level < 1) max_level = 1;
+
+    /* 测的是本机的稳态吞吐：不复用断点，不搬运输出，预取会让后面的任务读到热缓存 */
+    g_cli.resume_enabled = 0;
+    g_cli.publish_path[0] = '\0';
+    g_cli.write_manifest = 0;
+    g_cli.prefetch_mode = PREFETCH_MODE_OFF;
+
+    char work_dir[1024];
+    char fixture[1024];
+    char spec[1024];
+    build_path(work_dir, sizeof(work_dir), base->temp_dir_path, "calibrate");
+    ensure_directory_exists(work_dir);
+    build_path(fixture, sizeof(fixture), work_dir, "calibrate_adm.wav");
+    /* --adm-spec 可以换成更接近实际母版的布局，时长由最高并发决定 */
+    snprintf(spec, sizeof(spec), "%s,%s,seconds=%.0f", CALIBRATE_FIXTURE_SPEC, g_cli.adm_spec,
+             CALIBRATE_SEGMENT_SECONDS * max_level);
+    printf("并发校准: 编码选项 %d，每个任务 %.0f 秒素材，最高并发 %d\n", choice, CALIBRATE_SEGMENT_SECONDS, max_level);
+    if (make_adm_fixture(fixture, spec) != 0) {
+        remove(fixture);
+        return 1;
+    }
+
+    CalibrationLevel levels[CALIBRATE_MAX_LEVELS];
+    int count = 0;
+    int stalls = 0;
+    double best = 0.0;
+    int result = 0;
+    for (int n = 1; n <= max_level && !cancel_requested(); n += n < 4 ? 1 : n / 2) {
+        if (count > 0 && levels[0].peak_memory > 0) {
+            long long memory = available_memory_bytes();
+            if (memory > 0 && levels[0].peak_memory * n > memory) {
+                printf("可用内存不足以同时运行 %d 个任务，停止提高并发。\n", n);
+                break;
+            }
+        }
+        printf("\n--- 并发 %d ---\n", n);
+        fflush(stdout);
+        CalibrationLevel *level = &levels[count];
+        if (!calibration_run_level(base, fixture, work_dir, choice, n, level)) {
+            if (!cancel_requested()) fprintf(stderr, "并发 %d 时有任务失败，校准中止。\n", n);
+            result = cancel_requested() ? EXIT_CANCELLED : 1;
+            break;
+        }
+        count++;
+        if (level->throughput > best * (1.0 + CALIBRATE_MIN_GAIN)) {
+            stalls = 0;
+        } else if (++stalls >= 2 || level->throughput < best * 0.8) {
+            /* 连续两级几乎没有增益，或已明显回落：再加并发只会互相争抢 */
+            if (level->throughput > best) best = level->throughput;
+            break;
+        }
+        if (level->throughput > best) best = level->throughput;
+    }
+    remove(fixture);
+
+    if (count == 0 || result != 0) return result ? result : 1;
+
+    printf("\n%-5s %9s %11s %7s %8s %10s", "jobs", "wall(s)", "speed", "gain", "cpu", "peak(MB)");
+    for (int c = 0; c < TOOL_CLASS_COUNT; ++c) printf(" %8s", tool_class_names[c]);
+    printf("\n");
+    double rates[CALIBRATE_MAX_LEVELS];
+    for (int i = 0; i < count; ++i) {
+        calibration_print_level(&levels[i], &levels[0], i > 0 ? levels[i - 1].throughput : 0.0);
+        rates[i] = levels[i].throughput;
+    }
+
+    int pools[TOOL_CLASS_COUNT] = {0};
+    pools[TOOL_DEE] = calibration_knee(levels, rates, count);
+    for (int c = TOOL_PYTHON; c < TOOL_CLASS_COUNT; ++c) {
+        /* 某类阶段的吞吐：n 个任务各自在该类阶段花费的平均时间内完成 */
+        if (levels[0].class_seconds[c] <= 0.0) continue;
+        for (int i = 0; i < count; ++i) {
+            rates[i] = levels[i].class_seconds[c] > 0.0 ? levels[i].level / levels[i].class_seconds[c] : 0.0;
+        }
+        pools[c] = calibration_knee(levels, rates, count);
+    }
+    double knee_throughput = 0.0;
+    for (int i = 0; i < count; ++i) {
+        if (levels[i].level == pools[TOOL_DEE]) knee_throughput = levels[i].throughput;
+    }
+    printf("\n拐点: 同时运行 %d 个 dee，吞吐 %.2fx 实时", pools[TOOL_DEE], knee_throughput);
+    for (int c = TOOL_PYTHON; c < TOOL_CLASS_COUNT; ++c) {
+        if (pools[c] > 0) printf("，%s=%d", tool_class_names[c], pools[c]);
+    }
+    printf("\n");
+    calibration_save(base->temp_dir_path, choice, pools, knee_throughput);
+    return 0;
+}
+// --------- 并发校准结束 ---------
+#endif
+
+#ifndef DEE_LIBRARY
+// --------- 监视文件夹（--watch） ---------
+/*
+ * 监视配置每行一个文件夹，字段以 Tab 分隔：文件夹、编码选项、开头空白、结尾空白、输出目录（可省略，默认与输入同目录）。
+ * 新出现或被改写的 .wav 由系统通知发现（Linux inotify，Windows ReadDirectoryChangesW，其他平台退化为定时扫描）；
+ * 大小连续 WATCH_SETTLE_SECONDS 秒不变、且 RIFF/ds64 头声明的大小与文件一致时视为导出完成，按文件夹的配置入队。
+ * 启动时文件夹中已有、但还没有输出的文件同样入队。队列经批量流水线执行，编码期间继续监视。
+ */
+#define WATCH_MAX_FOLDERS 16
+#define WATCH_SETTLE_SECONDS 3.0
+#define WATCH_POLL_MS 500
+
+typedef struct {
+    char folder[512];
+    int choice;
+    char prepend_silence[64];
+    char append_silence[64];
+    char output_dir[512];
+} WatchProfile;
+
+typedef enum {
+    WATCH_SETTLING = 0,   /* 仍在写入或等待大小稳定 */
+    WATCH_READY,          /* 导出完成，等待入队 */
+    WATCH_QUEUED,         /* 正在编码 */
+    WATCH_DONE            /* 已处理；修改时间变化后重新进入 WATCH_SETTLING */
+} WatchFileState;
+
+typedef struct {
+    char path[1024];
+    int profile;
+    WatchFileState state;
+    long long size;
+    long long mtime;
+    double changed_at;    /* 最近一次大小变化的时刻 */
+} WatchFile;
+
+typedef struct {
+    WatchProfile profiles[WATCH_MAX_FOLDERS];
+    int profile_count;
+    WatchFile *files;
+    int file_count;
+    int file_capacity;
+    int jobs_started;
+#ifdef _WIN32
+    HANDLE dirs[WATCH_MAX_FOLDERS];
+    HANDLE events[WATCH_MAX_FOLDERS];
+    OVERLAPPED overlapped[WATCH_MAX_FOLDERS];
+    DWORD buffers[WATCH_MAX_FOLDERS][4096];
+#else
+    int notify_fd;        /* inotify 描述符；-1 表示定时扫描 */
+    int watch_ids[WATCH_MAX_FOLDERS];
+#endif
+} WatchState;
+
+/* 在后台线程中执行的一组任务，监视循环同时继续发现新文件 */
+typedef struct {
+    EncodeJob *jobs;
+    JobOutcome *outcomes;
+    int *file_indices;
+    int count;
+    int failed;
+    int finished;         /* 在 g_console_lock 下读写 */
+    int threaded;
+    worker_thread_t thread;
+} WatchRun;
+
+static void watch_log(const char *fmt, ...) {
+    va_list args;
+    worker_mutex_lock(&g_console_lock);
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    fflush(stdout);
+    worker_mutex_unlock(&g_console_lock);
+}
+
+static int load_watch_profiles(const char *path, WatchState *state) {
+    FILE *f = fopen(path, "r");
+    char line[2048];
+    int line_no = 0;
+    if (!f) {
+        fprintf(stderr, "无法打开监视配置文件: %s\n", path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) && state->profile_count < WATCH_MAX_FOLDERS) {
+        char *fields[5] = {0};
+        int field_count = 0;
+        line_no++;
+        trim_newline(line);
+        if (line[0] == '\0' || line[0] == '#') continue;
+        for (char *p = line; field_count < 5; ) {
+            fields[field_count++] = p;
+            char *tab = strchr(p, '\t');
+            if (!tab) break;
+            *tab = '\0';
+            p = tab + 1;
+        }
+        int choice = field_count > 1 ? atoi(fields[1]) : 0;
+        if (!fields[0][0] || choice < 1 || choice > 5 || !path_is_directory(fields[0])) {
+            fprintf(stderr, "监视配置第 %d 行无效（需要已存在的文件夹与编码选项 1-5），已跳过。\n", line_no);
+            continue;
+        }
+        WatchProfile *profile = &state->profiles[state->profile_count++];
+        copy_string(profile->folder, sizeof(profile->folder), fields[0]);
+        normalize_slashes(profile->folder);
+        profile->choice = choice;
+        copy_string(profile->prepend_silence, sizeof(profile->prepend_silence), field_count > 2 ? fields[2] : "");
+        copy_string(profile->append_silence, sizeof(profile->append_silence), field_count > 3 ? fields[3] : "");
+        copy_string(profile->output_dir, sizeof(profile->output_dir), field_count > 4 ? fields[4] : "");
+        normalize_slashes(profile->output_dir);
+    }
+    fclose(f);
+    return state->profile_count;
+}
+
+/* 输出与输入同名，扩展名按编码选项决定 */
+static void watch_output_path(const WatchProfile *profile, const char *input, char *out, size_t out_size) {
+    char dir[1024];
+    char name[512];
+    int choice = profile->choice;
+    if (profile->output_dir[0]) copy_string(dir, sizeof(dir), profile->output_dir);
+    else directory_of(input, dir, sizeof(dir));
+    replace_extension(path_file_name(input), name, sizeof(name), choice == 1 ? ".ec3" : choice == 3 ? ".mlp" : ".m4a");
+    build_path(out, out_size, dir, name);
+}
+
+/* 头部声明的大小与文件实际大小一致，说明导出程序已经回填了最终的块大小 */
+static int wav_header_complete(const char *path, long long size) {
+    WavLayout layout;
+    if (!wav_probe(path, &layout) || !layout.byte_rate || !layout.data_offset || layout.data_size == 0) return 0;
+    if (layout.riff_size + 8 != (unsigned long long)size) return 0;
+    return layout.data_offset + (long long)layout.data_size <= size;
+}
+
+/* 记录一次文件事件；startup 为真时来自启动扫描，已有输出的文件视为处理过 */
+static void watch_note_file(WatchState *state, int profile, const char *path, int startup) {
+    if (!ends_with_extension(path, ".wav")) return;
+    for (int i = 0; i < state->file_count; ++i) {
+        WatchFile *file = &state->files[i];
+        if (strcmp(file->path, path) != 0) continue;
+        if (file->state == WATCH_DONE && file_mtime_of(path) != file->mtime) {
+            file->state = WATCH_SETTLING;
+            file->size = -1;
+            file->changed_at = monotonic_seconds();
+        }
+        return;
+    }
+    if (state->file_count == state->file_capacity) {
+        int capacity = state->file_capacity ? state->file_capacity * 2 : 32;
+        WatchFile *grown = (WatchFile *)realloc(state->files, sizeof(WatchFile) * (size_t)capacity);
+        if (!grown) return;
+        state->files = grown;
+        state->file_capacity = capacity;
+    }
+    WatchFile *file = &state->files[state->file_count++];
+    memset(file, 0, sizeof(*file));
+    copy_string(file->path, sizeof(file->path), path);
+    file->profile = profile;
+    file->size = -1;
+    file->changed_at = monotonic_seconds();
+    if (startup) {
+        char output[1024];
+        watch_output_path(&state->profiles[profile], path, output, sizeof(output));
+        if (file_exists(output)) {
+            file->state = WATCH_DONE;
+            file->mtime = file_mtime_of(path);
+        }
+    }
+}
+
+static void watch_scan_folder(WatchState *state, int profile, int startup) {
+    char path[1024];
+    const char *folder = state->profiles[profile].folder;
+#ifdef _WIN32
+    char pattern[1024];
+    WIN32_FIND_DATAA data;
+    build_path(pattern, sizeof(pattern), folder, "*.wav");
+    HANDLE handle = FindFirstFileA(pattern, &data);
+    if (handle == INVALID_HANDLE_VALUE) return;
+    do {
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) continue;
+        build_path(path, sizeof(path), folder, data.cFileName);
+        watch_note_file(state, profile, path, startup);
+    } while (FindNextFileA(handle, &data));
+    FindClose(handle);
+#else
+    DIR *d = opendir(folder);
+    if (!d) return;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        build_path(path, sizeof(path), folder, entry->d_name);
+        watch_note_file(state, profile, path, startup);
+    }
+    closedir(d);
+#endif
+}
+
+#ifdef _WIN32
+static int watch_arm(WatchState *state, int i) {
+    ResetEvent(state->events[i]);
+    memset(&state->overlapped[i], 0, sizeof(state->overlapped[i]));
+    state->overlapped[i].hEvent = state->events[i];
+    return ReadDirectoryChangesW(state->dirs[i], state->buffers[i], sizeof(state->buffers[i]), FALSE,
+                                 FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE,
+                                 NULL, &state->overlapped[i], NULL) != 0;
+}
+#endif
+
+static void watch_open(WatchState *state) {
+#ifdef _WIN32
+    for (int i = 0; i < state->profile_count; ++i) {
+        state->dirs[i] = CreateFileA(state->profiles[i].folder, FILE_LIST_DIRECTORY,
+                                     FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING,
+                                     FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+        state->events[i] = CreateEventA(NULL, TRUE, FALSE, NULL);
+        if (state->dirs[i] == INVALID_HANDLE_VALUE || !state->events[i] || !watch_arm(state, i)) {
+            fprintf(stderr, "警告: 无法监视文件夹 %s，改为定时扫描。\n", state->profiles[i].folder);
+        }
+    }
+#elif defined(__linux__)
+    state->notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    for (int i = 0; i < state->profile_count && state->notify_fd >= 0; ++i) {
+        state->watch_ids[i] = inotify_add_watch(state->notify_fd, state->profiles[i].folder,
+                                                IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MODIFY);
+        if (state->watch_ids[i] < 0) {
+            fprintf(stderr, "警告: 无法监视文件夹 %s (errno=%d)，改为定时扫描。\n", state->profiles[i].folder, errno);
+            close(state->notify_fd);
+            state->notify_fd = -1;
+        }
+    }
+#else
+    state->notify_fd = -1;
+#endif
+}
+
+static void watch_close(WatchState *state) {
+#ifdef _WIN32
+    for (int i = 0; i < state->profile_count; ++i) {
+        if (state->dirs[i] != INVALID_HANDLE_VALUE && state->dirs[i]) {
+            CancelIo(state->dirs[i]);
+            CloseHandle(state->dirs[i]);
+        }
+        if (state->events[i]) CloseHandle(state->events[i]);
+    }
+#else
+    if (state->notify_fd >= 0) close(state->notify_fd);
+#endif
+}
+
+/* 等待最多 timeout_ms 毫秒的文件事件；通知丢失（缓冲区溢出）或不可用时重新扫描文件夹 */
+static void watch_poll(WatchState *state, int timeout_ms) {
+#ifdef _WIN32
+    HANDLE waits[WATCH_MAX_FOLDERS];
+    int map[WATCH_MAX_FOLDERS];
+    int count = 0;
+    for (int i = 0; i < state->profile_count; ++i) {
+        if (state->dirs[i] != INVALID_HANDLE_VALUE && state->events[i]) {
+            map[count] = i;
+            waits[count++] = state->events[i];
+        } else {
+            watch_scan_folder(state, i, 0);
+        }
+    }
+    if (count == 0) {
+        Sleep((DWORD)timeout_ms);
+        return;
+    }
+    if (WaitForMultipleObjects((DWORD)count, waits, FALSE, (DWORD)timeout_ms) == WAIT_TIMEOUT) return;
+    for (int w = 0; w < count; ++w) {
+        int i = map[w];
+        DWORD bytes = 0;
+        if (WaitForSingleObject(state->events[i], 0) != WAIT_OBJECT_0) continue;
+        if (!GetOverlappedResult(state->dirs[i], &state->overlapped[i], &bytes, FALSE) || bytes == 0) {
+            watch_scan_folder(state, i, 0);
+        } else {
+            const unsigned char *p = (const unsigned char *)state->buffers[i];
+            for (;;) {
+                const FILE_NOTIFY_INFORMATION *info = (const FILE_NOTIFY_INFORMATION *)p;
+                if (info->Action == FILE_ACTION_ADDED || info->Action == FILE_ACTION_MODIFIED ||
+                    info->Action == FILE_ACTION_RENAMED_NEW_NAME) {
+                    char name[MAX_PATH];
+                    char path[1024];
+                    int n = WideCharToMultiByte(CP_ACP, 0, info->FileName, (int)(info->FileNameLength / sizeof(WCHAR)),
+                                                name, (int)sizeof(name) - 1, NULL, NULL);
+                    name[n > 0 ? n : 0] = '\0';
+                    build_path(path, sizeof(path), state->profiles[i].folder, name);
+                    watch_note_file(state, i, path, 0);
+                }
+                if (info->NextEntryOffset == 0) break;
+                p += info->NextEntryOffset;
+            }
+        }
+        watch_arm(state, i);
+    }
+#elif defined(__linux__)
+    if (state->notify_fd < 0) {
+        sleep_milliseconds(timeout_ms);
+        for (int i = 0; i < state->profile_count; ++i) watch_scan_folder(state, i, 0);
+        return;
+    }
+    struct pollfd pfd = {state->notify_fd, POLLIN, 0};
+    if (poll(&pfd, 1, timeout_ms) <= 0) return;
+    char buffer[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(state->notify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *p = buffer; p < buffer + len; ) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                for (int i = 0; i < state->profile_count; ++i) watch_scan_folder(state, i, 0);
+                continue;
+            }
+            if (!event->len || (event->mask & IN_ISDIR)) continue;
+            for (int i = 0; i < state->profile_count; ++i) {
+                if (state->watch_ids[i] != event->wd) continue;
+                char path[1024];
+                build_path(path, sizeof(path), state->profiles[i].folder, event->name);
+                watch_note_file(state, i, path, 0);
+            }
+        }
+    }
+#else
+    sleep_milliseconds(timeout_ms);
+    for (int i = 0; i < state->profile_count; ++i) watch_scan_folder(state, i, 0);
+#endif
+}
+
+/* 检查写入中的文件：大小变化时重新计时，稳定足够久且头部完整后标记为就绪 */
+static void watch_update_files(WatchState *state) {
+    double now = monotonic_seconds();
+    for (int i = 0; i < state->file_count; ++i) {
+        WatchFile *file = &state->files[i];
+        if (file->state != WATCH_SETTLING && file->state != WATCH_READY) continue;
+        long long size = file_size_of(file->path);
+        if (size < 0) {
+            /* 导出程序常先写临时名再改名，原文件消失时等待下一次事件 */
+            file->state = WATCH_DONE;
+            file->mtime = -1;
+            continue;
+        }
+        if (size != file->size) {
+            file->size = size;
+            file->changed_at = now;
+            file->state = WATCH_SETTLING;
+            continue;
+        }
+        if (file->state == WATCH_SETTLING && now - file->changed_at >= WATCH_SETTLE_SECONDS &&
+            wav_header_complete(file->path, size)) {
+            file->state = WATCH_READY;
+            watch_log("监视: 导出完成 %s（%.1f MB）\n", file->path, size / (1024.0 * 1024.0));
+        }
+    }
+}
+
+static void watch_run_worker(void *arg) {
+    WatchRun *run = (WatchRun *)arg;
+    int failed = run_jobs_pipelined(run->jobs, run->count, run->outcomes);
+    worker_mutex_lock(&g_console_lock);
+    run->failed = failed;
+    run->finished = 1;
+    worker_mutex_unlock(&g_console_lock);
+}
+
+/* 把所有就绪文件作为一组任务交给批量流水线；没有就绪文件时返回 0 */
+static int watch_start_run(WatchState *state, const EncodeJob *base, WatchRun *run) {
+    int ready = 0;
+    memset(run, 0, sizeof(*run));
+    for (int i = 0; i < state->file_count; ++i) ready += state->files[i].state == WATCH_READY;
+    if (ready == 0) return 0;
+    run->jobs = (EncodeJob *)calloc((size_t)ready, sizeof(EncodeJob));
+    run->outcomes = (JobOutcome *)calloc((size_t)ready, sizeof(JobOutcome));
+    run->file_indices = (int *)calloc((size_t)ready, sizeof(int));
+    if (!run->jobs || !run->outcomes || !run->file_indices) {
+        free(run->jobs);
+        free(run->outcomes);
+        free(run->file_indices);
+        return 0;
+    }
+
+    for (int i = 0; i < state->file_count; ++i) {
+        WatchFile *file = &state->files[i];
+        if (file->state != WATCH_READY) continue;
+        const WatchProfile *profile = &state->profiles[file->profile];
+        EncodeJob *job = &run->jobs[run->count];
+        char output[1024];
+        watch_output_path(profile, file->path, output, sizeof(output));
+        if (profile->output_dir[0]) ensure_directory_exists(profile->output_dir);
+        setup_batch_job(job, base, profile->choice, "", "", profile->prepend_silence, profile->append_silence,
+                        output, file->path);
+        snprintf(job->label, sizeof(job->label), "w%d", state->jobs_started + 1);
+        file->state = WATCH_DONE;
+        file->mtime = file_mtime_of(file->path);
+        if (!assign_batch_job_key(run->jobs, run->count, job)) continue;
+        state->jobs_started++;
+        file->state = WATCH_QUEUED;
+        run->file_indices[run->count++] = i;
+        watch_log("监视: 任务 %s 入队 %s -> %s\n", job->label, file->path, output);
+    }
+    run->threaded = worker_start(&run->thread, watch_run_worker, run);
+    if (!run->threaded) watch_run_worker(run);
+    return 1;
+}
+
+static int watch_run_finished(WatchRun *run) {
+    worker_mutex_lock(&g_console_lock);
+    int finished = run->finished;
+    worker_mutex_unlock(&g_console_lock);
+    return finished;
+}
+
+/* 一组任务结束：成功与否都标记为已处理，文件再次被导出（修改时间变化）时才会重试 */
+static void watch_finish_run(WatchState *state, WatchRun *run) {
+    if (run->threaded) worker_join(run->thread);
+    for (int i = 0; i < run->count; ++i) {
+        WatchFile *file = &state->files[run->file_indices[i]];
+        file->state = WATCH_DONE;
+        file->mtime = file_mtime_of(file->path);
+    }
+    watch_log("监视: 本组 %d 个任务完成，失败 %d；继续监视...\n", run->count, run->failed);
+    free(run->jobs);
+    free(run->outcomes);
+    free(run->file_indices);
+    memset(run, 0, sizeof(*run));
+}
+
+/* 监视模式入口：直到取消才返回 */
+static int run_watch(const EncodeJob *base) {
+    static WatchState state;
+    WatchRun run;
+    int running = 0;
+    memset(&state, 0, sizeof(state));
+    memset(&run, 0, sizeof(run));
+    if (load_watch_profiles(g_cli.watch_file, &state) <= 0) {
+        fprintf(stderr, "监视配置中没有有效的文件夹: %s\n", g_cli.watch_file);
+        return 1;
+    }
+    watch_open(&state);
+    for (int i = 0; i < state.profile_count; ++i) {
+        const WatchProfile *profile = &state.profiles[i];
+        watch_scan_folder(&state, i, 1);
+        printf("监视文件夹: %s（choice=%d，输出到 %s）\n", profile->folder, profile->choice,
+               profile->output_dir[0] ? profile->output_dir : "输入所在目录");
+    }
+    printf("监视模式已启动：文件大小稳定 %.0f 秒且头部完整后自动编码，输入 cancel 或按 Ctrl+C 退出。\n", WATCH_SETTLE_SECONDS);
+    fflush(stdout);
+
+    while (!cancel_requested()) {
+        watch_poll(&state, WATCH_POLL_MS);
+        watch_update_files(&state);
+        if (running && watch_run_finished(&run)) {
+            watch_finish_run(&state, &run);
+            running = 0;
+        }
+        if (!running && !cancel_requested()) running = watch_start_run(&state, base, &run);
+    }
+
+    if (running) watch_finish_run(&state, &run);
+    watch_close(&state);
+    free(state.files);
+    printf("监视模式已退出。\n");
+    return EXIT_CANCELLED;
+}
+// --------- 监视文件夹结束 ---------
+#endif
+
+#ifndef DEE_LIBRARY
+// --------- 码流编辑（--edit）：不重新编码地补静音与裁切 ---------
+/*
+ * 直接在已编码的 E-AC-3 上修改首尾：按 --edit-spec 的 start/end 在访问单元边界裁切，
+ * 再在前后插入与码流配置一致的静音访问单元。MP4 输入先取出 mdat 中的基本流，MP4 输出走转封装阶段重建容器时间。
+ * 静音帧由 dee 编码一段合成的静音 ADM 得到，按码流配置缓存在 DolbyTemp\silence；
+ * dee 的模板产不出相同配置时（如非 JOC 的 DDP），用 silence=文件 提供一段同配置的静音码流。
+ */
+#define EDIT_SILENCE_SECONDS 8.0
+#define EDIT_SILENCE_GUARD 16   /* 丢弃静音码流首尾的访问单元，避开编码器的起止过渡 */
+
+typedef struct {
+    double start;              /* 源码流时间轴上保留的起点（秒） */
+    double end;                /* 保留的终点，0 表示到结尾 */
+    double prepend;            /* 开头插入的静音（秒） */
+    double append;
+    char output[1024];
+    char silence[1024];        /* 同配置的静音码流，用于填充缓存 */
+} EditSpec;
+
+/* 时间可写秒数或 HH:MM:SS.xxx */
+static double edit_seconds(const char *value) {
+    if (strchr(value, ':')) {
+        double seconds = timecode_seconds(value);
+        return seconds > 0.0 ? seconds : 0.0;
+    }
+    double seconds = atof(value);
+    return seconds > 0.0 ? seconds : 0.0;
+}
+
+static void edit_spec_parse(const char *text, EditSpec *spec) {
+    char buf[2048];
+    memset(spec, 0, sizeof(*spec));
+    copy_string(buf, sizeof(buf), text ? text : "");
+    for (char *item = strtok(buf, ","); item; item = strtok(NULL, ",")) {
+        char *eq = strchr(item, '=');
+        if (!eq) continue;
+        *eq = '\0';
+        const char *value = eq + 1;
+        if (strcmp(item, "start") == 0) spec->start = edit_seconds(value);
+        else if (strcmp(item, "end") == 0) spec->end = edit_seconds(value);
+        else if (strcmp(item, "prepend") == 0) spec->prepend = edit_seconds(value);
+        else if (strcmp(item, "append") == 0) spec->append = edit_seconds(value);
+        else if (strcmp(item, "output") == 0) copy_string(spec->output, sizeof(spec->output), value);
+        else if (strcmp(item, "silence") == 0) copy_string(spec->silence, sizeof(spec->silence), value);
+        else fprintf(stderr, "警告: 未知 --edit-spec 字段 %s，已忽略。\n", item);
+    }
+    normalize_slashes(spec->output);
+    normalize_slashes(spec->silence);
+}
+
+/* 码流配置的缓存键：静音帧必须与被编辑的码流逐项一致才能无缝拼接 */
+static void edit_config_key(const CmafStreamInfo *s, char *out, size_t out_size) {
+    snprintf(out, out_size, "eac3_%d_%d_a%d_l%d_b%d_%d_d%d_%04x_j%d_%d", s->core.bsid, s->core.sample_rate,
+             s->core.acmod, s->core.lfeon, s->core.blocks, s->au_bytes, s->dependent_count,
+             (unsigned)s->dependent_chanmap, s->core.joc, s->core.joc_complexity);
+}
+
+/* 从当前位置读一个访问单元（独立帧及其后的依赖帧），out 非空时追加其字节；返回字节数，结尾返回 0，失步返回 -1 */
+static long edit_read_au(ByteReader *r, BoxBuffer *out) {
+    long total = 0;
+    for (;;) {
+        Eac3FrameInfo info;
+        size_t avail = reader_fill(r, 64);
+        if (avail == 0) return total;
+        int size = parse_eac3_header(r->buf + r->pos, avail, &info);
+        if (size <= 0) return -1;
+        int starts_au = info.strmtyp != 1 && info.substreamid == 0;
+        if (starts_au && total > 0) return total;
+        if (!starts_au && total == 0) return -1;
+        if (reader_fill(r, (size_t)size) < (size_t)size) return -1;
+        if (out) box_put_bytes(out, r->buf + r->pos, (size_t)size);
+        r->pos += (size_t)size;
+        total += size;
+    }
+}
+
+/* MP4 输入：把各 mdat 中的 E-AC-3 帧按顺序拼成基本流 */
+static int edit_extract_mp4(const char *source, const char *target) {
+    QcReport *report = (QcReport *)calloc(1, sizeof(QcReport));
+    Mp4Walk walk;
+    int ok = 0;
+    if (!report) return 0;
+    memset(&walk, 0, sizeof(walk));
+    walk.report = report;
+    walk.fp = fopen(source, "rb");
+    FILE *out = walk.fp ? fopen(target, "wb") : NULL;
+    if (out) {
+        unsigned char *buf = (unsigned char *)malloc(PUBLISH_CHUNK);
+        mp4_walk_boxes(&walk, 0, file_size_of(source));
+        ok = buf && report->error_count == 0 && report->mp4_mdat_count > 0;
+        for (int i = 0; ok && i < report->mp4_mdat_count; ++i) {
+            long long pos = walk.mdat_start[i];
+            if (file_seek64(walk.fp, pos) != 0) ok = 0;
+            while (ok && pos < walk.mdat_end[i]) {
+                size_t want = walk.mdat_end[i] - pos > PUBLISH_CHUNK ? PUBLISH_CHUNK : (size_t)(walk.mdat_end[i] - pos);
+                if (fread(buf, 1, want, walk.fp) != want || fwrite(buf, 1, want, out) != want) ok = 0;
+                pos += (long long)want;
+            }
+        }
+        free(buf);
+        if (fclose(out) != 0) ok = 0;
+    }
+    if (walk.fp) fclose(walk.fp);
+    free(walk.mdat_start);
+    free(walk.mdat_end);
+    free(report);
+    if (!ok) remove_file_if_exists(target);
+    return ok;
+}
+
+/* 取一段静音码流中间的访问单元写入缓存；配置与 want 不一致时返回 0 */
+static int edit_cache_silence(const char *source, const CmafStreamInfo *want, const char *cache_path) {
+    CmafStreamInfo got;
+    char want_key[128];
+    char got_key[128];
+    ByteReader r;
+    BoxBuffer au = {0};
+    long total = 0;
+    long count = 0;
+    int ok = 0;
+
+    if (!cmaf_probe_stream(source, &got)) {
+        fprintf(stderr, "静音码流 %s 不是 E-AC-3 基本流\n", source);
+        return 0;
+    }
+    edit_config_key(want, want_key, sizeof(want_key));
+    edit_config_key(&got, got_key, sizeof(got_key));
+    if (strcmp(want_key, got_key) != 0) {
+        fprintf(stderr, "静音码流的配置 %s 与被编辑码流的 %s 不一致\n", got_key, want_key);
+        return 0;
+    }
+    if (!reader_open(&r, source, CMAF_READ_BUFFER, file_size_of(source))) return 0;
+    while ((total = edit_read_au(&r, NULL)) > 0) count++;
+    reader_close(&r);
+    if (total < 0 || count == 0) {
+        fprintf(stderr, "静音码流 %s 在第 %ld 个访问单元处失步\n", source, count + 1);
+        return 0;
+    }
+
+    long guard = count > 2 * EDIT_SILENCE_GUARD ? EDIT_SILENCE_GUARD : 0;
+    ensure_parent_directory(cache_path);
+    FILE *out = fopen(cache_path, "wb");
+    if (!out || !reader_open(&r, source, CMAF_READ_BUFFER, file_size_of(source))) {
+        if (out) fclose(out);
+        return 0;
+    }
+    ok = 1;
+    for (long i = 0; ok && i < count - guard; ++i) {
+        au.len = 0;
+        if (edit_read_au(&r, i >= guard ? &au : NULL) <= 0 || au.failed) ok = 0;
+        else if (au.len > 0 && fwrite(au.data, 1, au.len, out) != au.len) ok = 0;
+    }
+    reader_close(&r);
+    free(au.data);
+    if (fclose(out) != 0) ok = 0;
+    if (!ok) remove_file_if_exists(cache_path);
+    else printf("已缓存 %ld 个静音访问单元: %s\n", count - 2 * guard, cache_path);
+    return ok;
+}
+
+/* 用 dee 编码一段合成的静音 ADM，码率取被编辑码流的码率 */
+static int edit_encode_silence(const EncodeJob *base, const CmafStreamInfo *stream, const char *work_dir, char *out, size_t out_size) {
+    char fixture[1024];
+    char spec[256];
+    EncodeJob job;
+    build_path(fixture, sizeof(fixture), work_dir, "silence_adm.wav");
+    build_path(out, out_size, work_dir, "silence.ec3");
+    snprintf(spec, sizeof(spec), "signal=silence,seconds=%.0f", EDIT_SILENCE_SECONDS);
+    printf("静音缓存未命中，用 dee 编码 %.0f 秒静音...\n", EDIT_SILENCE_SECONDS);
+    if (make_adm_fixture(fixture, spec) != 0) {
+        remove(fixture);
+        return 0;
+    }
+    setup_batch_job(&job, base, 1, "", "", "", "", out, fixture);
+    job.formats = 0;
+    snprintf(job.bitrate, sizeof(job.bitrate), "%d", cmaf_data_rate_kbps(stream));
+    int code = run_encode_job(&job);
+    remove(fixture);
+    return code == 0;
+}
+
+/* 把缓存的静音访问单元循环写出 count 个 */
+static int edit_write_silence(FILE *out, const unsigned char *silence, const long *offsets, long units, long long count) {
+    for (long long i = 0; i < count; ++i) {
+        long u = (long)(i % units);
+        size_t len = (size_t)(offsets[u + 1] - offsets[u]);
+        if (fwrite(silence + offsets[u], 1, len, out) != len) return 0;
+    }
+    return 1;
+}
+
+/* 读入静音缓存并标出访问单元边界 */
+static unsigned char *edit_load_silence(const char *path, long **offsets_out, long *units_out) {
+    long long size = file_size_of(path);
+    ByteReader r;
+    BoxBuffer data = {0};
+    long *offsets = NULL;
+    long units = 0;
+    long cap = 0;
+    if (size <= 0 || !reader_open(&r, path, CMAF_READ_BUFFER, size)) return NULL;
+    for (;;) {
+        if (units + 1 >= cap) {
+            cap = cap ? cap * 2 : 256;
+            long *grown = (long *)realloc(offsets, sizeof(long) * (size_t)cap);
+            if (!grown) break;
+            offsets = grown;
+        }
+        offsets[units] = (long)data.len;
+        long len = edit_read_au(&r, &data);
+        if (len <= 0 || data.failed) break;
+        units++;
+    }
+    reader_close(&r);
+    if (units == 0 || data.failed || (long long)data.len != size) {
+        free(offsets);
+        free(data.data);
+        return NULL;
+    }
+    offsets[units] = (long)data.len;
+    *offsets_out = offsets;
+    *units_out = units;
+    return data.data;
+}
+
+static long long edit_units(double seconds, const CmafStreamInfo *s) {
+    return (long long)(seconds * s->core.sample_rate / s->au_samples + 0.5);
+}
+
+static int run_edit(const EncodeJob *base) {
+    EditSpec spec;
+    CmafStreamInfo stream;
+    char source[1024];
+    char work_dir[1024];
+    char key[128];
+    char cache_path[1024];
+    char edited[1024];
+    char stem[256];
+    int mp4_out;
+    int result = 1;
+    double started = monotonic_seconds();
+
+    edit_spec_parse(g_cli.edit_spec, &spec);
+    copy_string(source, sizeof(source), g_cli.edit_file);
+    normalize_slashes(source);
+    if (!file_exists(source)) {
+        fprintf(stderr, "要编辑的文件不存在: %s\n", source);
+        return 1;
+    }
+    if (spec.end > 0.0 && spec.end <= spec.start) {
+        fprintf(stderr, "--edit-spec 的 end 必须晚于 start。\n");
+        return 1;
+    }
+    if (!spec.output[0]) {
+        /* 默认输出与源同目录，文件名加 _edit */
+        char name[300];
+        const char *ext = strrchr(path_file_name(source), '.');
+        copy_string(stem, sizeof(stem), source);
+        char *dot = strrchr(stem, '.');
+        if (dot && dot > path_file_name(stem)) *dot = '\0';
+        snprintf(name, sizeof(name), "%s_edit%s", stem, ext ? ext : ".ec3");
+        copy_string(spec.output, sizeof(spec.output), name);
+    }
+    if (strcmp(spec.output, source) == 0) {
+        fprintf(stderr, "编辑结果不能覆盖源文件: %s\n", source);
+        return 1;
+    }
+    mp4_out = ends_with_extension(spec.output, ".m4a") || ends_with_extension(spec.output, ".mp4");
+
+    build_path(work_dir, sizeof(work_dir), base->temp_dir_path, "edit");
+    ensure_directory_exists(work_dir);
+    copy_string(stem, sizeof(stem), path_file_name(spec.output));
+    char *dot = strrchr(stem, '.');
+    if (dot) *dot = '\0';
+
+    /* MP4 先取出基本流 */
+    char extracted[1024] = "";
+    if (qc_detect_format(source) == QC_FORMAT_MP4) {
+        char name[300];
+        snprintf(name, sizeof(name), "%s_source.ec3", stem);
+        build_path(extracted, sizeof(extracted), work_dir, name);
+        if (!edit_extract_mp4(source, extracted)) {
+            fprintf(stderr, "无法从 %s 中取出 E-AC-3 码流\n", source);
+            return 1;
+        }
+        copy_string(source, sizeof(source), extracted);
+    }
+    if (!cmaf_probe_stream(source, &stream)) {
+        fprintf(stderr, "%s 不是 E-AC-3 码流，无法按帧编辑\n", source);
+        goto cleanup;
+    }
+
+    double unit_seconds = (double)stream.au_samples / stream.core.sample_rate;
+    long long skip = edit_units(spec.start, &stream);
+    long long keep_until = spec.end > 0.0 ? edit_units(spec.end, &stream) : -1;
+    long long head = edit_units(spec.prepend, &stream);
+    long long tail = edit_units(spec.append, &stream);
+    printf("码流编辑: %s（%d Hz，%d kbps%s，每个访问单元 %.1f 毫秒）\n", g_cli.edit_file, stream.core.sample_rate,
+           cmaf_data_rate_kbps(&stream), stream.core.joc ? "，JOC" : "", unit_seconds * 1000.0);
+
+    /* 静音帧：先查缓存，未命中时用提供的静音码流或 dee 生成 */
+    unsigned char *silence = NULL;
+    long *offsets = NULL;
+    long units = 0;
+    if (head > 0 || tail > 0) {
+        char silence_dir[1024];
+        char name[160];
+        edit_config_key(&stream, key, sizeof(key));
+        build_path(silence_dir, sizeof(silence_dir), base->temp_dir_path, "silence");
+        snprintf(name, sizeof(name), "%s.ec3", key);
+        build_path(cache_path, sizeof(cache_path), silence_dir, name);
+        if (!file_exists(cache_path)) {
+            char generated[1024] = "";
+            int cached = 0;
+            if (spec.silence[0]) {
+                cached = edit_cache_silence(spec.silence, &stream, cache_path);
+            } else if (edit_encode_silence(base, &stream, work_dir, generated, sizeof(generated))) {
+                cached = edit_cache_silence(generated, &stream, cache_path);
+            }
+            if (generated[0]) {
+                char report[1100];
+                snprintf(report, sizeof(report), "%s.qc.txt", generated);
+                remove_file_if_exists(generated);
+                remove_file_if_exists(report);
+            }
+            if (!cached) {
+                if (!cancel_requested()) fprintf(stderr, "无法得到与码流配置一致的静音帧，请用 --edit-spec silence=文件 提供一段同配置的静音码流。\n");
+                goto cleanup;
+            }
+        }
+        silence = edit_load_silence(cache_path, &offsets, &units);
+        if (!silence) {
+            fprintf(stderr, "静音缓存 %s 损坏，已删除，请重试。\n", cache_path);
+            remove_file_if_exists(cache_path);
+            goto cleanup;
+        }
+    }
+
+    /* 一遍顺序读：前置静音 → 源码流 [skip, keep_until) → 追加静音 */
+    if (mp4_out) {
+        char name[300];
+        snprintf(name, sizeof(name), "%s_edited.ec3", stem);
+        build_path(edited, sizeof(edited), work_dir, name);
+    } else {
+        copy_string(edited, sizeof(edited), spec.output);
+    }
+    ensure_parent_directory(edited);
+    FILE *out = fopen(edited, "wb");
+    ByteReader r;
+    long long index = 0;
+    long long kept = 0;
+    int ok = out != NULL && reader_open(&r, source, CMAF_READ_BUFFER, file_size_of(source));
+    if (ok) {
+        BoxBuffer au = {0};
+        ok = edit_write_silence(out, silence, offsets, units, head);
+        while (ok && (keep_until < 0 || index < keep_until)) {
+            if (cancel_requested()) {
+                ok = 0;
+                break;
+            }
+            au.len = 0;
+            long len = edit_read_au(&r, index >= skip ? &au : NULL);
+            if (len == 0) break;
+            if (len < 0 || au.failed) {
+                fprintf(stderr, "源码流在第 %lld 个访问单元处失步\n", index + 1);
+                ok = 0;
+                break;
+            }
+            if (index >= skip) {
+                if (fwrite(au.data, 1, au.len, out) != au.len) ok = 0;
+                kept++;
+            }
+            index++;
+        }
+        if (ok) ok = edit_write_silence(out, silence, offsets, units, tail);
+        free(au.data);
+        reader_close(&r);
+    }
+    if (out && fclose(out) != 0) ok = 0;
+    free(silence);
+    free(offsets);
+    if (!ok || kept == 0) {
+        if (ok) fprintf(stderr, "裁切后没有剩余的音频（start 超出码流长度）\n");
+        remove_file_if_exists(edited);
+        goto cleanup;
+    }
+    if (keep_until > index) {
+        printf("提示: end 超出码流长度，保留到结尾。\n");
+    }
+    printf("保留源码流 %.3f - %.3f 秒（%lld 个访问单元），前置静音 %.3f 秒，追加静音 %.3f 秒\n",
+           skip * unit_seconds, (skip + kept) * unit_seconds, kept, head * unit_seconds, tail * unit_seconds);
+    printf("新时长 %.3f 秒\n", (head + kept + tail) * unit_seconds);
+
+    if (mp4_out) {
+        /* 容器时间随样本数重建：按 --cmaf 选择分片封装或 ffmpeg 转封装 */
+        EncodeJob job = *base;
+        int code = run_remux_stage(&job, edited, spec.output);
+        remove_file_if_exists(edited);
+        if (code != 0) goto cleanup;
+    }
+
+    if (g_cli.verify_enabled) {
+        QcExpect expect;
+        memset(&expect, 0, sizeof(expect));
+        expect.container = mp4_out ? QC_FORMAT_MP4 : QC_FORMAT_EAC3;
+        expect.require_joc = stream.core.joc;
+        if (verify_output_file(spec.output, &expect, g_cli.qc_report, qc_thread_budget()) != 0) goto cleanup;
+    }
+    printf("编辑完成: %s（用时 %.2f 秒）\n", spec.output, monotonic_seconds() - started);
+    result = 0;
+
+cleanup:
+    if (extracted[0]) remove_file_if_exists(extracted);
+    if (result != 0 && cancel_requested()) return EXIT_CANCELLED;
+    return result;
+}
+// --------- 码流编辑结束 ---------
+#endif
+
+// --------- 波形概览（--overview）：各声道 min/max/RMS 多级金字塔，按输入指纹缓存 ---------
+/*
+ * 把 WAV 整个映射进内存，多线程一次算出第 0 级（每个 bin 若干帧）各声道的最小值、最大值与均方，
+ * 再逐级 4 合 1 得到更粗的级别，直到一级不超过 OVERVIEW_TOP_BINS 个 bin。结果写到 DolbyTemp\overview\<指纹>.wfp，
+ * 指纹只取格式与 data 块中均匀分布的若干采样块，不读整个文件，同一素材重开（哪怕换了路径）时直接复用。
+ *
+ * .wfp 格式（小端）：
+ *   头部 64 字节：magic "DEEWFP1\0"、版本(u32)、声道数(u32)、采样率(u32)、级数(u32)、总帧数(u64)、指纹(u64)，其余保留为 0
+ *   级别表，每级 16 字节：每 bin 帧数(u32)、bin 数(u32)、数据偏移(u64)
+ *   各级数据：bin × 声道 × {min, max, rms}，均为 int16，满刻度 32767
+ */
+#define OVERVIEW_MAGIC "DEEWFP1"
+#define OVERVIEW_VERSION 1
+#define OVERVIEW_HEADER 64
+#define OVERVIEW_BASE_FRAMES 256
+#define OVERVIEW_FACTOR 4
+#define OVERVIEW_TOP_BINS 512
+#define OVERVIEW_MAX_LEVELS 16
+#define OVERVIEW_LEVEL0_BUDGET (48LL << 20)  /* 第 0 级量化后的大小上限，超出时加大每 bin 帧数 */
+#define OVERVIEW_MAX_THREADS 64
+#define OVERVIEW_MIN_BINS_PER_THREAD 64
+#define OVERVIEW_KEY_BLOCKS 16
+#define OVERVIEW_KEY_BLOCK_BYTES (64 << 10)
+
+enum { OVERVIEW_S16 = 1, OVERVIEW_S24, OVERVIEW_S32, OVERVIEW_F32, OVERVIEW_F64 };
+
+/* 只读映射整个文件 */
+typedef struct {
+    const unsigned char *data;
+    long long size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+} FileMap;
+
+static int file_map_open(FileMap *m, const char *path) {
+    memset(m, 0, sizeof(*m));
+    m->size = file_size_of(path);
+    if (m->size <= 0) return 0;
+#ifdef _WIN32
+    m->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (m->file == INVALID_HANDLE_VALUE) return 0;
+    m->mapping = CreateFileMappingA(m->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m->mapping) m->data = (const unsigned char *)MapViewOfFile(m->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m->data) {
+        if (m->mapping) CloseHandle(m->mapping);
+        CloseHandle(m->file);
+        memset(m, 0, sizeof(*m));
+        return 0;
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    void *view = mmap(NULL, (size_t)m->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED) return 0;
+    madvise(view, (size_t)m->size, MADV_SEQUENTIAL);
+    m->data = (const unsigned char *)view;
+#endif
+    return 1;
+}
+
+static void file_map_close(FileMap *m) {
+    if (!m->data) return;
+#ifdef _WIN32
+    UnmapViewOfFile(m->data);
+    CloseHandle(m->mapping);
+    CloseHandle(m->file);
+#else
+    munmap((void *)m->data, (size_t)m->size);
+#endif
+    memset(m, 0, sizeof(*m));
+}
+
+typedef struct {
+    long long frames_per_bin;
+    long long bins;
+    float *stats;  /* [bin][声道][min, max, 均方] */
+} OverviewLevel;
+
+typedef struct {
+    const unsigned char *data;  /* data 块起点 */
+    int format;
+    int channels;
+    unsigned block_align;
+    long long frames;
+    long long frames_per_bin;
+    long long bin_begin;
+    long long bin_end;
+    float *stats;               /* 第 0 级 */
+    int honor_cancel;
+    int cancelled;
+    int failed;
+} OverviewSlice;
+
+static int overview_sample_format(const WavLayout *wav) {
+    if (wav->format_tag == 1) {
+        if (wav->bits_per_sample == 16) return OVERVIEW_S16;
+        if (wav->bits_per_sample == 24) return OVERVIEW_S24;
+        if (wav->bits_per_sample == 32) return OVERVIEW_S32;
+    } else if (wav->format_tag == 3) {
+        if (wav->bits_per_sample == 32) return OVERVIEW_F32;
+        if (wav->bits_per_sample == 64) return OVERVIEW_F64;
+    }
+    return 0;
+}
+
+/* 一帧各声道的采样转成 [-1, 1) 的浮点；每种格式各写一个循环，便于编译器向量化 */
+static void overview_decode_frame(const unsigned char *p, int format, int channels, float *row) {
+    switch (format) {
+    case OVERVIEW_S16:
+        for (int c = 0; c < channels; ++c) {
+            row[c] = (float)(int16_t)((unsigned)p[2 * c] | ((unsigned)p[2 * c + 1] << 8)) * (1.0f / 32768.0f);
+        }
+        break;
+    case OVERVIEW_S24:
+        for (int c = 0; c < channels; ++c) {
+            uint32_t u = ((uint32_t)p[3 * c] << 8) | ((uint32_t)p[3 * c + 1] << 16) | ((uint32_t)p[3 * c + 2] << 24);
+            row[c] = (float)((int32_t)u >> 8) * (1.0f / 8388608.0f);
+        }
+        break;
+    case OVERVIEW_S32:
+        for (int c = 0; c < channels; ++c) {
+            uint32_t u = (uint32_t)p[4 * c] | ((uint32_t)p[4 * c + 1] << 8) | ((uint32_t)p[4 * c + 2] << 16) |
+                         ((uint32_t)p[4 * c + 3] << 24);
+            row[c] = (float)(int32_t)u * (1.0f / 2147483648.0f);
+        }
+        break;
+    case OVERVIEW_F32:
+        memcpy(row, p, (size_t)channels * sizeof(float));
+        break;
+    case OVERVIEW_F64:
+        for (int c = 0; c < channels; ++c) {
+            double d;
+            memcpy(&d, p + 8 * c, sizeof(d));
+            row[c] = (float)d;
+        }
+        break;
+    }
+}
+
+/* 第 0 级的一段 bin：逐帧解码后在声道维度上更新最小、最大与平方和 */
+static void overview_worker(void *arg) {
+    OverviewSlice *s = (OverviewSlice *)arg;
+    int channels = s->channels;
+    float *row = (float *)malloc((size_t)channels * 4 * sizeof(float));
+    if (!row) {
+        s->failed = 1;
+        return;
+    }
+    float *lo = row + channels;
+    float *hi = lo + channels;
+    float *acc = hi + channels;
+    for (long long bin = s->bin_begin; bin < s->bin_end; ++bin) {
+        if (s->honor_cancel && (bin & 255) == 0 && cancel_requested()) {
+            s->cancelled = 1;
+            break;
+        }
+        long long first = bin * s->frames_per_bin;
+        long long count = s->frames - first < s->frames_per_bin ? s->frames - first : s->frames_per_bin;
+        const unsigned char *p = s->data + first * s->block_align;
+        overview_decode_frame(p, s->format, channels, row);
+        for (int c = 0; c < channels; ++c) {
+            lo[c] = hi[c] = row[c];
+            acc[c] = row[c] * row[c];
+        }
+        for (long long f = 1; f < count; ++f) {
+            p += s->block_align;
+            overview_decode_frame(p, s->format, channels, row);
+            for (int c = 0; c < channels; ++c) {
+                float v = row[c];
+                lo[c] = v < lo[c] ? v : lo[c];
+                hi[c] = v > hi[c] ? v : hi[c];
+                acc[c] += v * v;
+            }
+        }
+        float *out = s->stats + bin * channels * 3;
+        float scale = 1.0f / (float)count;
+        for (int c = 0; c < channels; ++c) {
+            out[3 * c] = lo[c];
+            out[3 * c + 1] = hi[c];
+            out[3 * c + 2] = acc[c] * scale;
+        }
+    }
+    free(row);
+}
+
+/* 由上一级 4 合 1；均方按各子 bin 的实际帧数加权（最后一个 bin 可能不满） */
+static int overview_reduce(const OverviewLevel *src, OverviewLevel *dst, int channels, long long frames) {
+    dst->frames_per_bin = src->frames_per_bin * OVERVIEW_FACTOR;
+    dst->bins = (src->bins + OVERVIEW_FACTOR - 1) / OVERVIEW_FACTOR;
+    dst->stats = (float *)malloc((size_t)(dst->bins * channels * 3) * sizeof(float));
+    if (!dst->stats) return 0;
+    for (long long bin = 0; bin < dst->bins; ++bin) {
+        float *out = dst->stats + bin * channels * 3;
+        long long child_end = (bin + 1) * OVERVIEW_FACTOR < src->bins ? (bin + 1) * OVERVIEW_FACTOR : src->bins;
+        long long parent_frames = 0;
+        for (int c = 0; c < channels; ++c) {
+            out[3 * c] = 1.0f;
+            out[3 * c + 1] = -1.0f;
+            out[3 * c + 2] = 0.0f;
+        }
+        for (long long child = bin * OVERVIEW_FACTOR; child < child_end; ++child) {
+            const float *in = src->stats + child * channels * 3;
+            long long first = child * src->frames_per_bin;
+            float weight = (float)(frames - first < src->frames_per_bin ? frames - first : src->frames_per_bin);
+            parent_frames += (long long)weight;
+            for (int c = 0; c < channels; ++c) {
+                out[3 * c] = in[3 * c] < out[3 * c] ? in[3 * c] : out[3 * c];
+                out[3 * c + 1] = in[3 * c + 1] > out[3 * c + 1] ? in[3 * c + 1] : out[3 * c + 1];
+                out[3 * c + 2] += in[3 * c + 2] * weight;
+            }
+        }
+        for (int c = 0; c < channels; ++c) out[3 * c + 2] /= (float)parent_frames;
+    }
+    return 1;
+}
+
+static int overview_quantize(float v) {
+    long q = (long)(v * 32767.0f + (v < 0.0f ? -0.5f : 0.5f));
+    if (q > 32767) q = 32767;
+    if (q < -32767) q = -32767;
+    return (int)q;
+}
+
+/* 指纹：格式参数加 data 块中均匀分布的 OVERVIEW_KEY_BLOCKS 个采样块，不含路径与修改时间 */
+static unsigned long long overview_input_key(const unsigned char *data, unsigned long long data_size, const WavLayout *wav) {
+    Xxh64State s;
+    char header[160];
+    xxh64_init(&s);
+    int len = snprintf(header, sizeof(header), "v%d|%u|%u|%lu|%u|%llu", OVERVIEW_VERSION, wav->format_tag, wav->channels,
+                       wav->sample_rate, wav->bits_per_sample, data_size);
+    xxh64_update(&s, header, (size_t)len);
+    if (data_size <= (unsigned long long)OVERVIEW_KEY_BLOCKS * OVERVIEW_KEY_BLOCK_BYTES) {
+        xxh64_update(&s, data, (size_t)data_size);
+    } else {
+        unsigned long long stride = (data_size - OVERVIEW_KEY_BLOCK_BYTES) / (OVERVIEW_KEY_BLOCKS - 1);
+        for (int i = 0; i < OVERVIEW_KEY_BLOCKS; ++i) xxh64_update(&s, data + stride * (unsigned long long)i, OVERVIEW_KEY_BLOCK_BYTES);
+    }
+    return xxh64_digest(&s);
+}
+
+/* 已有的 .wfp 与当前素材一致且各级数据完整时返回 1 */
+static int overview_sidecar_valid(const char *path, unsigned long long key, unsigned channels, long long frames) {
+    unsigned char header[OVERVIEW_HEADER];
+    unsigned char entry[16];
+    long long size = file_size_of(path);
+    int ok = 0;
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    if (fread(header, 1, sizeof(header), f) == sizeof(header) && memcmp(header, OVERVIEW_MAGIC, 8) == 0 &&
+        read_le32(header + 8) == OVERVIEW_VERSION && read_le32(header + 12) == channels &&
+        (long long)read_le64(header + 24) == frames && read_le64(header + 32) == key) {
+        unsigned long levels = read_le32(header + 20);
+        ok = levels > 0 && levels <= OVERVIEW_MAX_LEVELS;
+        for (unsigned long i = 0; ok && i < levels; ++i) {
+            if (fread(entry, 1, sizeof(entry), f) != sizeof(entry)) {
+                ok = 0;
+                break;
+            }
+            long long end = (long long)read_le64(entry + 8) + (long long)read_le32(entry + 4) * channels * 6;
+            if (end > size) ok = 0;
+        }
+    }
+    fclose(f);
+    return ok;
+}
+
+static int overview_write(const char *path, const OverviewLevel *levels, int level_count, const WavLayout *wav,
+                          long long frames, unsigned long long key) {
+    unsigned char header[OVERVIEW_HEADER];
+    unsigned char entry[16];
+    unsigned char buf[1 << 16];
+    int channels = (int)wav->channels;
+    FILE *f = fopen(path, "wb");
+    if (!f) return 0;
+    memset(header, 0, sizeof(header));
+    memcpy(header, OVERVIEW_MAGIC, 8);
+    put_le32(header + 8, OVERVIEW_VERSION);
+    put_le32(header + 12, wav->channels);
+    put_le32(header + 16, wav->sample_rate);
+    put_le32(header + 20, (unsigned long)level_count);
+    put_le64(header + 24, (unsigned long long)frames);
+    put_le64(header + 32, key);
+    int ok = fwrite(header, 1, sizeof(header), f) == sizeof(header);
+    unsigned long long offset = OVERVIEW_HEADER + 16ull * (unsigned long long)level_count;
+    for (int i = 0; ok && i < level_count; ++i) {
+        put_le32(entry, (unsigned long)levels[i].frames_per_bin);
+        put_le32(entry + 4, (unsigned long)levels[i].bins);
+        put_le64(entry + 8, offset);
+        ok = fwrite(entry, 1, sizeof(entry), f) == sizeof(entry);
+        offset += (unsigned long long)levels[i].bins * (unsigned long long)channels * 6;
+    }
+    for (int i = 0; ok && i < level_count; ++i) {
+        long long values = levels[i].bins * channels * 3;
+        size_t used = 0;
+        for (long long v = 0; ok && v < values; ++v) {
+            float x = levels[i].stats[v];
+            if (v % 3 == 2) x = (float)sqrt((double)x);
+            put_le16(buf + used, (unsigned)overview_quantize(x) & 0xFFFFu);
+            used += 2;
+            if (used == sizeof(buf) || v + 1 == values) {
+                ok = fwrite(buf, 1, used, f) == used;
+                used = 0;
+            }
+        }
+    }
+    if (ok) sync_file_to_disk(f);
+    if (fclose(f) != 0) ok = 0;
+    return ok;
+}
+
+/*
+ * 为 input 建立（或复用）波形概览，sidecar 返回 .wfp 路径。honor_cancel 为 1 时响应取消请求；
+ * 库接口与正在运行的编码任务共用取消标志，因此传 0。成功返回 0，取消返回 EXIT_CANCELLED，其余返回 1
+ */
+static int overview_build(const char *input, const char *cache_dir, int honor_cancel, char *sidecar, size_t sidecar_size) {
+    WavLayout wav;
+    FileMap map;
+    char name[64];
+    char temp_path[1100];
+    double started = monotonic_seconds();
+
+    if (!wav_probe(input, &wav) || !wav.data_offset || !wav.channels || !wav.block_align) {
+        fprintf(stderr, "波形概览: 无法识别的 WAV 文件: %s\n", input);
+        return 1;
+    }
+    int format = overview_sample_format(&wav);
+    if (!format || wav.block_align != wav.channels * (wav.bits_per_sample / 8)) {
+        fprintf(stderr, "波形概览: 不支持的采样格式（格式 %u，%u 位）: %s\n", wav.format_tag, wav.bits_per_sample, input);
+        return 1;
+    }
+    if (!file_map_open(&map, input)) {
+        fprintf(stderr, "波形概览: 无法映射文件: %s\n", input);
+        return 1;
+    }
+    /* 导出中途或被截断的文件按实际长度处理 */
+    unsigned long long data_size = wav.data_size;
+    if ((long long)(wav.data_offset + data_size) > map.size) data_size = (unsigned long long)(map.size - wav.data_offset);
+    long long frames = (long long)(data_size / wav.block_align);
+    if (frames <= 0) {
+        fprintf(stderr, "波形概览: 文件不含音频数据: %s\n", input);
+        file_map_close(&map);
+        return 1;
+    }
+    const unsigned char *data = map.data + wav.data_offset;
+    unsigned long long key = overview_input_key(data, data_size, &wav);
+    snprintf(name, sizeof(name), "%016llx.wfp", key);
+    ensure_directory_exists(cache_dir);
+    build_path(sidecar, sidecar_size, cache_dir, name);
+    if (overview_sidecar_valid(sidecar, key, wav.channels, frames)) {
+        printf("波形概览: 使用缓存 %s\n", sidecar);
+        file_map_close(&map);
+        return 0;
+    }
+
+    int channels = (int)wav.channels;
+    OverviewLevel levels[OVERVIEW_MAX_LEVELS];
+    int level_count = 1;
+    memset(levels, 0, sizeof(levels));
+    levels[0].frames_per_bin = OVERVIEW_BASE_FRAMES;
+    while ((frames + levels[0].frames_per_bin - 1) / levels[0].frames_per_bin * channels * 6 > OVERVIEW_LEVEL0_BUDGET) {
+        levels[0].frames_per_bin *= 2;
+    }
+    levels[0].bins = (frames + levels[0].frames_per_bin - 1) / levels[0].frames_per_bin;
+    levels[0].stats = (float *)malloc((size_t)(levels[0].bins * channels * 3) * sizeof(float));
+    if (!levels[0].stats) {
+        fprintf(stderr, "波形概览: 内存不足\n");
+        file_map_close(&map);
+        return 1;
+    }
+
+    int threads = qc_thread_budget();
+    if (threads <= 0) threads = cpu_count();
+    if (threads > OVERVIEW_MAX_THREADS) threads = OVERVIEW_MAX_THREADS;
+    while (threads > 1 && levels[0].bins / threads < OVERVIEW_MIN_BINS_PER_THREAD) threads--;
+    OverviewSlice slices[OVERVIEW_MAX_THREADS];
+    worker_thread_t handles[OVERVIEW_MAX_THREADS];
+    int started_threads[OVERVIEW_MAX_THREADS];
+    for (int i = 0; i < threads; ++i) {
+        memset(&slices[i], 0, sizeof(slices[i]));
+        slices[i].data = data;
+        slices[i].format = format;
+        slices[i].channels = channels;
+        slices[i].block_align = wav.block_align;
+        slices[i].frames = frames;
+        slices[i].frames_per_bin = levels[0].frames_per_bin;
+        slices[i].bin_begin = levels[0].bins * i / threads;
+        slices[i].bin_end = levels[0].bins * (i + 1) / threads;
+        slices[i].stats = levels[0].stats;
+        slices[i].honor_cancel = honor_cancel;
+        started_threads[i] = i > 0 && worker_start(&handles[i], overview_worker, &slices[i]);
+    }
+    overview_worker(&slices[0]);
+    int cancelled = 0;
+    int failed = 0;
+    for (int i = 0; i < threads; ++i) {
+        if (i > 0 && started_threads[i]) worker_join(handles[i]);
+        else if (i > 0) overview_worker(&slices[i]);
+        cancelled |= slices[i].cancelled;
+        failed |= slices[i].failed;
+    }
+    file_map_close(&map);
+
+    while (!cancelled && !failed && level_count < OVERVIEW_MAX_LEVELS && levels[level_count - 1].bins > OVERVIEW_TOP_BINS) {
+        if (!overview_reduce(&levels[level_count - 1], &levels[level_count], channels, frames)) {
+            failed = 1;
+            break;
+        }
+        level_count++;
+    }
+    int result = 0;
+    if (cancelled) {
+        fprintf(stderr, "波形概览: 已取消\n");
+        result = EXIT_CANCELLED;
+    } else if (failed) {
+        fprintf(stderr, "波形概览: 内存不足\n");
+        result = 1;
+    } else {
+        snprintf(temp_path, sizeof(temp_path), "%s.tmp", sidecar);
+        if (!overview_write(temp_path, levels, level_count, &wav, frames, key) || !atomic_replace(temp_path, sidecar, NULL)) {
+            fprintf(stderr, "波形概览: 无法写入 %s\n", sidecar);
+            remove_file_if_exists(temp_path);
+            result = 1;
+        } else {
+            printf("波形概览: %d 声道，%.1f 秒，%d 级（最细每 bin %lld 帧），%d 线程，用时 %.2f 秒 -> %s\n", channels,
+                   (double)frames / (wav.sample_rate ? wav.sample_rate : 1), level_count, levels[0].frames_per_bin, threads,
+                   monotonic_seconds() - started, sidecar);
+        }
+    }
+    for (int i = 0; i < level_count; ++i) free(levels[i].stats);
+    return result;
+}
+// --------- 波形概览结束 ---------
+
+// --------- 库接口（encode.h） ---------
+/* DEE_ROOT 下的固定布局：dee.exe、临时 XML、DolbyTemp 与三个模板 */
+typedef struct {
+    char base[512];
+    char temp_xml[1024];
+    char dee_exe[1024];
+    char temp_dir[1024];
+    char template_ec3[1024];
+    char template_m4a[1024];
+    char template_mlp[1024];
+} DeePaths;
+
+/* root 为空时依次取 DEE_ROOT 环境变量与默认路径 */
+static void resolve_dee_paths(const char *root, DeePaths *paths) {
+    const char *env_base = getenv("DEE_ROOT");
+    if (root && root[0]) {
+        copy_string(paths->base, sizeof(paths->base), root);
+    } else if (env_base && env_base[0]) {
+        copy_string(paths->base, sizeof(paths->base), env_base);
+    } else {
+        copy_string(paths->base, sizeof(paths->base), DEFAULT_DEE_ROOT);
+    }
+    normalize_slashes(paths->base);
+
+    build_path(paths->temp_xml, sizeof(paths->temp_xml), paths->base, "temp_job.xml");
+    build_path(paths->dee_exe, sizeof(paths->dee_exe), paths->base, "dee.exe");
+    build_path(paths->temp_dir, sizeof(paths->temp_dir), paths->base, "DolbyTemp");
+    build_path(paths->template_ec3, sizeof(paths->template_ec3), paths->base, "xml_templates\\encode_to_atmos_ddp\\atmos_mezz_encode_to_atmos_ddp_ec3.xml");
+    build_path(paths->template_m4a, sizeof(paths->template_m4a), paths->base, "xml_templates\\encode_to_atmos_ddp\\atmos_mezz_encode_to_atmos_ddp_mp4.xml");
+    build_path(paths->template_mlp, sizeof(paths->template_mlp), paths->base, "xml_templates\\encode_to_dthd\\atmos_mezz_encode_to_dthd_mlp.xml");
+}
+
+static void prepare_dee_dirs(const DeePaths *paths) {
+    ensure_parent_directory(paths->temp_xml);
+    ensure_directory_exists(paths->temp_dir);
+}
+
+static const char *default_output_for_choice(int choice) {
+    switch (choice) {
+        case 2: return "D:\\atmos.m4a";
+        case 3: return "D:\\atmos.mlp";
+        case 4: return "D:\\atmos_bluray.m4a";
+        case 5: return "D:\\atmos_bluray_atmos.m4a";
+        default: return "D:\\atmos.ec3";
+    }
+}
+
+/*
+ * 由任务描述构建单个任务：按 choice 选模板、补齐输出扩展名，Blu-ray 流程（4/5）的 dee 先产出同名 .mlp。
+ * 命令行与库调用共用这一份规则。choice 无效返回 0。
+ */
+static int job_from_desc(const DeeJobDesc *desc, const DeePaths *paths, EncodeJob *job) {
+    int choice = desc->choice;
+    if (choice < 1 || choice > 5) return 0;
+    memset(job, 0, sizeof(*job));
+    job->choice = choice;
+    copy_string(job->start, sizeof(job->start), desc->start ? desc->start : "");
+    copy_string(job->end, sizeof(job->end), desc->end ? desc->end : "");
+    copy_string(job->prepend_silence, sizeof(job->prepend_silence), desc->prepend_silence ? desc->prepend_silence : "");
+    copy_string(job->append_silence, sizeof(job->append_silence), desc->append_silence ? desc->append_silence : "");
+    copy_string(job->input_file, sizeof(job->input_file), desc->input_file && desc->input_file[0] ? desc->input_file : "D:\\ADM.wav");
+    copy_string(job->output_file, sizeof(job->output_file),
+                desc->output_file && desc->output_file[0] ? desc->output_file : default_output_for_choice(choice));
+    ensure_extension(job->output_file, sizeof(job->output_file),
+                     choice == 1 ? ".ec3" : choice == 3 ? ".mlp" : ".m4a");
+    copy_string(job->final_output_path, sizeof(job->final_output_path), job->output_file);
+
+    if (desc->template_xml && desc->template_xml[0]) {
+        copy_string(job->template_xml, sizeof(job->template_xml), desc->template_xml);
+    } else {
+        copy_string(job->template_xml, sizeof(job->template_xml),
+                    choice == 1 ? paths->template_ec3 : choice == 2 ? paths->template_m4a : paths->template_mlp);
+    }
+    copy_string(job->dee_exe_path, sizeof(job->dee_exe_path), paths->dee_exe);
+    copy_string(job->temp_xml_path, sizeof(job->temp_xml_path), paths->temp_xml);
+    copy_string(job->temp_dir_path, sizeof(job->temp_dir_path), paths->temp_dir);
+    copy_string(job->bitrate, sizeof(job->bitrate), desc->bitrate ? desc->bitrate : "");
+    copy_string(job->xml_overrides, sizeof(job->xml_overrides), desc->xml_overrides ? desc->xml_overrides : "");
+    job->queue_level = desc->queue_priority > QUEUE_UNSET && desc->queue_priority < QUEUE_LEVEL_COUNT
+                           ? desc->queue_priority : QUEUE_NORMAL;
+    if (choice == 4 || choice == 5) {
+        replace_extension(job->final_output_path, job->intermediate_mlp_path, sizeof(job->intermediate_mlp_path), ".mlp");
+        copy_string(job->dee_output_target, sizeof(job->dee_output_target), job->intermediate_mlp_path);
+    } else {
+        copy_string(job->dee_output_target, sizeof(job->dee_output_target), job->output_file);
+    }
+
+    if (desc->formats) {
+        /* 多格式输出：各格式与输出同名，仅扩展名不同 */
+        job->formats = desc->formats;
+        replace_extension(job->output_file, job->ec3_output, sizeof(job->ec3_output), ".ec3");
+        replace_extension(job->output_file, job->m4a_output, sizeof(job->m4a_output), ".m4a");
+        replace_extension(job->output_file, job->mlp_output, sizeof(job->mlp_output), ".mlp");
+        copy_string(job->template_ec3, sizeof(job->template_ec3), paths->template_ec3);
+        copy_string(job->template_m4a, sizeof(job->template_m4a), paths->template_m4a);
+        copy_string(job->template_mlp, sizeof(job->template_mlp), paths->template_mlp);
+    }
+    return job_xml_overrides_valid(job);
+}
+
+/* 先保存本次参数以便下次重复（放在执行前，避免执行过程中意外退出导致丢失） */
+static void remember_job_params(const char *state_file, const EncodeJob *job) {
+    LastParams cur;
+    memset(&cur, 0, sizeof(cur));
+    cur.choice = job->choice;
+    copy_string(cur.start, sizeof(cur.start), job->start);
+    copy_string(cur.end, sizeof(cur.end), job->end);
+    copy_string(cur.prepend_silence, sizeof(cur.prepend_silence), job->prepend_silence);
+    copy_string(cur.append_silence, sizeof(cur.append_silence), job->append_silence);
+    copy_string(cur.template_xml, sizeof(cur.template_xml), job->template_xml);
+    copy_string(cur.output_file, sizeof(cur.output_file), job->output_file);
+    copy_string(cur.input_file, sizeof(cur.input_file), job->input_file);
+    cur.valid = 1;
+    save_last_params(state_file, &cur);
+}
+
+#ifdef _WIN32
+static volatile LONG g_library_busy = 0;
+#define library_try_enter() (InterlockedCompareExchange(&g_library_busy, 1, 0) == 0)
+#define library_leave() InterlockedExchange(&g_library_busy, 0)
+#else
+static volatile int g_library_busy = 0;
+#define library_try_enter() __sync_bool_compare_and_swap(&g_library_busy, 0, 1)
+#define library_leave() __sync_lock_release(&g_library_busy)
+#endif
+/* dee_job_accept 已为下一个 dee_job_run 清除取消标志：排队期间到达的 dee_job_cancel 不会被 dee_job_run 抹掉 */
+static volatile int g_job_accepted = 0;
+
+/*
+ * 进入库调用：首次调用时初始化选项与子进程管理（不安装信号处理、不监听 stdin，它们属于宿主进程），
+ * 之后每次按 state_dir 定位任务历史。
+ */
+static void library_prepare(const DeeJobDesc *desc, DeePaths *paths) {
+    static int initialized = 0;
+    if (!initialized) {
+        init_cli_options(&g_cli);
+        cancel_state_init();
+        initialized = 1;
+    }
+    if (desc->state_dir && desc->state_dir[0]) {
+        build_path(g_history_path, sizeof(g_history_path), desc->state_dir, HISTORY_FILE);
+    } else {
+        copy_string(g_history_path, sizeof(g_history_path), HISTORY_FILE);
+    }
+    resolve_dee_paths(desc->dee_root, paths);
+}
+
+const char *dee_stage_name(int stage) {
+    return stage >= 0 && stage < STAGE_COUNT ? stage_names[stage] : "";
+}
+
+int dee_job_plan(const DeeJobDesc *desc, DeeJobPlan *plan) {
+    static EncodeJob job;
+    DeePaths paths;
+    EtaEstimate eta;
+    if (!desc || !plan) return DEE_ERROR_INVALID;
+    if (!library_try_enter()) return DEE_ERROR_BUSY;
+    memset(plan, 0, sizeof(*plan));
+    library_prepare(desc, &paths);
+    if (!job_from_desc(desc, &paths, &job)) {
+        library_leave();
+        return DEE_ERROR_INVALID;
+    }
+    int stages[DEE_STAGE_COUNT];
+    int count = 0;
+    if (job.formats) {
+        if (job.formats & (OUTPUT_FORMAT_EC3 | OUTPUT_FORMAT_M4A)) stages[count++] = STAGE_DEE;
+        if (job.formats & OUTPUT_FORMAT_MLP) stages[count++] = STAGE_DEE_MLP;
+        if ((job.formats & OUTPUT_FORMAT_EC3) && (job.formats & OUTPUT_FORMAT_M4A)) stages[count++] = STAGE_REMUX;
+    } else {
+        stages[count++] = STAGE_DEE;
+        if (job.choice == 4 || job.choice == 5) {
+            stages[count++] = post_stage_of(&job);
+            stages[count++] = STAGE_REMUX;
+        }
+    }
+    plan->stage_count = count;
+    for (int i = 0; i < count; ++i) copy_string(plan->stages[i], sizeof(plan->stages[i]), stage_names[stages[i]]);
+    copy_string(plan->final_output, sizeof(plan->final_output), job.final_output_path);
+    copy_string(plan->dee_output, sizeof(plan->dee_output), job.dee_output_target);
+    copy_string(plan->template_xml, sizeof(plan->template_xml), job.template_xml);
+    if (predict_job_eta(&job, &eta)) {
+        memcpy(plan->eta_seconds, eta.seconds, sizeof(plan->eta_seconds));
+        plan->eta_total = eta.total;
+        plan->eta_samples = eta.samples;
+    }
+    library_leave();
+    return 0;
+}
+
+void dee_job_accept(void) {
+    g_cancel_requested = 0;
+    g_job_accepted = 1;
+}
+
+int dee_job_run(const DeeJobDesc *desc, DeeEventCallback callback, void *user_data, DeeJobResult *result) {
+    static EncodeJob job;
+    DeePaths paths;
+    int accepted = g_job_accepted;
+    g_job_accepted = 0;
+    if (result) memset(result, 0, sizeof(*result));
+    if (!desc) return DEE_ERROR_INVALID;
+    if (!library_try_enter()) return DEE_ERROR_BUSY;
+    library_prepare(desc, &paths);
+    if (!job_from_desc(desc, &paths, &job)) {
+        library_leave();
+        return DEE_ERROR_INVALID;
+    }
+    prepare_dee_dirs(&paths);
+    if (desc->state_dir && desc->state_dir[0]) {
+        char state_file[1024];
+        build_path(state_file, sizeof(state_file), desc->state_dir, "last_params.txt");
+        remember_job_params(state_file, &job);
+    }
+
+    /* 上一个任务的取消标志与拆除状态不能带到这一个；已由 dee_job_accept 清除的，之后到达的取消请求要保留 */
+    if (!accepted) g_cancel_requested = 0;
+    g_teardown_started = 0;
+    g_teardown_done = 0;
+    g_event_callback = callback;
+    g_event_user = user_data;
+    double started = monotonic_seconds();
+    place_job_on_scratch(&job);
+    cpu_slot_acquire(paths.temp_dir);
+    queue_open(paths.temp_dir);
+    space_gc_start(paths.temp_dir);
+    int exit_code = run_encode_job(&job);
+    space_gc_stop();
+    queue_close();
+    cpu_slot_release();
+    relay_reset();
+    g_event_callback = NULL;
+    g_event_user = NULL;
+
+    if (result) {
+        result->exit_code = exit_code;
+        result->cancelled = exit_code == EXIT_CANCELLED;
+        copy_string(result->final_output, sizeof(result->final_output), job.final_output_path);
+        result->seconds = monotonic_seconds() - started;
+        memcpy(result->stage_seconds, job.stage_seconds, sizeof(result->stage_seconds));
+        result->qc_seconds = job.qc_seconds;
+    }
+    library_leave();
+    return exit_code;
+}
+
+void dee_job_cancel(void) {
+    g_cancel_requested = 1;
+}
+
+int dee_overview_build(const char *input_file, const char *dee_root, char *sidecar, size_t sidecar_size) {
+    DeePaths paths;
+    char cache_dir[1024];
+    if (!input_file || !input_file[0] || !sidecar || sidecar_size == 0) return DEE_ERROR_INVALID;
+    sidecar[0] = '\0';
+    resolve_dee_paths(dee_root, &paths);
+    build_path(cache_dir, sizeof(cache_dir), paths.temp_dir, "overview");
+    return overview_build(input_file, cache_dir, 0, sidecar, sidecar_size);
+}
+// --------- 库接口结束 ---------
+
+#ifndef DEE_LIBRARY
+
+int main(int argc, char *argv[])
+{
+    system("chcp 65001 > nul"); // 设置控制台UTF-8
+
+    int choice;
+    char start[64], end[64], prepend_silence[64], append_silence[64]; 
+    char output_file_buf[512]; // 用于存储 output_file，因为其需要被修改
+    char input_file_buf[512]; // 用于存储 input_file
+    DeePaths paths;
+    int interactive_mode = 1;
+    const char *template_xml = NULL;
+    const char *state_file = "last_params.txt";
+    LastParams last_params;
+    char *positional_args[16];
+
+    init_cli_options(&g_cli);
+    argc = parse_cli_options(argc, argv, &g_cli, positional_args, (int)(sizeof(positional_args) / sizeof(positional_args[0])));
+    argv = positional_args;
+
+    if (g_cli.replay_file[0]) {
+        /* 回放模式：按记录重放子进程输出，供 GUI 与进度解析的压测，不需要 dee */
+        return run_replay(g_cli.replay_file, g_cli.replay_speed, g_cli.replay_jobs);
+    }
+    if (g_cli.record_file[0]) trace_open(g_cli.record_file);
+
+    if (g_cli.make_adm[0]) {
+        /* 测试素材模式：只生成合成的 ADM BWF */
+        install_cancel_handlers(0);
+        return make_adm_fixture(g_cli.make_adm, g_cli.adm_spec);
+    }
+
+    if (g_cli.wrap_adm[0]) {
+        /* ADM 封装模式：普通多声道 WAV 床 → BW64 ADM，床格式默认按声道数，--adm-spec beds= 可指定 */
+        char target[1024];
+        char beds[16] = "";
+        const char *beds_field = strstr(g_cli.adm_spec, "beds=");
+        if (beds_field) {
+            AdmSpec spec;
+            adm_spec_parse(g_cli.adm_spec, &spec);
+            copy_string(beds, sizeof(beds), spec.beds);
+        }
+        if (g_cli.wrap_output[0]) {
+            copy_string(target, sizeof(target), g_cli.wrap_output);
+        } else {
+            char stem[1000];
+            replace_extension(g_cli.wrap_adm, stem, sizeof(stem), "");
+            snprintf(target, sizeof(target), "%s_adm.wav", stem);
+        }
+        install_cancel_handlers(0);
+        int code = adm_wrap_file(g_cli.wrap_adm, target, beds, 0);
+        return code == 2 ? 1 : code;
+    }
+
+    if (g_cli.package_file[0]) {
+        /* 独立封装模式：把已有的 E-AC-3 基本流封装为同名 .m4a（CMAF），按 --expect 校验结果 */
+        char target[1024];
+        CmafOptions options;
+        options.fragment_seconds = g_cli.fragment_seconds;
+        options.manifests = g_cli.stream_manifests;
+        replace_extension(g_cli.package_file, target, sizeof(target), ".m4a");
+        install_cancel_handlers(0);
+        if (cmaf_package_file(g_cli.package_file, target, &options) != 0) return cancel_requested() ? EXIT_CANCELLED : 1;
+        if (!g_cli.verify_enabled) return 0;
+        QcExpect expect;
+        qc_expectations_for_choice(g_cli.verify_choice, &expect);
+        return verify_output_file(target, &expect, g_cli.qc_report, qc_thread_budget());
+    }
+
+    if (g_cli.verify_file[0]) {
+        /* 独立校验模式：只检查已有文件，不调用 dee */
+        QcExpect expect;
+        qc_expectations_for_choice(g_cli.verify_choice, &expect);
+        return verify_output_file(g_cli.verify_file, &expect, g_cli.qc_report, qc_thread_budget());
+    }
+
+    resolve_dee_paths(NULL, &paths);
+    printf("使用 Dolby Encoding Engine 路径: %s\n", paths.base);
+    prepare_dee_dirs(&paths);
+
+    if (g_cli.overview_file[0]) {
+        /* 波形概览模式：最后一行 “Overview: 路径” 供 GUI 读取缓存文件 */
+        char cache_dir[1024];
+        char sidecar[1100];
+        build_path(cache_dir, sizeof(cache_dir), paths.temp_dir, "overview");
+        install_cancel_handlers(1);
+        int code = overview_build(g_cli.overview_file, cache_dir, 1, sidecar, sizeof(sidecar));
+        if (code == 0) printf("Overview: %s\n", sidecar);
+        return code;
+    }
+
+    if (g_cli.temp_report || g_cli.temp_collect) {
+        /* 空间报告模式：--gc 先回收孤儿与过期备份，超出 --temp-quota 时再淘汰缓存 */
+        SpaceReport report;
+        install_cancel_handlers(0);
+        space_collect(paths.temp_dir, g_cli.temp_collect, g_cli.temp_quota > 0 ? g_cli.temp_quota : -1, NULL, &report);
+        space_print_report(&report);
+        return 0;
+    }
+
+    if (g_cli.batch_file[0] || g_cli.sweep_file[0] || g_cli.watch_file[0] || g_cli.calibrate || g_cli.edit_file[0]) {
+        /* 批量/参数扫描/监视/校准/码流编辑模式：任务来自文件，不读位置参数，也不改写 last_params */
+        static EncodeJob batch_base;
+        memset(&batch_base, 0, sizeof(batch_base));
+        /* 参数扫描用 choice 维度区分格式，不叠加 --formats */
+        batch_base.formats = g_cli.sweep_file[0] || g_cli.calibrate ? 0 : g_cli.formats;
+        copy_string(batch_base.bitrate, sizeof(batch_base.bitrate), g_cli.bitrate);
+        batch_base.queue_level = g_cli.queue_level;
+        copy_string(batch_base.xml_overrides, sizeof(batch_base.xml_overrides), g_cli.xml_overrides);
+        copy_string(batch_base.dee_exe_path, sizeof(batch_base.dee_exe_path), paths.dee_exe);
+        copy_string(batch_base.temp_xml_path, sizeof(batch_base.temp_xml_path), paths.temp_xml);
+        copy_string(batch_base.temp_dir_path, sizeof(batch_base.temp_dir_path), paths.temp_dir);
+        copy_string(batch_base.template_ec3, sizeof(batch_base.template_ec3), paths.template_ec3);
+        copy_string(batch_base.template_m4a, sizeof(batch_base.template_m4a), paths.template_m4a);
+        copy_string(batch_base.template_mlp, sizeof(batch_base.template_mlp), paths.template_mlp);
+        install_cancel_handlers(1);
+        cpu_slot_acquire(paths.temp_dir);
+        queue_open(paths.temp_dir);
+        space_gc_start(paths.temp_dir);
+        if (g_cli.calibrate) return run_calibration(&batch_base);
+        if (g_cli.edit_file[0]) return run_edit(&batch_base);
+        calibration_apply(paths.temp_dir);
+        if (g_cli.watch_file[0]) return run_watch(&batch_base);
+        return g_cli.sweep_file[0] ? run_sweep(&batch_base) : run_batch(&batch_base);
+    }
+    load_last_params(state_file, &last_params);
+
+    // 初始化所有参数为空字符串，以便于后续逻辑判断
+    start[0] = end[0] = prepend_silence[0] = append_silence[0] = output_file_buf[0] = input_file_buf[0] = '\0';
+    choice = 0;
+
+    if (argc > 1) {
+        interactive_mode = 0;
+        // 从命令行参数解析；输出、输入为空时由 job_from_desc 使用默认值
+        choice = atoi(argv[1]);
+        if (argc > 2 && strlen(argv[2]) > 0) copy_string(start, sizeof(start), argv[2]);
+        if (argc > 3 && strlen(argv[3]) > 0) copy_string(end, sizeof(end), argv[3]);
+        if (argc > 4 && strlen(argv[4]) > 0) copy_string(prepend_silence, sizeof(prepend_silence), argv[4]);
+        if (argc > 5 && strlen(argv[5]) > 0) copy_string(append_silence, sizeof(append_silence), argv[5]);
+        if (argc > 6 && strlen(argv[6]) > 0) copy_string(output_file_buf, sizeof(output_file_buf), argv[6]);
+        if (argc > 7 && strlen(argv[7]) > 0) copy_string(input_file_buf, sizeof(input_file_buf), argv[7]);
+
+        printf("DEBUG: Parsed CLI args -> choice=%d, start='%s', end='%s', prepend='%s', append='%s', output='%s', input='%s'\n",
+               choice, start, end, prepend_silence, append_silence, output_file_buf, input_file_buf);
+
+        // 跳过交互式菜单，直接进入编码流程
+        goto encode_process;
+
+    } else {
+        // 没有命令行参数，显示交互式菜单
+    while (1)
+    {
+        printf("\n=============================\n");
+        printf("  Dolby Encoding Engine 工具\n");
+        printf("=============================\n");
+        printf("1. ADM BWF 编码为 atmos.ec3\n");
+        printf("2. ADM BWF 编码为 atmos.m4a\n");
+        printf("3. ADM BWF 编码为 atmos.mlp\n");
+        printf("4. ADM BWF 编码为 7.1ch Dolby Digital Plus (Blu-ray)\n");
+        printf("5. ADM BWF 编码为 Dolby Atmos M4A 7.1 (Blu-ray)\n");
+        printf("6. 重复上一次操作\n");
+        printf("0. 退出程序\n");
+        printf("请输入选项: ");
+
+        if (scanf("%d", &choice) != 1) {
+            printf("输入无效，请输入数字！\n");
+            while (getchar() != '\n'); 
+            continue;
+        }
+        while (getchar() != '\n'); // 清空缓冲
+
+        if (choice == 0) {
+            printf("退出程序。\n");
+            break;
+        }
+
+        /* 如果选择 4：直接使用上次保存的参数并跳过交互 */
+        if (choice == 6) {
+            if (!last_params.valid) {
+                printf("没有可用的上一次操作记录，无法重复。\n");
+                continue;
+            }
+            /* 从上次记录拷贝参数 */
+            copy_string(start, sizeof(start), last_params.start);
+            copy_string(end, sizeof(end), last_params.end);
+            copy_string(prepend_silence, sizeof(prepend_silence), last_params.prepend_silence);
+            copy_string(append_silence, sizeof(append_silence), last_params.append_silence);
+            /* 使用上次保存的类型（如果有）作为本次的具体格式 */
+            choice = last_params.choice ? last_params.choice : 1;
+            copy_string(output_file_buf, sizeof(output_file_buf), last_params.output_file);
+            copy_string(input_file_buf, sizeof(input_file_buf), last_params.input_file);
+            template_xml = last_params.template_xml[0] ? last_params.template_xml : NULL;
+            printf("使用上一次参数：choice=%d, start='%s', end='%s', prepend='%s', append='%s', out='%s'\n", choice, start, end, prepend_silence, append_silence,
+                   output_file_buf[0] ? output_file_buf : default_output_for_choice(choice));
+        } else {
+            /* 普通选项 1、2、3 或 4：交互式输入（回车表示空，保留模板默认） */
+            if (choice < 1 || choice > 5) {
+                printf("无效选项，请重新输入。\n");
+                continue;
+            }
+            printf("请输入起始时间 (HH:MM:SS:FF / HH:MM:SS.xx，直接回车默认): ");
+            if (fgets(start, sizeof(start), stdin)) trim_newline(start);
+
+            printf("请输入结束时间 (HH:MM:SS:FF / HH:MM:SS.xx，直接回车默认): ");
+            if (fgets(end, sizeof(end), stdin)) trim_newline(end);
+
+            printf("请输入开头空白时长 (秒，如10.0，直接回车默认0.0): ");
+            if (fgets(prepend_silence, sizeof(prepend_silence), stdin)) trim_newline(prepend_silence);
+
+            printf("请输入结尾空白时长 (秒，如5.0，直接回车默认0.0): ");
+            if (fgets(append_silence, sizeof(append_silence), stdin)) trim_newline(append_silence);
+
+            // 交互模式下输出与输入使用默认路径
+            output_file_buf[0] = '\0';
+            input_file_buf[0] = '\0';
+            template_xml = NULL;
+        }
+
+            goto encode_process; // 完成交互后跳转到编码流程
+        }
+    }
+
+encode_process:
+    {
+        DeeJobDesc desc;
+        memset(&desc, 0, sizeof(desc));
+        desc.choice = choice;
+        desc.start = start;
+        desc.end = end;
+        desc.prepend_silence = prepend_silence;
+        desc.append_silence = append_silence;
+        desc.output_file = output_file_buf;
+        desc.input_file = input_file_buf;
+        desc.bitrate = g_cli.bitrate;
+        desc.template_xml = template_xml;
+        desc.formats = g_cli.formats;
+        desc.queue_priority = g_cli.queue_level;
+        desc.xml_overrides = g_cli.xml_overrides;
+
+        static EncodeJob job;
+        if (!job_from_desc(&desc, &paths, &job)) {
+            fprintf(stderr, "错误: 无效的任务参数（编码选项 %d）。\n", choice);
+            if (interactive_mode) system("pause");
+            return 1;
+        }
+        if (!g_cli.eta_only) remember_job_params(state_file, &job);
+
+        if (g_cli.eta_only) {
+            print_job_eta(&job);
+            return 0;
+        }
+
+        place_job_on_scratch(&job);
+
+        /* GUI 通过 stdin 发送 “cancel”；交互模式下 stdin 属于菜单，只响应 Ctrl+C */
+        install_cancel_handlers(!interactive_mode);
+        cpu_slot_acquire(paths.temp_dir);
+        queue_open(paths.temp_dir);
+        space_gc_start(paths.temp_dir);
+        int exit_code = g_cli.ranges_file[0] ? run_ranges(&job) : run_encode_job(&job);
+        space_gc_stop();
+        queue_close();
+
+        if (interactive_mode) system("pause");
+        return exit_code;
+    }
+}
+#endif
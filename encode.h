@@ -0,0 +1,115 @@
+/*
+ * Dolby 编码流水线的 C 接口。encode.c 定义 DEE_LIBRARY 编译时不含 main()，供 Node 扩展（native/）在进程内调用；
+ * 命令行版本的 encode.exe 与扩展走同一套任务构建与执行代码。
+ *
+ * 流水线使用进程级的全局状态（调度配置、子进程登记、取消标志），同一时刻只能运行一个任务：
+ * dee_job_run 在已有任务运行时直接返回 DEE_ERROR_BUSY。事件回调在执行任务的线程或子进程输出转发线程中调用。
+ */
+#ifndef DOLBY_ENCODE_H
+#define DOLBY_ENCODE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* 阶段顺序与 dee_stage_name 一致 */
+#define DEE_STAGE_COUNT 5
+
+#define DEE_FORMAT_EC3 0x1u
+#define DEE_FORMAT_M4A 0x2u
+#define DEE_FORMAT_MLP 0x4u
+
+/* 队列优先级：urgent 任务运行时，本进程与其他 encode 进程中较低优先级的子进程被暂停（见 --queue-priority） */
+#define DEE_QUEUE_BACKGROUND 1
+#define DEE_QUEUE_NORMAL 2
+#define DEE_QUEUE_URGENT 3
+
+/* dee_job_run 的返回值：0 成功；130 取消（与命令行退出码一致）；其余为失败 */
+#define DEE_EXIT_CANCELLED 130
+#define DEE_ERROR_INVALID (-1)
+#define DEE_ERROR_BUSY (-2)
+
+typedef struct {
+    int choice;                   /* 1 ec3，2 m4a，3 mlp，4 7.1ch DDP (Blu-ray)，5 Atmos M4A 7.1 (Blu-ray) */
+    const char *start;            /* 以下字符串均可为 NULL，表示留空、保留模板默认值 */
+    const char *end;
+    const char *prepend_silence;
+    const char *append_silence;
+    const char *input_file;
+    const char *output_file;      /* 扩展名按 choice 补齐 */
+    const char *bitrate;          /* DDP 码率（kbps） */
+    const char *template_xml;     /* 覆盖按 choice 选择的模板 */
+    unsigned formats;             /* DEE_FORMAT_* 组合，非 0 时一次产出多种格式 */
+    const char *dee_root;         /* Dolby Encoding Engine 目录，NULL 时取 DEE_ROOT 环境变量或默认路径 */
+    const char *state_dir;        /* last_params.txt 与 job_history.log 所在目录，NULL 时为当前目录 */
+    int queue_priority;           /* DEE_QUEUE_*，0 按 normal */
+    const char *xml_overrides;    /* 任务 XML 覆盖：“路径=值” 以 ; 分隔（路径写法见 encode.c 的任务 XML 覆盖一节），按模板结构校验 */
+} DeeJobDesc;
+
+typedef struct {
+    int stage_count;
+    char stages[DEE_STAGE_COUNT][16];  /* 依次运行的阶段名 */
+    char final_output[512];
+    char dee_output[512];              /* dee 的直接产物（Blu-ray 流程为中间 MLP） */
+    char template_xml[1024];
+    double eta_seconds[DEE_STAGE_COUNT + 1];  /* 按任务历史预估的各阶段耗时，最后一项为 QC */
+    double eta_total;                  /* 无历史记录时为 0 */
+    int eta_samples;
+} DeeJobPlan;
+
+typedef enum {
+    DEE_EVENT_LOG = 0,     /* text：子进程输出或本库自身提示（QC 结论、发布、警告等）的一行 */
+    DEE_EVENT_PROGRESS,    /* value：dee 总进度 0-100 */
+    DEE_EVENT_STAGE,       /* text：开始的阶段名 */
+    DEE_EVENT_ETA          /* value：预计总耗时（秒）；stage_seconds：与 DeeJobPlan.eta_seconds 相同 */
+} DeeEventType;
+
+typedef struct {
+    DeeEventType type;
+    const char *text;
+    double value;
+    const double *stage_seconds;
+} DeeEvent;
+
+typedef void (*DeeEventCallback)(const DeeEvent *event, void *user_data);
+
+typedef struct {
+    int exit_code;
+    int cancelled;
+    char final_output[512];
+    double seconds;                          /* 任务总耗时 */
+    double stage_seconds[DEE_STAGE_COUNT];   /* 各阶段实际耗时 */
+    double qc_seconds;
+} DeeJobResult;
+
+/* 校验参数并给出执行计划，不启动任何进程。参数有效返回 0 */
+int dee_job_plan(const DeeJobDesc *desc, DeeJobPlan *plan);
+
+/*
+ * 在接受任务的线程上、把 dee_job_run 排进工作线程之前调用：清除上一个任务留下的取消请求。
+ * 之后到达的 dee_job_cancel 即使早于 dee_job_run 真正开始，也会让该任务立即以取消结束。
+ * 不调用时 dee_job_run 开始时自行清除（排队期间的取消会丢失）。
+ */
+void dee_job_accept(void);
+
+/* 同步执行一个任务，结束后填写 result（可为 NULL）；callback 可为 NULL */
+int dee_job_run(const DeeJobDesc *desc, DeeEventCallback callback, void *user_data, DeeJobResult *result);
+
+/* 请求取消正在运行的任务，可从任意线程调用；子进程树的拆除与中间文件清理由 dee_job_run 完成 */
+void dee_job_cancel(void);
+
+const char *dee_stage_name(int stage);
+
+/*
+ * 为 WAV 建立或复用波形概览（DolbyTemp 下 overview\<指纹>.wfp，格式见 encode.c 的波形概览一节），
+ * sidecar 返回缓存文件路径。不占用任务锁，编码期间也可调用。成功返回 0
+ */
+int dee_overview_build(const char *input_file, const char *dee_root, char *sidecar, size_t sidecar_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,387 @@
+/*
+ * Node 扩展：在 Electron 主进程内直接调用 encode.h，取代启动 encode.exe 并解析其输出。
+ * dee_job_run 是同步的，在 libuv 线程池中执行；事件经线程安全函数回到 JS 线程。
+ *
+ *   planJob(desc)            -> { stages, finalOutput, deeOutput, templateXml, eta }
+ *   runJob(desc, onEvent)    -> Promise<{ exitCode, cancelled, finalOutput, seconds, stageSeconds, qcSeconds }>
+ *   cancelJob()
+ *   buildOverview(input, deeRoot) -> Promise<string>  波形概览缓存文件（.wfp）的路径，可与编码任务同时进行
+ *
+ * desc 字段：choice、start、end、prependSilence、appendSilence、input、output、bitrate、templateXml、
+ * formats（DEE_FORMAT_* 位组合）、deeRoot、stateDir、queuePriority（DEE_QUEUE_*：1 background、2 normal、3 urgent）、
+ * xmlOverrides（“路径=值” 以 ; 分隔的任务 XML 覆盖）。
+ * onEvent 收到 { type: 'log'|'progress'|'stage'|'eta', ... }。
+ */
+#define NAPI_VERSION 4
+#include <node_api.h>
+#include <stdlib.h>
+#include <string.h>
+#include "encode.h"
+
+typedef struct {
+    char start[64];
+    char end[64];
+    char prepend_silence[64];
+    char append_silence[64];
+    char input[1024];
+    char output[1024];
+    char bitrate[16];
+    char template_xml[1024];
+    char dee_root[1024];
+    char state_dir[1024];
+    char xml_overrides[1024];
+    DeeJobDesc desc;
+} JobArgs;
+
+typedef struct {
+    JobArgs args;
+    DeeJobResult result;
+    int exit_code;
+    napi_async_work work;
+    napi_deferred deferred;
+    napi_threadsafe_function on_event;
+} RunRequest;
+
+typedef struct {
+    DeeEventType type;
+    char *text;
+    double value;
+    int has_stages;
+    double stage_seconds[DEE_STAGE_COUNT + 1];
+} EventCopy;
+
+typedef struct {
+    char input[1024];
+    char dee_root[1024];
+    char sidecar[1100];
+    int exit_code;
+    napi_async_work work;
+    napi_deferred deferred;
+} OverviewRequest;
+
+static int g_job_running = 0;
+
+#define CHECK(call)                                        \
+    do {                                                   \
+        if ((call) != napi_ok) return NULL;                \
+    } while (0)
+
+/* 读取可选的字符串属性；不存在或为 undefined/null 时返回 0，buf 置空 */
+static int get_string(napi_env env, napi_value obj, const char *name, char *buf, size_t size) {
+    napi_value value;
+    napi_valuetype type;
+    size_t len = 0;
+    buf[0] = '\0';
+    if (napi_get_named_property(env, obj, name, &value) != napi_ok) return 0;
+    if (napi_typeof(env, value, &type) != napi_ok || type == napi_undefined || type == napi_null) return 0;
+    if (type != napi_string) {
+        napi_value coerced;
+        if (napi_coerce_to_string(env, value, &coerced) != napi_ok) return 0;
+        value = coerced;
+    }
+    return napi_get_value_string_utf8(env, value, buf, size, &len) == napi_ok;
+}
+
+static int get_int(napi_env env, napi_value obj, const char *name, int fallback) {
+    napi_value value;
+    napi_valuetype type;
+    int32_t result = fallback;
+    if (napi_get_named_property(env, obj, name, &value) != napi_ok) return fallback;
+    if (napi_typeof(env, value, &type) != napi_ok || type == napi_undefined || type == napi_null) return fallback;
+    if (type != napi_number) {
+        napi_value coerced;
+        if (napi_coerce_to_number(env, value, &coerced) != napi_ok) return fallback;
+        value = coerced;
+    }
+    napi_get_value_int32(env, value, &result);
+    return result;
+}
+
+/* 把 JS 对象转成 DeeJobDesc；字符串都复制到 args 内，供工作线程使用 */
+static int read_job_args(napi_env env, napi_value obj, JobArgs *args) {
+    napi_valuetype type;
+    memset(args, 0, sizeof(*args));
+    if (napi_typeof(env, obj, &type) != napi_ok || type != napi_object) {
+        napi_throw_type_error(env, NULL, "任务描述必须是对象");
+        return 0;
+    }
+    args->desc.choice = get_int(env, obj, "choice", 0);
+    args->desc.formats = (unsigned)get_int(env, obj, "formats", 0);
+    args->desc.queue_priority = get_int(env, obj, "queuePriority", 0);
+    args->desc.start = get_string(env, obj, "start", args->start, sizeof(args->start)) ? args->start : NULL;
+    args->desc.end = get_string(env, obj, "end", args->end, sizeof(args->end)) ? args->end : NULL;
+    args->desc.prepend_silence = get_string(env, obj, "prependSilence", args->prepend_silence, sizeof(args->prepend_silence))
+                                     ? args->prepend_silence : NULL;
+    args->desc.append_silence = get_string(env, obj, "appendSilence", args->append_silence, sizeof(args->append_silence))
+                                    ? args->append_silence : NULL;
+    args->desc.input_file = get_string(env, obj, "input", args->input, sizeof(args->input)) ? args->input : NULL;
+    args->desc.output_file = get_string(env, obj, "output", args->output, sizeof(args->output)) ? args->output : NULL;
+    args->desc.bitrate = get_string(env, obj, "bitrate", args->bitrate, sizeof(args->bitrate)) ? args->bitrate : NULL;
+    args->desc.template_xml = get_string(env, obj, "templateXml", args->template_xml, sizeof(args->template_xml))
+                                  ? args->template_xml : NULL;
+    args->desc.dee_root = get_string(env, obj, "deeRoot", args->dee_root, sizeof(args->dee_root)) ? args->dee_root : NULL;
+    args->desc.state_dir = get_string(env, obj, "stateDir", args->state_dir, sizeof(args->state_dir)) ? args->state_dir : NULL;
+    args->desc.xml_overrides = get_string(env, obj, "xmlOverrides", args->xml_overrides, sizeof(args->xml_overrides))
+                                   ? args->xml_overrides : NULL;
+    return 1;
+}
+
+static void set_string(napi_env env, napi_value obj, const char *name, const char *text) {
+    napi_value value;
+    if (napi_create_string_utf8(env, text, NAPI_AUTO_LENGTH, &value) == napi_ok) napi_set_named_property(env, obj, name, value);
+}
+
+static void set_number(napi_env env, napi_value obj, const char *name, double number) {
+    napi_value value;
+    if (napi_create_double(env, number, &value) == napi_ok) napi_set_named_property(env, obj, name, value);
+}
+
+/* { dee: 秒, deew: 秒, ..., qc: 秒 }，只列出非零的阶段 */
+static napi_value stage_seconds_object(napi_env env, const double *seconds, int with_qc, double qc) {
+    napi_value obj;
+    if (napi_create_object(env, &obj) != napi_ok) return NULL;
+    for (int s = 0; s < DEE_STAGE_COUNT; ++s) {
+        if (seconds[s] > 0.0) set_number(env, obj, dee_stage_name(s), seconds[s]);
+    }
+    if (with_qc) set_number(env, obj, "qc", qc);
+    return obj;
+}
+
+static napi_value plan_job(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[1];
+    JobArgs args;
+    DeeJobPlan plan;
+    CHECK(napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+    if (argc < 1 || !read_job_args(env, argv[0], &args)) {
+        if (argc < 1) napi_throw_type_error(env, NULL, "缺少任务描述");
+        return NULL;
+    }
+    int code = dee_job_plan(&args.desc, &plan);
+    if (code != 0) {
+        napi_throw_error(env, NULL, code == DEE_ERROR_BUSY ? "编码任务正在进行中" : "无效的编码选项");
+        return NULL;
+    }
+    napi_value result;
+    napi_value stages;
+    CHECK(napi_create_object(env, &result));
+    CHECK(napi_create_array_with_length(env, (size_t)plan.stage_count, &stages));
+    for (int i = 0; i < plan.stage_count; ++i) {
+        napi_value name;
+        CHECK(napi_create_string_utf8(env, plan.stages[i], NAPI_AUTO_LENGTH, &name));
+        CHECK(napi_set_element(env, stages, (uint32_t)i, name));
+    }
+    CHECK(napi_set_named_property(env, result, "stages", stages));
+    set_string(env, result, "finalOutput", plan.final_output);
+    set_string(env, result, "deeOutput", plan.dee_output);
+    set_string(env, result, "templateXml", plan.template_xml);
+    if (plan.eta_samples > 0) {
+        napi_value eta = stage_seconds_object(env, plan.eta_seconds, 1, plan.eta_seconds[DEE_STAGE_COUNT]);
+        if (eta) {
+            set_number(env, eta, "total", plan.eta_total);
+            set_number(env, eta, "samples", plan.eta_samples);
+            napi_set_named_property(env, result, "eta", eta);
+        }
+    }
+    return result;
+}
+
+/* 工作线程：复制事件内容后排入 JS 线程；队列不限长度，不会阻塞输出转发 */
+static void on_job_event(const DeeEvent *event, void *user_data) {
+    RunRequest *req = (RunRequest *)user_data;
+    EventCopy *copy = (EventCopy *)calloc(1, sizeof(EventCopy));
+    if (!copy) return;
+    copy->type = event->type;
+    copy->value = event->value;
+    if (event->text) {
+        size_t len = strlen(event->text);
+        copy->text = (char *)malloc(len + 1);
+        if (copy->text) memcpy(copy->text, event->text, len + 1);
+    }
+    if (event->stage_seconds) {
+        copy->has_stages = 1;
+        memcpy(copy->stage_seconds, event->stage_seconds, sizeof(copy->stage_seconds));
+    }
+    if (napi_call_threadsafe_function(req->on_event, copy, napi_tsfn_nonblocking) != napi_ok) {
+        free(copy->text);
+        free(copy);
+    }
+}
+
+static void call_js_event(napi_env env, napi_value js_callback, void *context, void *data) {
+    (void)context;
+    EventCopy *copy = (EventCopy *)data;
+    static const char *const type_names[] = {"log", "progress", "stage", "eta"};
+    if (env && js_callback) {
+        napi_value event;
+        napi_value undefined;
+        if (napi_create_object(env, &event) == napi_ok) {
+            set_string(env, event, "type", type_names[copy->type]);
+            if (copy->text) set_string(env, event, "text", copy->text);
+            if (copy->type == DEE_EVENT_PROGRESS || copy->type == DEE_EVENT_ETA) set_number(env, event, "value", copy->value);
+            if (copy->has_stages) {
+                napi_value stages = stage_seconds_object(env, copy->stage_seconds, 1, copy->stage_seconds[DEE_STAGE_COUNT]);
+                if (stages) napi_set_named_property(env, event, "stages", stages);
+            }
+            napi_get_undefined(env, &undefined);
+            napi_call_function(env, undefined, js_callback, 1, &event, NULL);
+        }
+    }
+    free(copy->text);
+    free(copy);
+}
+
+static void execute_run(napi_env env, void *data) {
+    (void)env;
+    RunRequest *req = (RunRequest *)data;
+    req->exit_code = dee_job_run(&req->args.desc, req->on_event ? on_job_event : NULL, req, &req->result);
+}
+
+static void complete_run(napi_env env, napi_status status, void *data) {
+    RunRequest *req = (RunRequest *)data;
+    napi_value result;
+    g_job_running = 0;
+    if (req->on_event) napi_release_threadsafe_function(req->on_event, napi_tsfn_release);
+    if (status != napi_ok || req->exit_code == DEE_ERROR_INVALID || req->exit_code == DEE_ERROR_BUSY) {
+        napi_value message;
+        napi_value error;
+        const char *text = req->exit_code == DEE_ERROR_BUSY ? "编码任务正在进行中" : "无效的编码选项";
+        napi_create_string_utf8(env, text, NAPI_AUTO_LENGTH, &message);
+        napi_create_error(env, NULL, message, &error);
+        napi_reject_deferred(env, req->deferred, error);
+    } else if (napi_create_object(env, &result) == napi_ok) {
+        napi_value cancelled;
+        set_number(env, result, "exitCode", req->exit_code);
+        napi_get_boolean(env, req->result.cancelled != 0, &cancelled);
+        napi_set_named_property(env, result, "cancelled", cancelled);
+        set_string(env, result, "finalOutput", req->result.final_output);
+        set_number(env, result, "seconds", req->result.seconds);
+        napi_value stages = stage_seconds_object(env, req->result.stage_seconds, 0, 0.0);
+        if (stages) napi_set_named_property(env, result, "stageSeconds", stages);
+        set_number(env, result, "qcSeconds", req->result.qc_seconds);
+        napi_resolve_deferred(env, req->deferred, result);
+    }
+    napi_delete_async_work(env, req->work);
+    free(req);
+}
+
+static napi_value run_job(napi_env env, napi_callback_info info) {
+    size_t argc = 2;
+    napi_value argv[2];
+    napi_value promise;
+    napi_value resource_name;
+    napi_valuetype callback_type = napi_undefined;
+    CHECK(napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+    if (argc < 1) {
+        napi_throw_type_error(env, NULL, "缺少任务描述");
+        return NULL;
+    }
+    /* 同一时刻只允许一个任务：在 JS 线程上拒绝，避免排进线程池后才失败 */
+    if (g_job_running) {
+        napi_throw_error(env, NULL, "编码任务正在进行中");
+        return NULL;
+    }
+    RunRequest *req = (RunRequest *)calloc(1, sizeof(RunRequest));
+    if (!req) {
+        napi_throw_error(env, NULL, "内存不足");
+        return NULL;
+    }
+    if (!read_job_args(env, argv[0], &req->args)) {
+        free(req);
+        return NULL;
+    }
+    CHECK(napi_create_string_utf8(env, "dolbyEncoderJob", NAPI_AUTO_LENGTH, &resource_name));
+    if (argc > 1) napi_typeof(env, argv[1], &callback_type);
+    if (callback_type == napi_function &&
+        napi_create_threadsafe_function(env, argv[1], NULL, resource_name, 0, 1, NULL, NULL, NULL,
+                                        call_js_event, &req->on_event) != napi_ok) {
+        free(req);
+        napi_throw_error(env, NULL, "无法创建事件回调");
+        return NULL;
+    }
+    /* 在排进线程池之前清除取消标志，排队期间到达的 cancelJob() 才不会被工作线程抹掉 */
+    dee_job_accept();
+    if (napi_create_promise(env, &req->deferred, &promise) != napi_ok ||
+        napi_create_async_work(env, NULL, resource_name, execute_run, complete_run, req, &req->work) != napi_ok ||
+        napi_queue_async_work(env, req->work) != napi_ok) {
+        if (req->on_event) napi_release_threadsafe_function(req->on_event, napi_tsfn_abort);
+        free(req);
+        napi_throw_error(env, NULL, "无法启动编码任务");
+        return NULL;
+    }
+    g_job_running = 1;
+    return promise;
+}
+
+static napi_value cancel_job(napi_env env, napi_callback_info info) {
+    (void)info;
+    napi_value result;
+    dee_job_cancel();
+    napi_get_boolean(env, g_job_running != 0, &result);
+    return result;
+}
+
+static void execute_overview(napi_env env, void *data) {
+    (void)env;
+    OverviewRequest *req = (OverviewRequest *)data;
+    req->exit_code = dee_overview_build(req->input, req->dee_root[0] ? req->dee_root : NULL, req->sidecar, sizeof(req->sidecar));
+}
+
+static void complete_overview(napi_env env, napi_status status, void *data) {
+    OverviewRequest *req = (OverviewRequest *)data;
+    napi_value value;
+    if (status == napi_ok && req->exit_code == 0 &&
+        napi_create_string_utf8(env, req->sidecar, NAPI_AUTO_LENGTH, &value) == napi_ok) {
+        napi_resolve_deferred(env, req->deferred, value);
+    } else {
+        napi_value message;
+        napi_value error;
+        napi_create_string_utf8(env, "无法建立波形概览", NAPI_AUTO_LENGTH, &message);
+        napi_create_error(env, NULL, message, &error);
+        napi_reject_deferred(env, req->deferred, error);
+    }
+    napi_delete_async_work(env, req->work);
+    free(req);
+}
+
+static napi_value build_overview(napi_env env, napi_callback_info info) {
+    size_t argc = 2;
+    napi_value argv[2];
+    napi_value promise;
+    napi_value resource_name;
+    CHECK(napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+    OverviewRequest *req = (OverviewRequest *)calloc(1, sizeof(OverviewRequest));
+    if (!req) {
+        napi_throw_error(env, NULL, "内存不足");
+        return NULL;
+    }
+    size_t len = 0;
+    if (argc < 1 || napi_get_value_string_utf8(env, argv[0], req->input, sizeof(req->input), &len) != napi_ok || len == 0) {
+        free(req);
+        napi_throw_type_error(env, NULL, "缺少输入文件");
+        return NULL;
+    }
+    if (argc > 1) napi_get_value_string_utf8(env, argv[1], req->dee_root, sizeof(req->dee_root), &len);
+    CHECK(napi_create_string_utf8(env, "dolbyEncoderOverview", NAPI_AUTO_LENGTH, &resource_name));
+    if (napi_create_promise(env, &req->deferred, &promise) != napi_ok ||
+        napi_create_async_work(env, NULL, resource_name, execute_overview, complete_overview, req, &req->work) != napi_ok ||
+        napi_queue_async_work(env, req->work) != napi_ok) {
+        free(req);
+        napi_throw_error(env, NULL, "无法启动波形概览");
+        return NULL;
+    }
+    return promise;
+}
+
+static napi_value init(napi_env env, napi_value exports) {
+    napi_property_descriptor props[] = {
+        {"planJob", NULL, plan_job, NULL, NULL, NULL, napi_default, NULL},
+        {"runJob", NULL, run_job, NULL, NULL, NULL, napi_default, NULL},
+        {"cancelJob", NULL, cancel_job, NULL, NULL, NULL, napi_default, NULL},
+        {"buildOverview", NULL, build_overview, NULL, NULL, NULL, napi_default, NULL},
+    };
+    CHECK(napi_define_properties(env, exports, sizeof(props) / sizeof(props[0]), props));
+    return exports;
+}
+
+NAPI_MODULE(NODE_GYP_MODULE_NAME, init)
@@ -0,0 +1,16 @@
+{
+  "targets": [
+    {
+      "target_name": "dolby_encoder",
+      "sources": ["addon.c", "../encode.c"],
+      "include_dirs": [".."],
+      "defines": ["DEE_LIBRARY"],
+      "cflags_c": ["-std=gnu11"],
+      "msvs_settings": {
+        "VCCLCompilerTool": {
+          "AdditionalOptions": ["/utf-8"]
+        }
+      }
+    }
+  ]
+}
@@ -0,0 +1,2 @@
+// encode.c 以 DEE_LIBRARY 编译得到的进程内编码扩展，接口见 addon.c 顶部说明
+module.exports = require('./build/Release/dolby_encoder.node')
@@ -132,6 +132,8 @@ const buildAppMenu = () => {
 const C_PROGRAM_PATH = process.env.ENCODE_PATH || path.join(__dirname, '..', 'encode.exe')
 // 状态文件默认放在项目根（若需要也可改为其他位置）
 const STATE_FILE_PATH = path.join(__dirname, '..', 'last_params.txt')
+// 任务历史由 encode.exe 在其工作目录下追加，GUI 只追加事件行（如输出改名）
+const HISTORY_FILE_PATH = path.join(path.dirname(C_PROGRAM_PATH), 'job_history.log')
 
 const TEMP_ADM_FILENAME = 'ADM.wav'
 
@@ -229,19 +231,85 @@ const ensureDirectoryExists = (dirPath) => {
   }
 }
 
-const updateLastParamsOutputPath = (newPath) => {
+// 与 encode.exe 一样写临时文件后整体替换，避免与下一次任务保存参数交错而留下半个文件
+const writeFileAtomicSync = (filePath, content) => {
+  const tempPath = `${filePath}.${process.pid}.tmp`
+  try {
+    fs.writeFileSync(tempPath, content, 'utf-8')
+    fs.renameSync(tempPath, filePath)
+  } catch (error) {
+    fs.rmSync(tempPath, { force: true })
+    throw error
+  }
+}
+
+// 追加一条以 commit=1 结尾的事件行；encode.exe 预估耗时时只读取带 status 的任务记录
+const appendHistoryEvent = (fields) => {
+  const line = Object.entries({ v: 1, time: Math.floor(Date.now() / 1000), ...fields })
+    .map(([key, value]) => `${key}=${String(value).replace(/[\t\r\n]/g, ' ')}`)
+    .join('\t')
+  try {
+    fs.appendFileSync(HISTORY_FILE_PATH, `${line}\tcommit=1\n`, 'utf-8')
+  } catch (error) {
+    console.warn('[HISTORY] Failed to append history event:', error)
+  }
+}
+
+const updateLastParamsOutputPath = (newPath, previousPath) => {
   if (typeof newPath !== 'string' || newPath.length === 0) return
+  if (previousPath) {
+    appendHistoryEvent({ type: 'output_moved', from: previousPath, to: newPath })
+  }
   if (!fs.existsSync(STATE_FILE_PATH)) return
   try {
     const raw = fs.readFileSync(STATE_FILE_PATH, 'utf-8')
-    if (!raw.includes('output_file=')) return
-    const updated = raw.replace(/^(output_file=).*$/m, `$1${newPath}`)
-    fs.writeFileSync(STATE_FILE_PATH, updated, 'utf-8')
+    let found = false
+    const lines = raw.split(/\r?\n/).map((line) => {
+      if (!line.startsWith('output_file=')) return line
+      found = true
+      return `output_file=${newPath}`
+    })
+    if (!found) return
+    writeFileAtomicSync(STATE_FILE_PATH, lines.join('\n'))
   } catch (error) {
     console.warn('[AUTO OUTPUT] Failed to update last_params output path:', error)
   }
 }
 
+// encode.exe 在输出旁写出的附属文件（QC 报告等），随输出一起改名
+const OUTPUT_SIDECAR_SUFFIXES = ['.qc.txt', '.manifest.txt']
+
+// 同卷直接改名；跨卷时先拷到目标目录下的 .partial 再原子改名，避免留下半截文件
+const moveFileSync = (source, target) => {
+  try {
+    fs.renameSync(source, target)
+    return
+  } catch (error) {
+    if (error.code !== 'EXDEV') throw error
+  }
+  const partial = `${target}.partial`
+  try {
+    fs.copyFileSync(source, partial)
+    fs.renameSync(partial, target)
+  } catch (error) {
+    fs.rmSync(partial, { force: true })
+    throw error
+  }
+  fs.rmSync(source, { force: true })
+}
+
+const moveOutputSidecars = (fromPath, toPath) => {
+  OUTPUT_SIDECAR_SUFFIXES.forEach((suffix) => {
+    const source = `${fromPath}${suffix}`
+    if (!fs.existsSync(source)) return
+    try {
+      moveFileSync(source, `${toPath}${suffix}`)
+    } catch (error) {
+      console.warn(`[AUTO OUTPUT] Failed to move sidecar "${source}":`, error)
+    }
+  })
+}
+
 const createAutoOutputPlan = (finalPath, safePath) => {
   if (typeof finalPath !== 'string' || finalPath.length === 0) return null
   if (typeof safePath !== 'string' || safePath.length === 0) return null
@@ -272,14 +340,15 @@ const createAutoOutputPlan = (finalPath, safePath) => {
           console.log(`[AUTO OUTPUT] Existing final output backed up to: ${this.backupPath}`)
         }
 
-        fs.renameSync(this.safePath, this.finalPath)
+        moveFileSync(this.safePath, this.finalPath)
         console.log(`[AUTO OUTPUT] Output renamed to final path: ${this.finalPath}`)
+        moveOutputSidecars(this.safePath, this.finalPath)
         this.applied = true
         if (this.backupPath && fs.existsSync(this.backupPath)) {
           fs.rmSync(this.backupPath, { force: true })
           this.backupPath = null
         }
-        updateLastParamsOutputPath(this.finalPath)
+        updateLastParamsOutputPath(this.finalPath, this.safePath)
       } catch (error) {
         if (this.backupPath && fs.existsSync(this.backupPath)) {
           try {
@@ -301,6 +370,8 @@ const createAutoOutputPlan = (finalPath, safePath) => {
       }
     },
     cleanupOnFailure() {
+      // 失败时保留 QC 报告供排查，但改用最终文件名，避免遗留临时名
+      moveOutputSidecars(this.safePath, this.finalPath)
       if (this.backupPath && fs.existsSync(this.backupPath)) {
         try {
           fs.renameSync(this.backupPath, this.finalPath)
@@ -390,6 +461,42 @@ const terminateProcessTree = (childProcess) => {
   })
 }
 
+// encode.exe 收到取消后会拆除子进程树并清理中间文件，给它留出足够时间，超时再强制结束
+const CANCEL_GRACE_MS = 10000
+
+const requestGracefulCancel = (childProcess) => {
+  if (!childProcess || childProcess.exitCode !== null) {
+    return Promise.resolve(true)
+  }
+
+  return new Promise((resolve) => {
+    const onExit = () => {
+      clearTimeout(timeout)
+      resolve(true)
+    }
+    const timeout = setTimeout(() => {
+      childProcess.removeListener('exit', onExit)
+      resolve(false)
+    }, CANCEL_GRACE_MS)
+    childProcess.once('exit', onExit)
+
+    try {
+      if (childProcess.stdin && !childProcess.stdin.destroyed) {
+        childProcess.stdin.write('cancel\n')
+      }
+    } catch (err) {
+      // stdin 已关闭时依赖下面的信号或最终的强制结束
+    }
+    if (process.platform !== 'win32') {
+      try {
+        childProcess.kill('SIGTERM')
+      } catch (err) {
+        // 进程可能已退出
+      }
+    }
+  })
+}
+
 const emitProgress = (text) => {
   if (!mainWindow) return
   if (typeof text !== 'string' || text.length === 0) return
@@ -493,16 +600,50 @@ app.on('activate', () => {
   }
 })
 
-// IPC: 运行 C 程序
+// 进程内编码扩展（native/，由 encode.c 以库方式编译）：可用时不再启动 encode.exe、不再解析其输出，
+// 未编译或加载失败时退回到启动 encode.exe
+let nativeEncoder = null
+try {
+  nativeEncoder = require('dolby-encoder-native')
+} catch (err) {
+  console.warn('[NATIVE] In-process encoder unavailable, falling back to encode.exe:', err.message)
+}
+
+// 任务描述 <-> encode.exe 的位置参数：编码选项、起始、结束、开头空白、结尾空白、输出、输入
+const jobFromArgs = (args) => ({
+  choice: Number(args[0]) || 0,
+  start: args[1] || '',
+  end: args[2] || '',
+  prependSilence: args[3] || '',
+  appendSilence: args[4] || '',
+  output: args[5] || '',
+  input: args[6] || '',
+})
+
+const argsFromJob = (job) => [
+  String(job.choice),
+  job.start || '',
+  job.end || '',
+  job.prependSilence || '',
+  job.appendSilence || '',
+  job.output || '',
+  job.input || '',
+]
+
+// IPC: 运行编码任务
 ipcMain.handle('run-c-program', async (event, rawPayload) => {
-  let spawnArgs
+  let job
   let finalOutputTarget = null
   let safeOutputOverride = null
 
   if (Array.isArray(rawPayload)) {
-    spawnArgs = [...rawPayload]
+    job = jobFromArgs(rawPayload)
   } else if (rawPayload && typeof rawPayload === 'object') {
-    spawnArgs = Array.isArray(rawPayload.args) ? [...rawPayload.args] : []
+    if (rawPayload.job && typeof rawPayload.job === 'object') {
+      job = { ...rawPayload.job }
+    } else {
+      job = jobFromArgs(Array.isArray(rawPayload.args) ? rawPayload.args : [])
+    }
     if (typeof rawPayload.finalOutputPath === 'string') {
       finalOutputTarget = rawPayload.finalOutputPath
     }
@@ -510,20 +651,16 @@ ipcMain.handle('run-c-program', async (event, rawPayload) => {
       safeOutputOverride = rawPayload.safeOutputPath
     }
   } else {
-    spawnArgs = []
+    job = jobFromArgs([])
   }
 
-  if (!Array.isArray(spawnArgs)) {
-    spawnArgs = []
+  if (safeOutputOverride) {
+    job.output = safeOutputOverride
   }
 
-  if (safeOutputOverride && spawnArgs.length >= 2) {
-    spawnArgs[spawnArgs.length - 2] = safeOutputOverride
-  }
-
-  console.log('Renderer requested to run C program with args:', spawnArgs)
+  console.log('Renderer requested to run encoding job:', job)
 
-  const originalInputPath = spawnArgs.length > 0 ? spawnArgs[spawnArgs.length - 1] : ''
+  const originalInputPath = job.input
   let renameHandle = null
   let outputAutoPlan = null
 
@@ -562,26 +699,20 @@ ipcMain.handle('run-c-program', async (event, rawPayload) => {
       reject(error)
     }
 
-    if (currentProcessInfo && currentProcessInfo.process && currentProcessInfo.process.exitCode === null) {
+    if (currentProcessInfo) {
       const err = new Error('编码任务正在进行中，请先取消当前任务。')
       console.warn(err.message)
       safeReject(err)
       return
     }
-    if (!fs.existsSync(C_PROGRAM_PATH)) {
+    if (!nativeEncoder && !fs.existsSync(C_PROGRAM_PATH)) {
       console.error('C program not found:', C_PROGRAM_PATH)
       safeReject(new Error(`C 程序未找到: ${C_PROGRAM_PATH}`))
       return
     }
-    console.log('C program path confirmed:', C_PROGRAM_PATH)
-    console.log('Attempting to spawn C program...')
-    const env = { ...process.env }
-    if (settings && settings.deeRoot) {
-      env.DEE_ROOT = settings.deeRoot
-    }
     try {
       if (finalOutputTarget) {
-        const safeCandidate = spawnArgs.length > 1 ? spawnArgs[spawnArgs.length - 2] : null
+        const safeCandidate = job.output
         if (typeof safeCandidate === 'string' && safeCandidate.length > 0 && safeCandidate !== finalOutputTarget) {
           outputAutoPlan = createAutoOutputPlan(finalOutputTarget, safeCandidate)
           if (outputAutoPlan && fs.existsSync(outputAutoPlan.safePath)) {
@@ -606,7 +737,7 @@ ipcMain.handle('run-c-program', async (event, rawPayload) => {
       if (typeof originalInputPath === 'string' && originalInputPath.length > 0) {
         renameHandle = prepareTemporaryAdmRename(originalInputPath)
         if (renameHandle && renameHandle.effectivePath) {
-          spawnArgs[spawnArgs.length - 1] = renameHandle.effectivePath
+          job.input = renameHandle.effectivePath
         }
       }
     } catch (renameError) {
@@ -616,37 +747,13 @@ ipcMain.handle('run-c-program', async (event, rawPayload) => {
       return
     }
 
-    let cProcess
-    try {
-      cProcess = spawn(C_PROGRAM_PATH, spawnArgs, { cwd: path.dirname(C_PROGRAM_PATH), env })
-    } catch (spawnError) {
-      cleanupRename()
-      cleanupOutputPlan()
-      safeReject(spawnError)
-      return
-    }
-    const processInfo = { process: cProcess, wasKilled: false }
+    const processInfo = { process: null, native: Boolean(nativeEncoder), wasKilled: false }
     currentProcessInfo = processInfo
 
-    cProcess.stdout.on('data', (data) => {
-      const text = data.toString()
-      console.log('C program stdout:', text.trim())
-      mainWindow.webContents.send('console-output', text)
-      emitProgress(text)
-    })
-
-    cProcess.stderr.on('data', (data) => {
-      const text = data.toString()
-      console.error('C program stderr:', text.trim())
-      mainWindow.webContents.send('console-output', text)
-      emitProgress(text)
-    })
-
-    cProcess.on('close', (code, signal) => {
-      console.log(`C program exited with code: ${code}, signal: ${signal}`)
-      const wasKilled = processInfo.wasKilled || Boolean(signal)
+    // 两种执行方式共用的收尾：还原临时改名、落实自动输出改名并通知渲染进程
+    const finishJob = (code, wasKilled, signal) => {
       cleanupRename()
-      if (currentProcessInfo && currentProcessInfo.process === cProcess) {
+      if (currentProcessInfo === processInfo) {
         currentProcessInfo = null
       }
       if (wasKilled) {
@@ -680,36 +787,109 @@ ipcMain.handle('run-c-program', async (event, rawPayload) => {
         mainWindow.webContents.send('encoding-complete', code)
         safeResolve({ cancelled: false, code })
       }
-    })
+    }
 
-    cProcess.on('error', (err) => {
-      console.error(`Failed to start C program process: ${err.message}`)
+    const failToStart = (err) => {
+      console.error(`Failed to start encoding job: ${err.message}`)
       mainWindow.webContents.send('encoding-error', `启动 C 程序失败: ${err.message}`)
-      if (currentProcessInfo && currentProcessInfo.process === cProcess) {
+      if (currentProcessInfo === processInfo) {
         currentProcessInfo = null
       }
       cleanupRename()
       cleanupOutputPlan()
       safeReject(err)
+    }
+
+    if (nativeEncoder) {
+      // 进程内执行：状态文件与任务历史仍放在 encode.exe 所在目录，与命令行版本共用
+      const desc = {
+        ...job,
+        deeRoot: settings && settings.deeRoot ? settings.deeRoot : undefined,
+        stateDir: path.dirname(C_PROGRAM_PATH),
+      }
+      let running
+      try {
+        running = nativeEncoder.runJob(desc, (jobEvent) => {
+          if (mainWindow) mainWindow.webContents.send('encoding-event', jobEvent)
+        })
+      } catch (startError) {
+        failToStart(startError)
+        return
+      }
+      running.then(
+        (result) => {
+          console.log(`Encoding job finished with code: ${result.exitCode} in ${result.seconds.toFixed(1)}s`)
+          finishJob(result.exitCode, processInfo.wasKilled || result.cancelled, null)
+        },
+        (runError) => failToStart(runError),
+      )
+      return
+    }
+
+    console.log('C program path confirmed:', C_PROGRAM_PATH)
+    console.log('Attempting to spawn C program...')
+    const env = { ...process.env }
+    if (settings && settings.deeRoot) {
+      env.DEE_ROOT = settings.deeRoot
+    }
+    let cProcess
+    try {
+      cProcess = spawn(C_PROGRAM_PATH, argsFromJob(job), { cwd: path.dirname(C_PROGRAM_PATH), env })
+    } catch (spawnError) {
+      failToStart(spawnError)
+      return
+    }
+    processInfo.process = cProcess
+
+    cProcess.stdout.on('data', (data) => {
+      const text = data.toString()
+      console.log('C program stdout:', text.trim())
+      mainWindow.webContents.send('console-output', text)
+      emitProgress(text)
     })
+
+    cProcess.stderr.on('data', (data) => {
+      const text = data.toString()
+      console.error('C program stderr:', text.trim())
+      mainWindow.webContents.send('console-output', text)
+      emitProgress(text)
+    })
+
+    cProcess.on('close', (code, signal) => {
+      console.log(`C program exited with code: ${code}, signal: ${signal}`)
+      finishJob(code, processInfo.wasKilled || Boolean(signal), signal)
+    })
+
+    cProcess.on('error', (err) => failToStart(err))
   })
 })
 
 ipcMain.handle('cancel-c-program', async () => {
-  if (!currentProcessInfo || !currentProcessInfo.process) {
+  if (!currentProcessInfo) {
     return { success: false, reason: 'NO_PROCESS' }
   }
 
+  if (currentProcessInfo.native) {
+    // 库内部拆除子进程树并清理中间文件，runJob 的 Promise 随后以取消结束
+    currentProcessInfo.wasKilled = true
+    nativeEncoder.cancelJob()
+    return { success: true }
+  }
+
   const { process } = currentProcessInfo
 
-  if (process.exitCode !== null) {
+  if (!process || process.exitCode !== null) {
     currentProcessInfo = null
     return { success: false, reason: 'ALREADY_EXITED' }
   }
 
   try {
     currentProcessInfo.wasKilled = true
-    await terminateProcessTree(process)
+    const exitedGracefully = await requestGracefulCancel(process)
+    if (!exitedGracefully) {
+      console.warn('C program did not exit after cancel request, terminating process tree.')
+      await terminateProcessTree(process)
+    }
     return { success: true }
   } catch (error) {
     console.error('Failed to cancel C program:', error)
@@ -717,6 +897,57 @@ ipcMain.handle('cancel-c-program', async () => {
   }
 })
 
+// IPC: 开发用，回放 --record 生成的输出记录（encode.exe --replay）。输出与启动 encode.exe 编码时走同一条
+// console-output 路径；扩展可用时真实编码不经 stdout，这里仍启动 encode.exe，用来压测渲染进程的解析与界面。
+// --replay-probe 让 encode.exe 穿插带发送时刻的探针行，渲染进程按收到的时刻计算端到端延迟
+ipcMain.handle('replay-trace', async (event, options) => {
+  const { tracePath, speed, copies } = options || {}
+  if (!isDevelopment) {
+    throw new Error('输出回放仅在开发模式下可用')
+  }
+  if (currentProcessInfo) {
+    throw new Error('编码任务正在进行中，请先取消当前任务。')
+  }
+  if (!fs.existsSync(C_PROGRAM_PATH)) {
+    throw new Error(`C 程序未找到: ${C_PROGRAM_PATH}`)
+  }
+  if (typeof tracePath !== 'string' || !fs.existsSync(tracePath)) {
+    throw new Error(`输出记录不存在: ${tracePath}`)
+  }
+  const args = ['--replay', tracePath, '--replay-probe']
+  if (Number.isFinite(speed) && speed >= 0) args.push('--replay-speed', String(speed))
+  if (Number.isInteger(copies) && copies > 1) args.push('--replay-jobs', String(copies))
+
+  return new Promise((resolve, reject) => {
+    let replayProcess
+    try {
+      replayProcess = spawn(C_PROGRAM_PATH, args, { cwd: path.dirname(C_PROGRAM_PATH) })
+    } catch (spawnError) {
+      reject(spawnError)
+      return
+    }
+    // 登记为当前任务，取消按钮经 cancel-c-program 同样生效
+    const processInfo = { process: replayProcess, native: false, wasKilled: false }
+    currentProcessInfo = processInfo
+    const forward = (data) => {
+      const text = data.toString()
+      if (mainWindow) mainWindow.webContents.send('console-output', text)
+      emitProgress(text)
+    }
+    replayProcess.stdout.on('data', forward)
+    replayProcess.stderr.on('data', forward)
+    replayProcess.on('close', (code, signal) => {
+      console.log(`Replay exited with code: ${code}, signal: ${signal}`)
+      if (currentProcessInfo === processInfo) currentProcessInfo = null
+      resolve({ code, cancelled: processInfo.wasKilled || Boolean(signal) })
+    })
+    replayProcess.on('error', (err) => {
+      if (currentProcessInfo === processInfo) currentProcessInfo = null
+      reject(err)
+    })
+  })
+})
+
 // IPC: 加载 C 程序保存的参数
 ipcMain.handle('load-c-params', async () => {
   return new Promise((resolve, reject) => {
@@ -754,6 +985,89 @@ ipcMain.handle('load-c-params', async () => {
   })
 })
 
+// 波形概览：encode.c 把各声道 min/max/RMS 金字塔缓存在 DolbyTemp\overview\<指纹>.wfp（格式见 encode.c），
+// 这里读出后把各声道合并成一条包络，每级为 Int16Array [min, max, rms, ...]；同一会话内按路径、大小与修改时间直接复用
+const overviewCache = new Map()
+
+const buildOverviewWithProcess = (inputPath) => new Promise((resolve, reject) => {
+  if (!fs.existsSync(C_PROGRAM_PATH)) {
+    reject(new Error(`C 程序未找到: ${C_PROGRAM_PATH}`))
+    return
+  }
+  const env = { ...process.env }
+  if (settings && settings.deeRoot) {
+    env.DEE_ROOT = settings.deeRoot
+  }
+  let output = ''
+  const child = spawn(C_PROGRAM_PATH, ['--overview', inputPath], { cwd: path.dirname(C_PROGRAM_PATH), env })
+  child.stdout.on('data', (data) => { output += data.toString() })
+  child.stderr.on('data', (data) => { output += data.toString() })
+  child.on('error', reject)
+  child.on('close', (code) => {
+    const match = output.match(/^Overview:\s*(.+?)\s*$/m)
+    if (code === 0 && match) {
+      resolve(path.resolve(path.dirname(C_PROGRAM_PATH), match[1]))
+    } else {
+      reject(new Error(output.trim() || `C 程序退出码: ${code}`))
+    }
+  })
+})
+
+const parseOverviewFile = (sidecarPath) => {
+  const buffer = fs.readFileSync(sidecarPath)
+  if (buffer.length < 64 || buffer.toString('latin1', 0, 7) !== 'DEEWFP1') {
+    throw new Error(`无效的波形概览文件: ${sidecarPath}`)
+  }
+  const channels = buffer.readUInt32LE(12)
+  const sampleRate = buffer.readUInt32LE(16)
+  const levelCount = buffer.readUInt32LE(20)
+  const frames = Number(buffer.readBigUInt64LE(24))
+  const levels = []
+  for (let i = 0; i < levelCount; i += 1) {
+    const entry = 64 + i * 16
+    const framesPerBin = buffer.readUInt32LE(entry)
+    const bins = buffer.readUInt32LE(entry + 4)
+    let offset = Number(buffer.readBigUInt64LE(entry + 8))
+    const data = new Int16Array(bins * 3)
+    for (let bin = 0; bin < bins; bin += 1) {
+      let lo = 32767
+      let hi = -32767
+      let power = 0
+      for (let c = 0; c < channels; c += 1) {
+        const min = buffer.readInt16LE(offset)
+        const max = buffer.readInt16LE(offset + 2)
+        const rms = buffer.readInt16LE(offset + 4)
+        if (min < lo) lo = min
+        if (max > hi) hi = max
+        power += rms * rms
+        offset += 6
+      }
+      data[bin * 3] = lo
+      data[bin * 3 + 1] = hi
+      data[bin * 3 + 2] = Math.round(Math.sqrt(power / channels))
+    }
+    levels.push({ framesPerBin, bins, data })
+  }
+  return { channels, sampleRate, frames, duration: sampleRate ? frames / sampleRate : 0, levels }
+}
+
+ipcMain.handle('load-waveform-overview', async (event, inputPath) => {
+  if (typeof inputPath !== 'string' || inputPath.length === 0 || !fs.existsSync(inputPath)) {
+    return null
+  }
+  const stat = fs.statSync(inputPath)
+  const cached = overviewCache.get(inputPath)
+  if (cached && cached.size === stat.size && cached.mtimeMs === stat.mtimeMs) {
+    return cached.overview
+  }
+  const sidecarPath = nativeEncoder
+    ? await nativeEncoder.buildOverview(inputPath, settings && settings.deeRoot ? settings.deeRoot : undefined)
+    : await buildOverviewWithProcess(inputPath)
+  const overview = parseOverviewFile(path.resolve(sidecarPath))
+  overviewCache.set(inputPath, { size: stat.size, mtimeMs: stat.mtimeMs, overview })
+  return overview
+})
+
 // IPC: 打开文件对话框
 ipcMain.handle('open-file-dialog', async (event, options) => {
   const { canceled, filePaths } = await dialog.showOpenDialog(mainWindow, options)
@@ -6,6 +6,8 @@ module.exports = defineConfig({
       nodeIntegration: false,
       contextIsolation: true,
       preload: 'src/preload.js',
+      // 原生扩展由 electron-builder 随 node_modules 打包，不经 webpack
+      externals: ['dolby-encoder-native'],
       builderOptions: {
         appId: 'com.dolby.encoder.gui',
         productName: 'Dolby Encoding Engine',